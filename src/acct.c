@@ -60,6 +60,7 @@
 #include "prompter.h"
 #include "stash.h"
 #include "tokens.h"
+#include "txn.h"
 #include "userinfo.h"
 #include "v5.h"
 #include "v4.h"
@@ -76,7 +77,7 @@ pam_sm_acct_mgmt(pam_handle_t *pamh, int flags,
 	int i, retval;
 
 	/* Initialize Kerberos. */
-	if (_pam_krb5_init_ctx(&ctx, argc, argv) != 0) {
+	if (_pam_krb5_txn_init_ctx(pamh, &ctx, argc, argv) != 0) {
 		warn("error initializing Kerberos");
 		return PAM_SERVICE_ERR;
 	}
@@ -85,20 +86,20 @@ pam_sm_acct_mgmt(pam_handle_t *pamh, int flags,
 	i = pam_get_user(pamh, &user, NULL);
 	if ((i != PAM_SUCCESS) || (user == NULL)) {
 		warn("could not identify user name");
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return i;
 	}
 
 	/* Read our options. */
-	options = _pam_krb5_options_init(pamh, argc, argv, ctx);
+	options = _pam_krb5_txn_options_init(pamh, argc, argv, ctx);
 	if (options == NULL) {
 		warn("error parsing options (shouldn't happen)");
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 
 	/* Get information about the user and the user's principal name. */
-	userinfo = _pam_krb5_user_info_init(ctx, user, options);
+	userinfo = _pam_krb5_txn_user_info_init(pamh, ctx, user, options);
 	if (userinfo == NULL) {
 		if (options->ignore_unknown_principals == 0) {
 			retval = PAM_IGNORE;
@@ -106,8 +107,8 @@ pam_sm_acct_mgmt(pam_handle_t *pamh, int flags,
 			warn("error getting information about '%s'", user);
 			retval = PAM_USER_UNKNOWN;
 		}
-		_pam_krb5_options_free(pamh, ctx, options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return retval;
 	}
 
@@ -119,18 +120,18 @@ pam_sm_acct_mgmt(pam_handle_t *pamh, int flags,
 			debug("ignoring '%s' -- uid below minimum = %lu", user,
 			      (unsigned long) options->minimum_uid);
 		}
-		_pam_krb5_user_info_free(ctx, userinfo);
-		_pam_krb5_options_free(pamh, ctx, options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_IGNORE;
 	}
 
 	/* Get the stash for this user. */
 	stash = _pam_krb5_stash_get(pamh, user, userinfo, options);
 	if (stash == NULL) {
-		_pam_krb5_user_info_free(ctx, userinfo);
-		_pam_krb5_options_free(pamh, ctx, options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 
@@ -196,6 +197,14 @@ pam_sm_acct_mgmt(pam_handle_t *pamh, int flags,
 			retval = PAM_AUTHINFO_UNAVAIL;
 			break;
 		case KRB5_KDC_UNREACH:
+			if (stash->v5offline) {
+				if (options->debug) {
+					debug("account management succeeds "
+					      "for '%s' (offline)", user);
+				}
+				retval = PAM_SUCCESS;
+				break;
+			}
 			notice("account checks fail for '%s': "
 			       "KDCs are unreachable", user);
 			retval = PAM_AUTHINFO_UNAVAIL;
@@ -248,9 +257,9 @@ pam_sm_acct_mgmt(pam_handle_t *pamh, int flags,
 		debug("pam_acct_mgmt returning %d (%s)", retval,
 		      pam_strerror(pamh, retval));
 	}
-	_pam_krb5_options_free(pamh, ctx, options);
-	_pam_krb5_user_info_free(ctx, userinfo);
-	krb5_free_context(ctx);
+	_pam_krb5_txn_options_free(pamh, ctx, options);
+	_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
+	_pam_krb5_txn_free_ctx(pamh, ctx);
 
 	return retval;
 }
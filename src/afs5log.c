@@ -32,7 +32,10 @@
 
 #include "../config.h"
 
+#include <sys/time.h>
 #include <sys/types.h>
+#include <ctype.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -55,10 +58,16 @@
 #include "options.h"
 #include "stash.h"
 #include "minikafs.h"
+#include "tokens.h"
+#include "v5.h"
 #include "xstr.h"
 
 extern char *log_progname;
 
+/* In batch mode, the cells we're going to get tokens for. */
+static struct tokens_cell *batch;
+static int n_batch;
+
 static void
 set_methods(const char *strategy, int *methods, int max_methods,
 	    int try_v5_2b_only, int try_rxk5_only)
@@ -103,12 +112,189 @@ set_methods(const char *strategy, int *methods, int max_methods,
 	}
 }
 
+/* Add a cell to the batch, unless it's already in there. */
+static void
+batch_add(const char *cell, const char *principal)
+{
+	struct tokens_cell *tmp;
+	int i;
+
+	for (i = 0; i < n_batch; i++) {
+		if (strcmp(batch[i].cell, cell) == 0) {
+			return;
+		}
+	}
+	tmp = realloc(batch, sizeof(*batch) * (n_batch + 1));
+	if (tmp == NULL) {
+		warn("out of memory adding \"%s\" to batch", cell);
+		return;
+	}
+	batch = tmp;
+	memset(&batch[n_batch], 0, sizeof(batch[n_batch]));
+	batch[n_batch].cell = xstrdup(cell);
+	if (principal != NULL) {
+		batch[n_batch].hint_principal = xstrdup(principal);
+	}
+	n_batch++;
+}
+
+/* Read cell[=principal] entries, one per line, from a file, or from stdin if
+ * the file's name is "-".  Blank lines and anything after a "#" are
+ * ignored. */
+static int
+batch_read(const char *file)
+{
+	FILE *fp;
+	char buf[LINE_MAX], *p, *q;
+	int n;
+
+	if (strcmp(file, "-") == 0) {
+		fp = stdin;
+	} else {
+		fp = fopen(file, "r");
+	}
+	if (fp == NULL) {
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+		return -1;
+	}
+	n = 0;
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		p = buf + strspn(buf, " \t");
+		p[strcspn(p, "#\r\n")] = '\0';
+		q = p + strlen(p);
+		while ((q > p) && isspace((unsigned char) q[-1])) {
+			*--q = '\0';
+		}
+		if (*p == '\0') {
+			continue;
+		}
+		q = strchr(p, '=');
+		if (q != NULL) {
+			*q++ = '\0';
+		}
+		batch_add(p, q);
+		n++;
+	}
+	if (fp != stdin) {
+		fclose(fp);
+	}
+	return n;
+}
+
+/* Milliseconds since "start". */
+static double
+batch_elapsed(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000.0 +
+	       (now.tv_usec - start->tv_usec) / 1000.0;
+}
+
+/* Fetch service tickets for all of the cells in the batch at once, using
+ * the TGT in the ccache, then set tokens for each of them in turn and print
+ * a summary of how long each step took.  Returns the number of cells for
+ * which we failed to get tokens. */
+static int
+batch_run(krb5_context ctx, krb5_ccache ccache, const int *methods,
+	  int workers, uid_t uid)
+{
+	krb5_creds mcreds, tgt;
+	struct timeval start;
+	double fetch, *token;
+	int i, *result, failed, have_tgt;
+
+	token = calloc(n_batch, sizeof(*token));
+	result = calloc(n_batch, sizeof(*result));
+	if ((token == NULL) || (result == NULL)) {
+		free(token);
+		free(result);
+		warn("out of memory");
+		return n_batch;
+	}
+
+	/* Find the TGT for the default principal's realm, which is what the
+	 * workers will start with. */
+	have_tgt = 0;
+	memset(&mcreds, 0, sizeof(mcreds));
+	memset(&tgt, 0, sizeof(tgt));
+	if ((krb5_cc_get_principal(ctx, ccache, &mcreds.client) == 0) &&
+	    (krb5_build_principal_ext(ctx, &mcreds.server,
+				      v5_princ_realm_length(mcreds.client),
+				      v5_princ_realm_contents(mcreds.client),
+				      KRB5_TGS_NAME_SIZE,
+				      KRB5_TGS_NAME,
+				      v5_princ_realm_length(mcreds.client),
+				      v5_princ_realm_contents(mcreds.client),
+				      0) == 0) &&
+	    (krb5_cc_retrieve_cred(ctx, ccache, 0, &mcreds, &tgt) == 0)) {
+		have_tgt = 1;
+	} else {
+		warn("no TGT found, fetching credentials one cell at a time");
+	}
+	if (mcreds.client != NULL) {
+		krb5_free_principal(ctx, mcreds.client);
+	}
+	if (mcreds.server != NULL) {
+		krb5_free_principal(ctx, mcreds.server);
+	}
+
+	gettimeofday(&start, NULL);
+	if (have_tgt) {
+		if (log_options.debug) {
+			debug("fetching credentials for %d cells using up to "
+			      "%d workers", n_batch, workers);
+		}
+		tokens_fetch(ctx, ccache, &tgt, &log_options,
+			     batch, n_batch, uid, methods, -1, workers);
+		krb5_free_cred_contents(ctx, &tgt);
+	}
+	fetch = batch_elapsed(&start);
+
+	/* Set the tokens.  Anything we fetched is in the ccache now, so this
+	 * should only have to go to the network for cells whose fetches
+	 * failed. */
+	failed = 0;
+	for (i = 0; i < n_batch; i++) {
+		gettimeofday(&start, NULL);
+		result[i] = minikafs_log(ctx, ccache, &log_options,
+					 batch[i].cell,
+					 batch[i].hint_principal,
+					 uid, methods, -1);
+		token[i] = batch_elapsed(&start);
+		if (result[i] != 0) {
+			failed++;
+		}
+	}
+
+	printf("%-32s %6s %10s %10s  %s\n",
+	       "cell", "creds", "fetch(ms)", "token(ms)", "result");
+	for (i = 0; i < n_batch; i++) {
+		printf("%-32s %6u %10.1f %10.1f  ",
+		       batch[i].cell, batch[i].fetched,
+		       batch[i].fetch_usec / 1000.0, token[i]);
+		if (result[i] == 0) {
+			printf("ok\n");
+		} else {
+			printf("failed (%d)\n", result[i]);
+		}
+	}
+	printf("%d cell%s, %d failed, fetched in %.1f ms\n",
+	       n_batch, (n_batch == 1) ? "" : "s", failed, fetch);
+
+	free(token);
+	free(result);
+	return failed;
+}
+
 int
 main(int argc, char **argv)
 {
 	char local[PATH_MAX], home[PATH_MAX], path[PATH_MAX];
 	char *homedir, *cell, *principal, *pathdir, *strategy;
 	int i, j, try_v5_2b_only, try_rxk5_only, cells, process_options;
+	int batch_mode, workers;
 	int methods[8];
 	krb5_context ctx;
 	krb5_ccache ccache;
@@ -122,6 +308,8 @@ main(int argc, char **argv)
 #endif
 	try_rxk5_only = 0;
 	cells = 0;
+	batch_mode = 0;
+	workers = DEFAULT_TOKEN_FETCH_WORKERS;
 	log_progname = "afs5log";
 	strategy = DEFAULT_TOKEN_STRATEGY;
 	uid = getuid();
@@ -148,6 +336,10 @@ main(int argc, char **argv)
 			case 'v':
 				log_options.debug++;
 				break;
+			case 'b':
+			case 'f':
+				batch_mode = 1;
+				break;
 			default:
 				break;
 			}
@@ -177,6 +369,23 @@ main(int argc, char **argv)
 					!log_options.null_afs_first;
 				break;
 			case 'v':
+			case 'b':
+				break;
+			case 'f':
+				i++;
+				if (i >= argc) {
+					break;
+				}
+				j = batch_read(argv[i]);
+				if (j > 0) {
+					cells += j;
+				}
+				break;
+			case 'j':
+				i++;
+				if (i < argc) {
+					workers = atoi(argv[i]);
+				}
 				break;
 			case 'p':
 				i++;
@@ -190,6 +399,10 @@ main(int argc, char **argv)
 						debug("cell of \"%s\" is "
 						      "\"%s\"", pathdir, path);
 					}
+					if (batch_mode) {
+						batch_add(path, NULL);
+						break;
+					}
 					set_methods(strategy, methods,
 						    sizeof(methods) /
 						    sizeof(methods[0]),
@@ -211,7 +424,8 @@ main(int argc, char **argv)
 				break;
 			default:
 				printf("%s: [ [-v] [-5] [-k] [-n] "
-				       "[-s strategy] [-p path] "
+				       "[-s strategy] [-b] [-j workers] "
+				       "[-f file] [-p path] "
 				       "[cell[=principal]] ] [...]\n",
 				       argv[0]);
 				krb5_free_context(ctx);
@@ -226,6 +440,11 @@ main(int argc, char **argv)
 				*principal = '\0';
 				principal++;
 			}
+			if (batch_mode) {
+				batch_add(cell, principal);
+				xstrfree(cell);
+				continue;
+			}
 			set_methods(strategy, methods,
 				    sizeof(methods) / sizeof(methods[0]),
 				    try_v5_2b_only, try_rxk5_only);
@@ -241,18 +460,24 @@ main(int argc, char **argv)
 	/* If no parameters were offered, go for the user's home directory and
 	 * the local cell, if we can determine what its name is. */
 	if (cells == 0) {
+		memset(local, '\0', sizeof(local));
 		j = minikafs_ws_cell(local, sizeof(local));
 		if ((j == 0) && (strcmp(local, "dynroot") != 0)) {
 			if (log_options.debug) {
 				debug("local cell is \"%s\"", local);
 			}
-			set_methods(strategy, methods,
-				    sizeof(methods) / sizeof(methods[0]),
-				    try_v5_2b_only, try_rxk5_only);
-			j = minikafs_log(NULL, ccache, &log_options,
-					 local, NULL, uid, methods, -1);
-			if (j != 0) {
-				fprintf(stderr, "%s: %d\n", local, j);
+			if (batch_mode) {
+				batch_add(local, NULL);
+			} else {
+				set_methods(strategy, methods,
+					    sizeof(methods) /
+					    sizeof(methods[0]),
+					    try_v5_2b_only, try_rxk5_only);
+				j = minikafs_log(NULL, ccache, &log_options,
+						 local, NULL, uid, methods, -1);
+				if (j != 0) {
+					fprintf(stderr, "%s: %d\n", local, j);
+				}
 			}
 		}
 		if (getenv("HOME") != NULL) {
@@ -269,22 +494,44 @@ main(int argc, char **argv)
 				if (log_options.debug) {
 					debug("home cell is \"%s\"", home);
 				}
-				set_methods(strategy, methods,
-					    sizeof(methods) /
-					    sizeof(methods[0]),
-					    try_v5_2b_only, try_rxk5_only);
-				j = minikafs_log(NULL, ccache,
-						 &log_options,
-						 home, NULL, uid,
-						 methods, -1);
-				if (j != 0) {
-					fprintf(stderr, "%s: %d\n", home, j);
+				if (batch_mode) {
+					batch_add(home, NULL);
+				} else {
+					set_methods(strategy, methods,
+						    sizeof(methods) /
+						    sizeof(methods[0]),
+						    try_v5_2b_only,
+						    try_rxk5_only);
+					j = minikafs_log(NULL, ccache,
+							 &log_options,
+							 home, NULL, uid,
+							 methods, -1);
+					if (j != 0) {
+						fprintf(stderr, "%s: %d\n",
+							home, j);
+					}
 				}
 			}
 			xstrfree(homedir);
 		}
 	}
+
+	/* In batch mode, we've only been collecting the names of cells so
+	 * far.  Get tokens for all of them now, using the strategy options
+	 * which were in effect at the end of the command line. */
+	j = 0;
+	if (batch_mode && (n_batch > 0)) {
+		set_methods(strategy, methods,
+			    sizeof(methods) / sizeof(methods[0]),
+			    try_v5_2b_only, try_rxk5_only);
+		j = batch_run(ctx, ccache, methods, workers, uid);
+		for (i = 0; i < n_batch; i++) {
+			xstrfree((char *) batch[i].cell);
+			xstrfree((char *) batch[i].hint_principal);
+		}
+		free(batch);
+	}
 	krb5_cc_close(ctx, ccache);
 	krb5_free_context(ctx);
-	return 0;
+	return (j == 0) ? 0 : 1;
 }
@@ -0,0 +1,398 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/time.h>
+#ifdef HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#include KRB5_H
+
+#include "init.h"
+#include "items.h"
+#include "logstdio.h"
+#include "minikafs.h"
+#include "minikafsfake.h"
+#include "options.h"
+#include "stash.h"
+#include "tokens.h"
+#include "userinfo.h"
+#include "v5.h"
+#include "xstr.h"
+
+/* Measure how long it takes to get tokens for a number of cells, using
+ * credentials from a real KDC and a fake AFS client which takes however
+ * long we tell it to for each call.  The workstation's cell is named after
+ * the default realm, and the others get hints which name their services in
+ * that realm.  "Cold" logins start from scratch every time, while "warm"
+ * ones reuse the service tickets we got the first time around. */
+
+extern char *log_progname;
+
+static char bench_handle;
+
+int
+_pam_krb5_has_item(pam_handle_t *pamh, int item)
+{
+	return (item == PAM_SERVICE);
+}
+
+int
+_pam_krb5_get_item_text(pam_handle_t *pamh, int item, char **text)
+{
+	if (item == PAM_SERVICE) {
+		*text = "afsbench";
+		return PAM_SUCCESS;
+	}
+	*text = NULL;
+	return PAM_SERVICE_ERR;
+}
+
+int
+_pam_krb5_get_item_conv(pam_handle_t *pamh, struct pam_conv **conv)
+{
+	*conv = NULL;
+	return PAM_SERVICE_ERR;
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static struct _pam_krb5_stash *
+stash_new(krb5_context ctx, krb5_creds *creds)
+{
+	struct _pam_krb5_stash *stash;
+	krb5_creds *copy;
+
+	stash = malloc(sizeof(*stash));
+	if (stash == NULL) {
+		return NULL;
+	}
+	memset(stash, 0, sizeof(*stash));
+	if (krb5_copy_creds(ctx, creds, &copy) != 0) {
+		free(stash);
+		return NULL;
+	}
+	stash->v5creds = *copy;
+	free(copy);
+	return stash;
+}
+
+static void
+stash_free(krb5_context ctx, struct _pam_krb5_stash *stash)
+{
+	struct _pam_krb5_ccname_list *node;
+	krb5_ccache ccache;
+
+	if (stash->v5memcc != NULL) {
+		if (krb5_cc_resolve(ctx, stash->v5memcc, &ccache) == 0) {
+			krb5_cc_destroy(ctx, ccache);
+		}
+		xstrfree(stash->v5memcc);
+	}
+	while (stash->afscells != NULL) {
+		node = stash->afscells;
+		stash->afscells = node->next;
+		xstrfree(node->name);
+		free(node);
+	}
+	krb5_free_cred_contents(ctx, &stash->v5creds);
+	free(stash);
+}
+
+/* Log in once, and check that we got a token for every cell. */
+static int
+login(krb5_context ctx, struct _pam_krb5_stash *stash,
+      struct _pam_krb5_options *options, struct _pam_krb5_user_info *info,
+      struct minikafs_fake *fake, char **cells, int n_cells, int report)
+{
+	int i, missing, count, version;
+
+	tokens_obtain(ctx, stash, options, info, 1);
+	missing = 0;
+	for (i = 0; i < n_cells; i++) {
+		version = 0;
+		count = minikafs_fake_tokens(fake, cells[i], &version);
+		if (report) {
+			printf("%s: %d token%s", cells[i], count,
+			       (count == 1) ? "" : "s");
+			if (count > 0) {
+				printf(" (%s)", (version == 2) ?
+				       "settoken2" : "settoken");
+			}
+			printf("\n");
+		}
+		if (count == 0) {
+			missing++;
+		}
+	}
+	tokens_release(stash, options);
+	return missing;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const char *modes[] = {"cold", "warm"};
+	krb5_context ctx;
+	krb5_creds creds;
+	struct _pam_krb5_options *options;
+	struct _pam_krb5_user_info *info;
+	struct _pam_krb5_stash *stash;
+	struct minikafs_fake *fake;
+	struct minikafs_backend backend;
+	const char **module_args;
+	char *realm, **cells, *afs_cells;
+	double start, elapsed;
+	unsigned long latency, settokens, whereis;
+	size_t size;
+	int c, i, j, k, n_args, n_cells, iterations, quiet, missing;
+
+	log_progname = "afsbench";
+	memset(&log_options, 0, sizeof(log_options));
+	iterations = 10;
+	n_cells = 4;
+	latency = 0;
+	quiet = 0;
+	while ((c = getopt(argc, argv, "c:l:n:qv")) != -1) {
+		switch (c) {
+		case 'c':
+			n_cells = atoi(optarg);
+			break;
+		case 'l':
+			latency = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'q':
+			quiet++;
+			break;
+		case 'v':
+			log_options.debug++;
+			break;
+		default:
+			printf("%s: [-v] [-q] [-n iterations] [-c cells] "
+			       "[-l usec] principal password [option ...]\n",
+			       argv[0]);
+			return 1;
+		}
+	}
+	if ((iterations < 1) || (n_cells < 1) || (argc - optind < 2)) {
+		fprintf(stderr, "%s: [-v] [-q] [-n iterations] [-c cells] "
+			"[-l usec] principal password [option ...]\n",
+			argv[0]);
+		return 1;
+	}
+	if (_pam_krb5_init_ctx(&ctx, 0, NULL) != 0) {
+		fprintf(stderr, "error initializing Kerberos\n");
+		return 1;
+	}
+	realm = NULL;
+	if (krb5_get_default_realm(ctx, &realm) != 0) {
+		fprintf(stderr, "error reading default realm\n");
+		return 1;
+	}
+
+	/* Name the cells, and list all but the first as extras. */
+	cells = malloc(sizeof(cells[0]) * n_cells);
+	size = strlen("afs_cells=") + 1;
+	for (i = 0; (cells != NULL) && (i < n_cells); i++) {
+		cells[i] = malloc(strlen(realm) + 32);
+		if (cells[i] == NULL) {
+			break;
+		}
+		if (i == 0) {
+			strcpy(cells[i], realm);
+		} else {
+			sprintf(cells[i], "cell%d.%s", i, realm);
+		}
+		for (j = 0; cells[i][j] != '\0'; j++) {
+			cells[i][j] = tolower((unsigned char) cells[i][j]);
+		}
+		size += 2 * strlen(cells[i]) + strlen(realm) + 8;
+	}
+	afs_cells = malloc(size);
+	if ((cells == NULL) || (i < n_cells) || (afs_cells == NULL)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	strcpy(afs_cells, "afs_cells=");
+	for (i = 1; i < n_cells; i++) {
+		sprintf(afs_cells + strlen(afs_cells), "%s%s=afs/%s@%s",
+			(i > 1) ? "," : "", cells[i], cells[i], realm);
+	}
+
+	/* Read settings, adding the cell list to whatever we were given. */
+	n_args = argc - optind - 2;
+	module_args = malloc(sizeof(module_args[0]) * (n_args + 1));
+	if (module_args == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < n_args; i++) {
+		module_args[i] = argv[optind + 2 + i];
+	}
+	if (n_cells > 1) {
+		module_args[n_args++] = afs_cells;
+	}
+	options = _pam_krb5_options_init((pam_handle_t *) &bench_handle,
+					 n_args, module_args, ctx);
+	if (options == NULL) {
+		fprintf(stderr, "error reading options\n");
+		return 1;
+	}
+	info = _pam_krb5_user_info_init(ctx, argv[optind], options, NULL);
+	if (info == NULL) {
+		fprintf(stderr, "error looking up user \"%s\"\n",
+			argv[optind]);
+		return 1;
+	}
+	memset(&creds, 0, sizeof(creds));
+	if (krb5_get_init_creds_password(ctx, &creds, info->principal_name,
+					 argv[optind + 1], NULL, NULL, 0,
+					 NULL, NULL) != 0) {
+		fprintf(stderr, "error getting credentials for \"%s\"\n",
+			info->unparsed_name);
+		return 1;
+	}
+
+	/* Set up the fake client. */
+	fake = minikafs_fake_new(cells[0]);
+	if (fake == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (i = 1; i < n_cells; i++) {
+		minikafs_fake_add_cell(fake, cells[i], 0);
+	}
+	for (i = 0; i < minikafs_fake_n_ops; i++) {
+		minikafs_fake_set_latency(fake, i, latency);
+	}
+	minikafs_fake_backend(fake, &backend);
+	minikafs_set_backend(&backend);
+
+	if (!quiet) {
+		printf("%d cells, %lu us per call, %d fetch workers\n",
+		       n_cells, latency, options->token_fetch_workers);
+		printf("%6s %14s %10s %10s\n",
+		       "", "per login", "settoken", "whereis");
+	}
+	missing = 0;
+	for (k = 0; k < (int) (sizeof(modes) / sizeof(modes[0])); k++) {
+		if (quiet) {
+			printf("%s:\n", modes[k]);
+		}
+		stash = NULL;
+		if (k == 1) {
+			/* Prime the shared ccache. */
+			stash = stash_new(ctx, &creds);
+			if (stash == NULL) {
+				fprintf(stderr, "out of memory\n");
+				return 1;
+			}
+			login(ctx, stash, options, info, fake,
+			      cells, n_cells, 0);
+		}
+		minikafs_fake_reset_calls(fake);
+		elapsed = 0;
+		for (i = 0; i < iterations; i++) {
+			if (k == 0) {
+				stash = stash_new(ctx, &creds);
+				if (stash == NULL) {
+					fprintf(stderr, "out of memory\n");
+					return 1;
+				}
+			}
+			start = now();
+			missing += login(ctx, stash, options, info, fake,
+					 cells, n_cells, quiet && (i == 0));
+			elapsed += now() - start;
+			if (k == 0) {
+				stash_free(ctx, stash);
+				stash = NULL;
+			}
+		}
+		if (stash != NULL) {
+			stash_free(ctx, stash);
+		}
+		settokens = minikafs_fake_calls(fake,
+						minikafs_fake_op_settoken);
+		whereis = minikafs_fake_calls(fake, minikafs_fake_op_whereis);
+		if (!quiet) {
+			printf("%6s %11.1f ms %10.1f %10.1f\n", modes[k],
+			       elapsed * 1000 / iterations,
+			       (double) settokens / iterations,
+			       (double) whereis / iterations);
+		}
+	}
+	if (missing > 0) {
+		fprintf(stderr, "%d tokens missing\n", missing);
+	}
+
+	minikafs_set_backend(NULL);
+	minikafs_fake_free(fake);
+	krb5_free_cred_contents(ctx, &creds);
+	_pam_krb5_user_info_free(ctx, info);
+	_pam_krb5_options_free(NULL, ctx, options);
+	for (i = 0; i < n_cells; i++) {
+		free(cells[i]);
+	}
+	free(cells);
+	free(afs_cells);
+	free(module_args);
+	v5_free_default_realm(ctx, realm);
+	krb5_free_context(ctx);
+	return (missing > 0) ? 1 : 0;
+}
@@ -68,6 +68,7 @@
 #include "sly.h"
 #include "stash.h"
 #include "tokens.h"
+#include "txn.h"
 #include "userinfo.h"
 #include "v5.h"
 #include "v4.h"
@@ -87,7 +88,7 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 	char *first_pass, *second_pass;
 
 	/* Initialize Kerberos. */
-	if (_pam_krb5_init_ctx(&ctx, argc, argv) != 0) {
+	if (_pam_krb5_txn_init_ctx(pamh, &ctx, argc, argv) != 0) {
 		warn("error initializing Kerberos");
 		return PAM_SERVICE_ERR;
 	}
@@ -96,7 +97,7 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 	i = pam_get_user(pamh, &user, NULL);
 	if ((i != PAM_SUCCESS) || (user == NULL)) {
 		warn("could not identify user name");
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return i;
 	}
 
@@ -104,14 +105,14 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 	i = v5_alloc_get_init_creds_opt(ctx, &gic_options);
 	if (i != 0) {
 		warn("error initializing options (shouldn't happen)");
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
-	options = _pam_krb5_options_init(pamh, argc, argv, ctx);
+	options = _pam_krb5_txn_options_init(pamh, argc, argv, ctx);
 	if (options == NULL) {
 		warn("error parsing options (shouldn't happen)");
 		v5_free_get_init_creds_opt(ctx, gic_options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 	if (options->debug) {
@@ -137,7 +138,7 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 	}
 
 	/* Get information about the user and the user's principal name. */
-	userinfo = _pam_krb5_user_info_init(ctx, user, options);
+	userinfo = _pam_krb5_txn_user_info_init(pamh, ctx, user, options);
 	if (userinfo == NULL) {
 		if (options->ignore_unknown_principals) {
 			retval = PAM_IGNORE;
@@ -154,9 +155,9 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 			pam_set_item(pamh, PAM_AUTHTOK, second_pass);
 		}
 		/* Clean up and return. */
-		_pam_krb5_options_free(pamh, ctx, options);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
 		v5_free_get_init_creds_opt(ctx, gic_options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return retval;
 	}
 	if (options->debug) {
@@ -171,7 +172,7 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 			debug("ignoring '%s' -- uid below minimum = %lu", user,
 			      (unsigned long) options->minimum_uid);
 		}
-		_pam_krb5_user_info_free(ctx, userinfo);
+		_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
 		if (prompted && (prompt_result == 0) && (second_pass != NULL)) {
 			if (options->debug) {
 				debug("saving newly-entered "
@@ -180,9 +181,9 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 			}
 			pam_set_item(pamh, PAM_AUTHTOK, second_pass);
 		}
-		_pam_krb5_options_free(pamh, ctx, options);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
 		v5_free_get_init_creds_opt(ctx, gic_options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_IGNORE;
 	}
 
@@ -191,7 +192,7 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 	if (stash == NULL) {
 		warn("error retrieving stash for '%s' (shouldn't happen)",
 		     user);
-		_pam_krb5_user_info_free(ctx, userinfo);
+		_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
 		if (prompted && (prompt_result == 0) && (second_pass != NULL)) {
 			if (options->debug) {
 				debug("saving newly-entered "
@@ -200,9 +201,9 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 			}
 			pam_set_item(pamh, PAM_AUTHTOK, second_pass);
 		}
-		_pam_krb5_options_free(pamh, ctx, options);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
 		v5_free_get_init_creds_opt(ctx, gic_options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 
@@ -210,6 +211,7 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 	 * so reset things for applications which call pam_authenticate() more
 	 * than once with the same library context. */
 	stash->v5attempted = 0;
+	stash->v5offline = 0;
 
 	retval = PAM_AUTH_ERR;
 
@@ -229,6 +231,8 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 				      &stash->v5result);
 		stash->v5external = 0;
 		stash->v5attempted = 1;
+		stash->v5offline = (retval == PAM_SUCCESS) &&
+				   (stash->v5result == KRB5_KDC_UNREACH);
 		if (options->debug) {
 			debug("got result %d (%s)", stash->v5result,
 			      v5_error_message(stash->v5result));
@@ -280,12 +284,14 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 			use_third_pass = 0;
 			stash->v5external = 0;
 			stash->v5attempted = 1;
+			stash->v5offline = (retval == PAM_SUCCESS) &&
+					   (stash->v5result == KRB5_KDC_UNREACH);
 			if (options->debug) {
 				debug("got result %d (%s)", stash->v5result,
 				      v5_error_message(stash->v5result));
 			}
 		}
-		if ((retval == PAM_SUCCESS) &&
+		if ((retval == PAM_SUCCESS) && !stash->v5offline &&
 		    ((options->v4 == 1) || (options->v4_for_afs == 1))) {
 			v4_get_creds(ctx, pamh, stash, userinfo, options,
 				     first_pass, &i);
@@ -307,6 +313,7 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 			}
 		} else {
 			if ((retval == PAM_SUCCESS) &&
+			    !stash->v5offline &&
 			    (options->ignore_afs == 0) &&
 			    (options->tokens == 1) &&
 			    tokens_useful()) {
@@ -375,12 +382,14 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 			use_third_pass = 0;
 			stash->v5external = 0;
 			stash->v5attempted = 1;
+			stash->v5offline = (retval == PAM_SUCCESS) &&
+					   (stash->v5result == KRB5_KDC_UNREACH);
 			if (options->debug) {
 				debug("got result %d (%s)", stash->v5result,
 				      v5_error_message(stash->v5result));
 			}
 		}
-		if ((retval == PAM_SUCCESS) &&
+		if ((retval == PAM_SUCCESS) && !stash->v5offline &&
 		    ((options->v4 == 1) || (options->v4_for_afs == 1))) {
 			v4_get_creds(ctx, pamh, stash, userinfo, options,
 				     second_pass, &i);
@@ -402,6 +411,7 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 			}
 		} else {
 			if ((retval == PAM_SUCCESS) &&
+			    !stash->v5offline &&
 			    (options->ignore_afs == 0) &&
 			    (options->tokens == 1) &&
 			    tokens_useful()) {
@@ -437,11 +447,13 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 				      &stash->v5result);
 		stash->v5external = 0;
 		stash->v5attempted = 1;
+		stash->v5offline = (retval == PAM_SUCCESS) &&
+				   (stash->v5result == KRB5_KDC_UNREACH);
 		if (options->debug) {
 			debug("got result %d (%s)", stash->v5result,
 			      v5_error_message(stash->v5result));
 		}
-		if ((retval == PAM_SUCCESS) &&
+		if ((retval == PAM_SUCCESS) && !stash->v5offline &&
 		    ((options->v4 == 1) || (options->v4_for_afs == 1))) {
 			v4_get_creds(ctx, pamh, stash, userinfo, options,
 				     second_pass, &i);
@@ -463,6 +475,7 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 			}
 		} else {
 			if ((retval == PAM_SUCCESS) &&
+			    !stash->v5offline &&
 			    (options->ignore_afs == 0) &&
 			    (options->tokens == 1) &&
 			    tokens_useful()) {
@@ -519,9 +532,9 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 		      pam_strerror(pamh, retval));
 	}
 	v5_free_get_init_creds_opt(ctx, gic_options);
-	_pam_krb5_options_free(pamh, ctx, options);
-	_pam_krb5_user_info_free(ctx, userinfo);
-	krb5_free_context(ctx);
+	_pam_krb5_txn_options_free(pamh, ctx, options);
+	_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
+	_pam_krb5_txn_free_ctx(pamh, ctx);
 
 	return retval;
 }
@@ -0,0 +1,150 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* For F_OFD_SETLKW. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#include <string.h>
+#include <unistd.h>
+
+#include "cachedir.h"
+
+/* FNV-1a, for picking file names and slots.  Collisions are harmless, since
+ * everything which uses it stores the original key and checks it. */
+uint32_t
+_pam_krb5_cachedir_hash_bytes(uint32_t hash, const void *data, size_t length)
+{
+	const unsigned char *p;
+
+	for (p = data; length > 0; length--) {
+		hash ^= *p++;
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+uint32_t
+_pam_krb5_cachedir_hash(const char *s)
+{
+	return _pam_krb5_cachedir_hash_bytes(PAM_KRB5_CACHEDIR_HASH_INIT,
+					     s, strlen(s));
+}
+
+/* Only trust a directory which nobody but root or we could have written
+ * to, and if we're going to be writing to it, only if it's ours. */
+int
+_pam_krb5_cachedir_ok(const char *dir, int writing)
+{
+	struct stat st;
+
+	if ((dir[0] != '/') || (lstat(dir, &st) != 0)) {
+		return 0;
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		return 0;
+	}
+	if ((st.st_uid != 0) && (st.st_uid != geteuid())) {
+		return 0;
+	}
+	if (writing && (st.st_uid != geteuid())) {
+		return 0;
+	}
+	if ((st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+		return 0;
+	}
+	return 1;
+}
+
+/* Only use a directory which nobody but us can look into. */
+int
+_pam_krb5_cachedir_private(const char *dir)
+{
+	struct stat st;
+
+	if ((dir[0] != '/') || (lstat(dir, &st) != 0)) {
+		return 0;
+	}
+	if (!S_ISDIR(st.st_mode) ||
+	    (st.st_uid != geteuid()) ||
+	    ((st.st_mode & (S_IRWXG | S_IRWXO)) != 0)) {
+		return 0;
+	}
+	return 1;
+}
+
+/* Wait for a lock on the whole of a file.  Where we can, take one which
+ * belongs to the descriptor rather than to the process, so that it also
+ * keeps out other threads, such as token fetching workers, and isn't
+ * dropped when some other descriptor for the file is closed. */
+int
+_pam_krb5_cachedir_lock(int fd, int type)
+{
+	struct flock lock;
+	int cmd;
+
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = type;
+	lock.l_whence = SEEK_SET;
+#ifdef F_OFD_SETLKW
+	cmd = F_OFD_SETLKW;
+#else
+	cmd = F_SETLKW;
+#endif
+	while (fcntl(fd, cmd, &lock) == -1) {
+		if (errno == EINTR) {
+			continue;
+		}
+#ifdef F_OFD_SETLKW
+		/* The kernel may not know about them. */
+		if ((errno == EINVAL) && (cmd == F_OFD_SETLKW)) {
+			cmd = F_SETLKW;
+			continue;
+		}
+#endif
+		return -1;
+	}
+	return 0;
+}
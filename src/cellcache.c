@@ -0,0 +1,686 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
+#include <limits.h>
+#include <stdio.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#include KRB5_H
+
+#include "cellcache.h"
+#include "cachedir.h"
+#include "log.h"
+
+/* The cache is a single file holding a header and a fixed number of
+ * fixed-size slots, laid out like the unknown principal cache.  A cell can
+ * live in any of the CELLCACHE_PROBES slots which follow the one its name
+ * hashes to, and when those are all in use, the entry which is closest to
+ * expiring is replaced.  An entry with an empty realm records that we
+ * couldn't figure out the cell's realm.  Each entry can also record the
+ * token method and service principal which last worked for the cell, which
+ * expire separately.  Integers are stored in host byte order, because the
+ * file is never shared between hosts. */
+#define CELLCACHE_FILE		"cell_realms"
+#define CELLCACHE_MAGIC		0x504b3543
+#define CELLCACHE_VERSION	2
+#define CELLCACHE_PROBES	8
+#define CELLCACHE_SLOTS		256
+
+struct cellcache_header {
+	uint32_t magic, version, slots, reserved;
+};
+
+/* Which cell a user's home directory is in is kept in a small file of its
+ * own for each user, which holds the home directory's name, where it
+ * pointed if it was a symbolic link, and the cell's name.  These are
+ * replaced with rename(), so readers don't need to take locks. */
+#define CELLCACHE_HOME_PREFIX	"home_cell_"
+#define CELLCACHE_HOME_MAGIC	0x504b3548
+#define CELLCACHE_HOME_VERSION	1
+
+struct cellcache_home_header {
+	uint32_t magic, version, uid, expires;
+	uint32_t homedir_len, target_len, cell_len, reserved;
+};
+
+struct cellcache_slot {
+	uint32_t hash, expires;
+	uint32_t method_expires, method_failures;
+	char cell[PAM_KRB5_CELLCACHE_CELL_MAX + 1];
+	char realm[PAM_KRB5_CELLCACHE_REALM_MAX + 1];
+	char method[PAM_KRB5_CELLCACHE_METHOD_MAX + 1];
+	char principal[PAM_KRB5_CELLCACHE_PRINCIPAL_MAX + 1];
+};
+
+static char *
+cellcache_path(const char *dir)
+{
+	char *path;
+
+	path = malloc(strlen(dir) + 1 + strlen(CELLCACHE_FILE) + 1);
+	if (path != NULL) {
+		sprintf(path, "%s/%s", dir, CELLCACHE_FILE);
+	}
+	return path;
+}
+
+static off_t
+cellcache_offset(const struct cellcache_header *header, uint32_t slot)
+{
+	return sizeof(*header) +
+	       (off_t) (slot % header->slots) * sizeof(struct cellcache_slot);
+}
+
+/* Open the cache file and read its header, returning the descriptor with
+ * a lock held on it, or -1 if it's missing, untrustworthy, or not in the
+ * format we expect.  If we're writing and it's missing or unusable, start
+ * it over. */
+static int
+cellcache_open(const char *dir, int writing, struct cellcache_header *header)
+{
+	struct stat st;
+	char *path;
+	int fd, flags;
+
+	if (!_pam_krb5_cachedir_ok(dir, writing)) {
+		return -1;
+	}
+	path = cellcache_path(dir);
+	if (path == NULL) {
+		return -1;
+	}
+	flags = writing ? (O_RDWR | O_CREAT) : O_RDONLY;
+#ifdef O_NOFOLLOW
+	flags |= O_NOFOLLOW;
+#endif
+	fd = open(path, flags, S_IRUSR | S_IWUSR);
+	free(path);
+	if (fd == -1) {
+		return -1;
+	}
+	if ((fstat(fd, &st) != 0) ||
+	    !S_ISREG(st.st_mode) ||
+	    ((st.st_uid != 0) && (st.st_uid != geteuid())) ||
+	    ((st.st_mode & (S_IWGRP | S_IWOTH)) != 0) ||
+	    (_pam_krb5_cachedir_lock(fd, writing ? F_WRLCK : F_RDLCK) != 0)) {
+		close(fd);
+		return -1;
+	}
+	if ((pread(fd, header, sizeof(*header), 0) == sizeof(*header)) &&
+	    (header->magic == CELLCACHE_MAGIC) &&
+	    (header->version == CELLCACHE_VERSION) &&
+	    (header->slots == CELLCACHE_SLOTS) &&
+	    (fstat(fd, &st) == 0) &&
+	    (st.st_size == cellcache_offset(header, 0) +
+			   (off_t) header->slots *
+			   sizeof(struct cellcache_slot))) {
+		return fd;
+	}
+	if (!writing) {
+		close(fd);
+		return -1;
+	}
+	memset(header, 0, sizeof(*header));
+	header->magic = CELLCACHE_MAGIC;
+	header->version = CELLCACHE_VERSION;
+	header->slots = CELLCACHE_SLOTS;
+	if ((fchmod(fd, S_IRUSR | S_IWUSR) != 0) ||
+	    (ftruncate(fd, 0) != 0) ||
+	    (ftruncate(fd, cellcache_offset(header, 0) +
+		       (off_t) header->slots *
+		       sizeof(struct cellcache_slot)) != 0) ||
+	    (pwrite(fd, header, sizeof(*header), 0) != sizeof(*header))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Find the slot which holds "cell", live or not. */
+static int
+cellcache_find(int fd, const struct cellcache_header *header,
+	       const char *cell, uint32_t *which, struct cellcache_slot *slot)
+{
+	uint32_t hash, i;
+
+	hash = _pam_krb5_cachedir_hash(cell);
+	for (i = 0; (i < CELLCACHE_PROBES) && (i < header->slots); i++) {
+		if (pread(fd, slot, sizeof(*slot),
+			  cellcache_offset(header, hash + i)) !=
+		    sizeof(*slot)) {
+			return -1;
+		}
+		if ((slot->hash == hash) &&
+		    (slot->cell[sizeof(slot->cell) - 1] == '\0') &&
+		    (slot->realm[sizeof(slot->realm) - 1] == '\0') &&
+		    (slot->method[sizeof(slot->method) - 1] == '\0') &&
+		    (slot->principal[sizeof(slot->principal) - 1] == '\0') &&
+		    (strcmp(slot->cell, cell) == 0)) {
+			*which = hash + i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* When a slot stops being useful. */
+static uint32_t
+cellcache_slot_expires(const struct cellcache_slot *slot)
+{
+	return (slot->method_expires > slot->expires) ?
+	       slot->method_expires : slot->expires;
+}
+
+/* Find the slot to write "cell"'s entry to: the one it's already in, or an
+ * empty or expired one, or else the one which would have expired soonest.
+ * Returns 1 if "slot" holds the cell's current entry, 0 if it needs to be
+ * started over, and -1 on error. */
+static int
+cellcache_claim(int fd, const struct cellcache_header *header,
+		const char *cell, time_t now,
+		uint32_t *which, struct cellcache_slot *slot)
+{
+	uint32_t hash, i, oldest;
+
+	if (cellcache_find(fd, header, cell, which, slot) == 0) {
+		return 1;
+	}
+	hash = _pam_krb5_cachedir_hash(cell);
+	*which = hash;
+	oldest = 0xffffffff;
+	for (i = 0; (i < CELLCACHE_PROBES) && (i < header->slots); i++) {
+		if (pread(fd, slot, sizeof(*slot),
+			  cellcache_offset(header, hash + i)) !=
+		    sizeof(*slot)) {
+			return -1;
+		}
+		if (cellcache_slot_expires(slot) <= (uint32_t) now) {
+			*which = hash + i;
+			break;
+		}
+		if (cellcache_slot_expires(slot) < oldest) {
+			oldest = cellcache_slot_expires(slot);
+			*which = hash + i;
+		}
+	}
+	memset(slot, 0, sizeof(*slot));
+	slot->hash = hash;
+	strcpy(slot->cell, cell);
+	return 0;
+}
+
+/* Check if we know which realm "cell" is in.  Returns 1 and fills in
+ * "realm" if we do, 0 if we recently failed to find out, and -1 if we
+ * don't know anything about it. */
+int
+_pam_krb5_cellcache_lookup(const char *dir, const char *cell,
+			   char *realm, size_t length, int verbose)
+{
+	struct cellcache_header header;
+	struct cellcache_slot slot;
+	uint32_t which;
+	int fd, ret;
+
+	if (strlen(cell) > PAM_KRB5_CELLCACHE_CELL_MAX) {
+		return -1;
+	}
+	fd = cellcache_open(dir, 0, &header);
+	if (fd == -1) {
+		if (verbose) {
+			debug("no usable cell realm cache in \"%s\"", dir);
+		}
+		return -1;
+	}
+	ret = -1;
+	if ((cellcache_find(fd, &header, cell, &which, &slot) == 0) &&
+	    (slot.expires > (uint32_t) time(NULL))) {
+		if (slot.realm[0] == '\0') {
+			ret = 0;
+		} else if (strlen(slot.realm) < length) {
+			strcpy(realm, slot.realm);
+			ret = 1;
+		}
+	}
+	close(fd);
+	return ret;
+}
+
+/* Remember that "cell" is in "realm", or, if "realm" is NULL, that we
+ * couldn't figure out which realm it's in, for "ttl" seconds. */
+int
+_pam_krb5_cellcache_add(const char *dir, const char *cell,
+			const char *realm, time_t ttl, int verbose)
+{
+	struct cellcache_header header;
+	struct cellcache_slot slot;
+	uint32_t which;
+	time_t now;
+	int fd;
+
+	if ((ttl <= 0) ||
+	    (strlen(cell) > PAM_KRB5_CELLCACHE_CELL_MAX) ||
+	    ((realm != NULL) &&
+	     (strlen(realm) > PAM_KRB5_CELLCACHE_REALM_MAX))) {
+		return -1;
+	}
+	fd = cellcache_open(dir, 1, &header);
+	if (fd == -1) {
+		return -1;
+	}
+	now = time(NULL);
+	if (cellcache_claim(fd, &header, cell, now, &which, &slot) < 0) {
+		close(fd);
+		return -1;
+	}
+	slot.expires = now + ttl;
+	memset(slot.realm, '\0', sizeof(slot.realm));
+	if (realm != NULL) {
+		strcpy(slot.realm, realm);
+	}
+	if (pwrite(fd, &slot, sizeof(slot),
+		   cellcache_offset(&header, which)) != sizeof(slot)) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	if (verbose) {
+		if (realm != NULL) {
+			debug("remembering that \"%s\" is in realm \"%s\" "
+			      "for %ld seconds", cell, realm, (long) ttl);
+		} else {
+			debug("remembering that the realm of \"%s\" is "
+			      "unknown for %ld seconds", cell, (long) ttl);
+		}
+	}
+	return 0;
+}
+
+/* Check which token method and service principal last worked for "cell".
+ * Returns 1 and fills in "method" and "principal" (which is empty if the
+ * method doesn't use one) if we know, and -1 if we don't. */
+int
+_pam_krb5_cellcache_method_lookup(const char *dir, const char *cell,
+				  char *method, size_t method_length,
+				  char *principal, size_t principal_length)
+{
+	struct cellcache_header header;
+	struct cellcache_slot slot;
+	uint32_t which;
+	int fd, ret;
+
+	if (strlen(cell) > PAM_KRB5_CELLCACHE_CELL_MAX) {
+		return -1;
+	}
+	fd = cellcache_open(dir, 0, &header);
+	if (fd == -1) {
+		return -1;
+	}
+	ret = -1;
+	if ((cellcache_find(fd, &header, cell, &which, &slot) == 0) &&
+	    (slot.method_expires > (uint32_t) time(NULL)) &&
+	    (slot.method[0] != '\0') &&
+	    (strlen(slot.method) < method_length) &&
+	    (strlen(slot.principal) < principal_length)) {
+		strcpy(method, slot.method);
+		strcpy(principal, slot.principal);
+		ret = 1;
+	}
+	close(fd);
+	return ret;
+}
+
+/* Remember that "method", using "principal" (or none, if it's NULL), worked
+ * for "cell", for "ttl" seconds.  If "method" is NULL, note that nothing we
+ * tried worked, and forget what we remembered once that's happened
+ * "max_failures" times since we started remembering it. */
+int
+_pam_krb5_cellcache_method_add(const char *dir, const char *cell,
+			       const char *method, const char *principal,
+			       time_t ttl, int max_failures, int verbose)
+{
+	struct cellcache_header header;
+	struct cellcache_slot slot;
+	uint32_t which;
+	time_t now;
+	int fd, found;
+
+	if ((ttl <= 0) ||
+	    (strlen(cell) > PAM_KRB5_CELLCACHE_CELL_MAX) ||
+	    ((method != NULL) &&
+	     (strlen(method) > PAM_KRB5_CELLCACHE_METHOD_MAX)) ||
+	    ((principal != NULL) &&
+	     (strlen(principal) > PAM_KRB5_CELLCACHE_PRINCIPAL_MAX))) {
+		return -1;
+	}
+	fd = cellcache_open(dir, 1, &header);
+	if (fd == -1) {
+		return -1;
+	}
+	now = time(NULL);
+	found = cellcache_claim(fd, &header, cell, now, &which, &slot);
+	if ((found < 0) ||
+	    ((method == NULL) &&
+	     ((found == 0) || (slot.method_expires <= (uint32_t) now)))) {
+		/* Error, or no failure to count. */
+		close(fd);
+		return (found < 0) ? -1 : 0;
+	}
+	if (method != NULL) {
+		slot.method_expires = now + ttl;
+		slot.method_failures = 0;
+		memset(slot.method, '\0', sizeof(slot.method));
+		strcpy(slot.method, method);
+		memset(slot.principal, '\0', sizeof(slot.principal));
+		if (principal != NULL) {
+			strcpy(slot.principal, principal);
+		}
+	} else {
+		slot.method_failures++;
+		if (slot.method_failures >= (uint32_t) max_failures) {
+			slot.method_expires = 0;
+			slot.method_failures = 0;
+			memset(slot.method, '\0', sizeof(slot.method));
+			memset(slot.principal, '\0', sizeof(slot.principal));
+		}
+	}
+	if (pwrite(fd, &slot, sizeof(slot),
+		   cellcache_offset(&header, which)) != sizeof(slot)) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	if (verbose) {
+		if (method != NULL) {
+			debug("remembering that \"%s\"%s%s%s works for \"%s\" "
+			      "for %ld seconds", method,
+			      principal ? " (\"" : "",
+			      principal ? principal : "",
+			      principal ? "\")" : "",
+			      cell, (long) ttl);
+		} else if (slot.method_expires == 0) {
+			debug("forgetting which token method works for \"%s\"",
+			      cell);
+		} else {
+			debug("remembered token method for \"%s\" has failed "
+			      "%ld time%s", cell, (long) slot.method_failures,
+			      (slot.method_failures == 1) ? "" : "s");
+		}
+	}
+	return 0;
+}
+
+static int
+cellcache_home_path(const char *dir, uid_t uid, char *path, size_t length)
+{
+	if (snprintf(path, length, "%s/%s%lu", dir, CELLCACHE_HOME_PREFIX,
+		     (unsigned long) uid) >= (int) length) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Check if we know which cell "uid"'s home directory, "homedir", which was
+ * a link to "target" (or not a link, if "target" is empty), is in.  Returns
+ * 1 and fills in "cell" if we do, and -1 if we don't. */
+int
+_pam_krb5_cellcache_home_lookup(const char *dir, uid_t uid,
+				const char *homedir, const char *target,
+				char *cell, size_t length)
+{
+	struct cellcache_home_header header;
+	struct stat st;
+	char path[PATH_MAX], *buf;
+	size_t len;
+	int fd, flags, ret;
+
+	if (!_pam_krb5_cachedir_ok(dir, 0) ||
+	    (cellcache_home_path(dir, uid, path, sizeof(path)) != 0)) {
+		return -1;
+	}
+	flags = O_RDONLY;
+#ifdef O_NOFOLLOW
+	flags |= O_NOFOLLOW;
+#endif
+	fd = open(path, flags);
+	if (fd == -1) {
+		return -1;
+	}
+	if ((fstat(fd, &st) != 0) ||
+	    !S_ISREG(st.st_mode) ||
+	    ((st.st_uid != 0) && (st.st_uid != geteuid())) ||
+	    ((st.st_mode & (S_IWGRP | S_IWOTH)) != 0) ||
+	    (pread(fd, &header, sizeof(header), 0) != sizeof(header)) ||
+	    (header.magic != CELLCACHE_HOME_MAGIC) ||
+	    (header.version != CELLCACHE_HOME_VERSION) ||
+	    (header.uid != (uint32_t) uid) ||
+	    (header.expires <= (uint32_t) time(NULL)) ||
+	    (header.homedir_len != strlen(homedir)) ||
+	    (header.target_len != strlen(target)) ||
+	    (header.cell_len > PAM_KRB5_CELLCACHE_CELL_MAX) ||
+	    (header.cell_len >= length) ||
+	    (st.st_size != (off_t) (sizeof(header) + header.homedir_len +
+				    header.target_len + header.cell_len))) {
+		close(fd);
+		return -1;
+	}
+	len = header.homedir_len + header.target_len + header.cell_len;
+	buf = malloc(len);
+	if (buf == NULL) {
+		close(fd);
+		return -1;
+	}
+	ret = -1;
+	if ((pread(fd, buf, len, sizeof(header)) == (ssize_t) len) &&
+	    (memcmp(buf, homedir, header.homedir_len) == 0) &&
+	    (memcmp(buf + header.homedir_len, target,
+		    header.target_len) == 0) &&
+	    (memchr(buf + header.homedir_len + header.target_len, '\0',
+		    header.cell_len) == NULL)) {
+		memcpy(cell, buf + header.homedir_len + header.target_len,
+		       header.cell_len);
+		cell[header.cell_len] = '\0';
+		ret = 1;
+	}
+	free(buf);
+	close(fd);
+	return ret;
+}
+
+/* Remember that "uid"'s home directory is in "cell", for "ttl" seconds. */
+int
+_pam_krb5_cellcache_home_add(const char *dir, uid_t uid,
+			     const char *homedir, const char *target,
+			     const char *cell, time_t ttl, int verbose)
+{
+	struct cellcache_home_header header;
+	char path[PATH_MAX], tmp[PATH_MAX];
+	int fd, ret;
+
+	if ((ttl <= 0) ||
+	    (strlen(cell) > PAM_KRB5_CELLCACHE_CELL_MAX) ||
+	    !_pam_krb5_cachedir_ok(dir, 1) ||
+	    (cellcache_home_path(dir, uid, path, sizeof(path)) != 0) ||
+	    (snprintf(tmp, sizeof(tmp), "%s.XXXXXX",
+		      path) >= (int) sizeof(tmp))) {
+		return -1;
+	}
+	memset(&header, 0, sizeof(header));
+	header.magic = CELLCACHE_HOME_MAGIC;
+	header.version = CELLCACHE_HOME_VERSION;
+	header.uid = uid;
+	header.expires = time(NULL) + ttl;
+	header.homedir_len = strlen(homedir);
+	header.target_len = strlen(target);
+	header.cell_len = strlen(cell);
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		return -1;
+	}
+	ret = 0;
+	if ((fchmod(fd, S_IRUSR | S_IWUSR) != 0) ||
+	    (write(fd, &header, sizeof(header)) != sizeof(header)) ||
+	    (write(fd, homedir, header.homedir_len) !=
+	     (ssize_t) header.homedir_len) ||
+	    (write(fd, target, header.target_len) !=
+	     (ssize_t) header.target_len) ||
+	    (write(fd, cell, header.cell_len) != (ssize_t) header.cell_len)) {
+		ret = -1;
+	}
+	if (close(fd) != 0) {
+		ret = -1;
+	}
+	if ((ret != 0) || (rename(tmp, path) != 0)) {
+		unlink(tmp);
+		return -1;
+	}
+	if (verbose) {
+		debug("remembering that \"%s\" is in \"%s\" for %ld seconds",
+		      homedir, cell, (long) ttl);
+	}
+	return 0;
+}
+
+/* Forget about one cell, or about all of them. */
+int
+_pam_krb5_cellcache_flush(const char *dir, const char *cell)
+{
+	struct cellcache_header header;
+	struct cellcache_slot slot;
+	uint32_t which;
+	char *path;
+	int fd, ret;
+
+	if (!_pam_krb5_cachedir_ok(dir, 1)) {
+		return -1;
+	}
+	path = cellcache_path(dir);
+	if (path == NULL) {
+		return -1;
+	}
+	if (cell == NULL) {
+		ret = unlink(path);
+	} else {
+		ret = access(path, F_OK);
+	}
+	free(path);
+	if ((ret != 0) && (errno == ENOENT)) {
+		/* Nothing to forget. */
+		return 0;
+	}
+	if ((ret != 0) || (cell == NULL)) {
+		return ret;
+	}
+	fd = cellcache_open(dir, 1, &header);
+	if (fd == -1) {
+		return -1;
+	}
+	ret = 0;
+	if (cellcache_find(fd, &header, cell, &which, &slot) == 0) {
+		memset(&slot, 0, sizeof(slot));
+		if (pwrite(fd, &slot, sizeof(slot),
+			   cellcache_offset(&header, which)) != sizeof(slot)) {
+			ret = -1;
+		}
+	}
+	close(fd);
+	return ret;
+}
+
+/* Call "callback" for each live entry. */
+int
+_pam_krb5_cellcache_list(const char *dir,
+			 int (*callback)(const struct _pam_krb5_cellcache_entry *entry,
+					 void *data),
+			 void *data)
+{
+	struct _pam_krb5_cellcache_entry entry;
+	struct cellcache_header header;
+	struct cellcache_slot slot;
+	uint32_t i, now;
+	int fd, ret;
+
+	fd = cellcache_open(dir, 0, &header);
+	if (fd == -1) {
+		return -1;
+	}
+	now = time(NULL);
+	ret = 0;
+	for (i = 0; (i < header.slots) && (ret == 0); i++) {
+		if (pread(fd, &slot, sizeof(slot),
+			  cellcache_offset(&header, i)) != sizeof(slot)) {
+			ret = -1;
+			break;
+		}
+		if ((cellcache_slot_expires(&slot) <= now) ||
+		    (slot.cell[sizeof(slot.cell) - 1] != '\0') ||
+		    (slot.realm[sizeof(slot.realm) - 1] != '\0') ||
+		    (slot.method[sizeof(slot.method) - 1] != '\0') ||
+		    (slot.principal[sizeof(slot.principal) - 1] != '\0')) {
+			continue;
+		}
+		memset(&entry, 0, sizeof(entry));
+		entry.cell = slot.cell;
+		if (slot.expires > now) {
+			entry.realm = (slot.realm[0] != '\0') ?
+				      slot.realm : NULL;
+			entry.expires = slot.expires;
+		}
+		if ((slot.method_expires > now) && (slot.method[0] != '\0')) {
+			entry.method = slot.method;
+			entry.principal = (slot.principal[0] != '\0') ?
+					  slot.principal : NULL;
+			entry.method_expires = slot.method_expires;
+		}
+		ret = callback(&entry, data);
+	}
+	close(fd);
+	return ret;
+}
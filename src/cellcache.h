@@ -0,0 +1,84 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef pam_krb5_cellcache_h
+#define pam_krb5_cellcache_h
+
+/* Defaults for "cell_realm_cache_ttl" and "cell_realm_cache_negative_ttl". */
+#define DEFAULT_CELL_REALM_CACHE_TTL 86400
+#define DEFAULT_CELL_REALM_CACHE_NEGATIVE_TTL 300
+
+/* Default for "token_method_ttl", and how many times a remembered token
+ * method can fail before we forget about it. */
+#define DEFAULT_TOKEN_METHOD_TTL 86400
+#define PAM_KRB5_CELLCACHE_METHOD_FAILURES 3
+
+/* The longest cell, realm, method, and principal names which we'll
+ * remember. */
+#define PAM_KRB5_CELLCACHE_CELL_MAX 127
+#define PAM_KRB5_CELLCACHE_REALM_MAX 255
+#define PAM_KRB5_CELLCACHE_METHOD_MAX 15
+#define PAM_KRB5_CELLCACHE_PRINCIPAL_MAX 255
+
+struct _pam_krb5_cellcache_entry {
+	const char *cell;
+	const char *realm;	/* NULL if the cell's realm couldn't be found */
+	time_t expires;		/* 0 if we don't know about the realm */
+	const char *method;	/* NULL if we don't know which one works */
+	const char *principal;	/* NULL if the method doesn't use one */
+	time_t method_expires;
+};
+
+int _pam_krb5_cellcache_lookup(const char *dir, const char *cell,
+			       char *realm, size_t length, int verbose);
+int _pam_krb5_cellcache_add(const char *dir, const char *cell,
+			    const char *realm, time_t ttl, int verbose);
+int _pam_krb5_cellcache_method_lookup(const char *dir, const char *cell,
+				      char *method, size_t method_length,
+				      char *principal,
+				      size_t principal_length);
+int _pam_krb5_cellcache_method_add(const char *dir, const char *cell,
+				   const char *method, const char *principal,
+				   time_t ttl, int max_failures, int verbose);
+int _pam_krb5_cellcache_home_lookup(const char *dir, uid_t uid,
+				    const char *homedir, const char *target,
+				    char *cell, size_t length);
+int _pam_krb5_cellcache_home_add(const char *dir, uid_t uid,
+				 const char *homedir, const char *target,
+				 const char *cell, time_t ttl, int verbose);
+int _pam_krb5_cellcache_flush(const char *dir, const char *cell);
+int _pam_krb5_cellcache_list(const char *dir,
+			     int (*callback)(const struct _pam_krb5_cellcache_entry *entry,
+					     void *data),
+			     void *data);
+
+#endif
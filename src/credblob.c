@@ -0,0 +1,581 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include KRB5_H
+
+#include "credblob.h"
+
+/* Credentials which we save to shared memory are stored in the format which
+ * is used by version 4 FILE ccaches, so that a module which would read them
+ * by writing them to a file and opening that file as a ccache can still do
+ * so.  We only know how to do this when we can get at the structures
+ * directly, and we only read versions 3 and 4, which use network byte order
+ * throughout.  When we can't, we return an error, and the caller should fall
+ * back to using a temporary ccache file. */
+
+#if defined(HAVE_KRB5_CREDS_KEYBLOCK) && \
+    defined(HAVE_KRB5_KEYBLOCK_ENCTYPE) && \
+    defined(HAVE_KRB5_KEYBLOCK_LENGTH) && \
+    defined(HAVE_KRB5_KEYBLOCK_CONTENTS) && \
+    defined(HAVE_KRB5_CREDS_IS_SKEY) && \
+    defined(HAVE_KRB5_CREDS_TICKET_FLAGS) && \
+    defined(HAVE_KRB5_ADDRESS_ADDRTYPE) && \
+    defined(HAVE_KRB5_ADDRESS_LENGTH) && \
+    defined(HAVE_KRB5_ADDRESS_CONTENTS) && \
+    defined(HAVE_KRB5_AUTHDATA_AD_TYPE) && \
+    defined(HAVE_KRB5_AUTHDATA_LENGTH) && \
+    defined(HAVE_KRB5_AUTHDATA_CONTENTS) && \
+    defined(HAVE_KRB5_PRINCIPAL_DATA_LENGTH) && \
+    defined(HAVE_KRB5_PRINCIPAL_DATA_DATA) && \
+    defined(HAVE_KRB5_PRINCIPAL_DATA_REALM_DATA) && \
+    defined(HAVE_KRB5_PRINCIPAL_DATA_TYPE)
+
+#define CREDBLOB_FVNO_3 0x0503
+#define CREDBLOB_FVNO_4 0x0504
+
+/* A cursor for writing.  If "buf" is NULL, we just count. */
+struct credblob_writer {
+	unsigned char *buf;
+	size_t length, used;
+	int error;
+};
+
+/* A cursor for reading. */
+struct credblob_reader {
+	const unsigned char *buf;
+	size_t length, used;
+	int version;
+};
+
+static void
+credblob_put_bytes(struct credblob_writer *w, const void *p, size_t n)
+{
+	if (w->buf != NULL) {
+		if (w->length - w->used < n) {
+			w->error = 1;
+			return;
+		}
+		if (n > 0) {
+			memcpy(w->buf + w->used, p, n);
+		}
+	}
+	w->used += n;
+}
+
+static void
+credblob_put_u8(struct credblob_writer *w, unsigned int i)
+{
+	unsigned char b[1];
+	b[0] = i & 0xff;
+	credblob_put_bytes(w, b, sizeof(b));
+}
+
+static void
+credblob_put_u16(struct credblob_writer *w, unsigned int i)
+{
+	unsigned char b[2];
+	b[0] = (i >> 8) & 0xff;
+	b[1] = i & 0xff;
+	credblob_put_bytes(w, b, sizeof(b));
+}
+
+static void
+credblob_put_u32(struct credblob_writer *w, krb5_ui_4 i)
+{
+	unsigned char b[4];
+	b[0] = (i >> 24) & 0xff;
+	b[1] = (i >> 16) & 0xff;
+	b[2] = (i >> 8) & 0xff;
+	b[3] = i & 0xff;
+	credblob_put_bytes(w, b, sizeof(b));
+}
+
+static void
+credblob_put_counted(struct credblob_writer *w, const void *p, size_t n)
+{
+	credblob_put_u32(w, n);
+	credblob_put_bytes(w, p, n);
+}
+
+static void
+credblob_put_principal(struct credblob_writer *w, krb5_principal princ)
+{
+	int i;
+	credblob_put_u32(w, princ->type);
+	credblob_put_u32(w, princ->length);
+	credblob_put_counted(w, princ->realm.data, princ->realm.length);
+	for (i = 0; i < princ->length; i++) {
+		credblob_put_counted(w, princ->data[i].data,
+				     princ->data[i].length);
+	}
+}
+
+static void
+credblob_put_creds(struct credblob_writer *w, krb5_creds *creds)
+{
+	int i;
+
+	/* File header, with no tags, and the default principal. */
+	credblob_put_u16(w, CREDBLOB_FVNO_4);
+	credblob_put_u16(w, 0);
+	credblob_put_principal(w, creds->client);
+
+	/* The one credential. */
+	credblob_put_principal(w, creds->client);
+	credblob_put_principal(w, creds->server);
+	credblob_put_u16(w, creds->keyblock.enctype);
+	credblob_put_counted(w, creds->keyblock.contents,
+			     creds->keyblock.length);
+	credblob_put_u32(w, creds->times.authtime);
+	credblob_put_u32(w, creds->times.starttime);
+	credblob_put_u32(w, creds->times.endtime);
+	credblob_put_u32(w, creds->times.renew_till);
+	credblob_put_u8(w, creds->is_skey ? 1 : 0);
+	credblob_put_u32(w, creds->ticket_flags);
+	for (i = 0;
+	     (creds->addresses != NULL) && (creds->addresses[i] != NULL);
+	     i++) {
+		continue;
+	}
+	credblob_put_u32(w, i);
+	for (i = 0;
+	     (creds->addresses != NULL) && (creds->addresses[i] != NULL);
+	     i++) {
+		credblob_put_u16(w, creds->addresses[i]->addrtype);
+		credblob_put_counted(w, creds->addresses[i]->contents,
+				     creds->addresses[i]->length);
+	}
+	for (i = 0;
+	     (creds->authdata != NULL) && (creds->authdata[i] != NULL);
+	     i++) {
+		continue;
+	}
+	credblob_put_u32(w, i);
+	for (i = 0;
+	     (creds->authdata != NULL) && (creds->authdata[i] != NULL);
+	     i++) {
+		credblob_put_u16(w, creds->authdata[i]->ad_type);
+		credblob_put_counted(w, creds->authdata[i]->contents,
+				     creds->authdata[i]->length);
+	}
+	credblob_put_counted(w, creds->ticket.data, creds->ticket.length);
+	credblob_put_counted(w, creds->second_ticket.data,
+			     creds->second_ticket.length);
+}
+
+/* Compute the length of the encoded form of the credentials, or return 0 if
+ * they can't be encoded. */
+size_t
+_pam_krb5_credblob_length(krb5_creds *creds)
+{
+	struct credblob_writer w;
+	if ((creds->client == NULL) || (creds->server == NULL)) {
+		return 0;
+	}
+	memset(&w, 0, sizeof(w));
+	credblob_put_creds(&w, creds);
+	return w.used;
+}
+
+/* Encode the credentials into a buffer which is exactly large enough. */
+int
+_pam_krb5_credblob_encode(krb5_creds *creds,
+			  unsigned char *blob, size_t length)
+{
+	struct credblob_writer w;
+	if ((creds->client == NULL) || (creds->server == NULL)) {
+		return -1;
+	}
+	memset(&w, 0, sizeof(w));
+	w.buf = blob;
+	w.length = length;
+	credblob_put_creds(&w, creds);
+	return ((w.error == 0) && (w.used == length)) ? 0 : -1;
+}
+
+static int
+credblob_get_bytes(struct credblob_reader *r, void *p, size_t n)
+{
+	if (r->length - r->used < n) {
+		return -1;
+	}
+	memcpy(p, r->buf + r->used, n);
+	r->used += n;
+	return 0;
+}
+
+static int
+credblob_get_u8(struct credblob_reader *r, unsigned int *i)
+{
+	unsigned char b[1];
+	if (credblob_get_bytes(r, b, sizeof(b)) != 0) {
+		return -1;
+	}
+	*i = b[0];
+	return 0;
+}
+
+static int
+credblob_get_u16(struct credblob_reader *r, unsigned int *i)
+{
+	unsigned char b[2];
+	if (credblob_get_bytes(r, b, sizeof(b)) != 0) {
+		return -1;
+	}
+	*i = (b[0] << 8) | b[1];
+	return 0;
+}
+
+static int
+credblob_get_u32(struct credblob_reader *r, krb5_ui_4 *i)
+{
+	unsigned char b[4];
+	if (credblob_get_bytes(r, b, sizeof(b)) != 0) {
+		return -1;
+	}
+	*i = ((krb5_ui_4) b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+	return 0;
+}
+
+static int
+credblob_get_time(struct credblob_reader *r, krb5_timestamp *t)
+{
+	krb5_ui_4 u;
+	if (credblob_get_u32(r, &u) != 0) {
+		return -1;
+	}
+	*t = u;
+	return 0;
+}
+
+/* Read a length and that many bytes into a new buffer, which is
+ * NUL-terminated for the sake of anyone who treats it as a string. */
+static int
+credblob_get_counted(struct credblob_reader *r, void **p, unsigned int *n)
+{
+	krb5_ui_4 length;
+	unsigned char *data;
+	if (credblob_get_u32(r, &length) != 0) {
+		return -1;
+	}
+	if (length > r->length - r->used) {
+		return -1;
+	}
+	data = malloc(length + 1);
+	if (data == NULL) {
+		return -1;
+	}
+	credblob_get_bytes(r, data, length);
+	data[length] = '\0';
+	*p = data;
+	*n = length;
+	return 0;
+}
+
+static void
+credblob_free_principal(krb5_principal princ)
+{
+	int i;
+	if (princ == NULL) {
+		return;
+	}
+	if (princ->data != NULL) {
+		for (i = 0; i < princ->length; i++) {
+			free(princ->data[i].data);
+		}
+		free(princ->data);
+	}
+	free(princ->realm.data);
+	free(princ);
+}
+
+static int
+credblob_get_principal(struct credblob_reader *r, krb5_principal *princ)
+{
+	krb5_principal p;
+	krb5_ui_4 type, count, i;
+	void *data;
+
+	*princ = NULL;
+	if ((credblob_get_u32(r, &type) != 0) ||
+	    (credblob_get_u32(r, &count) != 0) ||
+	    (count > (r->length - r->used) / 4)) {
+		return -1;
+	}
+	p = calloc(1, sizeof(*p));
+	if (p == NULL) {
+		return -1;
+	}
+#ifdef KV5M_PRINCIPAL
+	p->magic = KV5M_PRINCIPAL;
+#endif
+	p->type = type;
+	if (credblob_get_counted(r, &data, &p->realm.length) != 0) {
+		free(p);
+		return -1;
+	}
+	p->realm.data = data;
+	if (count > 0) {
+		p->data = calloc(count, sizeof(p->data[0]));
+		if (p->data == NULL) {
+			credblob_free_principal(p);
+			return -1;
+		}
+	}
+	p->length = count;
+	for (i = 0; i < count; i++) {
+		if (credblob_get_counted(r, &data, &p->data[i].length) != 0) {
+			credblob_free_principal(p);
+			return -1;
+		}
+		p->data[i].data = data;
+	}
+	*princ = p;
+	return 0;
+}
+
+static void
+credblob_free_creds(krb5_creds *creds)
+{
+	int i;
+	credblob_free_principal(creds->client);
+	credblob_free_principal(creds->server);
+	if (creds->keyblock.contents != NULL) {
+		memset(creds->keyblock.contents, 0, creds->keyblock.length);
+		free(creds->keyblock.contents);
+	}
+	for (i = 0;
+	     (creds->addresses != NULL) && (creds->addresses[i] != NULL);
+	     i++) {
+		free(creds->addresses[i]->contents);
+		free(creds->addresses[i]);
+	}
+	free(creds->addresses);
+	for (i = 0;
+	     (creds->authdata != NULL) && (creds->authdata[i] != NULL);
+	     i++) {
+		free(creds->authdata[i]->contents);
+		free(creds->authdata[i]);
+	}
+	free(creds->authdata);
+	free(creds->ticket.data);
+	free(creds->second_ticket.data);
+	memset(creds, 0, sizeof(*creds));
+}
+
+static int
+credblob_get_creds(struct credblob_reader *r, krb5_creds *creds)
+{
+	unsigned int i, etype, is_skey;
+	krb5_ui_4 u, count;
+	krb5_principal princ;
+	void *data;
+
+	/* File header.  Version 4 has tagged fields which we skip. */
+	if (credblob_get_u16(r, &i) != 0) {
+		return -1;
+	}
+	if ((i != CREDBLOB_FVNO_3) && (i != CREDBLOB_FVNO_4)) {
+		return -1;
+	}
+	r->version = i;
+	if (r->version == CREDBLOB_FVNO_4) {
+		if ((credblob_get_u16(r, &i) != 0) ||
+		    (i > r->length - r->used)) {
+			return -1;
+		}
+		r->used += i;
+	}
+
+	/* The default principal, which we don't need. */
+	if (credblob_get_principal(r, &princ) != 0) {
+		return -1;
+	}
+	credblob_free_principal(princ);
+
+	/* The first credential. */
+#ifdef KV5M_CREDS
+	creds->magic = KV5M_CREDS;
+#endif
+	if ((credblob_get_principal(r, &creds->client) != 0) ||
+	    (credblob_get_principal(r, &creds->server) != 0)) {
+		return -1;
+	}
+	if (credblob_get_u16(r, &etype) != 0) {
+		return -1;
+	}
+	if ((r->version == CREDBLOB_FVNO_3) &&
+	    (credblob_get_u16(r, &etype) != 0)) {
+		return -1;
+	}
+#ifdef KV5M_KEYBLOCK
+	creds->keyblock.magic = KV5M_KEYBLOCK;
+#endif
+	creds->keyblock.enctype = etype;
+	if (credblob_get_counted(r, &data, &creds->keyblock.length) != 0) {
+		return -1;
+	}
+	creds->keyblock.contents = data;
+	if ((credblob_get_time(r, &creds->times.authtime) != 0) ||
+	    (credblob_get_time(r, &creds->times.starttime) != 0) ||
+	    (credblob_get_time(r, &creds->times.endtime) != 0) ||
+	    (credblob_get_time(r, &creds->times.renew_till) != 0) ||
+	    (credblob_get_u8(r, &is_skey) != 0) ||
+	    (credblob_get_u32(r, &u) != 0)) {
+		return -1;
+	}
+	creds->is_skey = is_skey;
+	creds->ticket_flags = u;
+
+	/* Addresses. */
+	if ((credblob_get_u32(r, &count) != 0) ||
+	    (count > (r->length - r->used) / 6)) {
+		return -1;
+	}
+	if (count > 0) {
+		creds->addresses = calloc(count + 1,
+					  sizeof(creds->addresses[0]));
+		if (creds->addresses == NULL) {
+			return -1;
+		}
+	}
+	for (u = 0; u < count; u++) {
+		creds->addresses[u] = calloc(1, sizeof(*creds->addresses[u]));
+		if ((creds->addresses[u] == NULL) ||
+		    (credblob_get_u16(r, &i) != 0)) {
+			return -1;
+		}
+#ifdef KV5M_ADDRESS
+		creds->addresses[u]->magic = KV5M_ADDRESS;
+#endif
+		creds->addresses[u]->addrtype = i;
+		if (credblob_get_counted(r, &data,
+					 &creds->addresses[u]->length) != 0) {
+			return -1;
+		}
+		creds->addresses[u]->contents = data;
+	}
+
+	/* Authorization data. */
+	if ((credblob_get_u32(r, &count) != 0) ||
+	    (count > (r->length - r->used) / 6)) {
+		return -1;
+	}
+	if (count > 0) {
+		creds->authdata = calloc(count + 1,
+					 sizeof(creds->authdata[0]));
+		if (creds->authdata == NULL) {
+			return -1;
+		}
+	}
+	for (u = 0; u < count; u++) {
+		creds->authdata[u] = calloc(1, sizeof(*creds->authdata[u]));
+		if ((creds->authdata[u] == NULL) ||
+		    (credblob_get_u16(r, &i) != 0)) {
+			return -1;
+		}
+#ifdef KV5M_AUTHDATA
+		creds->authdata[u]->magic = KV5M_AUTHDATA;
+#endif
+		creds->authdata[u]->ad_type = i;
+		if (credblob_get_counted(r, &data,
+					 &creds->authdata[u]->length) != 0) {
+			return -1;
+		}
+		creds->authdata[u]->contents = data;
+	}
+
+	/* Tickets. */
+#ifdef KV5M_DATA
+	creds->ticket.magic = KV5M_DATA;
+	creds->second_ticket.magic = KV5M_DATA;
+#endif
+	if (credblob_get_counted(r, &data, &creds->ticket.length) != 0) {
+		return -1;
+	}
+	creds->ticket.data = data;
+	if (credblob_get_counted(r, &data,
+				 &creds->second_ticket.length) != 0) {
+		return -1;
+	}
+	creds->second_ticket.data = data;
+	return 0;
+}
+
+/* Decode the first credential in the blob.  On success, the caller should
+ * free the result using krb5_free_cred_contents(). */
+int
+_pam_krb5_credblob_decode(const unsigned char *blob, size_t length,
+			  krb5_creds *creds)
+{
+	struct credblob_reader r;
+	memset(&r, 0, sizeof(r));
+	r.buf = blob;
+	r.length = length;
+	memset(creds, 0, sizeof(*creds));
+	if (credblob_get_creds(&r, creds) != 0) {
+		credblob_free_creds(creds);
+		return -1;
+	}
+	return 0;
+}
+
+#else
+
+size_t
+_pam_krb5_credblob_length(krb5_creds *creds)
+{
+	return 0;
+}
+
+int
+_pam_krb5_credblob_encode(krb5_creds *creds,
+			  unsigned char *blob, size_t length)
+{
+	return -1;
+}
+
+int
+_pam_krb5_credblob_decode(const unsigned char *blob, size_t length,
+			  krb5_creds *creds)
+{
+	return -1;
+}
+
+#endif
@@ -0,0 +1,378 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
+#include <limits.h>
+#include <stdio.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#include KRB5_H
+
+#include "cachedir.h"
+#include "log.h"
+#include "v5.h"
+#include "k5lcache.h"
+
+/* Each remembered .k5login file gets a record file of its own, named for
+ * the slot which its path hashes to, so that the directory never holds
+ * more than "k5login_cache_size" of them.  A record holds the identity of
+ * the file it was made from, the file's name, and the unparsed forms of
+ * each of the principal names which were listed in it.  Records are
+ * replaced with rename(), so readers don't need to take locks.  Integers
+ * are stored in host byte order, because records are never shared between
+ * hosts. */
+#define K5LCACHE_PREFIX		"k5login_"
+#define K5LCACHE_MAGIC		0x504b354c
+#define K5LCACHE_VERSION	1
+#define K5LCACHE_MAX_SLOTS	0x10000
+
+struct k5lcache_header {
+	uint32_t magic, version;
+	uint64_t dev, ino, size;
+	int64_t mtime, mtime_nsec;
+	uint32_t owner, path_len, count, data_len;
+};
+
+static long long
+k5lcache_nsec(const struct stat *st)
+{
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+	return st->st_mtim.tv_nsec;
+#else
+	return 0;
+#endif
+}
+
+/* libkrb5 won't use a .k5login file which belongs to someone other than
+ * the user or root, so we won't either. */
+static int
+k5lcache_file_ok(const struct stat *st, uid_t owner)
+{
+	return S_ISREG(st->st_mode) &&
+	       ((st->st_uid == owner) || (st->st_uid == 0)) &&
+	       (st->st_size <= PAM_KRB5_K5LCACHE_DATA_MAX);
+}
+
+static int
+k5lcache_record_path(const char *dir, const char *path, unsigned int slots,
+		     char *record, size_t size)
+{
+	unsigned int slot;
+
+	slot = _pam_krb5_cachedir_hash(path) % slots;
+	if (snprintf(record, size, "%s/" K5LCACHE_PREFIX "%04x",
+		     dir, slot) >= (int) size) {
+		return -1;
+	}
+	return 0;
+}
+
+static ssize_t
+k5lcache_read(int fd, char *buf, size_t len)
+{
+	size_t done;
+	ssize_t i;
+
+	done = 0;
+	while (done < len) {
+		i = read(fd, buf + done, len - done);
+		if (i == 0) {
+			break;
+		}
+		if (i < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		done += i;
+	}
+	return done;
+}
+
+/* Read a record, if we have one for "path", and check that it matches the
+ * file as it is now.  Returns the record's contents, or NULL. */
+static char *
+k5lcache_load(const char *dir, const char *path, const struct stat *st,
+	      unsigned int slots, struct k5lcache_header *header)
+{
+	struct stat rst;
+	char record[PATH_MAX], *buf;
+	size_t len;
+	int fd, flags;
+
+	if (k5lcache_record_path(dir, path, slots,
+				 record, sizeof(record)) != 0) {
+		return NULL;
+	}
+	flags = O_RDONLY;
+#ifdef O_NOFOLLOW
+	flags |= O_NOFOLLOW;
+#endif
+	fd = open(record, flags);
+	if (fd == -1) {
+		return NULL;
+	}
+	if ((fstat(fd, &rst) != 0) ||
+	    !S_ISREG(rst.st_mode) ||
+	    ((rst.st_uid != 0) && (rst.st_uid != geteuid())) ||
+	    ((rst.st_mode & (S_IWGRP | S_IWOTH)) != 0) ||
+	    (k5lcache_read(fd, (char *) header,
+			   sizeof(*header)) != sizeof(*header)) ||
+	    (header->magic != K5LCACHE_MAGIC) ||
+	    (header->version != K5LCACHE_VERSION) ||
+	    (header->dev != (uint64_t) st->st_dev) ||
+	    (header->ino != (uint64_t) st->st_ino) ||
+	    (header->size != (uint64_t) st->st_size) ||
+	    (header->mtime != (int64_t) st->st_mtime) ||
+	    (header->mtime_nsec != (int64_t) k5lcache_nsec(st)) ||
+	    (header->owner != (uint32_t) st->st_uid) ||
+	    (header->path_len != strlen(path)) ||
+	    (header->data_len > PAM_KRB5_K5LCACHE_DATA_MAX) ||
+	    (rst.st_size != (off_t) (sizeof(*header) + header->path_len +
+				     header->data_len))) {
+		close(fd);
+		return NULL;
+	}
+	len = header->path_len + header->data_len;
+	buf = malloc(len + 1);
+	if (buf == NULL) {
+		close(fd);
+		return NULL;
+	}
+	if ((k5lcache_read(fd, buf, len) != (ssize_t) len) ||
+	    (memcmp(buf, path, header->path_len) != 0) ||
+	    ((header->data_len > 0) && (buf[len - 1] != '\0'))) {
+		free(buf);
+		close(fd);
+		return NULL;
+	}
+	buf[len] = '\0';
+	close(fd);
+	return buf;
+}
+
+/* Check if we remember "path", in its current state, listing "principal".
+ * Returns 1 if it does, 0 if it doesn't, and -1 if we don't know. */
+int
+_pam_krb5_k5lcache_check(const char *dir, const char *path, uid_t owner,
+			 const char *principal, unsigned int size,
+			 int verbose)
+{
+	struct k5lcache_header header;
+	struct stat st;
+	char *buf, *p, *end;
+	uint32_t i;
+	int ret;
+
+	if ((size == 0) || !_pam_krb5_cachedir_ok(dir, 0) ||
+	    (stat(path, &st) != 0) || !k5lcache_file_ok(&st, owner)) {
+		return -1;
+	}
+	if (size > K5LCACHE_MAX_SLOTS) {
+		size = K5LCACHE_MAX_SLOTS;
+	}
+	buf = k5lcache_load(dir, path, &st, size, &header);
+	if (buf == NULL) {
+		if (verbose) {
+			debug("no usable cached copy of \"%s\"", path);
+		}
+		return -1;
+	}
+	ret = 0;
+	p = buf + header.path_len;
+	end = p + header.data_len;
+	for (i = 0; (i < header.count) && (p < end); i++) {
+		if (strcmp(p, principal) == 0) {
+			ret = 1;
+			break;
+		}
+		p += strlen(p) + 1;
+	}
+	free(buf);
+	return ret;
+}
+
+/* Parse "path", which the caller has opened as "file_fd" using the user's
+ * IDs, the way libkrb5 would and remember the principal names which it
+ * lists.  Files which were modified in the last couple of seconds are left
+ * alone, since they might change again without their timestamps changing.
+ * The caller closes "file_fd". */
+int
+_pam_krb5_k5lcache_store(krb5_context ctx, const char *dir,
+			 const char *path, int file_fd, uid_t owner,
+			 unsigned int size, int verbose)
+{
+	struct k5lcache_header header;
+	struct stat st;
+	krb5_principal princ;
+	char record[PATH_MAX], tmp[PATH_MAX], *buf, *data, *line, *next;
+	char *unparsed;
+	size_t data_len, len;
+	ssize_t n;
+	int fd, ret;
+
+	if ((size == 0) || !_pam_krb5_cachedir_ok(dir, 1)) {
+		return -1;
+	}
+	if (size > K5LCACHE_MAX_SLOTS) {
+		size = K5LCACHE_MAX_SLOTS;
+	}
+	if ((k5lcache_record_path(dir, path, size,
+				  record, sizeof(record)) != 0) ||
+	    (snprintf(tmp, sizeof(tmp), "%s.XXXXXX",
+		      record) >= (int) sizeof(tmp))) {
+		return -1;
+	}
+
+	/* Read the file. */
+	if ((file_fd == -1) ||
+	    (fstat(file_fd, &st) != 0) || !k5lcache_file_ok(&st, owner) ||
+	    (st.st_mtime + 2 > time(NULL))) {
+		return -1;
+	}
+	buf = malloc(st.st_size + 1);
+	if (buf == NULL) {
+		return -1;
+	}
+	n = k5lcache_read(file_fd, buf, st.st_size);
+	if (n != st.st_size) {
+		free(buf);
+		return -1;
+	}
+	buf[n] = '\0';
+
+	/* Parse it the way krb5_kuserok() does: one principal name per line,
+	 * with only the newline removed.  If there's anything it would read
+	 * differently (a NUL, or a line which it would truncate) or which it
+	 * would skip (a line which doesn't parse), don't try to remember the
+	 * file's contents. */
+	if (memchr(buf, '\0', n) != NULL) {
+		free(buf);
+		return -1;
+	}
+	data = malloc(PAM_KRB5_K5LCACHE_DATA_MAX);
+	if (data == NULL) {
+		free(buf);
+		return -1;
+	}
+	memset(&header, 0, sizeof(header));
+	data_len = 0;
+	ret = 0;
+	for (line = buf; (ret == 0) && (*line != '\0'); line = next) {
+		next = strchr(line, '\n');
+		if (next != NULL) {
+			*next++ = '\0';
+		} else {
+			next = line + strlen(line);
+		}
+		if ((strlen(line) >= BUFSIZ - 1) ||
+		    (krb5_parse_name(ctx, line, &princ) != 0)) {
+			ret = -1;
+			break;
+		}
+		unparsed = NULL;
+		if (krb5_unparse_name(ctx, princ, &unparsed) == 0) {
+			len = strlen(unparsed) + 1;
+			if (data_len + len <= PAM_KRB5_K5LCACHE_DATA_MAX) {
+				memcpy(data + data_len, unparsed, len);
+				data_len += len;
+				header.count++;
+			} else {
+				ret = -1;
+			}
+			v5_free_unparsed_name(ctx, unparsed);
+		} else {
+			ret = -1;
+		}
+		krb5_free_principal(ctx, princ);
+	}
+	free(buf);
+	if (ret != 0) {
+		free(data);
+		return -1;
+	}
+
+	/* Write the record and move it into place. */
+	header.magic = K5LCACHE_MAGIC;
+	header.version = K5LCACHE_VERSION;
+	header.dev = st.st_dev;
+	header.ino = st.st_ino;
+	header.size = st.st_size;
+	header.mtime = st.st_mtime;
+	header.mtime_nsec = k5lcache_nsec(&st);
+	header.owner = st.st_uid;
+	header.path_len = strlen(path);
+	header.data_len = data_len;
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		free(data);
+		return -1;
+	}
+	if ((fchmod(fd, S_IRUSR | S_IWUSR) != 0) ||
+	    (write(fd, &header, sizeof(header)) != sizeof(header)) ||
+	    (write(fd, path, header.path_len) != (ssize_t) header.path_len) ||
+	    (write(fd, data, data_len) != (ssize_t) data_len)) {
+		ret = -1;
+	}
+	if (close(fd) != 0) {
+		ret = -1;
+	}
+	free(data);
+	if ((ret != 0) || (rename(tmp, record) != 0)) {
+		unlink(tmp);
+		return -1;
+	}
+	if (verbose) {
+		debug("remembering %u principal names listed in \"%s\"",
+		      header.count, path);
+	}
+	return 0;
+}
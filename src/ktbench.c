@@ -0,0 +1,322 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/time.h>
+#ifdef HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
+#include <limits.h>
+#include <stdio.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#include KRB5_H
+
+#include "ktindex.h"
+#include "logstdio.h"
+#include "options.h"
+
+/* Measure how long it takes to find a service's keys in keytabs of various
+ * sizes, using libkrb5's keytab iterator and lookup function, and using
+ * our own index of the mapped file.  The service we look for is the last
+ * one in the file, so that everything has to read all of it. */
+
+extern char *log_progname;
+
+#define BENCH_REALM "EXAMPLE.COM"
+#define BENCH_TARGET "host/bench.example.com"
+
+static void
+put_u16(FILE *fp, unsigned int u)
+{
+	fputc((u >> 8) & 0xff, fp);
+	fputc(u & 0xff, fp);
+}
+
+static void
+put_u32(FILE *fp, uint32_t u)
+{
+	put_u16(fp, u >> 16);
+	put_u16(fp, u & 0xffff);
+}
+
+static void
+put_string(FILE *fp, const char *s)
+{
+	put_u16(fp, strlen(s));
+	fputs(s, fp);
+}
+
+/* Write a version 2 keytab with "entries" two-component keys in it. */
+static int
+write_keytab(const char *path, int entries)
+{
+	FILE *fp;
+	char service[64], host[64];
+	int i, j;
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		return -1;
+	}
+	fputc(5, fp);
+	fputc(2, fp);
+	for (i = 0; i < entries; i++) {
+		if (i < entries - 1) {
+			snprintf(service, sizeof(service), "service%d", i);
+			snprintf(host, sizeof(host), "host%d.example.com", i);
+		} else {
+			snprintf(service, sizeof(service), "%.*s",
+				 (int) strcspn(BENCH_TARGET, "/"),
+				 BENCH_TARGET);
+			snprintf(host, sizeof(host), "%s",
+				 strchr(BENCH_TARGET, '/') + 1);
+		}
+		put_u32(fp, 2 + 2 + strlen(BENCH_REALM) +
+			    2 + strlen(service) + 2 + strlen(host) +
+			    4 + 4 + 1 + 2 + 2 + 32 + 4);
+		put_u16(fp, 2);
+		put_string(fp, BENCH_REALM);
+		put_string(fp, service);
+		put_string(fp, host);
+		put_u32(fp, KRB5_NT_SRV_HST);
+		put_u32(fp, 1300000000);
+		fputc(1, fp);
+		put_u16(fp, 18);
+		put_u16(fp, 32);
+		for (j = 0; j < 32; j++) {
+			fputc(i + j, fp);
+		}
+		put_u32(fp, 1);
+	}
+	return fclose(fp);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Walk the whole keytab using the library, the way service selection
+ * used to. */
+static int
+scan_library(krb5_context ctx, const char *ktname, krb5_principal target)
+{
+	krb5_keytab keytab;
+	krb5_kt_cursor cursor;
+	krb5_keytab_entry entry;
+	int found;
+
+	found = 0;
+	if (krb5_kt_resolve(ctx, ktname, &keytab) != 0) {
+		return -1;
+	}
+	if (krb5_kt_start_seq_get(ctx, keytab, &cursor) != 0) {
+		krb5_kt_close(ctx, keytab);
+		return -1;
+	}
+	while (krb5_kt_next_entry(ctx, keytab, &entry, &cursor) == 0) {
+		if (krb5_principal_compare(ctx, entry.principal, target)) {
+			found++;
+		}
+		krb5_free_keytab_entry_contents(ctx, &entry);
+	}
+	krb5_kt_end_seq_get(ctx, keytab, &cursor);
+	krb5_kt_close(ctx, keytab);
+	return found;
+}
+
+/* Look up the key using the library, the way verification does. */
+static int
+lookup_library(krb5_context ctx, const char *ktname, krb5_principal target)
+{
+	krb5_keytab keytab;
+	krb5_keytab_entry entry;
+	int found;
+
+	if (krb5_kt_resolve(ctx, ktname, &keytab) != 0) {
+		return -1;
+	}
+	found = 0;
+	if (krb5_kt_get_entry(ctx, keytab, target, 0, 0, &entry) == 0) {
+		krb5_free_keytab_entry_contents(ctx, &entry);
+		found = 1;
+	}
+	krb5_kt_close(ctx, keytab);
+	return found;
+}
+
+/* Map and index the keytab, then walk the index. */
+static int
+scan_index(const char *ktname, const char *target)
+{
+	struct _pam_krb5_ktindex *index;
+	const unsigned char *data;
+	const char *instance;
+	size_t i, length;
+	int found;
+
+	instance = target + strcspn(target, "/") + 1;
+	index = _pam_krb5_ktindex_open(ktname);
+	if (index == NULL) {
+		return -1;
+	}
+	found = 0;
+	for (i = 0; i < index->n_entries; i++) {
+		if (index->entries[i].n_components != 2) {
+			continue;
+		}
+		data = _pam_krb5_ktindex_realm(index, &index->entries[i],
+					       &length);
+		if ((length != strlen(BENCH_REALM)) ||
+		    (memcmp(data, BENCH_REALM, length) != 0)) {
+			continue;
+		}
+		data = _pam_krb5_ktindex_component(index, &index->entries[i],
+						   0, &length);
+		if ((length != strcspn(target, "/")) ||
+		    (memcmp(data, target, length) != 0)) {
+			continue;
+		}
+		data = _pam_krb5_ktindex_component(index, &index->entries[i],
+						   1, &length);
+		if ((length == strlen(instance)) &&
+		    (memcmp(data, instance, length) == 0)) {
+			found++;
+		}
+	}
+	_pam_krb5_ktindex_close(index);
+	return found;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int sizes[] = {10, 1000, 50000};
+	char path[] = "/tmp/ktbenchXXXXXX";
+	char ktname[PATH_MAX];
+	krb5_context ctx;
+	krb5_principal target;
+	double start, scan_time, lookup_time, index_time;
+	int c, fd, i, j, iterations, scanned, looked_up, indexed;
+
+	log_progname = "ktbench";
+	memset(&log_options, 0, sizeof(log_options));
+	iterations = 20;
+	while ((c = getopt(argc, argv, "n:v")) != -1) {
+		switch (c) {
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'v':
+			log_options.debug++;
+			break;
+		default:
+			printf("%s: [-v] [-n iterations]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (iterations < 1) {
+		fprintf(stderr, "%s: counts must be positive\n", argv[0]);
+		return 1;
+	}
+	if (krb5_init_context(&ctx) != 0) {
+		fprintf(stderr, "error initializing Kerberos\n");
+		return 1;
+	}
+	if (krb5_parse_name(ctx, BENCH_TARGET "@" BENCH_REALM,
+			    &target) != 0) {
+		fprintf(stderr, "error parsing principal name\n");
+		return 1;
+	}
+	fd = mkstemp(path);
+	if (fd == -1) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	snprintf(ktname, sizeof(ktname), "FILE:%s", path);
+
+	printf("%8s %14s %14s %14s\n",
+	       "entries", "iterate", "get_entry", "index");
+	for (i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++) {
+		if (write_keytab(path, sizes[i]) != 0) {
+			perror(path);
+			unlink(path);
+			return 1;
+		}
+		scanned = looked_up = indexed = 0;
+		start = now();
+		for (j = 0; j < iterations; j++) {
+			scanned = scan_library(ctx, ktname, target);
+		}
+		scan_time = (now() - start) / iterations;
+		start = now();
+		for (j = 0; j < iterations; j++) {
+			looked_up = lookup_library(ctx, ktname, target);
+		}
+		lookup_time = (now() - start) / iterations;
+		start = now();
+		for (j = 0; j < iterations; j++) {
+			indexed = scan_index(ktname, BENCH_TARGET);
+		}
+		index_time = (now() - start) / iterations;
+		printf("%8d %11.1f us %11.1f us %11.1f us\n", sizes[i],
+		       scan_time * 1000000, lookup_time * 1000000,
+		       index_time * 1000000);
+		if ((scanned != 1) || (looked_up != 1) || (indexed != 1)) {
+			fprintf(stderr, "lookups disagree (%d/%d/%d)\n",
+				scanned, looked_up, indexed);
+			unlink(path);
+			return 1;
+		}
+	}
+	unlink(path);
+	krb5_free_principal(ctx, target);
+	krb5_free_context(ctx);
+	return 0;
+}
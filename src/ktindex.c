@@ -0,0 +1,380 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cachedir.h"
+#include "ktindex.h"
+
+/* A read-only view of a version 2 FILE keytab, which saves us from having
+ * libkrb5 decode, allocate, and free every entry in the file every time we
+ * want to look at one of them.  The format is a two-byte version number
+ * followed by records, each of which is a signed big-endian length and
+ * then that many bytes of entry data, or a hole if the length is
+ * negative:
+ *   uint16 number of components
+ *   uint16-counted realm
+ *   uint16-counted components
+ *   uint32 name type
+ *   uint32 timestamp
+ *   uint8 key version number
+ *   uint16 key type, uint16-counted key
+ *   [uint32 key version number, which overrides the first if non-zero]
+ */
+#define KTINDEX_MAX_SIZE	0x7fffffff
+
+static uint16_t
+ktindex_u16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static uint32_t
+ktindex_u32(const unsigned char *p)
+{
+	return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* Parse one entry which occupies [start, end), or return -1 if it's
+ * malformed. */
+static int
+ktindex_parse(const unsigned char *map, size_t start, size_t end,
+	      struct _pam_krb5_ktindex_entry *entry)
+{
+	size_t p, length;
+	unsigned int i;
+	uint32_t hash, kvno;
+
+	memset(entry, 0, sizeof(*entry));
+	p = start;
+	if (end - p < 2) {
+		return -1;
+	}
+	entry->n_components = ktindex_u16(map + p);
+	p += 2;
+	entry->principal = p;
+	hash = PAM_KRB5_CACHEDIR_HASH_INIT;
+	for (i = 0; i <= entry->n_components; i++) {
+		if (end - p < 2) {
+			return -1;
+		}
+		length = ktindex_u16(map + p);
+		if (end - p - 2 < length) {
+			return -1;
+		}
+		/* Hash the lengths and contents. */
+		hash = _pam_krb5_cachedir_hash_bytes(hash, map + p,
+						     length + 2);
+		p += length + 2;
+	}
+	entry->hash = hash;
+	if (end - p < 4 + 4 + 1 + 2 + 2) {
+		return -1;
+	}
+	entry->name_type = ktindex_u32(map + p);
+	p += 4;
+	entry->timestamp = ktindex_u32(map + p);
+	p += 4;
+	entry->kvno = map[p];
+	p += 1;
+	entry->enctype = (int16_t) ktindex_u16(map + p);
+	p += 2;
+	entry->key_length = ktindex_u16(map + p);
+	p += 2;
+	if (end - p < entry->key_length) {
+		return -1;
+	}
+	entry->key = p;
+	p += entry->key_length;
+	if (end - p >= 4) {
+		kvno = ktindex_u32(map + p);
+		if (kvno != 0) {
+			entry->kvno = kvno;
+		}
+	}
+	return 0;
+}
+
+static int
+ktindex_build(struct _pam_krb5_ktindex *index)
+{
+	struct _pam_krb5_ktindex_entry *tmp;
+	size_t p, n_alloc;
+	int32_t length;
+
+	n_alloc = 0;
+	p = 2;
+	while (index->size - p >= 4) {
+		length = (int32_t) ktindex_u32(index->map + p);
+		p += 4;
+		if (length == 0) {
+			/* The rest of the file is unused. */
+			break;
+		}
+		if (length < 0) {
+			/* A hole left by a deleted entry. */
+			if ((size_t) -(int64_t) length > index->size - p) {
+				return -1;
+			}
+			p += -(int64_t) length;
+			continue;
+		}
+		if ((size_t) length > index->size - p) {
+			return -1;
+		}
+		if (index->n_entries >= n_alloc) {
+			n_alloc = n_alloc ? n_alloc * 2 : 32;
+			tmp = realloc(index->entries, n_alloc * sizeof(*tmp));
+			if (tmp == NULL) {
+				return -1;
+			}
+			index->entries = tmp;
+		}
+		if (ktindex_parse(index->map, p, p + length,
+				  &index->entries[index->n_entries]) != 0) {
+			return -1;
+		}
+		index->n_entries++;
+		p += length;
+	}
+	return 0;
+}
+
+/* Map and index a keytab, if it's a file which we can read. */
+struct _pam_krb5_ktindex *
+_pam_krb5_ktindex_open(const char *ktname)
+{
+	struct _pam_krb5_ktindex *index;
+	struct stat st;
+	const char *path;
+	void *map;
+	int fd;
+
+	if (ktname == NULL) {
+		return NULL;
+	}
+	if (strncmp(ktname, "FILE:", 5) == 0) {
+		path = ktname + 5;
+	} else if (strncmp(ktname, "WRFILE:", 7) == 0) {
+		path = ktname + 7;
+	} else {
+		path = ktname;
+	}
+	if (path[0] != '/') {
+		return NULL;
+	}
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+	if ((fstat(fd, &st) != 0) ||
+	    !S_ISREG(st.st_mode) ||
+	    (st.st_size < 2) ||
+	    (st.st_size > KTINDEX_MAX_SIZE)) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+	index = malloc(sizeof(*index));
+	if (index == NULL) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	memset(index, 0, sizeof(*index));
+	index->map = map;
+	index->size = st.st_size;
+	if ((index->map[0] != 5) || (index->map[1] != 2) ||
+	    (ktindex_build(index) != 0)) {
+		_pam_krb5_ktindex_close(index);
+		return NULL;
+	}
+	return index;
+}
+
+void
+_pam_krb5_ktindex_close(struct _pam_krb5_ktindex *index)
+{
+	if (index != NULL) {
+		munmap((void *) index->map, index->size);
+		free(index->entries);
+		free(index);
+	}
+}
+
+const unsigned char *
+_pam_krb5_ktindex_realm(struct _pam_krb5_ktindex *index,
+			struct _pam_krb5_ktindex_entry *entry,
+			size_t *length)
+{
+	*length = ktindex_u16(index->map + entry->principal);
+	return index->map + entry->principal + 2;
+}
+
+const unsigned char *
+_pam_krb5_ktindex_component(struct _pam_krb5_ktindex *index,
+			    struct _pam_krb5_ktindex_entry *entry,
+			    unsigned int i, size_t *length)
+{
+	size_t p;
+
+	if (i >= entry->n_components) {
+		*length = 0;
+		return NULL;
+	}
+	/* Skip over the realm and any earlier components. */
+	p = entry->principal;
+	for (i++; i > 0; i--) {
+		p += 2 + ktindex_u16(index->map + p);
+	}
+	*length = ktindex_u16(index->map + p);
+	return index->map + p + 2;
+}
+
+const unsigned char *
+_pam_krb5_ktindex_key(struct _pam_krb5_ktindex *index,
+		      struct _pam_krb5_ktindex_entry *entry,
+		      size_t *length)
+{
+	*length = entry->key_length;
+	return index->map + entry->key;
+}
+
+int
+_pam_krb5_ktindex_same_principal(struct _pam_krb5_ktindex *index,
+				 struct _pam_krb5_ktindex_entry *a,
+				 struct _pam_krb5_ktindex_entry *b)
+{
+	size_t length, p;
+	unsigned int i;
+
+	if ((a->hash != b->hash) || (a->n_components != b->n_components)) {
+		return 0;
+	}
+	if (a->principal == b->principal) {
+		return 1;
+	}
+	length = 0;
+	p = a->principal;
+	for (i = 0; i <= a->n_components; i++) {
+		length += 2 + ktindex_u16(index->map + p + length);
+	}
+	return memcmp(index->map + a->principal,
+		      index->map + b->principal, length) == 0;
+}
+
+/* Produce a name which krb5_parse_name() will turn back into this entry's
+ * principal. */
+char *
+_pam_krb5_ktindex_unparse(struct _pam_krb5_ktindex *index,
+			  struct _pam_krb5_ktindex_entry *entry)
+{
+	const unsigned char *data;
+	size_t length, i, j, size;
+	unsigned int c;
+	char *name, *p;
+
+	size = 1;
+	for (c = 0; c <= entry->n_components; c++) {
+		if (c < entry->n_components) {
+			_pam_krb5_ktindex_component(index, entry, c, &length);
+		} else {
+			_pam_krb5_ktindex_realm(index, entry, &length);
+		}
+		size += 2 * length + 1;
+	}
+	name = malloc(size);
+	if (name == NULL) {
+		return NULL;
+	}
+	p = name;
+	for (c = 0; c <= entry->n_components; c++) {
+		if (c < entry->n_components) {
+			data = _pam_krb5_ktindex_component(index, entry, c,
+							   &length);
+			if (c > 0) {
+				*p++ = '/';
+			}
+		} else {
+			data = _pam_krb5_ktindex_realm(index, entry, &length);
+			*p++ = '@';
+		}
+		for (i = 0; i < length; i++) {
+			j = 0;
+			switch (data[i]) {
+			case '/':
+			case '@':
+			case '\\':
+				j = data[i];
+				break;
+			case '\0':
+				j = '0';
+				break;
+			case '\n':
+				j = 'n';
+				break;
+			case '\t':
+				j = 't';
+				break;
+			case '\b':
+				j = 'b';
+				break;
+			}
+			if (j != 0) {
+				*p++ = '\\';
+				*p++ = j;
+			} else {
+				*p++ = data[i];
+			}
+		}
+	}
+	*p = '\0';
+	return name;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef pam_krb5_ktindex_h
+#define pam_krb5_ktindex_h
+
+/* One key in a keytab file.  Offsets are into the mapped file. */
+struct _pam_krb5_ktindex_entry {
+	uint32_t principal;		/* the realm, then the components */
+	uint32_t hash;			/* of the principal name */
+	uint16_t n_components;
+	uint16_t key_length;
+	uint32_t key;
+	uint32_t name_type, timestamp, kvno;
+	int32_t enctype;
+};
+
+struct _pam_krb5_ktindex {
+	const unsigned char *map;
+	size_t size;
+	struct _pam_krb5_ktindex_entry *entries;
+	size_t n_entries;
+};
+
+struct _pam_krb5_ktindex *_pam_krb5_ktindex_open(const char *ktname);
+void _pam_krb5_ktindex_close(struct _pam_krb5_ktindex *index);
+const unsigned char *_pam_krb5_ktindex_realm(struct _pam_krb5_ktindex *index,
+					     struct _pam_krb5_ktindex_entry *entry,
+					     size_t *length);
+const unsigned char *_pam_krb5_ktindex_component(struct _pam_krb5_ktindex *index,
+						 struct _pam_krb5_ktindex_entry *entry,
+						 unsigned int i,
+						 size_t *length);
+const unsigned char *_pam_krb5_ktindex_key(struct _pam_krb5_ktindex *index,
+					   struct _pam_krb5_ktindex_entry *entry,
+					   size_t *length);
+int _pam_krb5_ktindex_same_principal(struct _pam_krb5_ktindex *index,
+				     struct _pam_krb5_ktindex_entry *a,
+				     struct _pam_krb5_ktindex_entry *b);
+char *_pam_krb5_ktindex_unparse(struct _pam_krb5_ktindex *index,
+				struct _pam_krb5_ktindex_entry *entry);
+
+#endif
@@ -35,7 +35,16 @@
 #include <sys/types.h>
 #include <sys/select.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
+#if defined(HAVE_SYS_VFS_H) && defined(__linux__)
+#include <sys/vfs.h>
+#define KUSEROK_STATFS_MAGIC
+#elif defined(HAVE_SYS_MOUNT_H)
+#include <sys/param.h>
+#include <sys/mount.h>
+#ifdef MNT_LOCAL
+#define KUSEROK_MNT_LOCAL
+#endif
+#endif
 #include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
@@ -54,6 +63,11 @@
 #endif
 
 #include KRB5_H
+#if defined(HAVE_PROFILE_H) && defined(HAVE_KRB5_GET_PROFILE) && \
+    defined(HAVE_PROFILE_GET_VALUES)
+#include <profile.h>
+#define KUSEROK_PROFILE
+#endif
 #ifdef USE_KRB4
 #include KRB4_DES_H
 #include KRB4_KRB_H
@@ -63,8 +77,11 @@
 #endif
 
 #include "init.h"
+#include "k5lcache.h"
 #include "log.h"
 #include "options.h"
+#include "perms.h"
+#include "spawn.h"
 #include "stash.h"
 #include "storetmp.h"
 #include "tokens.h"
@@ -74,6 +91,302 @@
 
 #include "kuserok.h"
 
+/* The check itself. */
+static krb5_boolean
+kuserok_check(krb5_context ctx, struct _pam_krb5_options *options,
+	      struct _pam_krb5_user_info *userinfo, const char *user)
+{
+	krb5_boolean allowed;
+#ifdef HAVE_KRB5_ANAME_TO_LOCALNAME
+	krb5_error_code err;
+	char localname[PATH_MAX];
+#endif
+
+	allowed = krb5_kuserok(ctx, userinfo->principal_name, user);
+	if (options->debug) {
+		debug("krb5_kuserok() says %d", allowed);
+	}
+#ifdef HAVE_KRB5_ANAME_TO_LOCALNAME
+	if (!allowed && options->always_allow_localname) {
+		memset(&localname, '\0', sizeof(localname));
+		err = krb5_aname_to_localname(ctx, userinfo->principal_name,
+					      sizeof(localname), localname);
+		if (err != 0) {
+			if (options->debug) {
+				debug("krb5_aname_to_localname failed: %s",
+				      error_message(err));
+			}
+		} else {
+			if (strcmp(localname, user) == 0) {
+				if (options->debug) {
+					debug("krb5_aname_to_localname "
+					      "returned '%s' for '%s', "
+					      "allowing access", localname,
+					      userinfo->unparsed_name);
+				}
+				allowed = 1;
+			}
+		}
+	}
+#endif
+	return allowed;
+}
+
+/* Filesystems which we know keep their data on this host, so that we can
+ * read files in them without the user's credentials. */
+#ifdef KUSEROK_STATFS_MAGIC
+static const unsigned int kuserok_local_magic[] = {
+	0xEF53,		/* ext2, ext3, ext4 */
+	0x58465342,	/* xfs */
+	0x9123683E,	/* btrfs */
+	0x01021994,	/* tmpfs */
+	0x858458F6,	/* ramfs */
+	0x52654973,	/* reiserfs */
+	0x3153464A,	/* jfs */
+	0xF2F52010,	/* f2fs */
+	0x2FC12FC1,	/* zfs */
+	0xCA451A4E,	/* bcachefs */
+	0x794C7630,	/* overlayfs */
+};
+#define KUSEROK_OVERLAYFS_MAGIC 0x794C7630
+
+/* Undo the octal escaping of a field in /proc/self/mountinfo. */
+static void
+kuserok_mountinfo_unescape(char *field)
+{
+	char *p, *q;
+
+	for (p = q = field; *p != '\0'; p++) {
+		if ((p[0] == '\\') &&
+		    (p[1] >= '0') && (p[1] <= '3') &&
+		    (p[2] >= '0') && (p[2] <= '7') &&
+		    (p[3] >= '0') && (p[3] <= '7')) {
+			*q++ = ((p[1] - '0') << 6) | ((p[2] - '0') << 3) |
+			       (p[3] - '0');
+			p += 3;
+		} else {
+			*q++ = *p;
+		}
+	}
+	*q = '\0';
+}
+
+/* Find the superblock options of the filesystem mounted over "path", using
+ * the entry in /proc/self/mountinfo with the longest mount point which
+ * contains it.  When mounts are stacked, the last one listed is the one
+ * which is visible. */
+static int
+kuserok_mount_options(const char *path, char *options, size_t size)
+{
+	FILE *fp;
+	char resolved[PATH_MAX], line[LINE_MAX], *fields[6], *p, *sep;
+	size_t best, len;
+	int i, found;
+
+	if (realpath(path, resolved) == NULL) {
+		return -1;
+	}
+	fp = fopen("/proc/self/mountinfo", "r");
+	if (fp == NULL) {
+		return -1;
+	}
+	best = 0;
+	found = 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strchr(line, '\n') == NULL) {
+			continue;
+		}
+		line[strcspn(line, "\n")] = '\0';
+		/* "ID PARENT MAJ:MIN ROOT MOUNTPOINT OPTIONS [TAGS...] - TYPE
+		 * SOURCE SUPEROPTIONS" */
+		p = line;
+		for (i = 0; (i < 5) && (p != NULL); i++) {
+			fields[i] = p;
+			p = strchr(p, ' ');
+			if (p != NULL) {
+				*p++ = '\0';
+			}
+		}
+		sep = (p != NULL) ? strstr(p, " - ") : NULL;
+		if (sep == NULL) {
+			continue;
+		}
+		sep = strrchr(sep + 3, ' ');
+		if (sep == NULL) {
+			continue;
+		}
+		fields[5] = sep + 1;
+		kuserok_mountinfo_unescape(fields[4]);
+		len = strlen(fields[4]);
+		if ((strncmp(resolved, fields[4], len) != 0) ||
+		    ((resolved[len] != '\0') && (resolved[len] != '/') &&
+		     (len != 1))) {
+			continue;
+		}
+		if (len >= best) {
+			best = len;
+			found = (snprintf(options, size, "%s",
+					  fields[5]) < (int) size);
+		}
+	}
+	fclose(fp);
+	return found ? 0 : -1;
+}
+#endif
+
+static int kuserok_path_is_local_depth(const char *path, int depth);
+
+#ifdef KUSEROK_STATFS_MAGIC
+/* An overlay filesystem is only as local as the directories it's built from,
+ * which are named in its mount options. */
+static int
+kuserok_overlay_is_local(const char *path, int depth)
+{
+	char options[LINE_MAX], *option, *dir, *next, *save;
+	int layers;
+
+	if (kuserok_mount_options(path, options, sizeof(options)) != 0) {
+		return 0;
+	}
+	/* Don't try to make sense of escaped separators. */
+	if (strchr(options, '\\') != NULL) {
+		return 0;
+	}
+	layers = 0;
+	for (option = strtok_r(options, ",", &save);
+	     option != NULL;
+	     option = strtok_r(NULL, ",", &save)) {
+		if ((strncmp(option, "lowerdir=", 9) != 0) &&
+		    (strncmp(option, "upperdir=", 9) != 0)) {
+			continue;
+		}
+		dir = option + 9;
+		for (; dir != NULL; dir = next) {
+			next = strchr(dir, ':');
+			if (next != NULL) {
+				*next++ = '\0';
+			}
+			if ((strlen(dir) == 0) ||
+			    !kuserok_path_is_local_depth(dir, depth + 1)) {
+				return 0;
+			}
+			layers++;
+		}
+	}
+	return layers > 0;
+}
+#endif
+
+static int
+kuserok_path_is_local_depth(const char *path, int depth)
+{
+#if defined(KUSEROK_STATFS_MAGIC) || defined(KUSEROK_MNT_LOCAL)
+	struct statfs sfs;
+	unsigned int i;
+
+	if ((depth > 4) || (statfs(path, &sfs) != 0)) {
+		return 0;
+	}
+#ifdef KUSEROK_STATFS_MAGIC
+	for (i = 0;
+	     i < sizeof(kuserok_local_magic) / sizeof(kuserok_local_magic[0]);
+	     i++) {
+		if ((unsigned int) sfs.f_type == kuserok_local_magic[i]) {
+			if ((unsigned int) sfs.f_type ==
+			    KUSEROK_OVERLAYFS_MAGIC) {
+				return kuserok_overlay_is_local(path, depth);
+			}
+			return 1;
+		}
+	}
+	return 0;
+#else
+	return (sfs.f_flags & MNT_LOCAL) != 0;
+#endif
+#else
+	return 0;
+#endif
+}
+
+/* Decide if the filesystem holding "path" keeps its data on this host.  On
+ * Linux, statfs() reports the type of the filesystem itself, so bind mounts
+ * are classified by what they're bound from, and FUSE filesystems (whatever
+ * they're backed by) are never treated as local.  Overlays are classified by
+ * their layers, which we find in /proc/self/mountinfo. */
+static int
+kuserok_path_is_local(const char *path)
+{
+	return kuserok_path_is_local_depth(path, 0);
+}
+
+/* Figure out which file krb5_kuserok() will read: the user's .k5login,
+ * unless libkrb5 has been told to look for it somewhere else. */
+static int
+kuserok_file(krb5_context ctx, struct _pam_krb5_user_info *userinfo,
+	     const char *user, char *path, size_t size)
+{
+#ifdef KUSEROK_PROFILE
+	profile_t profile;
+	const char *names[3];
+	char **values;
+	int ret;
+
+	if (krb5_get_profile(ctx, &profile) == 0) {
+		names[0] = "libdefaults";
+		names[1] = "k5login_directory";
+		names[2] = NULL;
+		values = NULL;
+		ret = 1;
+		if ((profile_get_values(profile, names, &values) == 0) &&
+		    (values != NULL) && (values[0] != NULL)) {
+			ret = (snprintf(path, size, "%s/%s",
+					values[0], user) < (int) size) ? 0 : -1;
+		}
+		if (values != NULL) {
+			profile_free_list(values);
+		}
+		profile_release(profile);
+		if (ret != 1) {
+			return ret;
+		}
+	}
+#endif
+	if ((userinfo->homedir == NULL) ||
+	    (snprintf(path, size, "%s/.k5login",
+		      userinfo->homedir) >= (int) size)) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Decide if "path" is on a local filesystem.  If it is, we don't need to
+ * do anything special to be able to read it.  We look at the file if it's
+ * there (it may be a link to somewhere else), and otherwise at the
+ * directory which would hold it. */
+static int
+kuserok_is_local(const char *path)
+{
+	char dir[PATH_MAX], *p;
+	struct stat st;
+
+	if (stat(path, &st) == 0) {
+		return kuserok_path_is_local(path);
+	}
+	if (strlen(path) >= sizeof(dir)) {
+		return 0;
+	}
+	strcpy(dir, path);
+	p = strrchr(dir, '/');
+	if (p == NULL) {
+		return 0;
+	}
+	p[(p == dir) ? 1 : 0] = '\0';
+	if (stat(dir, &st) == 0) {
+		return kuserok_path_is_local(dir);
+	}
+	return 0;
+}
+
 /* Use a helper to perform the kuserok check using the user's credentials,
  * in case we're in a root-squashed or needs-authentication situation with
  * a remotely-stored file. */
@@ -86,54 +399,88 @@ _pam_krb5_kuserok(krb5_context ctx,
 		  uid_t uid, gid_t gid)
 {
 	int outpipe[2];
-	int i;
+	int i, local, fd;
 	krb5_boolean allowed;
-	krb5_error_code err;
 	unsigned char result;
-	pid_t child;
-	struct sigaction saved_sigchld_handler, saved_sigpipe_handler;
-	struct sigaction ignore_handler, default_handler;
-	char envstr[PATH_MAX + 20], localname[PATH_MAX];
+	struct _pam_krb5_perms *saved;
+	struct _pam_krb5_spawn spawn;
+	char envstr[PATH_MAX + 20], path[PATH_MAX];
 	const char *ccname;
 
-	if (pipe(outpipe) == -1) {
-		return -1;
+	if (kuserok_file(ctx, userinfo, user, path, sizeof(path)) != 0) {
+		path[0] = '\0';
 	}
-	/* Set signal handlers here.  We used to do it later, but that turns
-	 * out to be a race if the child decides to exit immediately. */
-	memset(&default_handler, 0, sizeof(default_handler));
-	default_handler.sa_handler = SIG_DFL;
-	if (sigaction(SIGCHLD, &default_handler, &saved_sigchld_handler) != 0) {
-		close(outpipe[0]);
-		close(outpipe[1]);
-		return -1;
+
+	/* If we've seen the file before, and it hasn't changed since then,
+	 * and it lists the principal, we don't need to read it again.  We only
+	 * remember local files, and only trust what we remember about a file
+	 * while it's still local. */
+	local = (path[0] != '\0') && kuserok_is_local(path);
+	i = -1;
+	if (local && (options->k5login_cache != NULL)) {
+		i = _pam_krb5_k5lcache_check(options->k5login_cache, path,
+					     uid, userinfo->unparsed_name,
+					     options->k5login_cache_size,
+					     options->debug);
+		if (i == 1) {
+			if (options->debug) {
+				debug("'%s' is listed in cached copy of '%s'",
+				      userinfo->unparsed_name, path);
+			}
+			return TRUE;
+		}
 	}
-	memset(&ignore_handler, 0, sizeof(ignore_handler));
-	ignore_handler.sa_handler = SIG_IGN;
-	if (sigaction(SIGPIPE, &ignore_handler, &saved_sigpipe_handler) != 0) {
-		sigaction(SIGCHLD, &saved_sigchld_handler, NULL);
-		close(outpipe[0]);
-		close(outpipe[1]);
+
+	/* If the file's right here, just read it, but only with the user's
+	 * IDs, so that we don't look at anything the user couldn't read. */
+	saved = local ? _pam_krb5_become_user(uid, gid) : NULL;
+	if (saved != NULL) {
+		if (options->debug) {
+			debug("checking '%s' for '%s' directly", path, user);
+		}
+		allowed = kuserok_check(ctx, options, userinfo, user);
+		/* Open the file for the cache while we're still the user,
+		 * since the cache itself is ours. */
+		fd = -1;
+		if ((i == -1) && (options->k5login_cache != NULL)) {
+			fd = open(path, O_RDONLY);
+		}
+		if (_pam_krb5_restore_perms(saved) != 0) {
+			crit("error restoring privileges after checking "
+			     "'%s'", path);
+			if (fd != -1) {
+				close(fd);
+			}
+			return FALSE;
+		}
+		if (fd != -1) {
+			_pam_krb5_k5lcache_store(ctx, options->k5login_cache,
+						 path, fd, uid,
+						 options->k5login_cache_size,
+						 options->debug);
+			close(fd);
+		}
+		return allowed;
+	}
+	if (local && options->debug) {
+		debug("unable to switch to the IDs of '%s', checking '%s' "
+		      "using a helper", user, path);
+	}
+
+	if (pipe(outpipe) == -1) {
 		return -1;
 	}
-	switch (child = fork()) {
+	switch (_pam_krb5_spawn_fork(&spawn, &outpipe[1], 1)) {
 	case -1:
-		sigaction(SIGCHLD, &saved_sigchld_handler, NULL);
-		sigaction(SIGPIPE, &saved_sigpipe_handler, NULL);
 		close(outpipe[0]);
 		close(outpipe[1]);
 		return -1;
 		break;
 	case 0:
-		/* We're the child. */
-		close(outpipe[0]);
-		for (i = 0; i < sysconf(_SC_OPEN_MAX); i++) {
-			if ((i != outpipe[1]) &&
-			    (i != STDIN_FILENO) &&
-			    (i != STDOUT_FILENO) &&
-			    (i != STDERR_FILENO)) {
-				close(i);
-			}
+		/* We're the child.  Only stdin, stdout, stderr, and our end of
+		 * the pipe (renumbered) are still open. */
+		if (outpipe[0] <= STDERR_FILENO) {
+			close(outpipe[0]);
 		}
 		setgroups(0, NULL);
 		/* Now, attempt to assume the desired uid/gid pair.  Note that
@@ -171,37 +518,7 @@ _pam_krb5_kuserok(krb5_context ctx,
 		}
 		/* Actually check, now that we have a shot at being able to
 		 * read the user's .k5login file. */
-		allowed = krb5_kuserok(ctx, userinfo->principal_name, user);
-		if (options->debug) {
-			debug("krb5_kuserok() says %d", allowed);
-		}
-#ifdef HAVE_KRB5_ANAME_TO_LOCALNAME
-		if (!allowed && options->always_allow_localname) {
-			memset(&localname, '\0', sizeof(localname));
-			err = krb5_aname_to_localname(ctx,
-						      userinfo->principal_name,
-						      sizeof(localname),
-						      localname);
-			if (err != 0) {
-				if (options->debug) {
-					debug("krb5_aname_to_localname "
-					      "failed: %s",
-					      error_message(err));
-				}
-			} else {
-				if (strcmp(localname, user) == 0) {
-					if (options->debug) {
-						debug("krb5_aname_to_localname "
-						      "returned '%s' for '%s', "
-						      "allowing access",
-						      localname,
-						      userinfo->unparsed_name);
-					}
-					allowed = 1;
-				}
-			}
-		}
-#endif
+		allowed = kuserok_check(ctx, options, userinfo, user);
 		/* Clean up. */
 		if (ccname != NULL) {
 			v5_destroy(ctx, stash, options);
@@ -228,9 +545,7 @@ _pam_krb5_kuserok(krb5_context ctx,
 		} else {
 			allowed = FALSE;
 		}
-		waitpid(child, NULL, 0);
-		sigaction(SIGCHLD, &saved_sigchld_handler, NULL);
-		sigaction(SIGPIPE, &saved_sigpipe_handler, NULL);
+		_pam_krb5_spawn_wait(&spawn);
 		close(outpipe[0]);
 		return allowed;
 		break;
@@ -60,56 +60,202 @@
 #include "options.h"
 
 #define SEPARATOR '$'
+#define MAP_MATCHES 10
 
+/* Inputs longer than this have never been mapped. */
+#define MAP_MAX_INPUT 50
+
+/* A compiled mapping.  Patterns which are just an optional literal prefix,
+ * one "(.*)" or "(.+)" group, and an optional literal suffix, anchored at
+ * both ends, or which are entirely literal and anchored at both ends, are
+ * matched without the regex engine. */
+struct _pam_krb5_map_rule {
+	enum {
+		map_rule_invalid,
+		map_rule_regex,
+		map_rule_literal,
+	} type;
+	regex_t re;
+	char *prefix, *suffix;
+	size_t prefix_len, suffix_len;
+	int group, group_min;
+};
+
+/* Copy the literal part of a pattern which starts at "pattern", stopping at
+ * any of the characters in "stop" or at the end of the string.  Returns NULL
+ * if it includes anything other than ordinary characters and escaped special
+ * ones. */
+static char *
+map_literal(const char *pattern, const char *stop, const char **end,
+	    size_t *len)
+{
+	static const char *special = ".[]()*+?{}|^$\\";
+	char *ret;
+	size_t i;
+
+	ret = malloc(strlen(pattern) + 1);
+	if (ret == NULL) {
+		return NULL;
+	}
+	for (i = 0;
+	     (*pattern != '\0') && (strchr(stop, *pattern) == NULL);
+	     pattern++) {
+		if (*pattern == '\\') {
+			pattern++;
+			if ((*pattern == '\0') ||
+			    (strchr(special, *pattern) == NULL)) {
+				free(ret);
+				return NULL;
+			}
+		} else if (strchr(special, *pattern) != NULL) {
+			free(ret);
+			return NULL;
+		}
+		ret[i++] = *pattern;
+	}
+	ret[i] = '\0';
+	*end = pattern;
+	*len = i;
+	return ret;
+}
+
+/* Check if a pattern is one we can match without the regex engine. */
 static int
-map_single(const char *pattern, const char *replacement,
-	   const char *input, char *output, size_t output_len)
+map_analyze(const char *pattern, struct _pam_krb5_map_rule *rule)
 {
-	regex_t re;
-	regmatch_t *matches;
-	const char *specifiers = "0123456789", *p;
-	size_t n_matches;
-	unsigned int i, j;
-	int k, match;
+	const char *p;
 
-	/* Limit the length of the match array. */
-	n_matches = strlen(input) * 2;
-	if (n_matches > 100) {
+	if (pattern[0] != '^') {
+		return -1;
+	}
+	rule->prefix = map_literal(pattern + 1, "($", &p, &rule->prefix_len);
+	if (rule->prefix == NULL) {
 		return -1;
 	}
-	if (n_matches < strlen(specifiers)) {
-		n_matches = strlen(specifiers) * 2;
+	if (strcmp(p, "$") == 0) {
+		rule->group = 0;
+		rule->group_min = 0;
+		rule->suffix = NULL;
+		rule->suffix_len = 0;
+		return 0;
 	}
-	matches = malloc(n_matches * sizeof(regmatch_t));
-	if (matches == NULL) {
+	if (strncmp(p, "(.*)", 4) == 0) {
+		rule->group_min = 0;
+	} else if (strncmp(p, "(.+)", 4) == 0) {
+		rule->group_min = 1;
+	} else {
+		free(rule->prefix);
+		rule->prefix = NULL;
+		return -1;
+	}
+	rule->group = 1;
+	rule->suffix = map_literal(p + 4, "$", &p, &rule->suffix_len);
+	if ((rule->suffix == NULL) || (strcmp(p, "$") != 0)) {
+		free(rule->prefix);
+		free(rule->suffix);
+		rule->prefix = rule->suffix = NULL;
 		return -1;
 	}
+	return 0;
+}
 
-	for (i = 0; i < n_matches; i++) {
-		matches[i].rm_so = -1;
-		matches[i].rm_eo = -1;
+static int
+map_match_literal(const struct _pam_krb5_map_rule *rule, const char *input,
+		  regmatch_t *matches)
+{
+	size_t len;
+
+	len = strlen(input);
+	if (rule->group == 0) {
+		if ((len != rule->prefix_len) ||
+		    (memcmp(input, rule->prefix, len) != 0)) {
+			return -1;
+		}
+	} else {
+		if ((len < rule->prefix_len + rule->suffix_len +
+			   rule->group_min) ||
+		    (memcmp(input, rule->prefix, rule->prefix_len) != 0) ||
+		    (memcmp(input + len - rule->suffix_len,
+			    rule->suffix, rule->suffix_len) != 0)) {
+			return -1;
+		}
+		matches[1].rm_so = rule->prefix_len;
+		matches[1].rm_eo = len - rule->suffix_len;
 	}
+	matches[0].rm_so = 0;
+	matches[0].rm_eo = len;
+	return 0;
+}
 
-	/* Build the pattern and check for a match. */
-	i = regcomp(&re, pattern, REG_EXTENDED);
-	if (i != 0) {
-		free(matches);
-		return -1;
+static int
+map_match(const struct _pam_krb5_map_rule *rule, const char *input,
+	  regmatch_t *matches)
+{
+	const unsigned char *p;
+
+	switch (rule->type) {
+	case map_rule_literal:
+		/* "." doesn't match bytes which aren't valid characters in
+		 * the current locale, so leave those to the regex engine. */
+		for (p = (const unsigned char *) input; *p != '\0'; p++) {
+			if (*p & 0x80) {
+				break;
+			}
+		}
+		if (*p == '\0') {
+			return map_match_literal(rule, input, matches);
+		}
+		/* fall through */
+	case map_rule_regex:
+		if (regexec(&rule->re, input, MAP_MATCHES, matches, 0) != 0) {
+			return -1;
+		}
+		if ((matches[0].rm_so == -1) && (matches[0].rm_eo != -1)) {
+			return -1;
+		}
+		return 0;
+	case map_rule_invalid:
+		break;
 	}
-	i = regexec(&re, input, n_matches, matches, 0);
-	if (i != 0) {
-		free(matches);
-		regfree(&re);
+	return -1;
+}
+
+static int
+map_compile(const char *pattern, struct _pam_krb5_map_rule *rule)
+{
+	memset(rule, 0, sizeof(*rule));
+	if (regcomp(&rule->re, pattern, REG_EXTENDED) != 0) {
+		rule->type = map_rule_invalid;
 		return -1;
 	}
-	if ((matches[0].rm_so == -1) && (matches[0].rm_eo != -1)) {
-		free(matches);
-		regfree(&re);
-		return -1;
+	if (map_analyze(pattern, rule) == 0) {
+		rule->type = map_rule_literal;
+	} else {
+		rule->type = map_rule_regex;
+	}
+	return 0;
+}
+
+static void
+map_free(struct _pam_krb5_map_rule *rule)
+{
+	if (rule->type != map_rule_invalid) {
+		regfree(&rule->re);
 	}
-	regfree(&re);
+	free(rule->prefix);
+	free(rule->suffix);
+	memset(rule, 0, sizeof(*rule));
+}
+
+/* Build the output string. */
+static int
+map_expand(const char *replacement, const char *input,
+	   const regmatch_t *matches, char *output, size_t output_len)
+{
+	const char *specifiers = "0123456789", *p;
+	unsigned int i, j;
+	int k, match;
 
-	/* Build the output string. */
 	for (i = j = 0; (replacement[i] != '\0') && (j < output_len - 1); i++) {
 		switch (replacement[i]) {
 		case SEPARATOR:
@@ -141,7 +287,6 @@ map_single(const char *pattern, const char *replacement,
 			break;
 		}
 	}
-	free(matches);
 	output[j] = '\0';
 	/* Check for unexpected truncation. */
 	if (replacement[i] != '\0') {
@@ -150,20 +295,88 @@ map_single(const char *pattern, const char *replacement,
 	return 0;
 }
 
+static int
+map_single(const struct _pam_krb5_map_rule *rule, const char *replacement,
+	   const char *input, char *output, size_t output_len)
+{
+	regmatch_t matches[MAP_MATCHES];
+	unsigned int i;
+
+	if (strlen(input) > MAP_MAX_INPUT) {
+		return -1;
+	}
+	for (i = 0; i < MAP_MATCHES; i++) {
+		matches[i].rm_so = -1;
+		matches[i].rm_eo = -1;
+	}
+	if (map_match(rule, input, matches) != 0) {
+		return -1;
+	}
+	return map_expand(replacement, input, matches, output, output_len);
+}
+
+/* Compile the patterns, once, when the options which list them are read. */
+int
+map_compile_mappings(struct name_mapping *mappings, int n_mappings)
+{
+	int i, ret;
+
+	ret = 0;
+	for (i = 0; i < n_mappings; i++) {
+		mappings[i].rule = malloc(sizeof(*mappings[i].rule));
+		if (mappings[i].rule == NULL) {
+			ret = -1;
+			continue;
+		}
+		if (map_compile(mappings[i].pattern, mappings[i].rule) != 0) {
+			warn("error compiling mapping pattern \"%s\"",
+			     mappings[i].pattern);
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+void
+map_free_mappings(struct name_mapping *mappings, int n_mappings)
+{
+	int i;
+
+	for (i = 0; i < n_mappings; i++) {
+		if (mappings[i].rule != NULL) {
+			map_free(mappings[i].rule);
+			free(mappings[i].rule);
+			mappings[i].rule = NULL;
+		}
+	}
+}
+
 int
 map_lname_aname(const struct name_mapping *mappings, int n_mappings,
 		const char *lname,
 		char *principal, size_t principal_len)
 {
+	struct _pam_krb5_map_rule rule;
 	int i, status;
 
 	/* Iterate through the maps. */
 	for (i = 0; i < n_mappings; i++) {
-		status = map_single(mappings[i].pattern,
-				    mappings[i].replacement,
-				    lname,
-				    principal,
-				    principal_len);
+		if (mappings[i].rule != NULL) {
+			status = map_single(mappings[i].rule,
+					    mappings[i].replacement,
+					    lname,
+					    principal,
+					    principal_len);
+		} else {
+			/* Not compiled ahead of time, so do it now. */
+			map_compile(mappings[i].pattern, &rule);
+			status = map_single(&rule,
+					    mappings[i].replacement,
+					    lname,
+					    principal,
+					    principal_len);
+			map_free(&rule);
+		}
 		if (status == 0) {
 			return 0;
 		}
@@ -175,6 +388,7 @@ map_lname_aname(const struct name_mapping *mappings, int n_mappings,
 int
 main(int argc, char **argv)
 {
+	struct name_mapping mapping;
 	char output[LINE_MAX];
 	int i;
 
@@ -182,8 +396,11 @@ main(int argc, char **argv)
 		printf("Usage: %s pattern replacment data\n", argv[0]);
 		return 1;
 	}
-	i = map_single(argv[1], argv[2], argv[3],
-		       output, sizeof(output));
+
+	mapping.pattern = argv[1];
+	mapping.replacement = argv[2];
+	mapping.rule = NULL;
+	i = map_lname_aname(&mapping, 1, argv[3], output, sizeof(output));
 	if (i == 0) {
 		printf("Match: \"%s\" -> \"%s\"\n", argv[3], output);
 	} else {
@@ -35,6 +35,8 @@
 
 #include "options.h"
 
+int map_compile_mappings(struct name_mapping *mappings, int n_mappings);
+void map_free_mappings(struct name_mapping *mappings, int n_mappings);
 int map_lname_aname(const struct name_mapping *mappings, int n_mappings,
 		    const char *lname, char *principal, size_t principal_len);
 
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#include KRB5_H
+
+#include "logstdio.h"
+#include "map.h"
+#include "options.h"
+
+/* Measure how long it takes to map a corpus of user names through sets of
+ * 1, 10 and 100 rules, compiling each rule's pattern every time it's used
+ * (the way we used to) and compiling them all ahead of time.  Half of the
+ * rules are simple enough to be matched without the regex engine.  Most of
+ * the names don't match any rule but the last one, which matches
+ * everything, so that every name is checked against every rule. */
+
+extern char *log_progname;
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static struct name_mapping *
+make_rules(int n_rules)
+{
+	struct name_mapping *mappings;
+	char buf[LINE_MAX];
+	int i;
+
+	mappings = calloc(n_rules, sizeof(*mappings));
+	if (mappings == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < n_rules - 1; i++) {
+		if (i % 2) {
+			snprintf(buf, sizeof(buf), "^svc%d-([a-z0-9]+)$", i);
+		} else {
+			snprintf(buf, sizeof(buf), "^svc%d-(.*)$", i);
+		}
+		mappings[i].pattern = strdup(buf);
+		snprintf(buf, sizeof(buf), "$1/svc%d", i);
+		mappings[i].replacement = strdup(buf);
+	}
+	mappings[i].pattern = strdup("^(.*)$");
+	mappings[i].replacement = strdup("$1");
+	for (i = 0; i < n_rules; i++) {
+		if ((mappings[i].pattern == NULL) ||
+		    (mappings[i].replacement == NULL)) {
+			return NULL;
+		}
+	}
+	return mappings;
+}
+
+static double
+time_it(struct name_mapping *mappings, int n_rules, char **names, int n_names)
+{
+	char principal[LINE_MAX];
+	double start;
+	int i;
+
+	start = now();
+	for (i = 0; i < n_names; i++) {
+		if (map_lname_aname(mappings, n_rules, names[i],
+				    principal, sizeof(principal)) != 0) {
+			return -1;
+		}
+	}
+	return now() - start;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int rule_counts[] = {1, 10, 100};
+	struct name_mapping *mappings;
+	double old_time, new_time;
+	char **names, buf[LINE_MAX];
+	int c, i, j, n_names, n_rules;
+
+	log_progname = "mapbench";
+	n_names = 100000;
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		switch (c) {
+		case 'n':
+			n_names = atoi(optarg);
+			break;
+		default:
+			printf("%s: [-n names]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (n_names < 1) {
+		fprintf(stderr, "%s: counts must be positive\n", argv[0]);
+		return 1;
+	}
+	names = malloc(sizeof(char *) * n_names);
+	if (names == NULL) {
+		perror("malloc");
+		return 1;
+	}
+	for (i = 0; i < n_names; i++) {
+		if (i % 100 == 0) {
+			snprintf(buf, sizeof(buf), "svc%d-user%06d",
+				 (i / 100) % 100, i);
+		} else {
+			snprintf(buf, sizeof(buf), "user%06d", i);
+		}
+		names[i] = strdup(buf);
+		if (names[i] == NULL) {
+			perror("strdup");
+			return 1;
+		}
+	}
+
+	printf("%8s %8s %16s %16s\n",
+	       "rules", "names", "per-call", "precompiled");
+	for (i = 0; i < (int) (sizeof(rule_counts) / sizeof(rule_counts[0]));
+	     i++) {
+		n_rules = rule_counts[i];
+		mappings = make_rules(n_rules);
+		if (mappings == NULL) {
+			perror("malloc");
+			return 1;
+		}
+		old_time = time_it(mappings, n_rules, names, n_names);
+		map_compile_mappings(mappings, n_rules);
+		new_time = time_it(mappings, n_rules, names, n_names);
+		if ((old_time < 0) || (new_time < 0)) {
+			fprintf(stderr, "error mapping names\n");
+			return 1;
+		}
+		printf("%8d %8d %13.3f us %13.3f us\n", n_rules, n_names,
+		       old_time * 1000000 / n_names,
+		       new_time * 1000000 / n_names);
+		map_free_mappings(mappings, n_rules);
+		for (j = 0; j < n_rules; j++) {
+			free(mappings[j].pattern);
+			free(mappings[j].replacement);
+		}
+		free(mappings);
+	}
+	for (i = 0; i < n_names; i++) {
+		free(names[i]);
+	}
+	free(names);
+	return 0;
+}
@@ -65,6 +65,7 @@
 #endif
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef HAVE_SECURITY_PAM_APPL_H
@@ -85,6 +86,7 @@
 #endif
 #endif
 
+#include "cellcache.h"
 #include "init.h"
 #include "log.h"
 #include "minikafs.h"
@@ -101,6 +103,10 @@
 
 #define HOSTNAME_SIZE NI_MAXHOST
 
+/* How long we'll trust what we found out about whether or not AFS is
+ * running. */
+#define MINIKAFS_HAS_AFS_TTL 60
+
 #define OPENAFS_AFS_IOCTL_FILE  "/proc/fs/openafs/afs_ioctl"
 #define ARLA_AFS_IOCTL_FILE     "/proc/fs/nnpfs/afs_ioctl"
 
@@ -167,10 +173,12 @@ enum minikafs_pioctl_fn {
 	minikafs_pioctl_settoken2 = CIOCTL_FN(8),
 	minikafs_pioctl_getprop = CIOCTL_FN(10),
 	minikafs_pioctl_setprop = CIOCTL_FN(11),
+	minikafs_pioctl_getpag = CIOCTL_FN(13),
 };
 
 /* Forward declarations. */
 static int minikafs_5settoken2(const char *cell, krb5_creds *creds, int32_t id);
+static const struct minikafs_backend *minikafs_backend;
 
 /* Call AFS using an ioctl. Might not port to your system. */
 static int
@@ -226,28 +234,110 @@ minikafs_pioctl(char *file, enum minikafs_pioctl_fn subfunction,
 			     subfunction, (long) iob, 0);
 }
 
-/* Determine in which cell a given file resides.  Returns 0 on success. */
-int
-minikafs_cell_of_file(const char *file, char *cell, size_t length)
+/* Identify the PAG we're in.  Clients which track PAGs themselves will tell
+ * us; clients which keep them in the session keyring (kAFS, and OpenAFS on
+ * kernels without group-based PAGs) change keyrings when they create one, so
+ * the keyring's serial number serves as well. */
+static int
+minikafs_kernel_getpag(char *out, size_t outsize)
 {
 	struct minikafs_ioblock iob;
-	char *wfile;
-	int i;
-
-	wfile = xstrdup(file ? file : "/afs");
+	uint32_t value;
+	unsigned long pag;
+	long serial;
 
+	if (outsize < sizeof(pag)) {
+		errno = E2BIG;
+		return -1;
+	}
 	memset(&iob, 0, sizeof(iob));
-	iob.in = wfile;
-	iob.insize = strlen(wfile) + 1;
-	iob.out = cell;
-	iob.outsize = length;
+	iob.out = (char *) &value;
+	iob.outsize = sizeof(value);
+	if (minikafs_pioctl(NULL, minikafs_pioctl_getpag, &iob) == 0) {
+		pag = value;
+		memcpy(out, &pag, sizeof(pag));
+		return 0;
+	}
+#if defined(__linux__) && defined(SYS_keyctl)
+	/* KEYCTL_GET_KEYRING_ID, KEY_SPEC_SESSION_KEYRING, don't create. */
+	serial = syscall(SYS_keyctl, 0, -3, 0);
+	if (serial > 0) {
+		/* Keep these distinct from PAG numbers from the pioctl. */
+		pag = ((unsigned long) serial) | 0x80000000UL;
+		memcpy(out, &pag, sizeof(pag));
+		return 0;
+	}
+#else
+	serial = -1;
+	errno = ENOSYS;
+#endif
+	return -1;
+}
+
+/* The kernel backend's pioctl, for calls which don't have their own entry
+ * points. */
+static int
+minikafs_kernel_pioctl(void *data, enum minikafs_backend_pioctl what,
+		       const char *path, const char *in, size_t insize,
+		       char *out, size_t outsize)
+{
+	struct minikafs_ioblock iob;
+	enum minikafs_pioctl_fn subfunction;
+	char *wfile;
+	int i;
 
-	i = minikafs_pioctl(wfile, minikafs_pioctl_getcelloffile, &iob);
+	switch (what) {
+	case minikafs_backend_cell_of_file:
+		subfunction = minikafs_pioctl_getcelloffile;
+		break;
+	case minikafs_backend_unlog:
+		subfunction = minikafs_pioctl_unlog;
+		break;
+	case minikafs_backend_get_property:
+		subfunction = minikafs_pioctl_getprop;
+		break;
+	case minikafs_backend_get_pag:
+		return minikafs_kernel_getpag(out, outsize);
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
 
+	wfile = NULL;
+	if (path != NULL) {
+		wfile = xstrdup(path);
+		if (wfile == NULL) {
+			return -1;
+		}
+	}
+	if ((in == NULL) && (out == NULL)) {
+		i = minikafs_pioctl(wfile, subfunction, NULL);
+	} else {
+		memset(&iob, 0, sizeof(iob));
+		iob.in = (char *) in;
+		iob.insize = insize;
+		iob.out = out;
+		iob.outsize = outsize;
+		i = minikafs_pioctl(wfile, subfunction, &iob);
+	}
 	xstrfree(wfile);
 	return i;
 }
 
+/* Determine in which cell a given file resides.  Returns 0 on success. */
+int
+minikafs_cell_of_file(const char *file, char *cell, size_t length)
+{
+	const char *path;
+
+	path = file ? file : "/afs";
+	return minikafs_backend->pioctl(minikafs_backend->data,
+					minikafs_backend_cell_of_file,
+					path, path, strlen(path) + 1,
+					cell, length);
+}
+
 /* Do minikafs_cell_of_file, but if we can't find out, walk up the filesystem
  * tree until we either get an answer or hit the root directory. */
 int
@@ -274,8 +364,8 @@ minikafs_cell_of_file_walk_up(const char *file, char *cell, size_t length)
 
 /* Determine if AFS is running. Unlike most other functions, return 0 on
  * FAILURE. */
-int
-minikafs_has_afs(void)
+static int
+minikafs_has_afs_probe(void)
 {
 	char cell[PATH_MAX];
 	int fd, i, ret;
@@ -325,17 +415,34 @@ minikafs_has_afs(void)
 	return ret;
 }
 
+/* The same, but only actually check once in a while, since we get asked
+ * several times over the course of a login. */
+static int
+minikafs_kernel_has_afs(void *data)
+{
+	static int result = -1;
+	static time_t checked = 0;
+	time_t now;
+
+	now = time(NULL);
+	if ((result == -1) ||
+	    (now < checked) || (now - checked >= MINIKAFS_HAS_AFS_TTL)) {
+		result = minikafs_has_afs_probe();
+		checked = now;
+	}
+	return result;
+}
+
 /* Determine in which realm a cell exists.  We do this by obtaining the address
  * of the fileserver which holds /afs/cellname (assuming that the root.cell
  * volume from the cell is mounted there), converting the address to a host
  * name, and then asking libkrb5 to tell us to which realm the host belongs. */
 static int
-minikafs_realm_of_cell_with_ctx(krb5_context ctx,
-				struct _pam_krb5_options *options,
-				const char *cell,
-				char *realm, size_t length)
+minikafs_realm_of_cell_lookup(krb5_context ctx,
+			      struct _pam_krb5_options *options,
+			      const char *cell,
+			      char *realm, size_t length)
 {
-	struct minikafs_ioblock iob;
 	struct sockaddr_in sin;
 	in_addr_t *address;
 	krb5_context use_ctx;
@@ -365,12 +472,10 @@ minikafs_realm_of_cell_with_ctx(krb5_context ctx,
 			break;
 		}
 		memset(address, 0, n_addresses * sizeof(address[0]));
-		memset(&iob, 0, sizeof(iob));
-		iob.in = path;
-		iob.insize = strlen(path) + 1;
-		iob.out = (char*) &address[0];
-		iob.outsize = n_addresses * sizeof(address[0]);
-		ret = minikafs_pioctl(path, minikafs_pioctl_whereis, &iob);
+		ret = minikafs_backend->whereis(minikafs_backend->data, path,
+						address,
+						n_addresses *
+						sizeof(address[0]));
 		/* if we failed, free the address [list], and if the error was
 		 * E2BIG, increase the size we'll use next time, up to a
 		 * hard-coded limit */
@@ -467,11 +572,72 @@ minikafs_realm_of_cell_with_ctx(krb5_context ctx,
 	return i;
 }
 
+/* Check the cell realm cache, if we have one, before going to the file
+ * servers and DNS, and remember whatever they tell us. */
+static int
+minikafs_realm_of_cell_with_ctx(krb5_context ctx,
+				struct _pam_krb5_options *options,
+				const char *cell,
+				char *realm, size_t length)
+{
+	int ret;
+
+	if ((cell == NULL) || (options->cell_realm_cache == NULL)) {
+		return minikafs_realm_of_cell_lookup(ctx, options, cell,
+						     realm, length);
+	}
+	switch (_pam_krb5_cellcache_lookup(options->cell_realm_cache, cell,
+					   realm, length, options->debug)) {
+	case 1:
+		if (options->debug) {
+			debug("cached: \"%s\" is in realm %s", cell, realm);
+		}
+		return 0;
+		break;
+	case 0:
+		if (options->debug) {
+			debug("cached: realm of \"%s\" is unknown", cell);
+		}
+		return -1;
+		break;
+	default:
+		break;
+	}
+	realm[0] = '\0';
+	ret = minikafs_realm_of_cell_lookup(ctx, options, cell, realm, length);
+	if ((ret == 0) && (realm[0] != '\0')) {
+		_pam_krb5_cellcache_add(options->cell_realm_cache, cell, realm,
+					options->cell_realm_cache_ttl,
+					options->debug);
+	} else if (ret != 0) {
+		_pam_krb5_cellcache_add(options->cell_realm_cache, cell, NULL,
+					options->cell_realm_cache_negative_ttl,
+					options->debug);
+	}
+	return ret;
+}
+
 /* Create a new PAG. */
+static int
+minikafs_kernel_setpag(void *data)
+{
+	return minikafs_call(minikafs_subsys_setpag, 0, 0, 0, 0);
+}
+
 int
 minikafs_setpag(void)
 {
-	return minikafs_call(minikafs_subsys_setpag, 0, 0, 0, 0);
+	return minikafs_backend->setpag(minikafs_backend->data);
+}
+
+/* Identify the PAG we're in.  Returns 0 on success. */
+int
+minikafs_pag(unsigned long *pag)
+{
+	return minikafs_backend->pioctl(minikafs_backend->data,
+					minikafs_backend_get_pag,
+					NULL, NULL, 0,
+					(char *) pag, sizeof(*pag));
 }
 
 #if 0
@@ -496,8 +662,8 @@ minikafs_unpag(void)
 #endif
 
 /* Determine which cell is the default on this workstation. */
-int
-minikafs_ws_cell(char *cell, size_t length)
+static int
+minikafs_kernel_wscell(void *data, char *cell, size_t length)
 {
 	struct minikafs_ioblock iob;
 	char wfile[] = "/afs";
@@ -515,6 +681,79 @@ minikafs_ws_cell(char *cell, size_t length)
 	return i;
 }
 
+int
+minikafs_ws_cell(char *cell, size_t length)
+{
+	return minikafs_backend->wscell(minikafs_backend->data, cell, length);
+}
+
+/* Ask the kernel where the servers for a path are. */
+static int
+minikafs_kernel_whereis(void *data, const char *path,
+			void *addresses, size_t size)
+{
+	struct minikafs_ioblock iob;
+	char *wfile;
+	int i;
+
+	wfile = xstrdup(path);
+	if (wfile == NULL) {
+		return -1;
+	}
+	memset(&iob, 0, sizeof(iob));
+	iob.in = wfile;
+	iob.insize = strlen(wfile) + 1;
+	iob.out = addresses;
+	iob.outsize = size;
+	i = minikafs_pioctl(wfile, minikafs_pioctl_whereis, &iob);
+	xstrfree(wfile);
+	return i;
+}
+
+/* Hand a token to the kernel. */
+static int
+minikafs_kernel_settoken(void *data, const char *cell, int version,
+			 const void *token, size_t length)
+{
+	struct minikafs_ioblock iob;
+
+	memset(&iob, 0, sizeof(iob));
+	iob.in = (char *) token;
+	iob.insize = length;
+	iob.out = NULL;
+	iob.outsize = 0;
+	return minikafs_pioctl(NULL,
+			       (version == 2) ?
+			       minikafs_pioctl_settoken2 :
+			       minikafs_pioctl_settoken,
+			       &iob);
+}
+
+static const struct minikafs_backend minikafs_kernel_backend = {
+	"kernel",
+	minikafs_kernel_has_afs,
+	minikafs_kernel_pioctl,
+	minikafs_kernel_setpag,
+	minikafs_kernel_settoken,
+	minikafs_kernel_whereis,
+	minikafs_kernel_wscell,
+	NULL,
+};
+static const struct minikafs_backend *minikafs_backend =
+	&minikafs_kernel_backend;
+
+void
+minikafs_set_backend(const struct minikafs_backend *backend)
+{
+	minikafs_backend = backend ? backend : &minikafs_kernel_backend;
+}
+
+int
+minikafs_has_afs(void)
+{
+	return minikafs_backend->has_afs(minikafs_backend->data);
+}
+
 /* Stuff a ticket and DES key into the kernel. */
 static int
 minikafs_settoken(const void *ticket, uint32_t ticket_size,
@@ -524,7 +763,6 @@ minikafs_settoken(const void *ticket, uint32_t ticket_size,
 {
 	char *buffer;
 	struct minikafs_plain_token plain_token;
-	struct minikafs_ioblock iob;
 	uint32_t size;
 	int i;
 
@@ -565,15 +803,11 @@ minikafs_settoken(const void *ticket, uint32_t ticket_size,
 	       cell, strlen(cell) + 1);
 
 	/* the regular stuff */
-	memset(&iob, 0, sizeof(iob));
-	iob.in = buffer;
-	iob.insize = 4 + ticket_size +
-		     4 + sizeof(struct minikafs_plain_token) +
-		     4 + strlen(cell) + 1;
-	iob.out = NULL;
-	iob.outsize = 0;
-
-	i = minikafs_pioctl(NULL, minikafs_pioctl_settoken, &iob);
+	i = minikafs_backend->settoken(minikafs_backend->data, cell, 1,
+				       buffer,
+				       4 + ticket_size +
+				       4 + sizeof(struct minikafs_plain_token) +
+				       4 + strlen(cell) + 1);
 	free(buffer);
 	return i;
 }
@@ -617,7 +851,9 @@ minikafs_5settoken(const char *cell, krb5_creds *creds, uid_t uid)
 int
 minikafs_unlog(void)
 {
-	return minikafs_pioctl(NULL, minikafs_pioctl_unlog, NULL);
+	return minikafs_backend->pioctl(minikafs_backend->data,
+					minikafs_backend_unlog,
+					NULL, NULL, 0, NULL, 0);
 }
 
 #ifdef USE_KRB4
@@ -663,19 +899,45 @@ minikafs_5convert_and_log(krb5_context ctx, struct _pam_krb5_options *options,
 }
 #endif
 
+/* Try to set a token for the given cell using a v5 credential.  If we're only
+ * fetching credentials, just check whether or not we'd try to use it. */
+static int
+minikafs_5use_creds(krb5_context ctx, struct _pam_krb5_options *options,
+		    const char *cell, krb5_creds *creds, uid_t uid,
+		    int use_rxk5, int use_v5_2b, int fetch_only)
+{
+	if (fetch_only) {
+		if (use_rxk5) {
+			return 0;
+		}
+		if (use_v5_2b) {
+			return (v5_creds_key_length(creds) == 8) ? 0 : -1;
+		}
+		return options->v4_use_524 ? 0 : -1;
+	}
+	if (use_rxk5 && (minikafs_5settoken2(cell, creds, uid) == 0)) {
+		return 0;
+	}
+	if (use_v5_2b && (minikafs_5settoken(cell, creds, uid) == 0)) {
+		return 0;
+	}
+	if (options->v4_use_524 &&
+	    (minikafs_5convert_and_log(ctx, options, cell, creds, uid) == 0)) {
+		return 0;
+	}
+	return -1;
+}
+
 /* Ask the kernel which ciphers it supports for use with rxk5. */
 static int
 minikafs_get_property(const char *property, char *value, int length)
 {
-	struct minikafs_ioblock iob;
-	int i;
-
-	iob.in = property ? (char *) property : "*";
-	iob.insize = strlen(property) + 1;
-	iob.out = value;
-	iob.outsize = length;
-	i = minikafs_pioctl(NULL, minikafs_pioctl_getprop, &iob);
-	return i;
+	return minikafs_backend->pioctl(minikafs_backend->data,
+					minikafs_backend_get_property,
+					NULL,
+					property ? property : "*",
+					strlen(property) + 1,
+					value, length);
 }
 
 static int
@@ -727,7 +989,8 @@ minikafs_5log_with_principal(krb5_context ctx,
 			     const char *principal,
 			     uid_t uid,
 			     int use_rxk5,
-			     int use_v5_2b)
+			     int use_v5_2b,
+			     int fetch_only)
 {
 	krb5_principal server, client;
 	krb5_creds mcreds, creds, *new_creds;
@@ -817,25 +1080,9 @@ minikafs_5log_with_principal(krb5_context ctx,
 		}
 		if (krb5_cc_retrieve_cred(ctx, ccache, v5_cc_retrieve_match(),
 					  &mcreds, &creds) == 0) {
-			if (use_rxk5 &&
-			    (minikafs_5settoken2(cell, &creds, uid) == 0)) {
-				krb5_free_cred_contents(ctx, &creds);
-				v5_free_unparsed_name(ctx, unparsed_client);
-				krb5_free_principal(ctx, client);
-				krb5_free_principal(ctx, server);
-				return 0;
-			} else
-			if (use_v5_2b &&
-			    (minikafs_5settoken(cell, &creds, uid) == 0)) {
-				krb5_free_cred_contents(ctx, &creds);
-				v5_free_unparsed_name(ctx, unparsed_client);
-				krb5_free_principal(ctx, client);
-				krb5_free_principal(ctx, server);
-				return 0;
-			} else
-			if (options->v4_use_524 &&
-			    minikafs_5convert_and_log(ctx, options, cell,
-						      &creds, uid) == 0) {
+			if (minikafs_5use_creds(ctx, options, cell, &creds,
+						uid, use_rxk5, use_v5_2b,
+						fetch_only) == 0) {
 				krb5_free_cred_contents(ctx, &creds);
 				v5_free_unparsed_name(ctx, unparsed_client);
 				krb5_free_principal(ctx, client);
@@ -858,25 +1105,9 @@ minikafs_5log_with_principal(krb5_context ctx,
 		tmp = krb5_get_credentials(ctx, 0, ccache,
 					   &mcreds, &new_creds);
 		if (tmp == 0) {
-			if (use_rxk5 &&
-			    (minikafs_5settoken2(cell, new_creds, uid) == 0)) {
-				krb5_free_creds(ctx, new_creds);
-				v5_free_unparsed_name(ctx, unparsed_client);
-				krb5_free_principal(ctx, client);
-				krb5_free_principal(ctx, server);
-				return 0;
-			} else
-			if (use_v5_2b &&
-			    (minikafs_5settoken(cell, new_creds, uid) == 0)) {
-				krb5_free_creds(ctx, new_creds);
-				v5_free_unparsed_name(ctx, unparsed_client);
-				krb5_free_principal(ctx, client);
-				krb5_free_principal(ctx, server);
-				return 0;
-			} else
-			if (options->v4_use_524 &&
-			    minikafs_5convert_and_log(ctx, options, cell,
-						      new_creds, uid) == 0) {
+			if (minikafs_5use_creds(ctx, options, cell, new_creds,
+						uid, use_rxk5, use_v5_2b,
+						fetch_only) == 0) {
 				krb5_free_creds(ctx, new_creds);
 				v5_free_unparsed_name(ctx, unparsed_client);
 				krb5_free_principal(ctx, client);
@@ -912,13 +1143,27 @@ minikafs_5log_with_principal(krb5_context ctx,
 	return -1;
 }
 
+/* Note which service principal we used. */
+static void
+minikafs_5log_used(const char *principal, char *used, size_t used_size)
+{
+	if ((used != NULL) && (used_size > 0)) {
+		strncpy(used, principal, used_size - 1);
+		used[used_size - 1] = '\0';
+	}
+}
+
 /* Try to obtain tokens for the named cell using the default ccache and
- * configuration settings. */
+ * configuration settings.  If we know which service principal worked the
+ * last time, try it first.  On success, store the name of the one which
+ * worked in "used". */
 static int
 minikafs_5log(krb5_context context, krb5_ccache ccache,
 	      struct _pam_krb5_options *options,
 	      const char *cell, const char *hint_principal,
-	      uid_t uid, int use_rxk5, int use_v5_2b)
+	      const char *preferred_principal,
+	      uid_t uid, int use_rxk5, int use_v5_2b, int fetch_only,
+	      char *used, size_t used_size)
 {
 	krb5_context ctx;
 	krb5_ccache use_ccache;
@@ -958,6 +1203,31 @@ minikafs_5log(krb5_context context, krb5_ccache ccache,
 		}
 	}
 
+	/* If we remember which principal name worked before, try it. */
+	if ((preferred_principal != NULL) &&
+	    (strlen(preferred_principal) > 0)) {
+		if (options->debug) {
+			debug("attempting to obtain tokens for \"%s\" "
+			      "(remembered \"%s\")",
+			      cell, preferred_principal);
+		}
+		ret = minikafs_5log_with_principal(ctx, options, use_ccache,
+						   cell, preferred_principal,
+						   uid, use_rxk5, use_v5_2b,
+						   fetch_only);
+		if (ret == 0) {
+			minikafs_5log_used(preferred_principal,
+					   used, used_size);
+			if (use_ccache != ccache) {
+				krb5_cc_close(ctx, use_ccache);
+			}
+			if (ctx != context) {
+				krb5_free_context(ctx);
+			}
+			return 0;
+		}
+	}
+
 	/* If we were given a principal name, try it. */
 	if ((hint_principal != NULL) && (strlen(hint_principal) > 0)) {
 		if (options->debug) {
@@ -967,8 +1237,10 @@ minikafs_5log(krb5_context context, krb5_ccache ccache,
 		}
 		ret = minikafs_5log_with_principal(ctx, options, use_ccache,
 						   cell, hint_principal, uid,
-						   use_rxk5, use_v5_2b);
+						   use_rxk5, use_v5_2b,
+						   fetch_only);
 		if (ret == 0) {
+			minikafs_5log_used(hint_principal, used, used_size);
 			if (use_ccache != ccache) {
 				krb5_cc_close(ctx, use_ccache);
 			}
@@ -1033,7 +1305,8 @@ minikafs_5log(krb5_context context, krb5_ccache ccache,
 			ret = minikafs_5log_with_principal(ctx, options,
 							   use_ccache,
 							   cell, principal, uid,
-							   use_rxk5, use_v5_2b);
+							   use_rxk5, use_v5_2b,
+							   fetch_only);
 		}
 		if (ret == 0) {
 			break;
@@ -1047,7 +1320,8 @@ minikafs_5log(krb5_context context, krb5_ccache ccache,
 		}
 		ret = minikafs_5log_with_principal(ctx, options, use_ccache,
 						   cell, principal, uid,
-						   use_rxk5, use_v5_2b);
+						   use_rxk5, use_v5_2b,
+						   fetch_only);
 		if (ret == 0) {
 			break;
 		}
@@ -1064,7 +1338,8 @@ minikafs_5log(krb5_context context, krb5_ccache ccache,
 			ret = minikafs_5log_with_principal(ctx, options,
 							   use_ccache,
 							   cell, principal, uid,
-							   use_rxk5, use_v5_2b);
+							   use_rxk5, use_v5_2b,
+							   fetch_only);
 		}
 		if (ret == 0) {
 			break;
@@ -1089,7 +1364,8 @@ minikafs_5log(krb5_context context, krb5_ccache ccache,
 								   principal,
 								   uid,
 								   use_rxk5,
-								   use_v5_2b);
+								   use_v5_2b,
+								   fetch_only);
 			}
 			if (ret == 0) {
 				break;
@@ -1104,7 +1380,8 @@ minikafs_5log(krb5_context context, krb5_ccache ccache,
 			ret = minikafs_5log_with_principal(ctx, options,
 							   use_ccache,
 							   cell, principal, uid,
-							   use_rxk5, use_v5_2b);
+							   use_rxk5, use_v5_2b,
+							   fetch_only);
 			if (ret == 0) {
 				break;
 			}
@@ -1125,7 +1402,8 @@ minikafs_5log(krb5_context context, krb5_ccache ccache,
 								   principal,
 								   uid,
 								   use_rxk5,
-								   use_v5_2b);
+								   use_v5_2b,
+								   fetch_only);
 			}
 			if (ret == 0) {
 				break;
@@ -1133,6 +1411,9 @@ minikafs_5log(krb5_context context, krb5_ccache ccache,
 		}
 	}
 
+	if (ret == 0) {
+		minikafs_5log_used(principal, used, used_size);
+	}
 	if (use_ccache != ccache) {
 		krb5_cc_close(ctx, use_ccache);
 	}
@@ -1383,87 +1664,219 @@ minikafs_4log(krb5_context context, struct _pam_krb5_options *options,
 }
 #endif
 
-/* Try to get tokens for the named cell using every available mechanism. */
-int
-minikafs_log(krb5_context ctx, krb5_ccache ccache,
-	     struct _pam_krb5_options *options,
-	     const char *cell, const char *hint_principal,
-	     uid_t uid, const int *methods, int n_methods)
+/* The names which token_strategy uses for each method, which are also what
+ * we call them in the cell cache. */
+static const struct {
+	int method;
+	const char *name;
+} minikafs_method_names[] = {
+	{MINIKAFS_METHOD_V4, "v4"},
+	{MINIKAFS_METHOD_V5_V4, "524"},
+	{MINIKAFS_METHOD_V5_2B, "2b"},
+	{MINIKAFS_METHOD_RXK5, "rxk5"},
+};
+
+static const char *
+minikafs_method_name(int method)
 {
-	int i, method;
-	if (n_methods == -1) {
-		for (i = 0; methods[i] != 0; i++) {
-			continue;
+	unsigned int i;
+
+	for (i = 0;
+	     i < sizeof(minikafs_method_names) /
+		 sizeof(minikafs_method_names[0]);
+	     i++) {
+		if (minikafs_method_names[i].method == method) {
+			return minikafs_method_names[i].name;
+		}
+	}
+	return NULL;
+}
+
+static int
+minikafs_method_named(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0;
+	     i < sizeof(minikafs_method_names) /
+		 sizeof(minikafs_method_names[0]);
+	     i++) {
+		if (strcmp(minikafs_method_names[i].name, name) == 0) {
+			return minikafs_method_names[i].method;
 		}
-		n_methods = i;
 	}
-	for (method = 0; method < n_methods; method++) {
-		i = -1;
-		switch (methods[method]) {
+	return 0;
+}
+
+/* Try to get tokens for the named cell using one mechanism. */
+static int
+minikafs_log_method(krb5_context ctx, krb5_ccache ccache,
+		    struct _pam_krb5_options *options,
+		    const char *cell, const char *hint_principal,
+		    const char *preferred_principal, uid_t uid, int method,
+		    int fetch_only, char *used, size_t used_size)
+{
+	int i;
+
+	i = -1;
+	switch (method) {
 #ifdef USE_KRB4
-		case MINIKAFS_METHOD_V4:
-			if (options->debug) {
-				debug("trying with v4 ticket");
-			}
-			i = minikafs_4log(ctx, options, cell,
-					  hint_principal, uid);
-			if (i != 0) {
-				if (options->debug) {
-					debug("v4 afslog failed to \"%s\"",
-					      cell);
-				}
-			}
+	case MINIKAFS_METHOD_V4:
+		if (fetch_only) {
+			/* v4 tickets never pass through the ccache. */
 			break;
-		case MINIKAFS_METHOD_V5_V4:
+		}
+		if (options->debug) {
+			debug("trying with v4 ticket");
+		}
+		i = minikafs_4log(ctx, options, cell, hint_principal, uid);
+		if (i != 0) {
 			if (options->debug) {
-				debug("trying with v5 ticket and 524 service");
+				debug("v4 afslog failed to \"%s\"", cell);
 			}
-			i = minikafs_5log(ctx, ccache, options, cell,
-					  hint_principal, uid, 0, 0);
-			if (i != 0) {
-				if (options->debug) {
-					debug("v5 with 524 service afslog "
-					      "failed to \"%s\"", cell);
-				}
+		}
+		break;
+	case MINIKAFS_METHOD_V5_V4:
+		if (options->debug) {
+			debug("trying with v5 ticket and 524 service");
+		}
+		i = minikafs_5log(ctx, ccache, options, cell,
+				  hint_principal, preferred_principal, uid,
+				  0, 0, fetch_only, used, used_size);
+		if (i != 0) {
+			if (options->debug) {
+				debug("v5 with 524 service afslog failed to "
+				      "\"%s\"", cell);
 			}
-			break;
+		}
+		break;
 #endif
-		case MINIKAFS_METHOD_V5_2B:
+	case MINIKAFS_METHOD_V5_2B:
+		if (options->debug) {
+			debug("trying with v5 ticket (2b)");
+		}
+		i = minikafs_5log(ctx, ccache, options, cell,
+				  hint_principal, preferred_principal, uid,
+				  0, 1, fetch_only, used, used_size);
+		if (i != 0) {
 			if (options->debug) {
-				debug("trying with v5 ticket (2b)");
-			}
-			i = minikafs_5log(ctx, ccache, options, cell,
-					  hint_principal, uid, 0, 1);
-			if (i != 0) {
-				if (options->debug) {
-					debug("v5 afslog (2b) failed to \"%s\"",
-					      cell);
-				}
+				debug("v5 afslog (2b) failed to \"%s\"",
+				      cell);
 			}
-			break;
-		case MINIKAFS_METHOD_RXK5:
+		}
+		break;
+	case MINIKAFS_METHOD_RXK5:
+		if (options->debug) {
+			debug("trying with v5 ticket (rxk5)");
+		}
+		i = minikafs_5log(ctx, ccache, options, cell,
+				  hint_principal, preferred_principal, uid,
+				  1, 0, fetch_only, used, used_size);
+		if (i != 0) {
 			if (options->debug) {
-				debug("trying with v5 ticket (rxk5)");
+				debug("v5 afslog (rxk5) failed to \"%s\"",
+				      cell);
 			}
-			i = minikafs_5log(ctx, ccache, options, cell,
-					  hint_principal, uid, 1, 0);
-			if (i != 0) {
-				if (options->debug) {
-					debug("v5 afslog (rxk5) failed to \"%s\"",
-					      cell);
-				}
+		}
+		break;
+	default:
+		break;
+	}
+	return i;
+}
+
+/* Try to get tokens for the named cell using every available mechanism,
+ * starting with the one which worked the last time, if we remember it.  If
+ * we're only fetching credentials, we only want to know that we could get a
+ * usable credential, and shouldn't be touching the kernel. */
+static int
+minikafs_log_common(krb5_context ctx, krb5_ccache ccache,
+		    struct _pam_krb5_options *options,
+		    const char *cell, const char *hint_principal,
+		    uid_t uid, const int *methods, int n_methods,
+		    int fetch_only)
+{
+	char remembered[PAM_KRB5_CELLCACHE_METHOD_MAX + 1];
+	char preferred[PAM_KRB5_CELLCACHE_PRINCIPAL_MAX + 1];
+	char used[PAM_KRB5_CELLCACHE_PRINCIPAL_MAX + 1];
+	const char *name;
+	int i, method, first, remember;
+
+	if (n_methods == -1) {
+		for (i = 0; methods[i] != 0; i++) {
+			continue;
+		}
+		n_methods = i;
+	}
+	remember = (options->cell_realm_cache != NULL) &&
+		   (options->token_method_ttl > 0);
+	first = -1;
+	memset(preferred, '\0', sizeof(preferred));
+	if (remember &&
+	    (_pam_krb5_cellcache_method_lookup(options->cell_realm_cache,
+					       cell,
+					       remembered,
+					       sizeof(remembered),
+					       preferred,
+					       sizeof(preferred)) == 1)) {
+		for (method = 0; method < n_methods; method++) {
+			if (methods[method] ==
+			    minikafs_method_named(remembered)) {
+				first = method;
+				break;
 			}
-			break;
-		default:
-			break;
 		}
-		if (i == 0) {
-			break;
+	}
+
+	i = -1;
+	method = first;
+	memset(used, '\0', sizeof(used));
+	if (first != -1) {
+		if (options->debug) {
+			debug("trying remembered method \"%s\" first for "
+			      "\"%s\"", remembered, cell);
 		}
+		i = minikafs_log_method(ctx, ccache, options, cell,
+					hint_principal, preferred, uid,
+					methods[first], fetch_only,
+					used, sizeof(used));
 	}
-	if (method < n_methods) {
+	if (i != 0) {
+		for (method = 0; method < n_methods; method++) {
+			if (method == first) {
+				continue;
+			}
+			memset(used, '\0', sizeof(used));
+			i = minikafs_log_method(ctx, ccache, options, cell,
+						hint_principal, NULL, uid,
+						methods[method], fetch_only,
+						used, sizeof(used));
+			if (i == 0) {
+				break;
+			}
+		}
+	}
+
+	/* Remember what worked, if it isn't what we already knew about, or
+	 * that nothing did.  Just fetching credentials doesn't tell us
+	 * whether or not we'll be able to use them. */
+	if (remember && !fetch_only &&
+	    ((i != 0) ||
+	     (method != first) ||
+	     (strcmp(used, preferred) != 0))) {
+		name = (i == 0) ? minikafs_method_name(methods[method]) : NULL;
+		_pam_krb5_cellcache_method_add(options->cell_realm_cache, cell,
+					       name,
+					       (used[0] != '\0') ? used : NULL,
+					       options->token_method_ttl,
+					       PAM_KRB5_CELLCACHE_METHOD_FAILURES,
+					       options->debug);
+	}
+	if (i == 0) {
 		if (options->debug) {
-			debug("got tokens for cell \"%s\"", cell);
+			debug("got %s for cell \"%s\"",
+			      fetch_only ? "credentials" : "tokens",
+			      cell);
 		}
 		return 0;
 	} else {
@@ -1471,6 +1884,28 @@ minikafs_log(krb5_context ctx, krb5_ccache ccache,
 	}
 }
 
+int
+minikafs_log(krb5_context ctx, krb5_ccache ccache,
+	     struct _pam_krb5_options *options,
+	     const char *cell, const char *hint_principal,
+	     uid_t uid, const int *methods, int n_methods)
+{
+	return minikafs_log_common(ctx, ccache, options, cell, hint_principal,
+				   uid, methods, n_methods, 0);
+}
+
+/* Get the credentials which minikafs_log() would use to get tokens for the
+ * named cell into the ccache, without setting any tokens. */
+int
+minikafs_fetch(krb5_context ctx, krb5_ccache ccache,
+	       struct _pam_krb5_options *options,
+	       const char *cell, const char *hint_principal,
+	       uid_t uid, const int *methods, int n_methods)
+{
+	return minikafs_log_common(ctx, ccache, options, cell, hint_principal,
+				   uid, methods, n_methods, 1);
+}
+
 /* We do the XDR here to avoid deps on what might not be a standard part of
  * glibc, and we don't need the decode or free functionality. */
 static int
@@ -1684,7 +2119,6 @@ encode_token_union(char *buffer, krb5_creds *creds, int token_union_type,
 static int
 minikafs_5settoken2(const char *cell, krb5_creds *creds, int32_t uid)
 {
-	struct minikafs_ioblock iob;
 	int i, bufsize, token_union_size;
 	char *buffer, *bufptr;
 
@@ -1705,11 +2139,8 @@ minikafs_5settoken2(const char *cell, krb5_creds *creds, int32_t uid)
 		bufptr += encode_int32(bufptr, token_union_size); /* size of token */
 		bufptr += encode_token_union(bufptr, creds, AFSTOKEN_UNION_K5,
 					     uid); /* token */
-		iob.in = buffer;
-		iob.insize = bufptr - buffer;
-		iob.out = NULL;
-		iob.outsize = 0;
-		i = minikafs_pioctl(NULL, minikafs_pioctl_settoken2, &iob);
+		i = minikafs_backend->settoken(minikafs_backend->data, cell, 2,
+					       buffer, bufptr - buffer);
 		free(buffer);
 	}
 	return i;
@@ -36,6 +36,42 @@
 #include "options.h"
 #include "stash.h"
 
+/* The AFS client operations we use.  By default we talk to the kernel
+ * module through its ioctl file or the AFS syscall, but an implementation
+ * which doesn't need a client can be substituted for testing. */
+enum minikafs_backend_pioctl {
+	minikafs_backend_cell_of_file,
+	minikafs_backend_unlog,
+	minikafs_backend_get_property,
+	/* Store the calling process's PAG, as an unsigned long, in "out". */
+	minikafs_backend_get_pag,
+};
+struct minikafs_backend {
+	const char *name;
+	/* Return 1 if the client is there, 0 if it isn't. */
+	int (*has_afs)(void *data);
+	/* Everything else returns 0 on success, -1 and sets errno on
+	 * failure. */
+	int (*pioctl)(void *data, enum minikafs_backend_pioctl what,
+		      const char *path, const char *in, size_t insize,
+		      char *out, size_t outsize);
+	int (*setpag)(void *data);
+	/* "version" is 1 for an old-style rxkad token, 2 for an XDR-encoded
+	 * settoken2 buffer. */
+	int (*settoken)(void *data, const char *cell, int version,
+			const void *token, size_t length);
+	/* Fill "addresses" with the IPv4 addresses, in network byte order,
+	 * of the servers for "path", failing with E2BIG if it's too small. */
+	int (*whereis)(void *data, const char *path,
+		       void *addresses, size_t size);
+	int (*wscell)(void *data, char *cell, size_t length);
+	void *data;
+};
+
+/* Switch to a different backend, or back to the kernel if "backend" is
+ * NULL. */
+void minikafs_set_backend(const struct minikafs_backend *backend);
+
 /* Determine if AFS is running. */
 int minikafs_has_afs(void);
 
@@ -49,6 +85,9 @@ int minikafs_cell_of_file_walk_up(const char *file, char *cell, size_t length);
 /* Create a new PAG. */
 int minikafs_setpag(void);
 
+/* Identify the PAG we're in.  Returns 0 on success. */
+int minikafs_pag(unsigned long *pag);
+
 /* Figure out which cell the workstation is in. */
 int minikafs_ws_cell(char *cell, size_t length);
 
@@ -65,4 +104,11 @@ int minikafs_log(krb5_context ctx, krb5_ccache ccache,
 		 const char *cell, const char *hint_principal,
 		 uid_t uid, const int *methods, int n_methods);
 
+/* Get the credentials minikafs_log() would use into the ccache, but don't set
+ * any tokens. */
+int minikafs_fetch(krb5_context ctx, krb5_ccache ccache,
+		   struct _pam_krb5_options *options,
+		   const char *cell, const char *hint_principal,
+		   uid_t uid, const int *methods, int n_methods);
+
 #endif
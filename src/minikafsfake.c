@@ -0,0 +1,511 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <errno.h>
+#ifdef HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
+#ifdef HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#include KRB5_H
+
+#include "minikafsfake.h"
+#include "xstr.h"
+
+struct minikafs_fake_token {
+	char *cell;
+	unsigned long pag;
+	int version;
+	struct minikafs_fake_token *next;
+};
+
+struct minikafs_fake_cell {
+	char *cell;
+	uint32_t address;
+	struct minikafs_fake_cell *next;
+};
+
+struct minikafs_fake {
+	char *ws_cell;
+	struct minikafs_fake_cell *cells;
+	struct minikafs_fake_token *tokens;
+	unsigned long pag, next_pag;
+	unsigned long latency[minikafs_fake_n_ops];
+	unsigned long calls[minikafs_fake_n_ops];
+};
+
+struct minikafs_fake *
+minikafs_fake_new(const char *ws_cell)
+{
+	struct minikafs_fake *fake;
+
+	fake = malloc(sizeof(*fake));
+	if (fake == NULL) {
+		return NULL;
+	}
+	memset(fake, 0, sizeof(*fake));
+	fake->ws_cell = xstrdup(ws_cell);
+	if (fake->ws_cell == NULL) {
+		free(fake);
+		return NULL;
+	}
+	fake->next_pag = 1;
+	if (minikafs_fake_add_cell(fake, ws_cell, 0) != 0) {
+		minikafs_fake_free(fake);
+		return NULL;
+	}
+	return fake;
+}
+
+static void
+minikafs_fake_forget_tokens(struct minikafs_fake *fake, unsigned long pag)
+{
+	struct minikafs_fake_token **token, *next;
+
+	token = &fake->tokens;
+	while (*token != NULL) {
+		if ((*token)->pag == pag) {
+			next = (*token)->next;
+			xstrfree((*token)->cell);
+			free(*token);
+			*token = next;
+		} else {
+			token = &(*token)->next;
+		}
+	}
+}
+
+void
+minikafs_fake_free(struct minikafs_fake *fake)
+{
+	struct minikafs_fake_cell *cell;
+	struct minikafs_fake_token *token;
+
+	while (fake->cells != NULL) {
+		cell = fake->cells;
+		fake->cells = cell->next;
+		xstrfree(cell->cell);
+		free(cell);
+	}
+	while (fake->tokens != NULL) {
+		token = fake->tokens;
+		fake->tokens = token->next;
+		xstrfree(token->cell);
+		free(token);
+	}
+	xstrfree(fake->ws_cell);
+	free(fake);
+}
+
+static struct minikafs_fake_cell *
+minikafs_fake_find_cell(struct minikafs_fake *fake, const char *cell,
+			size_t length)
+{
+	struct minikafs_fake_cell *c;
+
+	for (c = fake->cells; c != NULL; c = c->next) {
+		if ((strlen(c->cell) == length) &&
+		    (strncmp(c->cell, cell, length) == 0)) {
+			return c;
+		}
+	}
+	return NULL;
+}
+
+int
+minikafs_fake_add_cell(struct minikafs_fake *fake, const char *cell,
+		       uint32_t address)
+{
+	struct minikafs_fake_cell *c;
+
+	c = minikafs_fake_find_cell(fake, cell, strlen(cell));
+	if (c != NULL) {
+		c->address = address;
+		return 0;
+	}
+	c = malloc(sizeof(*c));
+	if (c == NULL) {
+		return -1;
+	}
+	c->cell = xstrdup(cell);
+	if (c->cell == NULL) {
+		free(c);
+		return -1;
+	}
+	c->address = address;
+	c->next = fake->cells;
+	fake->cells = c;
+	return 0;
+}
+
+void
+minikafs_fake_set_latency(struct minikafs_fake *fake,
+			  enum minikafs_fake_op op, unsigned long usec)
+{
+	if ((op >= 0) && (op < minikafs_fake_n_ops)) {
+		fake->latency[op] = usec;
+	}
+}
+
+int
+minikafs_fake_tokens(struct minikafs_fake *fake, const char *cell,
+		     int *version)
+{
+	struct minikafs_fake_token *token;
+	int count;
+
+	count = 0;
+	for (token = fake->tokens; token != NULL; token = token->next) {
+		if ((token->pag == fake->pag) &&
+		    (strcmp(token->cell, cell) == 0)) {
+			if ((count == 0) && (version != NULL)) {
+				*version = token->version;
+			}
+			count++;
+		}
+	}
+	return count;
+}
+
+unsigned long
+minikafs_fake_calls(struct minikafs_fake *fake, enum minikafs_fake_op op)
+{
+	if ((op >= 0) && (op < minikafs_fake_n_ops)) {
+		return fake->calls[op];
+	}
+	return 0;
+}
+
+void
+minikafs_fake_reset_calls(struct minikafs_fake *fake)
+{
+	memset(fake->calls, 0, sizeof(fake->calls));
+}
+
+#ifdef HAVE_PTHREAD_CREATE
+/* Token fetching workers make calls from more than one thread. */
+static pthread_mutex_t minikafs_fake_calls_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Note the call, and take as long as we've been told to. */
+static void
+minikafs_fake_call(struct minikafs_fake *fake, enum minikafs_fake_op op)
+{
+	struct timespec delay;
+
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_lock(&minikafs_fake_calls_lock);
+#endif
+	fake->calls[op]++;
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_unlock(&minikafs_fake_calls_lock);
+#endif
+	if (fake->latency[op] > 0) {
+		delay.tv_sec = fake->latency[op] / 1000000;
+		delay.tv_nsec = (fake->latency[op] % 1000000) * 1000;
+		while ((nanosleep(&delay, &delay) == -1) && (errno == EINTR)) {
+			continue;
+		}
+	}
+}
+
+/* Figure out which cell a path is in. */
+static struct minikafs_fake_cell *
+minikafs_fake_cell_of_path(struct minikafs_fake *fake, const char *path)
+{
+	const char *cell;
+	size_t length;
+
+	if ((path == NULL) || (strncmp(path, "/afs", 4) != 0) ||
+	    ((path[4] != '\0') && (path[4] != '/'))) {
+		return NULL;
+	}
+	cell = path + 4 + strspn(path + 4, "/");
+	if (*cell == '.') {
+		cell++;
+	}
+	length = strcspn(cell, "/");
+	if (length == 0) {
+		return minikafs_fake_find_cell(fake, fake->ws_cell,
+					       strlen(fake->ws_cell));
+	}
+	return minikafs_fake_find_cell(fake, cell, length);
+}
+
+static int
+minikafs_fake_has_afs(void *data)
+{
+	return 1;
+}
+
+static int
+minikafs_fake_pioctl(void *data, enum minikafs_backend_pioctl what,
+		     const char *path, const char *in, size_t insize,
+		     char *out, size_t outsize)
+{
+	struct minikafs_fake *fake = data;
+	struct minikafs_fake_cell *cell;
+
+	minikafs_fake_call(fake, minikafs_fake_op_pioctl);
+	switch (what) {
+	case minikafs_backend_cell_of_file:
+		cell = minikafs_fake_cell_of_path(fake, path);
+		if (cell == NULL) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (strlen(cell->cell) + 1 > outsize) {
+			errno = E2BIG;
+			return -1;
+		}
+		strcpy(out, cell->cell);
+		return 0;
+		break;
+	case minikafs_backend_unlog:
+		minikafs_fake_forget_tokens(fake, fake->pag);
+		return 0;
+		break;
+	case minikafs_backend_get_pag:
+		if (outsize < sizeof(fake->pag)) {
+			errno = E2BIG;
+			return -1;
+		}
+		memcpy(out, &fake->pag, sizeof(fake->pag));
+		return 0;
+		break;
+	default:
+		break;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+static int
+minikafs_fake_setpag(void *data)
+{
+	struct minikafs_fake *fake = data;
+
+	minikafs_fake_call(fake, minikafs_fake_op_setpag);
+	fake->pag = fake->next_pag++;
+	return 0;
+}
+
+static uint32_t
+minikafs_fake_get32(const unsigned char *p)
+{
+	uint32_t u;
+
+	memcpy(&u, p, 4);
+	return ntohl(u);
+}
+
+/* Check that an old-style token is laid out the way the cache manager
+ * expects: ticket, our half of the token, flags, and cell name. */
+static int
+minikafs_fake_check_token(const char *cell, const unsigned char *token,
+			  size_t length)
+{
+	uint32_t size;
+	size_t offset;
+
+	offset = 0;
+	if (length < offset + 4) {
+		return -1;
+	}
+	memcpy(&size, token + offset, 4);
+	offset += 4 + size;
+	if (length < offset + 4) {
+		return -1;
+	}
+	memcpy(&size, token + offset, 4);
+	offset += 4 + size + 4;
+	if ((length != offset + strlen(cell) + 1) ||
+	    (memcmp(token + offset, cell, strlen(cell) + 1) != 0)) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Check the XDR-encoded settoken2 structure: flags, cell name, and a
+ * counted list of tokens, each of which is a sized union. */
+static int
+minikafs_fake_check_token2(const char *cell, const unsigned char *token,
+			   size_t length)
+{
+	uint32_t size, n_tokens, i;
+	size_t offset;
+
+	offset = 4;
+	if (length < offset + 4) {
+		return -1;
+	}
+	size = minikafs_fake_get32(token + offset);
+	offset += 4;
+	if ((size != strlen(cell)) || (length < offset + size) ||
+	    (memcmp(token + offset, cell, size) != 0)) {
+		return -1;
+	}
+	offset += size + ((size % 4) ? (4 - (size % 4)) : 0);
+	if (length < offset + 4) {
+		return -1;
+	}
+	n_tokens = minikafs_fake_get32(token + offset);
+	offset += 4;
+	for (i = 0; i < n_tokens; i++) {
+		if (length < offset + 8) {
+			return -1;
+		}
+		size = minikafs_fake_get32(token + offset);
+		offset += 4;
+		if ((size < 4) || (length < offset + size) ||
+		    (minikafs_fake_get32(token + offset) == 0)) {
+			return -1;
+		}
+		offset += size;
+	}
+	return (n_tokens > 0) && (offset == length) ? 0 : -1;
+}
+
+static int
+minikafs_fake_settoken(void *data, const char *cell, int version,
+		       const void *token, size_t length)
+{
+	struct minikafs_fake *fake = data;
+	struct minikafs_fake_token *t;
+	int i;
+
+	minikafs_fake_call(fake, minikafs_fake_op_settoken);
+	if (minikafs_fake_find_cell(fake, cell, strlen(cell)) == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+	switch (version) {
+	case 1:
+		i = minikafs_fake_check_token(cell, token, length);
+		break;
+	case 2:
+		i = minikafs_fake_check_token2(cell, token, length);
+		break;
+	default:
+		i = -1;
+		break;
+	}
+	if (i != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	t = malloc(sizeof(*t));
+	if (t == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	t->cell = xstrdup(cell);
+	if (t->cell == NULL) {
+		free(t);
+		errno = ENOMEM;
+		return -1;
+	}
+	t->pag = fake->pag;
+	t->version = version;
+	t->next = fake->tokens;
+	fake->tokens = t;
+	return 0;
+}
+
+static int
+minikafs_fake_whereis(void *data, const char *path, void *addresses,
+		      size_t size)
+{
+	struct minikafs_fake *fake = data;
+	struct minikafs_fake_cell *cell;
+
+	minikafs_fake_call(fake, minikafs_fake_op_whereis);
+	cell = minikafs_fake_cell_of_path(fake, path);
+	if ((cell == NULL) || (cell->address == 0)) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (size < 2 * sizeof(cell->address)) {
+		errno = E2BIG;
+		return -1;
+	}
+	memset(addresses, 0, size);
+	memcpy(addresses, &cell->address, sizeof(cell->address));
+	return 0;
+}
+
+static int
+minikafs_fake_wscell(void *data, char *cell, size_t length)
+{
+	struct minikafs_fake *fake = data;
+
+	minikafs_fake_call(fake, minikafs_fake_op_wscell);
+	if (strlen(fake->ws_cell) + 1 > length) {
+		errno = E2BIG;
+		return -1;
+	}
+	strcpy(cell, fake->ws_cell);
+	return 0;
+}
+
+void
+minikafs_fake_backend(struct minikafs_fake *fake,
+		      struct minikafs_backend *backend)
+{
+	memset(backend, 0, sizeof(*backend));
+	backend->name = "fake";
+	backend->has_afs = minikafs_fake_has_afs;
+	backend->pioctl = minikafs_fake_pioctl;
+	backend->setpag = minikafs_fake_setpag;
+	backend->settoken = minikafs_fake_settoken;
+	backend->whereis = minikafs_fake_whereis;
+	backend->wscell = minikafs_fake_wscell;
+	backend->data = fake;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef pam_krb5_minikafsfake_h
+#define pam_krb5_minikafsfake_h
+
+#include "minikafs.h"
+
+/* A stand-in for an AFS client, for exercising and timing the token code on
+ * systems which don't have one.  It knows about a list of cells, answers
+ * questions about them, and keeps the tokens it's given instead of handing
+ * them to a cache manager.  Paths under /afs/<cell> are in that cell, and
+ * /afs itself is in the workstation's cell. */
+
+enum minikafs_fake_op {
+	minikafs_fake_op_pioctl,
+	minikafs_fake_op_setpag,
+	minikafs_fake_op_settoken,
+	minikafs_fake_op_whereis,
+	minikafs_fake_op_wscell,
+	minikafs_fake_n_ops,
+};
+
+struct minikafs_fake;
+
+/* Create a fake client whose workstation cell is "ws_cell". */
+struct minikafs_fake *minikafs_fake_new(const char *ws_cell);
+void minikafs_fake_free(struct minikafs_fake *fake);
+
+/* Add a cell.  If "address" is not zero, it's the address (in network byte
+ * order) of the cell's file server. */
+int minikafs_fake_add_cell(struct minikafs_fake *fake, const char *cell,
+			   uint32_t address);
+
+/* Make every call of the given kind take at least "usec" microseconds. */
+void minikafs_fake_set_latency(struct minikafs_fake *fake,
+			       enum minikafs_fake_op op, unsigned long usec);
+
+/* Fill in a backend which uses the fake client. */
+void minikafs_fake_backend(struct minikafs_fake *fake,
+			   struct minikafs_backend *backend);
+
+/* Count the tokens we've been given for a cell in the current PAG, and note
+ * the version of the last one (1 for rxkad, 2 for settoken2). */
+int minikafs_fake_tokens(struct minikafs_fake *fake, const char *cell,
+			 int *version);
+
+/* Count the calls of a given kind which have been made, and forget about
+ * them. */
+unsigned long minikafs_fake_calls(struct minikafs_fake *fake,
+				  enum minikafs_fake_op op);
+void minikafs_fake_reset_calls(struct minikafs_fake *fake);
+
+#endif
@@ -0,0 +1,400 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#include KRB5_H
+
+#include "cachedir.h"
+#include "log.h"
+#include "negcache.h"
+
+/* The cache is a single file holding a header and a fixed number of
+ * fixed-size slots.  A principal can live in any of the NEGCACHE_PROBES
+ * slots which follow the one its name hashes to, so the file never grows
+ * past the size it was created with, and when those slots are all in use,
+ * the entry which is closest to expiring is replaced.  Integers are stored
+ * in host byte order, because the file is never shared between hosts. */
+#define NEGCACHE_FILE		"unknown_principals"
+#define NEGCACHE_MAGIC		0x504b354e
+#define NEGCACHE_VERSION	1
+#define NEGCACHE_PROBES		8
+#define NEGCACHE_MAX_SLOTS	0x10000
+
+struct negcache_header {
+	uint32_t magic, version, slots, reserved;
+};
+
+struct negcache_slot {
+	uint32_t hash, expires;
+	char name[PAM_KRB5_NEGCACHE_NAME_MAX + 1];
+};
+
+static char *
+negcache_path(const char *dir)
+{
+	char *path;
+
+	path = malloc(strlen(dir) + 1 + strlen(NEGCACHE_FILE) + 1);
+	if (path != NULL) {
+		sprintf(path, "%s/%s", dir, NEGCACHE_FILE);
+	}
+	return path;
+}
+
+/* Read the header from a locked cache file, and check that the file is the
+ * size that it says it should be. */
+static int
+negcache_header_ok(int fd, struct negcache_header *header)
+{
+	struct stat st;
+
+	return (pread(fd, header, sizeof(*header), 0) == sizeof(*header)) &&
+	       (header->magic == NEGCACHE_MAGIC) &&
+	       (header->version == NEGCACHE_VERSION) &&
+	       (header->slots != 0) &&
+	       (header->slots <= NEGCACHE_MAX_SLOTS) &&
+	       (fstat(fd, &st) == 0) &&
+	       (st.st_size == (off_t) (sizeof(*header) +
+				       header->slots *
+				       sizeof(struct negcache_slot)));
+}
+
+/* Open the cache file and read its header, returning the descriptor with
+ * a lock held on it, or -1 if it's missing, untrustworthy, or not in the
+ * format we expect. */
+static int
+negcache_open(const char *dir, int writing, struct negcache_header *header)
+{
+	struct stat st;
+	char *path;
+	int fd, flags;
+
+	if (!_pam_krb5_cachedir_ok(dir, writing)) {
+		return -1;
+	}
+	path = negcache_path(dir);
+	if (path == NULL) {
+		return -1;
+	}
+	flags = writing ? O_RDWR : O_RDONLY;
+#ifdef O_NOFOLLOW
+	flags |= O_NOFOLLOW;
+#endif
+	fd = open(path, flags);
+	free(path);
+	if (fd == -1) {
+		return -1;
+	}
+	if ((fstat(fd, &st) != 0) ||
+	    !S_ISREG(st.st_mode) ||
+	    ((st.st_uid != 0) && (st.st_uid != geteuid())) ||
+	    ((st.st_mode & (S_IWGRP | S_IWOTH)) != 0) ||
+	    (_pam_krb5_cachedir_lock(fd, writing ? F_WRLCK : F_RDLCK) != 0) ||
+	    !negcache_header_ok(fd, header)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static off_t
+negcache_offset(const struct negcache_header *header, uint32_t slot)
+{
+	return sizeof(*header) +
+	       (off_t) (slot % header->slots) * sizeof(struct negcache_slot);
+}
+
+/* Find the slot which holds "principal", live or not. */
+static int
+negcache_find(int fd, const struct negcache_header *header,
+	      const char *principal, uint32_t *which,
+	      struct negcache_slot *slot)
+{
+	uint32_t hash, i;
+
+	hash = _pam_krb5_cachedir_hash(principal);
+	for (i = 0; (i < NEGCACHE_PROBES) && (i < header->slots); i++) {
+		if (pread(fd, slot, sizeof(*slot),
+			  negcache_offset(header, hash + i)) != sizeof(*slot)) {
+			return -1;
+		}
+		if ((slot->hash == hash) &&
+		    (slot->name[sizeof(slot->name) - 1] == '\0') &&
+		    (strcmp(slot->name, principal) == 0)) {
+			*which = hash + i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Check if the KDC recently told us that "principal" doesn't exist. */
+int
+_pam_krb5_negcache_check(const char *dir, const char *principal,
+			 int verbose)
+{
+	struct negcache_header header;
+	struct negcache_slot slot;
+	uint32_t which;
+	int fd, ret;
+
+	if (strlen(principal) > PAM_KRB5_NEGCACHE_NAME_MAX) {
+		return 0;
+	}
+	fd = negcache_open(dir, 0, &header);
+	if (fd == -1) {
+		if (verbose) {
+			debug("no usable unknown principal cache in \"%s\"",
+			      dir);
+		}
+		return 0;
+	}
+	ret = (negcache_find(fd, &header, principal, &which, &slot) == 0) &&
+	      (slot.expires > (uint32_t) time(NULL));
+	close(fd);
+	return ret;
+}
+
+/* Remember that "principal" doesn't exist for "ttl" seconds.  If the file
+ * doesn't exist yet, or is unusable, start it over with "size" slots.  A
+ * file which already exists keeps the number of slots it was created with,
+ * since realms which share a directory may not agree about the size. */
+int
+_pam_krb5_negcache_add(const char *dir, const char *principal,
+		       time_t ttl, unsigned int size, int verbose)
+{
+	struct negcache_header header;
+	struct negcache_slot slot, victim;
+	uint32_t hash, i, which;
+	time_t now;
+	char *path;
+	int fd, flags;
+
+	if ((ttl <= 0) || (size == 0) ||
+	    (strlen(principal) > PAM_KRB5_NEGCACHE_NAME_MAX)) {
+		return -1;
+	}
+	if (size > NEGCACHE_MAX_SLOTS) {
+		size = NEGCACHE_MAX_SLOTS;
+	}
+	fd = negcache_open(dir, 1, &header);
+	if (fd == -1) {
+		if (!_pam_krb5_cachedir_ok(dir, 1)) {
+			return -1;
+		}
+		path = negcache_path(dir);
+		if (path == NULL) {
+			return -1;
+		}
+		flags = O_RDWR | O_CREAT;
+#ifdef O_NOFOLLOW
+		flags |= O_NOFOLLOW;
+#endif
+		fd = open(path, flags, S_IRUSR | S_IWUSR);
+		if ((fd == -1) ||
+		    (_pam_krb5_cachedir_lock(fd, F_WRLCK) != 0)) {
+			if (fd != -1) {
+				close(fd);
+			}
+			free(path);
+			return -1;
+		}
+		/* Someone else may have set it up while we waited for the
+		 * lock, in which case we use the size they picked. */
+		if (!negcache_header_ok(fd, &header)) {
+			if (verbose) {
+				debug("initializing unknown principal cache "
+				      "\"%s\" with %u slots", path, size);
+			}
+			memset(&header, 0, sizeof(header));
+			header.magic = NEGCACHE_MAGIC;
+			header.version = NEGCACHE_VERSION;
+			header.slots = size;
+			if ((fchmod(fd, S_IRUSR | S_IWUSR) != 0) ||
+			    (ftruncate(fd, 0) != 0) ||
+			    (ftruncate(fd, negcache_offset(&header, 0) +
+				       (off_t) size * sizeof(slot)) != 0) ||
+			    (pwrite(fd, &header, sizeof(header), 0) !=
+			     sizeof(header))) {
+				close(fd);
+				free(path);
+				return -1;
+			}
+		}
+		free(path);
+	}
+
+	/* Reuse the principal's slot, or an empty or expired one, or else
+	 * the one which would have expired soonest. */
+	now = time(NULL);
+	if (negcache_find(fd, &header, principal, &which, &slot) != 0) {
+		hash = _pam_krb5_cachedir_hash(principal);
+		which = hash;
+		memset(&victim, 0, sizeof(victim));
+		victim.expires = 0xffffffff;
+		for (i = 0; (i < NEGCACHE_PROBES) && (i < header.slots); i++) {
+			if (pread(fd, &slot, sizeof(slot),
+				  negcache_offset(&header, hash + i)) !=
+			    sizeof(slot)) {
+				close(fd);
+				return -1;
+			}
+			if (slot.expires <= (uint32_t) now) {
+				which = hash + i;
+				break;
+			}
+			if (slot.expires < victim.expires) {
+				victim = slot;
+				which = hash + i;
+			}
+		}
+	}
+	memset(&slot, 0, sizeof(slot));
+	slot.hash = _pam_krb5_cachedir_hash(principal);
+	slot.expires = now + ttl;
+	strcpy(slot.name, principal);
+	if (pwrite(fd, &slot, sizeof(slot), negcache_offset(&header, which)) !=
+	    sizeof(slot)) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	if (verbose) {
+		debug("remembering that \"%s\" is unknown for %ld seconds",
+		      principal, (long) ttl);
+	}
+	return 0;
+}
+
+/* Forget about one principal, or about all of them. */
+int
+_pam_krb5_negcache_flush(const char *dir, const char *principal)
+{
+	struct negcache_header header;
+	struct negcache_slot slot;
+	uint32_t which;
+	char *path;
+	int fd, ret;
+
+	if (!_pam_krb5_cachedir_ok(dir, 1)) {
+		return -1;
+	}
+	path = negcache_path(dir);
+	if (path == NULL) {
+		return -1;
+	}
+	if (principal == NULL) {
+		ret = unlink(path);
+	} else {
+		ret = access(path, F_OK);
+	}
+	free(path);
+	if ((ret != 0) && (errno == ENOENT)) {
+		/* Nothing to forget. */
+		return 0;
+	}
+	if ((ret != 0) || (principal == NULL)) {
+		return ret;
+	}
+	fd = negcache_open(dir, 1, &header);
+	if (fd == -1) {
+		return -1;
+	}
+	ret = 0;
+	if (negcache_find(fd, &header, principal, &which, &slot) == 0) {
+		memset(&slot, 0, sizeof(slot));
+		if (pwrite(fd, &slot, sizeof(slot),
+			   negcache_offset(&header, which)) != sizeof(slot)) {
+			ret = -1;
+		}
+	}
+	close(fd);
+	return ret;
+}
+
+/* Call "callback" for each live entry. */
+int
+_pam_krb5_negcache_list(const char *dir,
+			int (*callback)(const struct _pam_krb5_negcache_entry *entry,
+					void *data),
+			void *data)
+{
+	struct _pam_krb5_negcache_entry entry;
+	struct negcache_header header;
+	struct negcache_slot slot;
+	uint32_t i, now;
+	int fd, ret;
+
+	fd = negcache_open(dir, 0, &header);
+	if (fd == -1) {
+		return -1;
+	}
+	now = time(NULL);
+	ret = 0;
+	for (i = 0; (i < header.slots) && (ret == 0); i++) {
+		if (pread(fd, &slot, sizeof(slot),
+			  negcache_offset(&header, i)) != sizeof(slot)) {
+			ret = -1;
+			break;
+		}
+		if ((slot.expires <= now) ||
+		    (slot.name[sizeof(slot.name) - 1] != '\0')) {
+			continue;
+		}
+		entry.principal = slot.name;
+		entry.expires = slot.expires;
+		ret = callback(&entry, data);
+	}
+	close(fd);
+	return ret;
+}
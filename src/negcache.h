@@ -0,0 +1,58 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef pam_krb5_negcache_h
+#define pam_krb5_negcache_h
+
+/* Defaults for "negative_cache_ttl" and "negative_cache_size". */
+#define DEFAULT_NEGATIVE_CACHE_TTL 300
+#define DEFAULT_NEGATIVE_CACHE_SIZE 1024
+
+/* The longest principal name which we'll remember. */
+#define PAM_KRB5_NEGCACHE_NAME_MAX 247
+
+struct _pam_krb5_negcache_entry {
+	const char *principal;
+	time_t expires;
+};
+
+int _pam_krb5_negcache_check(const char *dir, const char *principal,
+			     int verbose);
+int _pam_krb5_negcache_add(const char *dir, const char *principal,
+			   time_t ttl, unsigned int size, int verbose);
+int _pam_krb5_negcache_flush(const char *dir, const char *principal);
+int _pam_krb5_negcache_list(const char *dir,
+			    int (*callback)(const struct _pam_krb5_negcache_entry *entry,
+					    void *data),
+			    void *data);
+
+#endif
@@ -55,6 +55,11 @@
 #include "minikafs.h"
 #include "tokens.h"
 
+void
+minikafs_set_backend(const struct minikafs_backend *backend)
+{
+}
+
 int
 minikafs_has_afs(void)
 {
@@ -80,6 +85,12 @@ minikafs_setpag(void)
 	return -1;
 }
 
+int
+minikafs_pag(unsigned long *pag)
+{
+	return -1;
+}
+
 int
 minikafs_unlog(void)
 {
@@ -95,12 +106,35 @@ minikafs_log(krb5_context ctx, krb5_ccache ccache,
 	return -1;
 }
 
+int
+minikafs_fetch(krb5_context ctx, krb5_ccache ccache,
+	       struct _pam_krb5_options *options,
+	       const char *cell, const char *hint_principal,
+	       uid_t uid, const int *methods, int n_methods)
+{
+	return -1;
+}
+
 int
 tokens_useful()
 {
 	return 0;
 }
 
+void
+tokens_fetch(krb5_context context, krb5_ccache ccache, krb5_creds *tgt,
+	     struct _pam_krb5_options *options,
+	     struct tokens_cell *cells, int n_cells, uid_t uid,
+	     const int *methods, int n_methods, int max_workers)
+{
+	int i;
+
+	for (i = 0; i < n_cells; i++) {
+		cells[i].fetched = 0;
+		cells[i].fetch_usec = 0;
+	}
+}
+
 int
 tokens_obtain(krb5_context context, struct _pam_krb5_stash *stash,
 	      struct _pam_krb5_options *options,
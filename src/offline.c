@@ -0,0 +1,307 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#include KRB5_H
+
+#include "cachedir.h"
+#include "log.h"
+#include "offline.h"
+#include "storetmp.h"
+
+/* Each principal's verifier lives in a fixed-size record in its own file.
+ * The verifier is PBKDF2 applied to the password with a random salt, which
+ * we get libkrb5 to compute for us by asking for an AES key with a large
+ * iteration count.  Integers are stored in host byte order, because the
+ * records are never shared between hosts. */
+#define OFFLINE_MAGIC		0x504b354c
+#define OFFLINE_VERSION		1
+#define OFFLINE_ITERATIONS	100000
+#define OFFLINE_SALT_SIZE	16
+#define OFFLINE_VERIFIER_SIZE	32
+#define OFFLINE_NAME_MAX	255
+
+struct offline_record {
+	uint32_t magic, version, iterations;
+	int32_t stored, expires;
+	unsigned char salt[OFFLINE_SALT_SIZE];
+	unsigned char verifier[OFFLINE_VERIFIER_SIZE];
+	char principal[OFFLINE_NAME_MAX + 1];
+};
+
+static char *
+offline_path(const char *dir, const char *principal)
+{
+	uint32_t hash;
+	char *path;
+
+	hash = _pam_krb5_cachedir_hash(principal);
+	path = malloc(strlen(dir) + strlen("/offline_") + 8 + 1);
+	if (path != NULL) {
+		sprintf(path, "%s/offline_%08lx", dir, (unsigned long) hash);
+	}
+	return path;
+}
+
+static int
+offline_derive(krb5_context ctx, const char *password,
+	       const unsigned char *salt, uint32_t iterations,
+	       unsigned char *verifier)
+{
+#if defined(HAVE_KRB5_C_STRING_TO_KEY_WITH_PARAMS) && \
+    defined(ENCTYPE_AES256_CTS_HMAC_SHA1_96) && \
+    defined(HAVE_KRB5_KEYBLOCK_LENGTH) && \
+    defined(HAVE_KRB5_KEYBLOCK_CONTENTS)
+	krb5_data pw, s, params;
+	krb5_keyblock key;
+	unsigned char count[4];
+	int ret;
+
+	pw.data = (char *) password;
+	pw.length = strlen(password);
+	s.data = (char *) salt;
+	s.length = OFFLINE_SALT_SIZE;
+	count[0] = (iterations >> 24) & 0xff;
+	count[1] = (iterations >> 16) & 0xff;
+	count[2] = (iterations >> 8) & 0xff;
+	count[3] = iterations & 0xff;
+	params.data = (char *) count;
+	params.length = sizeof(count);
+	memset(&key, 0, sizeof(key));
+	if (krb5_c_string_to_key_with_params(ctx,
+					     ENCTYPE_AES256_CTS_HMAC_SHA1_96,
+					     &pw, &s, &params, &key) != 0) {
+		return -1;
+	}
+	ret = -1;
+	if (key.length == OFFLINE_VERIFIER_SIZE) {
+		memcpy(verifier, key.contents, OFFLINE_VERIFIER_SIZE);
+		ret = 0;
+	}
+	krb5_free_keyblock_contents(ctx, &key);
+	return ret;
+#else
+	return -1;
+#endif
+}
+
+/* Remember a verifier for the password which was just used to get
+ * credentials which expire at "endtime". */
+int
+_pam_krb5_offline_store(krb5_context ctx, const char *dir,
+			const char *principal, const char *password,
+			krb5_timestamp endtime)
+{
+	struct offline_record record;
+	char *path, *tmp;
+	int fd, ret;
+
+	if ((strlen(principal) > OFFLINE_NAME_MAX) || !_pam_krb5_cachedir_private(dir)) {
+		return -1;
+	}
+	memset(&record, 0, sizeof(record));
+	record.magic = OFFLINE_MAGIC;
+	record.version = OFFLINE_VERSION;
+	record.iterations = OFFLINE_ITERATIONS;
+	record.stored = time(NULL);
+	record.expires = endtime;
+	strcpy(record.principal, principal);
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd == -1) {
+		return -1;
+	}
+	ret = _pam_krb5_read_with_retry(fd, record.salt, sizeof(record.salt));
+	close(fd);
+	if ((ret != sizeof(record.salt)) ||
+	    (offline_derive(ctx, password, record.salt, record.iterations,
+			    record.verifier) != 0)) {
+		memset(&record, 0, sizeof(record));
+		return -1;
+	}
+
+	/* Write a new copy and rename it into place. */
+	path = offline_path(dir, principal);
+	tmp = malloc(strlen(dir) + strlen("/.offline_XXXXXX") + 1);
+	if ((path == NULL) || (tmp == NULL)) {
+		memset(&record, 0, sizeof(record));
+		free(path);
+		free(tmp);
+		return -1;
+	}
+	sprintf(tmp, "%s/.offline_XXXXXX", dir);
+	fd = mkstemp(tmp);
+	ret = -1;
+	if (fd != -1) {
+		if ((fchmod(fd, S_IRUSR | S_IWUSR) == 0) &&
+		    (_pam_krb5_write_with_retry(fd, (unsigned char *) &record,
+						sizeof(record)) ==
+		     sizeof(record))) {
+			ret = 0;
+		}
+		if (close(fd) != 0) {
+			ret = -1;
+		}
+		if ((ret == 0) && (rename(tmp, path) != 0)) {
+			ret = -1;
+		}
+		if (ret != 0) {
+			unlink(tmp);
+		}
+	}
+	memset(&record, 0, sizeof(record));
+	free(path);
+	free(tmp);
+	return ret;
+}
+
+/* Check a password against the saved verifier, if we have one and it
+ * hasn't been too long since the credentials we got with it expired. */
+int
+_pam_krb5_offline_check(krb5_context ctx, const char *dir,
+			const char *principal, const char *password,
+			krb5_deltat window, int verbose)
+{
+	struct offline_record record;
+	struct stat st;
+	unsigned char verifier[OFFLINE_VERIFIER_SIZE], diff;
+	char *path;
+	time_t now;
+	size_t i;
+	int fd, ret;
+
+	if ((strlen(principal) > OFFLINE_NAME_MAX) || !_pam_krb5_cachedir_private(dir)) {
+		return -1;
+	}
+	path = offline_path(dir, principal);
+	if (path == NULL) {
+		return -1;
+	}
+#ifdef O_NOFOLLOW
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+#else
+	fd = open(path, O_RDONLY);
+#endif
+	free(path);
+	if (fd == -1) {
+		if (verbose) {
+			debug("no offline verifier for '%s'", principal);
+		}
+		return -1;
+	}
+	ret = -1;
+	if ((fstat(fd, &st) == 0) &&
+	    S_ISREG(st.st_mode) &&
+	    (st.st_uid == geteuid()) &&
+	    ((st.st_mode & (S_IRWXG | S_IRWXO)) == 0) &&
+	    (st.st_size == sizeof(record)) &&
+	    (_pam_krb5_read_with_retry(fd, (unsigned char *) &record,
+				       sizeof(record)) == sizeof(record))) {
+		ret = 0;
+	}
+	close(fd);
+	if ((ret != 0) ||
+	    (record.magic != OFFLINE_MAGIC) ||
+	    (record.version != OFFLINE_VERSION) ||
+	    (record.principal[OFFLINE_NAME_MAX] != '\0') ||
+	    (strcmp(record.principal, principal) != 0)) {
+		memset(&record, 0, sizeof(record));
+		return -1;
+	}
+
+	/* Don't trust a clock which has gone backwards, and don't let the
+	 * verifier outlive the window. */
+	now = time(NULL);
+	if ((now < record.stored) ||
+	    (now >= (time_t) record.expires + (window > 0 ? window : 0))) {
+		if (verbose) {
+			debug("offline verifier for '%s' has expired",
+			      principal);
+		}
+		memset(&record, 0, sizeof(record));
+		return -1;
+	}
+
+	ret = -1;
+	if (offline_derive(ctx, password, record.salt, record.iterations,
+			   verifier) == 0) {
+		diff = 0;
+		for (i = 0; i < sizeof(verifier); i++) {
+			diff |= verifier[i] ^ record.verifier[i];
+		}
+		ret = (diff == 0) ? 0 : -1;
+	}
+	memset(verifier, 0, sizeof(verifier));
+	memset(&record, 0, sizeof(record));
+	return ret;
+}
+
+int
+_pam_krb5_offline_forget(const char *dir, const char *principal)
+{
+	char *path;
+	int ret;
+
+	if (!_pam_krb5_cachedir_private(dir)) {
+		return -1;
+	}
+	path = offline_path(dir, principal);
+	if (path == NULL) {
+		return -1;
+	}
+	ret = unlink(path);
+	if ((ret != 0) && (errno == ENOENT)) {
+		ret = 0;
+	}
+	free(path);
+	return ret;
+}
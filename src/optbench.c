@@ -0,0 +1,321 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#ifdef HAVE_SECURITY_PAM_MODULES_H
+#include <security/pam_modules.h>
+#endif
+
+#include KRB5_H
+#ifdef USE_KRB4
+#include KRB4_DES_H
+#include KRB4_KRB_H
+#ifdef KRB4_KRB_ERR_H
+#include KRB4_KRB_ERR_H
+#endif
+#endif
+
+#include "init.h"
+#include "items.h"
+#include "logstdio.h"
+#include "options.h"
+#include "xstr.h"
+
+/* Measure how long it takes to compute our settings, with and without the
+ * compiled options cache, using a generated krb5.conf which describes
+ * lots of realms and lists lots of services. */
+
+extern char *log_progname;
+
+static char *bench_service;
+static char bench_handle;
+
+int
+_pam_krb5_has_item(pam_handle_t *pamh, int item)
+{
+	return (item == PAM_SERVICE);
+}
+
+int
+_pam_krb5_get_item_text(pam_handle_t *pamh, int item, char **text)
+{
+	if (item == PAM_SERVICE) {
+		*text = bench_service;
+		return PAM_SUCCESS;
+	}
+	*text = NULL;
+	return PAM_SERVICE_ERR;
+}
+
+int
+_pam_krb5_get_item_conv(pam_handle_t *pamh, struct pam_conv **conv)
+{
+	*conv = NULL;
+	return PAM_SERVICE_ERR;
+}
+
+static void
+write_services(FILE *fp, const char *name, int first, int last)
+{
+	int i;
+
+	fprintf(fp, "\t\t\t%s =", name);
+	for (i = first; i < last; i++) {
+		fprintf(fp, " service%d", i);
+	}
+	fprintf(fp, "\n");
+}
+
+static int
+write_config(const char *path, int realms, int services)
+{
+	FILE *fp;
+	int i;
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		return -1;
+	}
+	fprintf(fp, "[libdefaults]\n\tdefault_realm = REALM0.EXAMPLE.COM\n");
+	fprintf(fp, "[realms]\n");
+	for (i = 0; i < realms; i++) {
+		fprintf(fp, "\tREALM%d.EXAMPLE.COM = {\n"
+			"\t\tkdc = kdc%d.example.com\n"
+			"\t\tadmin_server = kdc%d.example.com\n"
+			"\t}\n", i, i, i);
+	}
+	fprintf(fp, "[appdefaults]\n\tpam = {\n"
+		"\t\tdebug = false\n"
+		"\t\tticket_lifetime = 36000\n"
+		"\t\trenew_lifetime = 36000\n");
+	for (i = 0; i < realms; i++) {
+		fprintf(fp, "\t\tREALM%d.EXAMPLE.COM = {\n", i);
+		write_services(fp, "use_shmem", 0, services / 2);
+		write_services(fp, "no_use_shmem", services / 2, services);
+		write_services(fp, "no_validate", 0, services / 4);
+		write_services(fp, "multiple_ccaches", services / 4,
+			       services / 2);
+		write_services(fp, "no_cred_session", services / 2,
+			       services);
+		fprintf(fp, "\t\t\tccache_dir = /var/tmp/realm%d\n"
+			"\t\t\tkeytab = FILE:/etc/krb5.keytab.%d\n"
+			"\t\t\tafs_cells = cell%d.example.com\n"
+			"\t\t\tmappings = ^(.*)$ $1@REALM%d.EXAMPLE.COM\n"
+			"\t\t}\n", i, i, i, i);
+	}
+	fprintf(fp, "\t}\n");
+	return fclose(fp);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Time "iterations" calls to _pam_krb5_options_init(), each made using a
+ * fresh library context, the way a forking server would. */
+static double
+run(int argc, const char **argv, int iterations,
+    struct _pam_krb5_options *result)
+{
+	krb5_context ctx;
+	struct _pam_krb5_options *options;
+	double start, elapsed;
+	int i;
+
+	elapsed = 0;
+	for (i = 0; i < iterations; i++) {
+		if (_pam_krb5_init_ctx(&ctx, argc, argv) != 0) {
+			fprintf(stderr, "error initializing Kerberos\n");
+			exit(1);
+		}
+		start = now();
+		options = _pam_krb5_options_init((pam_handle_t *) &bench_handle,
+						 argc, argv, ctx);
+		elapsed += now() - start;
+		if (options == NULL) {
+			fprintf(stderr, "error reading options\n");
+			exit(1);
+		}
+		if (result != NULL) {
+			result->use_shmem = options->use_shmem;
+			result->validate = options->validate;
+			result->multiple_ccaches = options->multiple_ccaches;
+			result->cred_session = options->cred_session;
+			result->ticket_lifetime = options->ticket_lifetime;
+			result->n_afs_cells = options->n_afs_cells;
+			result->n_mappings = options->n_mappings;
+		}
+		_pam_krb5_options_free(NULL, ctx, options);
+		krb5_free_context(ctx);
+	}
+	return elapsed / iterations;
+}
+
+static void
+remove_dir(const char *path)
+{
+	DIR *dir;
+	struct dirent *ent;
+	char file[PATH_MAX];
+
+	dir = opendir(path);
+	if (dir != NULL) {
+		while ((ent = readdir(dir)) != NULL) {
+			if ((strcmp(ent->d_name, ".") == 0) ||
+			    (strcmp(ent->d_name, "..") == 0)) {
+				continue;
+			}
+			snprintf(file, sizeof(file), "%s/%s",
+				 path, ent->d_name);
+			unlink(file);
+		}
+		closedir(dir);
+	}
+	rmdir(path);
+}
+
+int
+main(int argc, char **argv)
+{
+	char top[] = "/tmp/optbenchXXXXXX";
+	char conf[PATH_MAX], cache[PATH_MAX], realm[PATH_MAX];
+	char service[PATH_MAX], cache_arg[PATH_MAX];
+	const char *args[4];
+	struct _pam_krb5_options plain, cached;
+	double uncached_time, cold_time, warm_time;
+	int c, realms, services, iterations;
+
+	log_progname = "optbench";
+	memset(&log_options, 0, sizeof(log_options));
+	realms = 300;
+	services = 200;
+	iterations = 100;
+	while ((c = getopt(argc, argv, "r:s:n:v")) != -1) {
+		switch (c) {
+		case 'r':
+			realms = atoi(optarg);
+			break;
+		case 's':
+			services = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'v':
+			log_options.debug++;
+			break;
+		default:
+			printf("%s: [-v] [-r realms] [-s services] "
+			       "[-n iterations]\n", argv[0]);
+			return 1;
+		}
+	}
+	if ((realms < 1) || (services < 1) || (iterations < 1)) {
+		fprintf(stderr, "%s: counts must be positive\n", argv[0]);
+		return 1;
+	}
+
+	if (mkdtemp(top) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(conf, sizeof(conf), "%s/krb5.conf", top);
+	snprintf(cache, sizeof(cache), "%s/cache", top);
+	if ((write_config(conf, realms, services) != 0) ||
+	    (mkdir(cache, S_IRWXU) != 0)) {
+		perror(top);
+		remove_dir(cache);
+		remove_dir(top);
+		return 1;
+	}
+	setenv("KRB5_CONFIG", conf, 1);
+
+	/* Look up the last service in the last realm, so that any linear
+	 * searches have to go all the way to the end. */
+	snprintf(realm, sizeof(realm), "realm=REALM%d.EXAMPLE.COM",
+		 realms - 1);
+	snprintf(service, sizeof(service), "service%d", services - 1);
+	snprintf(cache_arg, sizeof(cache_arg), "options_cache=%s", cache);
+	bench_service = service;
+	args[0] = "unsecure_for_debugging_only";
+	args[1] = realm;
+	args[2] = cache_arg;
+	args[3] = NULL;
+
+	memset(&plain, 0, sizeof(plain));
+	memset(&cached, 0, sizeof(cached));
+	uncached_time = run(2, args, iterations, &plain);
+	cold_time = run(3, args, 1, NULL);
+	warm_time = run(3, args, iterations, &cached);
+
+	printf("%d realms, %d services, %d iterations\n",
+	       realms, services, iterations);
+	printf("uncached:     %10.1f us/call\n", uncached_time * 1000000);
+	printf("cache (cold): %10.1f us/call\n", cold_time * 1000000);
+	printf("cache (warm): %10.1f us/call\n", warm_time * 1000000);
+
+	remove_dir(cache);
+	unlink(conf);
+	rmdir(top);
+
+	if ((plain.use_shmem != cached.use_shmem) ||
+	    (plain.validate != cached.validate) ||
+	    (plain.multiple_ccaches != cached.multiple_ccaches) ||
+	    (plain.cred_session != cached.cred_session) ||
+	    (plain.ticket_lifetime != cached.ticket_lifetime) ||
+	    (plain.n_afs_cells != cached.n_afs_cells) ||
+	    (plain.n_mappings != cached.n_mappings)) {
+		fprintf(stderr, "cached options differ from computed ones\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,956 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#ifdef HAVE_SECURITY_PAM_MODULES_H
+#include <security/pam_modules.h>
+#endif
+
+#include KRB5_H
+#ifdef USE_KRB4
+#include KRB4_DES_H
+#include KRB4_KRB_H
+#ifdef KRB4_KRB_ERR_H
+#include KRB4_KRB_ERR_H
+#endif
+#endif
+
+#include "cachedir.h"
+#include "log.h"
+#include "optcache.h"
+#include "options.h"
+#include "storetmp.h"
+#include "xstr.h"
+
+/* A compiled options record is a header, a copy of the key which it was
+ * generated for, and then the resolved settings, in the order in which
+ * they're listed in the tables below.  Integers are stored in host byte
+ * order, because the records are never shared between hosts.  Bump
+ * OPTCACHE_VERSION whenever the layout or the resolution logic changes. */
+#define OPTCACHE_MAGIC		0x504b354f
+#define OPTCACHE_VERSION	11
+#define OPTCACHE_MAX_SIZE	0x100000
+#define OPTCACHE_MAX_DEPTH	8
+#define OPTCACHE_NONE		0xffffffff
+
+#ifndef HOST_NAME_MAX
+#define HOST_NAME_MAX		255
+#endif
+
+struct optcache_header {
+	uint32_t magic, version, options_size, total_size, key_length;
+};
+
+static const size_t optcache_ints[] = {
+	offsetof(struct _pam_krb5_options, debug),
+	offsetof(struct _pam_krb5_options, debug_flag),
+	offsetof(struct _pam_krb5_options, trace_flag),
+	offsetof(struct _pam_krb5_options, addressless),
+#ifdef HAVE_KRB5_ANAME_TO_LOCALNAME
+	offsetof(struct _pam_krb5_options, always_allow_localname),
+#endif
+#ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_CANONICALIZE
+	offsetof(struct _pam_krb5_options, canonicalize),
+#endif
+	offsetof(struct _pam_krb5_options, cell_realm_cache_negative_ttl),
+	offsetof(struct _pam_krb5_options, cell_realm_cache_ttl),
+	offsetof(struct _pam_krb5_options, chpw_prompt),
+	offsetof(struct _pam_krb5_options, cred_session),
+	offsetof(struct _pam_krb5_options, debug_sensitive),
+	offsetof(struct _pam_krb5_options, external),
+	offsetof(struct _pam_krb5_options, existing_ticket),
+	offsetof(struct _pam_krb5_options, forwardable),
+	offsetof(struct _pam_krb5_options, ignore_afs),
+	offsetof(struct _pam_krb5_options, ignore_k5login),
+	offsetof(struct _pam_krb5_options, ignore_unknown_principals),
+	offsetof(struct _pam_krb5_options, k5login_cache_size),
+	offsetof(struct _pam_krb5_options, multiple_ccaches),
+	offsetof(struct _pam_krb5_options, negative_cache_size),
+	offsetof(struct _pam_krb5_options, negative_cache_ttl),
+	offsetof(struct _pam_krb5_options, null_afs_first),
+	offsetof(struct _pam_krb5_options, offline_window),
+	offsetof(struct _pam_krb5_options, permit_password_callback),
+	offsetof(struct _pam_krb5_options, persistent_storetmp),
+	offsetof(struct _pam_krb5_options, proxiable),
+	offsetof(struct _pam_krb5_options, renewable),
+	offsetof(struct _pam_krb5_options, token_fetch_workers),
+	offsetof(struct _pam_krb5_options, token_method_ttl),
+	offsetof(struct _pam_krb5_options, tokens),
+	offsetof(struct _pam_krb5_options, user_check),
+	offsetof(struct _pam_krb5_options, use_authtok),
+	offsetof(struct _pam_krb5_options, use_first_pass),
+	offsetof(struct _pam_krb5_options, use_second_pass),
+	offsetof(struct _pam_krb5_options, use_third_pass),
+	offsetof(struct _pam_krb5_options, use_shmem),
+	offsetof(struct _pam_krb5_options, shmem_transport),
+	offsetof(struct _pam_krb5_options, validate),
+	offsetof(struct _pam_krb5_options, validate_user_user),
+	offsetof(struct _pam_krb5_options, v4),
+	offsetof(struct _pam_krb5_options, v4_use_524),
+	offsetof(struct _pam_krb5_options, v4_use_as_req),
+	offsetof(struct _pam_krb5_options, warn),
+#ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_PKINIT
+	offsetof(struct _pam_krb5_options, pkinit_flags),
+#endif
+};
+
+static const size_t optcache_strings[] = {
+	offsetof(struct _pam_krb5_options, banner),
+	offsetof(struct _pam_krb5_options, ccache_dir),
+	offsetof(struct _pam_krb5_options, ccname_template),
+	offsetof(struct _pam_krb5_options, cell_realm_cache),
+	offsetof(struct _pam_krb5_options, k5login_cache),
+	offsetof(struct _pam_krb5_options, keytab),
+	offsetof(struct _pam_krb5_options, negative_cache),
+	offsetof(struct _pam_krb5_options, offline_cache),
+	offsetof(struct _pam_krb5_options, pwhelp),
+	offsetof(struct _pam_krb5_options, realm),
+	offsetof(struct _pam_krb5_options, token_strategy),
+	offsetof(struct _pam_krb5_options, mappings_s),
+#ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_PKINIT
+	offsetof(struct _pam_krb5_options, pkinit_identity),
+#endif
+};
+
+static const size_t optcache_lists[] = {
+	offsetof(struct _pam_krb5_options, hosts),
+#ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_PA
+	offsetof(struct _pam_krb5_options, preauth_options),
+#endif
+};
+
+#define OPTCACHE_FIELD(_options, _offset, _type) \
+	((_type *) (((char *) (_options)) + (_offset)))
+
+/* A growable buffer, used for building both keys and records. */
+struct optcache_buf {
+	unsigned char *data;
+	size_t length, size;
+	int failed;
+};
+
+static void
+buf_append(struct optcache_buf *buf, const void *data, size_t length)
+{
+	unsigned char *tmp;
+	size_t size;
+
+	if (buf->failed) {
+		return;
+	}
+	if (buf->length + length > buf->size) {
+		size = buf->size ? buf->size : 256;
+		while (size < buf->length + length) {
+			size *= 2;
+		}
+		tmp = realloc(buf->data, size);
+		if (tmp == NULL) {
+			buf->failed = 1;
+			return;
+		}
+		buf->data = tmp;
+		buf->size = size;
+	}
+	memcpy(buf->data + buf->length, data, length);
+	buf->length += length;
+}
+
+static void
+buf_u32(struct optcache_buf *buf, uint32_t u)
+{
+	buf_append(buf, &u, sizeof(u));
+}
+
+static void
+buf_str(struct optcache_buf *buf, const char *s)
+{
+	if (s == NULL) {
+		buf_u32(buf, OPTCACHE_NONE);
+	} else {
+		buf_u32(buf, strlen(s));
+		buf_append(buf, s, strlen(s) + 1);
+	}
+}
+
+static void
+buf_list(struct optcache_buf *buf, char **list)
+{
+	uint32_t i;
+
+	if (list == NULL) {
+		buf_u32(buf, OPTCACHE_NONE);
+	} else {
+		for (i = 0; list[i] != NULL; i++) {
+			continue;
+		}
+		buf_u32(buf, i);
+		for (i = 0; list[i] != NULL; i++) {
+			buf_str(buf, list[i]);
+		}
+	}
+}
+
+/* A bounds-checked reader for records. */
+struct optcache_cursor {
+	const unsigned char *p, *end;
+	int failed;
+};
+
+static uint32_t
+cur_u32(struct optcache_cursor *cur)
+{
+	uint32_t u;
+
+	if (cur->failed || (cur->end - cur->p < (ptrdiff_t) sizeof(u))) {
+		cur->failed = 1;
+		return OPTCACHE_NONE;
+	}
+	memcpy(&u, cur->p, sizeof(u));
+	cur->p += sizeof(u);
+	return u;
+}
+
+static char *
+cur_str(struct optcache_cursor *cur)
+{
+	uint32_t length;
+	char *s;
+
+	length = cur_u32(cur);
+	if (cur->failed || (length == OPTCACHE_NONE)) {
+		return NULL;
+	}
+	if ((length >= (uint32_t) (cur->end - cur->p)) ||
+	    (cur->p[length] != '\0')) {
+		cur->failed = 1;
+		return NULL;
+	}
+	s = xstrdup((const char *) cur->p);
+	if (s == NULL) {
+		cur->failed = 1;
+		return NULL;
+	}
+	cur->p += length + 1;
+	return s;
+}
+
+static char **
+cur_list(struct optcache_cursor *cur)
+{
+	uint32_t i, n;
+	char **list;
+
+	n = cur_u32(cur);
+	if (cur->failed || (n == OPTCACHE_NONE)) {
+		return NULL;
+	}
+	if (n > (uint32_t) (cur->end - cur->p) / sizeof(uint32_t)) {
+		cur->failed = 1;
+		return NULL;
+	}
+	list = malloc((n + 1) * sizeof(char *));
+	if (list == NULL) {
+		cur->failed = 1;
+		return NULL;
+	}
+	memset(list, 0, (n + 1) * sizeof(char *));
+	for (i = 0; (i < n) && !cur->failed; i++) {
+		list[i] = cur_str(cur);
+		if (list[i] == NULL) {
+			cur->failed = 1;
+		}
+	}
+	if (cur->failed) {
+		for (i = 0; list[i] != NULL; i++) {
+			xstrfree(list[i]);
+		}
+		free(list);
+		return NULL;
+	}
+	return list;
+}
+
+/* Record the identity of a configuration file, and of anything which it
+ * pulls in using "include" or "includedir", in the key. */
+static void optcache_stamp_path(struct optcache_buf *buf, const char *path,
+				int depth);
+
+static int
+optcache_compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static void
+optcache_stamp_dir(struct optcache_buf *buf, const char *path, int depth)
+{
+	DIR *dir;
+	struct dirent *ent;
+	char **names, **tmp, *name;
+	size_t i, n, size;
+
+	dir = opendir(path);
+	if (dir == NULL) {
+		return;
+	}
+	names = NULL;
+	n = size = 0;
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.') {
+			continue;
+		}
+		if (n >= size) {
+			size = size ? size * 2 : 16;
+			tmp = realloc(names, size * sizeof(char *));
+			if (tmp == NULL) {
+				buf->failed = 1;
+				break;
+			}
+			names = tmp;
+		}
+		name = malloc(strlen(path) + strlen(ent->d_name) + 2);
+		if (name == NULL) {
+			buf->failed = 1;
+			break;
+		}
+		sprintf(name, "%s/%s", path, ent->d_name);
+		names[n++] = name;
+	}
+	closedir(dir);
+	if (n > 0) {
+		qsort(names, n, sizeof(names[0]), optcache_compare_names);
+	}
+	for (i = 0; i < n; i++) {
+		optcache_stamp_path(buf, names[i], depth);
+		free(names[i]);
+	}
+	free(names);
+}
+
+static void
+optcache_stamp_path(struct optcache_buf *buf, const char *path, int depth)
+{
+	struct stat st;
+	FILE *fp;
+	char line[LINE_MAX], *p;
+	int is_dir;
+
+	buf_str(buf, path);
+	if (stat(path, &st) != 0) {
+		buf_u32(buf, OPTCACHE_NONE);
+		return;
+	}
+	buf_append(buf, &st.st_dev, sizeof(st.st_dev));
+	buf_append(buf, &st.st_ino, sizeof(st.st_ino));
+	buf_append(buf, &st.st_mtime, sizeof(st.st_mtime));
+	buf_append(buf, &st.st_ctime, sizeof(st.st_ctime));
+	buf_append(buf, &st.st_size, sizeof(st.st_size));
+	if (depth >= OPTCACHE_MAX_DEPTH) {
+		/* Don't chase include loops forever. */
+		buf->failed = 1;
+		return;
+	}
+	if (S_ISDIR(st.st_mode)) {
+		optcache_stamp_dir(buf, path, depth + 1);
+		return;
+	}
+	if (!S_ISREG(st.st_mode)) {
+		return;
+	}
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		return;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		p = line + strspn(line, " \t");
+		if (strncmp(p, "include", 7) != 0) {
+			continue;
+		}
+		p += 7;
+		is_dir = (strncmp(p, "dir", 3) == 0);
+		if (is_dir) {
+			p += 3;
+		}
+		if ((*p != ' ') && (*p != '\t')) {
+			continue;
+		}
+		p += strspn(p, " \t");
+		p[strcspn(p, "\r\n")] = '\0';
+		while ((strlen(p) > 0) &&
+		       ((p[strlen(p) - 1] == ' ') ||
+			(p[strlen(p) - 1] == '\t'))) {
+			p[strlen(p) - 1] = '\0';
+		}
+		if (strlen(p) > 0) {
+			optcache_stamp_path(buf, p, depth + 1);
+		}
+	}
+	fclose(fp);
+}
+
+/* Build the key which identifies the set of options we'd compute for this
+ * combination of module arguments, service, realm, and configuration. */
+char *
+_pam_krb5_optcache_key(int argc, PAM_KRB5_MAYBE_CONST char **argv,
+		       const char *service, const char *realm,
+		       size_t *key_length)
+{
+	struct optcache_buf buf;
+	const char *files;
+	char *tmp, *p, *q;
+	int i, secure;
+
+	memset(&buf, 0, sizeof(buf));
+	buf_u32(&buf, OPTCACHE_VERSION);
+	buf_str(&buf, service);
+	buf_u32(&buf, argc);
+	secure = 1;
+	for (i = 0; i < argc; i++) {
+		buf_str(&buf, argv[i]);
+		if (strcmp(argv[i], "unsecure_for_debugging_only") == 0) {
+			secure = 0;
+		}
+	}
+	buf_str(&buf, realm);
+
+	/* Mirror the library's choice of configuration files:  a secure
+	 * context ignores $KRB5_CONFIG. */
+#ifndef HAVE_KRB5_INIT_SECURE_CONTEXT
+	secure = 0;
+#endif
+	files = secure ? NULL : getenv("KRB5_CONFIG");
+	if (files == NULL) {
+		files = DEFAULT_KRB5_CONF_FILES;
+	}
+	tmp = xstrdup(files);
+	if (tmp == NULL) {
+		buf.failed = 1;
+	} else {
+		p = tmp;
+		do {
+			q = p + strcspn(p, ":");
+			if (*q != '\0') {
+				*q++ = '\0';
+			}
+			if (strlen(p) > 0) {
+				optcache_stamp_path(&buf, p, 0);
+			}
+			p = q;
+		} while (*p != '\0');
+		xstrfree(tmp);
+	}
+
+	if (buf.failed) {
+		free(buf.data);
+		return NULL;
+	}
+	*key_length = buf.length;
+	return (char *) buf.data;
+}
+
+static char *
+optcache_path(const char *dir, const char *prefix,
+	      const char *key, size_t key_length)
+{
+	uint32_t hash;
+	char *path;
+
+	hash = _pam_krb5_cachedir_hash_bytes(PAM_KRB5_CACHEDIR_HASH_INIT,
+					     key, key_length);
+	path = malloc(strlen(dir) + 1 + strlen(prefix) + 1 + 8 + 1);
+	if (path != NULL) {
+		sprintf(path, "%s/%s_%08lx", dir, prefix,
+			(unsigned long) hash);
+	}
+	return path;
+}
+
+/* Write a new copy of a record and rename it into place, so that readers
+ * only ever see complete records. */
+static int
+optcache_write(const char *dir, const char *prefix,
+	       const char *key, size_t key_length, struct optcache_buf *buf)
+{
+	char *path, *tmp;
+	int fd, ret;
+
+	path = optcache_path(dir, prefix, key, key_length);
+	tmp = malloc(strlen(dir) + 2 + strlen(prefix) + strlen("_XXXXXX") + 1);
+	if ((path == NULL) || (tmp == NULL)) {
+		free(path);
+		free(tmp);
+		return -1;
+	}
+	sprintf(tmp, "%s/.%s_XXXXXX", dir, prefix);
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		free(path);
+		free(tmp);
+		return -1;
+	}
+	ret = -1;
+	if ((fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0) &&
+	    (_pam_krb5_write_with_retry(fd, buf->data,
+					buf->length) == (ssize_t) buf->length)) {
+		ret = 0;
+	}
+	if (close(fd) != 0) {
+		ret = -1;
+	}
+	if ((ret == 0) && (rename(tmp, path) != 0)) {
+		ret = -1;
+	}
+	if (ret != 0) {
+		unlink(tmp);
+	}
+	free(path);
+	free(tmp);
+	return ret;
+}
+
+struct _pam_krb5_options *
+_pam_krb5_optcache_load(const char *dir, const char *key, size_t key_length,
+			int verbose)
+{
+	struct _pam_krb5_options *options;
+	struct optcache_header header;
+	struct optcache_cursor cur;
+	struct stat st;
+	void *map;
+	char *path;
+	size_t i;
+	uint32_t n;
+	int fd;
+
+	if (!_pam_krb5_cachedir_ok(dir, 0)) {
+		if (verbose) {
+			debug("not using options cache directory \"%s\"", dir);
+		}
+		return NULL;
+	}
+	path = optcache_path(dir, "options", key, key_length);
+	if (path == NULL) {
+		return NULL;
+	}
+#ifdef O_NOFOLLOW
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+#else
+	fd = open(path, O_RDONLY);
+#endif
+	if (fd == -1) {
+		free(path);
+		return NULL;
+	}
+	if ((fstat(fd, &st) != 0) ||
+	    !S_ISREG(st.st_mode) ||
+	    ((st.st_uid != 0) && (st.st_uid != geteuid())) ||
+	    ((st.st_mode & (S_IWGRP | S_IWOTH)) != 0) ||
+	    (st.st_size < (off_t) sizeof(header)) ||
+	    (st.st_size > OPTCACHE_MAX_SIZE)) {
+		if (verbose) {
+			debug("ignoring options cache \"%s\"", path);
+		}
+		close(fd);
+		free(path);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		free(path);
+		return NULL;
+	}
+
+	/* Check that the record was built by this version of the module for
+	 * exactly this key. */
+	memcpy(&header, map, sizeof(header));
+	if ((header.magic != OPTCACHE_MAGIC) ||
+	    (header.version != OPTCACHE_VERSION) ||
+	    (header.options_size != sizeof(struct _pam_krb5_options)) ||
+	    (header.total_size != (uint32_t) st.st_size) ||
+	    (header.key_length != key_length) ||
+	    ((off_t) key_length > st.st_size - (off_t) sizeof(header)) ||
+	    (memcmp((unsigned char *) map + sizeof(header),
+		    key, key_length) != 0)) {
+		if (verbose) {
+			debug("options cache \"%s\" is stale", path);
+		}
+		munmap(map, st.st_size);
+		free(path);
+		return NULL;
+	}
+
+	options = malloc(sizeof(struct _pam_krb5_options));
+	if (options == NULL) {
+		munmap(map, st.st_size);
+		free(path);
+		return NULL;
+	}
+	memset(options, 0, sizeof(struct _pam_krb5_options));
+
+	cur.p = (unsigned char *) map + sizeof(header) + key_length;
+	cur.end = (unsigned char *) map + st.st_size;
+	cur.failed = 0;
+	for (i = 0; i < sizeof(optcache_ints) / sizeof(optcache_ints[0]); i++) {
+		*OPTCACHE_FIELD(options, optcache_ints[i], int) =
+			(int32_t) cur_u32(&cur);
+	}
+	options->ticket_lifetime = (int32_t) cur_u32(&cur);
+	options->renew_lifetime = (int32_t) cur_u32(&cur);
+	options->minimum_uid = (uid_t) (int32_t) cur_u32(&cur);
+	for (i = 0;
+	     i < sizeof(optcache_strings) / sizeof(optcache_strings[0]);
+	     i++) {
+		*OPTCACHE_FIELD(options, optcache_strings[i], char *) =
+			cur_str(&cur);
+	}
+	for (i = 0; i < sizeof(optcache_lists) / sizeof(optcache_lists[0]); i++) {
+		*OPTCACHE_FIELD(options, optcache_lists[i], char **) =
+			cur_list(&cur);
+	}
+	n = cur_u32(&cur);
+	if ((n > 0) && (n <= (uint32_t) (cur.end - cur.p))) {
+		options->afs_cells = malloc(sizeof(struct afs_cell) * n);
+		if (options->afs_cells != NULL) {
+			memset(options->afs_cells, 0,
+			       sizeof(struct afs_cell) * n);
+			options->n_afs_cells = n;
+			for (i = 0; i < n; i++) {
+				options->afs_cells[i].cell = cur_str(&cur);
+				options->afs_cells[i].principal_name =
+					cur_str(&cur);
+			}
+		} else {
+			cur.failed = 1;
+		}
+	}
+	n = cur_u32(&cur);
+	if ((n > 0) && (n <= (uint32_t) (cur.end - cur.p))) {
+		options->mappings = malloc(sizeof(struct name_mapping) * n);
+		if (options->mappings != NULL) {
+			memset(options->mappings, 0,
+			       sizeof(struct name_mapping) * n);
+			options->n_mappings = n;
+			for (i = 0; i < n; i++) {
+				options->mappings[i].pattern = cur_str(&cur);
+				options->mappings[i].replacement =
+					cur_str(&cur);
+			}
+		} else {
+			cur.failed = 1;
+		}
+	}
+	munmap(map, st.st_size);
+
+	if (cur.failed || (cur.p != cur.end)) {
+		if (verbose) {
+			debug("options cache \"%s\" is damaged", path);
+		}
+		free(path);
+		_pam_krb5_options_free(NULL, NULL, options);
+		return NULL;
+	}
+	if (options->debug) {
+		debug("using cached options from \"%s\"", path);
+	}
+	free(path);
+	return options;
+}
+
+int
+_pam_krb5_optcache_store(const char *dir, const char *key, size_t key_length,
+			 struct _pam_krb5_options *options)
+{
+	struct optcache_header header;
+	struct optcache_buf buf;
+	struct stat st;
+	size_t i;
+	int ret;
+
+	/* Only the owner of the directory gets to write to it. */
+	if (!_pam_krb5_cachedir_ok(dir, 0) ||
+	    (lstat(dir, &st) != 0) ||
+	    (st.st_uid != geteuid())) {
+		return -1;
+	}
+
+	memset(&buf, 0, sizeof(buf));
+	memset(&header, 0, sizeof(header));
+	buf_append(&buf, &header, sizeof(header));
+	buf_append(&buf, key, key_length);
+	for (i = 0; i < sizeof(optcache_ints) / sizeof(optcache_ints[0]); i++) {
+		buf_u32(&buf, *OPTCACHE_FIELD(options, optcache_ints[i], int));
+	}
+	buf_u32(&buf, options->ticket_lifetime);
+	buf_u32(&buf, options->renew_lifetime);
+	buf_u32(&buf, options->minimum_uid);
+	for (i = 0;
+	     i < sizeof(optcache_strings) / sizeof(optcache_strings[0]);
+	     i++) {
+		buf_str(&buf, *OPTCACHE_FIELD(options, optcache_strings[i],
+					      char *));
+	}
+	for (i = 0; i < sizeof(optcache_lists) / sizeof(optcache_lists[0]); i++) {
+		buf_list(&buf, *OPTCACHE_FIELD(options, optcache_lists[i],
+					       char **));
+	}
+	buf_u32(&buf, options->n_afs_cells);
+	for (i = 0; i < (size_t) options->n_afs_cells; i++) {
+		buf_str(&buf, options->afs_cells[i].cell);
+		buf_str(&buf, options->afs_cells[i].principal_name);
+	}
+	buf_u32(&buf, options->n_mappings);
+	for (i = 0; i < (size_t) options->n_mappings; i++) {
+		buf_str(&buf, options->mappings[i].pattern);
+		buf_str(&buf, options->mappings[i].replacement);
+	}
+	if (buf.failed || (buf.length > OPTCACHE_MAX_SIZE)) {
+		free(buf.data);
+		return -1;
+	}
+	header.magic = OPTCACHE_MAGIC;
+	header.version = OPTCACHE_VERSION;
+	header.options_size = sizeof(struct _pam_krb5_options);
+	header.total_size = buf.length;
+	header.key_length = key_length;
+	memcpy(buf.data, &header, sizeof(header));
+
+	ret = optcache_write(dir, "options", key, key_length, &buf);
+	free(buf.data);
+	return ret;
+}
+
+/* Build the key which identifies a keytab, as it is now, and the client
+ * realm and host name which we'd be picking a service key for.  We can
+ * only tell when a keytab is a file has changed. */
+static char *
+optcache_keytab_key(const char *ktname, const char *realm,
+		    size_t *key_length)
+{
+	struct optcache_buf buf;
+	struct stat st;
+	char host[HOST_NAME_MAX + 1];
+	const char *path;
+
+	if (strncmp(ktname, "FILE:", 5) == 0) {
+		path = ktname + 5;
+	} else if (strncmp(ktname, "WRFILE:", 7) == 0) {
+		path = ktname + 7;
+	} else {
+		path = ktname;
+	}
+	if ((path[0] != '/') || (stat(path, &st) != 0) ||
+	    !S_ISREG(st.st_mode)) {
+		return NULL;
+	}
+	memset(host, '\0', sizeof(host));
+	if (gethostname(host, sizeof(host) - 1) != 0) {
+		return NULL;
+	}
+
+	memset(&buf, 0, sizeof(buf));
+	buf_u32(&buf, OPTCACHE_VERSION);
+	buf_str(&buf, path);
+	buf_append(&buf, &st.st_dev, sizeof(st.st_dev));
+	buf_append(&buf, &st.st_ino, sizeof(st.st_ino));
+	buf_append(&buf, &st.st_mtime, sizeof(st.st_mtime));
+	buf_append(&buf, &st.st_ctime, sizeof(st.st_ctime));
+	buf_append(&buf, &st.st_size, sizeof(st.st_size));
+	buf_str(&buf, realm);
+	buf_str(&buf, host);
+	if (buf.failed) {
+		free(buf.data);
+		return NULL;
+	}
+	*key_length = buf.length;
+	return (char *) buf.data;
+}
+
+/* Look up the name of the service which we chose the last time we had to
+ * validate credentials for a client in "realm" using this keytab. */
+char *
+_pam_krb5_optcache_keytab_load(const char *dir, const char *ktname,
+			       const char *realm, int verbose)
+{
+	struct optcache_header header;
+	struct optcache_cursor cur;
+	struct stat st;
+	unsigned char *data;
+	char *key, *path, *principal;
+	size_t key_length;
+	int fd;
+
+	if (!_pam_krb5_cachedir_ok(dir, 0)) {
+		return NULL;
+	}
+	key = optcache_keytab_key(ktname, realm, &key_length);
+	if (key == NULL) {
+		return NULL;
+	}
+	path = optcache_path(dir, "keytab", key, key_length);
+	if (path == NULL) {
+		free(key);
+		return NULL;
+	}
+#ifdef O_NOFOLLOW
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+#else
+	fd = open(path, O_RDONLY);
+#endif
+	if (fd == -1) {
+		free(path);
+		free(key);
+		return NULL;
+	}
+	data = NULL;
+	if ((fstat(fd, &st) == 0) &&
+	    S_ISREG(st.st_mode) &&
+	    ((st.st_uid == 0) || (st.st_uid == geteuid())) &&
+	    ((st.st_mode & (S_IWGRP | S_IWOTH)) == 0) &&
+	    (st.st_size >= (off_t) (sizeof(header) + key_length)) &&
+	    (st.st_size <= OPTCACHE_MAX_SIZE)) {
+		data = malloc(st.st_size);
+		if ((data != NULL) &&
+		    (_pam_krb5_read_with_retry(fd, data,
+					       st.st_size) != st.st_size)) {
+			free(data);
+			data = NULL;
+		}
+	}
+	close(fd);
+	if (data == NULL) {
+		free(path);
+		free(key);
+		return NULL;
+	}
+
+	/* Check that the record was built for this key, and pull out the
+	 * principal name. */
+	principal = NULL;
+	memcpy(&header, data, sizeof(header));
+	if ((header.magic == OPTCACHE_MAGIC) &&
+	    (header.version == OPTCACHE_VERSION) &&
+	    (header.options_size == 0) &&
+	    (header.total_size == (uint32_t) st.st_size) &&
+	    (header.key_length == key_length) &&
+	    (memcmp(data + sizeof(header), key, key_length) == 0)) {
+		cur.p = data + sizeof(header) + key_length;
+		cur.end = data + st.st_size;
+		cur.failed = 0;
+		principal = cur_str(&cur);
+		if (cur.failed || (cur.p != cur.end)) {
+			xstrfree(principal);
+			principal = NULL;
+		}
+	}
+	if (verbose) {
+		if (principal != NULL) {
+			debug("using cached keytab service '%s' from \"%s\"",
+			      principal, path);
+		} else {
+			debug("keytab service cache \"%s\" is stale", path);
+		}
+	}
+	free(data);
+	free(path);
+	free(key);
+	return principal;
+}
+
+/* Remember which service we chose. */
+int
+_pam_krb5_optcache_keytab_store(const char *dir, const char *ktname,
+				const char *realm, const char *principal)
+{
+	struct optcache_header header;
+	struct optcache_buf buf;
+	struct stat st;
+	char *key;
+	size_t key_length;
+	int ret;
+
+	if (!_pam_krb5_cachedir_ok(dir, 0) ||
+	    (lstat(dir, &st) != 0) ||
+	    (st.st_uid != geteuid())) {
+		return -1;
+	}
+	key = optcache_keytab_key(ktname, realm, &key_length);
+	if (key == NULL) {
+		return -1;
+	}
+
+	memset(&buf, 0, sizeof(buf));
+	memset(&header, 0, sizeof(header));
+	buf_append(&buf, &header, sizeof(header));
+	buf_append(&buf, key, key_length);
+	buf_str(&buf, principal);
+	if (buf.failed || (buf.length > OPTCACHE_MAX_SIZE)) {
+		free(buf.data);
+		free(key);
+		return -1;
+	}
+	header.magic = OPTCACHE_MAGIC;
+	header.version = OPTCACHE_VERSION;
+	header.options_size = 0;
+	header.total_size = buf.length;
+	header.key_length = key_length;
+	memcpy(buf.data, &header, sizeof(header));
+
+	ret = optcache_write(dir, "keytab", key, key_length, &buf);
+	free(buf.data);
+	free(key);
+	return ret;
+}
@@ -36,7 +36,9 @@
 #include <sys/types.h>
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <pwd.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -58,47 +60,407 @@
 #endif
 #endif
 
+#if defined(HAVE_PROFILE_H) && defined(HAVE_KRB5_GET_PROFILE) && \
+    defined(HAVE_PROFILE_ITERATOR_CREATE)
+#include <profile.h>
+#define OPTION_INDEX_PROFILE
+#endif
+
+#include "cellcache.h"
 #include "items.h"
+#include "k5lcache.h"
 #include "log.h"
+#include "map.h"
+#include "negcache.h"
+#include "offline.h"
+#include "optcache.h"
 #include "options.h"
+#include "shmem.h"
+#include "stash.h"
+#include "tokens.h"
 #include "userinfo.h"
 #include "v5.h"
 #include "xstr.h"
 
 #define LIST_SEPARATORS " \t,"
 
-static char **option_l(int argc, PAM_KRB5_MAYBE_CONST char **argv,
-		       krb5_context ctx, const char *realm,
-		       const char *s, const char *def);
+/* A value no configuration file will ever contain, which lets us tell "not
+ * set" apart from "set to the default". */
+#define OPTION_UNSET "\001pam_krb5 unset\001"
+
+static const char *option_prefixes[] = {
+	"not", "dont", "no", "not_", "dont_", "no_"
+};
+
+/* Everything we know about one option name:  either what the arguments
+ * said about it, or what the configuration file said about it. */
+struct option_entry {
+	char *name;
+	char *value;
+	int flag;
+	int have_value, have_boolean;
+};
+
+struct option_table {
+	struct option_entry *entries;
+	unsigned int size, count;
+};
+
+/* The arguments, parsed once, and a per-realm index of the configuration
+ * settings we've looked up so far.  If we can walk the configuration, we
+ * also note which names are set at all in the places the library checks, so
+ * that looking for anything else doesn't cost us a trip into the library. */
+struct option_source {
+	krb5_context ctx;
+	struct option_table flags, values;
+	char *realm;
+	struct option_table conf, known;
+	int indexed;
+};
+
+static unsigned int
+option_hash(const char *name, unsigned int size)
+{
+	unsigned int hash;
+
+	hash = 2166136261U;
+	while (*name != '\0') {
+		hash ^= (unsigned char) *name++;
+		hash *= 16777619U;
+	}
+	return hash & (size - 1);
+}
+
+static struct option_entry *
+option_table_find(struct option_table *table, const char *name)
+{
+	unsigned int i;
+
+	if (table->size == 0) {
+		return NULL;
+	}
+	for (i = option_hash(name, table->size);
+	     table->entries[i].name != NULL;
+	     i = (i + 1) & (table->size - 1)) {
+		if (strcmp(table->entries[i].name, name) == 0) {
+			return &table->entries[i];
+		}
+	}
+	return NULL;
+}
+
+/* Add an entry for "name", which the table takes ownership of. */
+static struct option_entry *
+option_table_add(struct option_table *table, char *name)
+{
+	struct option_entry *entries;
+	unsigned int i, j, size;
+
+	if (name == NULL) {
+		return NULL;
+	}
+	if ((table->count + 1) * 4 > table->size * 3) {
+		size = table->size ? table->size * 2 : 32;
+		entries = malloc(sizeof(struct option_entry) * size);
+		if (entries == NULL) {
+			xstrfree(name);
+			return NULL;
+		}
+		memset(entries, 0, sizeof(struct option_entry) * size);
+		for (i = 0; i < table->size; i++) {
+			if (table->entries[i].name == NULL) {
+				continue;
+			}
+			for (j = option_hash(table->entries[i].name, size);
+			     entries[j].name != NULL;
+			     j = (j + 1) & (size - 1)) {
+				continue;
+			}
+			entries[j] = table->entries[i];
+		}
+		free(table->entries);
+		table->entries = entries;
+		table->size = size;
+	}
+	for (i = option_hash(name, table->size);
+	     table->entries[i].name != NULL;
+	     i = (i + 1) & (table->size - 1)) {
+		continue;
+	}
+	table->entries[i].name = name;
+	table->count++;
+	return &table->entries[i];
+}
+
+static void
+option_table_free(struct option_table *table)
+{
+	unsigned int i;
+
+	for (i = 0; i < table->size; i++) {
+		xstrfree(table->entries[i].name);
+		xstrfree(table->entries[i].value);
+	}
+	free(table->entries);
+	memset(table, 0, sizeof(*table));
+}
+
+static void
+option_source_flag(struct option_source *src, const char *name, int flag)
+{
+	struct option_entry *entry;
+
+	/* The first mention of a flag wins. */
+	if ((strlen(name) == 0) ||
+	    (option_table_find(&src->flags, name) != NULL)) {
+		return;
+	}
+	entry = option_table_add(&src->flags, xstrdup(name));
+	if (entry != NULL) {
+		entry->flag = flag;
+	}
+}
+
+static void
+option_source_init(struct option_source *src,
+		   int argc, PAM_KRB5_MAYBE_CONST char **argv,
+		   krb5_context ctx)
+{
+	struct option_entry *entry;
+	const char *p;
+	char *name;
+	unsigned int n;
+	int i;
+
+	memset(src, 0, sizeof(*src));
+	src->ctx = ctx;
+	for (i = 0; i < argc; i++) {
+		p = strchr(argv[i], '=');
+		if (p != NULL) {
+			/* "name=value", first one wins */
+			name = xstrndup(argv[i], p - argv[i]);
+			if ((name == NULL) ||
+			    (option_table_find(&src->values, name) != NULL)) {
+				xstrfree(name);
+				continue;
+			}
+			entry = option_table_add(&src->values, name);
+			if (entry != NULL) {
+				entry->value = xstrdup(p + 1);
+				entry->have_value = 1;
+			}
+			continue;
+		}
+		/* boolean yes */
+		option_source_flag(src, argv[i], 1);
+		/* boolean no */
+		for (n = 0;
+		     n < sizeof(option_prefixes) / sizeof(option_prefixes[0]);
+		     n++) {
+			if (strncmp(argv[i], option_prefixes[n],
+				    strlen(option_prefixes[n])) == 0) {
+				option_source_flag(src,
+						   argv[i] +
+						   strlen(option_prefixes[n]),
+						   0);
+			}
+		}
+	}
+}
+
+static void
+option_source_free(struct option_source *src)
+{
+	option_table_free(&src->flags);
+	option_table_free(&src->values);
+	option_table_free(&src->conf);
+	option_table_free(&src->known);
+	xstrfree(src->realm);
+	src->realm = NULL;
+}
+
+/* Note the names of all of the relations in the parts of [appdefaults]
+ * which krb5_appdefault_string() and krb5_appdefault_boolean() search. */
+static void
+option_source_index(struct option_source *src, const char *realm)
+{
+#ifdef OPTION_INDEX_PROFILE
+	profile_t profile;
+	const char *names[4];
+	void *iter;
+	char *name, *value;
+	int i, n;
+
+	option_table_free(&src->known);
+	src->indexed = 0;
+	if (krb5_get_profile(src->ctx, &profile) != 0) {
+		return;
+	}
+	src->indexed = 1;
+	for (i = 0; (i < 4) && src->indexed; i++) {
+		n = 0;
+		names[n++] = "appdefaults";
+		if (i < 2) {
+			names[n++] = PAM_KRB5_APPNAME;
+		}
+		if ((i % 2) == 0) {
+			names[n++] = realm;
+		}
+		names[n] = NULL;
+		iter = NULL;
+		if (profile_iterator_create(profile, names,
+					    PROFILE_ITER_LIST_SECTION |
+					    PROFILE_ITER_RELATIONS_ONLY,
+					    &iter) != 0) {
+			src->indexed = 0;
+			break;
+		}
+		for (;;) {
+			name = value = NULL;
+			if (profile_iterator(&iter, &name, &value) != 0) {
+				src->indexed = 0;
+				break;
+			}
+			if (name == NULL) {
+				break;
+			}
+			if ((option_table_find(&src->known, name) == NULL) &&
+			    (option_table_add(&src->known,
+					      xstrdup(name)) == NULL)) {
+				src->indexed = 0;
+			}
+			profile_release_string(name);
+			profile_release_string(value);
+		}
+		profile_iterator_free(&iter);
+	}
+	profile_release(profile);
+	if (!src->indexed) {
+		option_table_free(&src->known);
+	}
+#else
+	src->indexed = 0;
+#endif
+}
+
+/* Find or create the index entry for a setting in the realm. */
+static struct option_entry *
+option_source_conf(struct option_source *src, const char *realm,
+		   const char *s)
+{
+	struct option_entry *entry;
+
+	if ((src->realm == NULL) || (strcmp(src->realm, realm) != 0)) {
+		option_table_free(&src->conf);
+		xstrfree(src->realm);
+		src->realm = xstrdup(realm);
+		option_source_index(src, realm);
+	}
+	entry = option_table_find(&src->conf, s);
+	if (entry == NULL) {
+		entry = option_table_add(&src->conf, xstrdup(s));
+	}
+	return entry;
+}
+
+/* The value of "s", from the arguments if one's given there, or from the
+ * configuration file, or NULL if it isn't set anywhere. */
+static const char *
+option_source_string(struct option_source *src, const char *realm,
+		     const char *s)
+{
+	struct option_entry *entry;
+	char *o;
+
+	entry = option_table_find(&src->values, s);
+	if (entry != NULL) {
+		return entry->value;
+	}
+	entry = option_source_conf(src, realm, s);
+	if (entry == NULL) {
+		return NULL;
+	}
+	if (!entry->have_value && src->indexed &&
+	    (option_table_find(&src->known, s) == NULL)) {
+		entry->have_value = 1;
+	}
+	if (!entry->have_value) {
+		v5_appdefault_string(src->ctx, realm, s, OPTION_UNSET, &o);
+		if ((o != NULL) && (strcmp(o, OPTION_UNSET) != 0)) {
+			entry->value = o;
+		} else {
+			xstrfree(o);
+		}
+		entry->have_value = 1;
+	}
+	return entry->value;
+}
+
+/* The configured boolean value of "s", or -1. */
+static int
+option_source_boolean(struct option_source *src, const char *realm,
+		      const char *s)
+{
+	struct option_entry *entry;
+	krb5_boolean retbool;
+
+	entry = option_source_conf(src, realm, s);
+	if (entry == NULL) {
+		v5_appdefault_boolean(src->ctx, realm, s, -1, &retbool);
+		return retbool;
+	}
+	if (!entry->have_boolean && src->indexed &&
+	    (option_table_find(&src->known, s) == NULL)) {
+		entry->flag = -1;
+		entry->have_boolean = 1;
+	}
+	if (!entry->have_boolean) {
+		v5_appdefault_boolean(src->ctx, realm, s, -1, &retbool);
+		entry->flag = retbool;
+		entry->have_boolean = 1;
+	}
+	return entry->flag;
+}
+
+/* Check if "word" is one of the items in "list". */
+static int
+option_in_list(const char *list, const char *word)
+{
+	const char *p, *q;
+
+	if ((list == NULL) || (word == NULL)) {
+		return 0;
+	}
+	p = list + strspn(list, LIST_SEPARATORS);
+	while (*p != '\0') {
+		q = p + strcspn(p, LIST_SEPARATORS);
+		if ((strlen(word) == (size_t) (q - p)) &&
+		    (strncmp(p, word, q - p) == 0)) {
+			return 1;
+		}
+		p = q + strspn(q, LIST_SEPARATORS);
+	}
+	return 0;
+}
+
 static char ** option_l_from_s(const char *o);
 static void free_l(char **l);
 
 static int
-option_b(int argc, PAM_KRB5_MAYBE_CONST char **argv,
-	 krb5_context ctx, const char *realm,
+option_b(struct option_source *src, const char *realm,
 	 const char *service,
 	 const char *default_services, const char *default_notservices,
 	 const char *s, int default_value)
 {
-	int i, j, ret;
+	struct option_entry *entry;
 	unsigned int n;
-	krb5_boolean retbool;
-	char **list, *nots;
-	const char *prefix[] = {"not", "dont", "no", "not_", "dont_", "no_"};
+	int ret;
+	char nots[LINE_MAX];
 
-	for (i = 0; i < argc; i++) {
-		/* boolean yes */
-		if (strcmp(argv[i], s) == 0) {
-			return 1;
-		}
-		/* boolean no */
-		for (n = 0; n < (sizeof(prefix) / sizeof(prefix[0])); n++) {
-			if ((strncmp(argv[i], prefix[n],
-				     strlen(prefix[n])) == 0) &&
-			    (strcmp(argv[i] + strlen(prefix[n]), s) == 0)) {
-				return 0;
-			}
-		}
+	/* boolean yes or no */
+	entry = option_table_find(&src->flags, s);
+	if (entry != NULL) {
+		return entry->flag;
 	}
 
 	ret = -1;
@@ -106,42 +468,27 @@ option_b(int argc, PAM_KRB5_MAYBE_CONST char **argv,
 	/* configured service yes */
 	if ((ret == -1) && (realm != NULL) &&
 	    (service != NULL) && (strlen(service) > 0)) {
-		list = option_l(argc, argv, ctx, realm, s, "");
-		if (list != NULL) {
-			for (i = 0;
-			     ((list != NULL) && (list[i] != NULL));
-			     i++) {
-				if (strcmp(list[i], service) == 0) {
-					ret = 1;
-					break;
-				}
-			}
-			free_l(list);
+		if (option_in_list(option_source_string(src, realm, s),
+				   service)) {
+			ret = 1;
 		}
 	}
 
 	/* configured service no */
 	if ((ret == -1) && (realm != NULL) &&
 	    (service != NULL) && (strlen(service) > 0)) {
-		for (n = 0; n < (sizeof(prefix) / sizeof(prefix[0])); n++) {
-			nots = malloc(strlen(prefix[n]) + strlen(s) + 1);
-			if (nots != NULL) {
-				sprintf(nots, "%s%s", prefix[n], s);
-				list = option_l(argc, argv, ctx, realm,
-						nots, "");
-				if (list != NULL) {
-					for (j = 0; list[j] != NULL; j++) {
-						if (strcmp(list[j],
-							   service) == 0) {
-							ret = 0;
-							break;
-						}
-					}
-					free_l(list);
-				}
-				free(nots);
+		for (n = 0;
+		     n < sizeof(option_prefixes) / sizeof(option_prefixes[0]);
+		     n++) {
+			if (strlen(option_prefixes[n]) + strlen(s) >=
+			    sizeof(nots)) {
+				continue;
 			}
-			if (ret != -1) {
+			sprintf(nots, "%s%s", option_prefixes[n], s);
+			if (option_in_list(option_source_string(src, realm,
+								nots),
+					   service)) {
+				ret = 0;
 				break;
 			}
 		}
@@ -149,64 +496,42 @@ option_b(int argc, PAM_KRB5_MAYBE_CONST char **argv,
 
 	/* configured boolean */
 	if ((ret == -1) && (realm != NULL)) {
-		v5_appdefault_boolean(ctx, realm, s, -1, &retbool);
-		ret = retbool;
+		ret = option_source_boolean(src, realm, s);
 	}
 
 	/* compile-time default service yes */
 	if ((ret == -1) && (default_services != NULL)) {
-		list = option_l_from_s(default_services);
-		for (i = 0; ((list != NULL) && (list[i] != NULL)); i++) {
-			if (strcmp(list[i], service) == 0) {
-				ret = 1;
-				break;
-			}
+		if (option_in_list(default_services, service)) {
+			ret = 1;
 		}
-		free_l(list);
 	}
 
 	/* compile-time default service no */
 	if ((ret == -1) && (default_notservices != NULL)) {
-		list = option_l_from_s(default_notservices);
-		for (i = 0; ((list != NULL) && (list[i] != NULL)); i++) {
-			if (strcmp(list[i], service) == 0) {
-				ret = 0;
-				break;
-			}
+		if (option_in_list(default_notservices, service)) {
+			ret = 0;
 		}
-		free_l(list);
 	}
 
 	/* hard-coded default */
 	switch (ret) {
 	case -1:
-		retbool = default_value;
+		return default_value;
 		break;
 	default:
-		retbool = ret;
+		return ret;
 		break;
 	}
-	return retbool;
 }
 
 static char *
-option_s(int argc, PAM_KRB5_MAYBE_CONST char **argv,
-	 krb5_context ctx, const char *realm, const char *s,
+option_s(struct option_source *src, const char *realm, const char *s,
 	 const char *default_value)
 {
-	int i;
-	char *o;
-
-	for (i = 0; i < argc; i++) {
-		if ((strncmp(argv[i], s, strlen(s)) == 0) &&
-		    (argv[i][strlen(s)] == '=')) {
-		    	return xstrdup(argv[i] + strlen(s) + 1);
-		}
-	}
+	const char *value;
 
-	v5_appdefault_string(ctx, realm, s, default_value, &o);
-
-	return o;
+	value = option_source_string(src, realm, s);
+	return xstrdup(value ? value : default_value);
 }
 static void
 free_s(char *s)
@@ -218,8 +543,7 @@ static long long
 #else
 static long
 #endif
-option_i(int argc, PAM_KRB5_MAYBE_CONST char **argv,
-	 krb5_context ctx, const char *realm, const char *s)
+option_i(struct option_source *src, const char *realm, const char *s)
 {
 	char *tmp, *p;
 #ifdef HAVE_LONG_LONG
@@ -228,7 +552,7 @@ option_i(int argc, PAM_KRB5_MAYBE_CONST char **argv,
 	long i;
 #endif
 
-	tmp = option_s(argc, argv, ctx, realm, s, "");
+	tmp = option_s(src, realm, s, "");
 
 #ifdef HAVE_STRTOLL
 	i = strtoll(tmp, &p, 10);
@@ -243,14 +567,13 @@ option_i(int argc, PAM_KRB5_MAYBE_CONST char **argv,
 	return i;
 }
 static krb5_deltat
-option_t(int argc, PAM_KRB5_MAYBE_CONST char **argv,
-	 krb5_context ctx, const char *realm, const char *s)
+option_t(struct option_source *src, const char *realm, const char *s)
 {
 	char *tmp, *p;
 	krb5_deltat d;
 	long i;
 
-	tmp = option_s(argc, argv, ctx, realm, s, "");
+	tmp = option_s(src, realm, s, "");
 
 	i = strtol(tmp, &p, 10);
 	if ((p == NULL) || (p == tmp) || (*p != '\0')) {
@@ -265,12 +588,12 @@ option_t(int argc, PAM_KRB5_MAYBE_CONST char **argv,
 	return i;
 }
 static char **
-option_l(int argc, PAM_KRB5_MAYBE_CONST char **argv,
-	 krb5_context ctx, const char *realm, const char *s, const char *def)
+option_l(struct option_source *src, const char *realm, const char *s,
+	 const char *def)
 {
 	char *o, **list;
 
-	o = option_s(argc, argv, ctx, realm, s, def ? def : "");
+	o = option_s(src, realm, s, def ? def : "");
 	list = option_l_from_s(o);
 	free_s(o);
 	return list;
@@ -319,17 +642,327 @@ free_l(char **l)
 	}
 }
 
+/* Flags which are simply looked up and logged.  The tables are applied in
+ * order, so that debugging output doesn't change. */
+struct option_flag {
+	const char *name;
+	size_t offset;
+	const char *default_services, *default_notservices;
+	int default_value;
+	const char *set_message, *unset_message;
+};
+
+#define OPTION_FLAG(_field) offsetof(struct _pam_krb5_options, _field)
+
+static const struct option_flag session_flags[] = {
+	{"cred_session", OPTION_FLAG(cred_session),
+	 NULL, DEFAULT_NO_CRED_SESSION, 1,
+	 "flag: cred_session", "flag: no cred_session"},
+	{"ignore_k5login", OPTION_FLAG(ignore_k5login),
+	 NULL, NULL, 0,
+	 "flag: ignore_k5login", "flag: no ignore_k5login"},
+};
+
+static const struct option_flag account_flags[] = {
+	{"user_check", OPTION_FLAG(user_check),
+	 NULL, NULL, 1,
+	 "flag: user_check", NULL},
+	{"use_authtok", OPTION_FLAG(use_authtok),
+	 NULL, NULL, 0,
+	 "flag: use_authtok", NULL},
+	{"krb4_convert", OPTION_FLAG(v4),
+	 NULL, NULL, 0,
+	 "flag: krb4_convert", "flag: no krb4_convert"},
+	{"krb4_convert_524", OPTION_FLAG(v4_use_524),
+	 NULL, NULL, 1,
+	 "flag: krb4_convert_524", "flag: no krb4_convert_524"},
+	{"krb4_use_as_req", OPTION_FLAG(v4_use_as_req),
+	 NULL, NULL, 1,
+	 "flag: krb4_use_as_req", "flag: no krb4_use_as_req"},
+};
+
+static const struct option_flag behavior_flags[] = {
+	{"use_shmem", OPTION_FLAG(use_shmem),
+	 DEFAULT_USE_SHMEM, NULL, 0,
+	 "flag: use_shmem", "flag: no use_shmem"},
+	{"external", OPTION_FLAG(external),
+	 DEFAULT_EXTERNAL, "", 0,
+	 "flag: external", "flag: no external"},
+	{"existing_ticket", OPTION_FLAG(existing_ticket),
+	 NULL, NULL, 0,
+	 "flag: existing_ticket", NULL},
+	{"multiple_ccaches", OPTION_FLAG(multiple_ccaches),
+	 DEFAULT_MULTIPLE_CCACHES, "", 0,
+	 "flag: multiple_ccaches", "flag: no multiple_ccaches"},
+	{"persistent_storetmp", OPTION_FLAG(persistent_storetmp),
+	 NULL, "", 0,
+	 "flag: persistent_storetmp", "flag: no persistent_storetmp"},
+	{"validate", OPTION_FLAG(validate),
+	 NULL, NULL, 1,
+	 "flag: validate", NULL},
+	{"validate_user_user", OPTION_FLAG(validate_user_user),
+	 NULL, NULL, 0,
+	 "flag: validate_user_user", NULL},
+	{"warn", OPTION_FLAG(warn),
+	 NULL, NULL, 1,
+	 "flag: warn", NULL},
+};
+
+static void
+option_flags(struct option_source *src, struct _pam_krb5_options *options,
+	     const char *service, const struct option_flag *flags,
+	     unsigned int n_flags)
+{
+	unsigned int i;
+	int *value;
+
+	for (i = 0; i < n_flags; i++) {
+		value = (int *) (((char *) options) + flags[i].offset);
+		*value = option_b(src, options->realm, service,
+				  flags[i].default_services,
+				  flags[i].default_notservices,
+				  flags[i].name, flags[i].default_value);
+	}
+}
+
+static void
+option_flags_debug(const struct _pam_krb5_options *options,
+		   const struct option_flag *flags, unsigned int n_flags)
+{
+	unsigned int i;
+	int value;
+
+	for (i = 0; i < n_flags; i++) {
+		value = *(const int *) (((const char *) options) +
+					flags[i].offset);
+		if ((value == 1) && (flags[i].set_message != NULL)) {
+			debug("%s", flags[i].set_message);
+		}
+		if ((value == 0) && (flags[i].unset_message != NULL)) {
+			debug("%s", flags[i].unset_message);
+		}
+	}
+}
+
+/* If /afs is on a different device from /, this suggests that AFS is
+ * running. */
+static void
+option_afs_mounted(struct _pam_krb5_options *options)
+{
+	struct stat stroot, stafs;
+
+	if (stat("/", &stroot) == 0) {
+		if (stat("/afs", &stafs) == 0) {
+			if (stroot.st_dev != stafs.st_dev) {
+				options->v4_for_afs = 1;
+			}
+		}
+	}
+}
+
+/* Log the settings we ended up with, whether we just worked them out or read
+ * them from the options cache.  If "trace" didn't go along with "debug",
+ * only note that "debug" was set. */
+static void
+option_debug(const struct _pam_krb5_options *options)
+{
+	int i;
+
+	if (options->debug_flag) {
+		debug("flag: debug");
+	}
+	if (options->trace_flag) {
+		debug("flag: trace");
+	}
+	if (!options->debug) {
+		return;
+	}
+	if (options->debug_sensitive) {
+		debug("flag: debug_sensitive");
+	}
+	debug("flags:%s%s%s%s%s%s%s%s",
+	      options->addressless == 1 ? " addressless" : "",
+	      options->addressless == 0 ? " not addressless" : "",
+	      options->forwardable == 1 ? " forwardable" : "",
+	      options->forwardable == 0 ? " not forwardable" : "",
+	      options->proxiable == 1 ? " proxiable" : "",
+	      options->proxiable == 0 ? " not proxiable" : "",
+	      options->renewable == 1 ? " renewable" : "",
+	      options->renewable == 0 ? " not renewable" : "");
+#ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_CANONICALIZE
+	if (options->canonicalize == 1) {
+		debug("flag: canonicalize");
+	}
+	if (options->canonicalize == 0) {
+		debug("flag: don't canonicalize");
+	}
+#endif
+#ifdef HAVE_KRB5_ANAME_TO_LOCALNAME
+	if (options->always_allow_localname == 1) {
+		debug("flag: always_allow_localname");
+	}
+	if (options->always_allow_localname == 0) {
+		debug("flag: don't always_allow_localname");
+	}
+#endif
+#ifdef HAVE_AFS
+	if (options->ignore_afs == 1) {
+		debug("flag: ignore_afs");
+	}
+	if (options->ignore_afs == 0) {
+		debug("flag: no ignore_afs");
+	}
+	if (options->null_afs_first == 1) {
+		debug("flag: null_afs");
+	}
+	if (options->null_afs_first == 0) {
+		debug("flag: no null_afs");
+	}
+	if (options->tokens) {
+		debug("flag: tokens");
+	}
+#endif
+	option_flags_debug(options, session_flags,
+			   sizeof(session_flags) / sizeof(session_flags[0]));
+#ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_PKINIT
+	if (options->pkinit_identity) {
+		debug("pkinit_identity(template): %s",
+		      options->pkinit_identity);
+	}
+	debug("pkinit_flags: %d", options->pkinit_flags);
+#endif
+#ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_PA
+	for (i = 0;
+	     (options->preauth_options != NULL) &&
+	     (options->preauth_options[i] != NULL);
+	     i++) {
+		debug("preauth_options(template): %s",
+		      options->preauth_options[i]);
+	}
+#endif
+#ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_CHANGE_PASSWORD_PROMPT
+	if (options->user_check) {
+		debug("flag: chpw_prompt");
+	}
+#endif
+	option_flags_debug(options, account_flags,
+			   sizeof(account_flags) / sizeof(account_flags[0]));
+	if (options->use_first_pass == 1) {
+		debug("will try previously set password first");
+	}
+	if (options->use_second_pass == 1) {
+		if (options->use_first_pass == 1) {
+			debug("will ask for a password if that fails");
+		} else {
+			debug("will ask for a password");
+		}
+	}
+	if (options->use_third_pass == 1) {
+		debug("will let libkrb5 ask questions");
+	} else {
+		debug("will not let libkrb5 ask questions");
+	}
+	option_flags_debug(options, behavior_flags,
+			   sizeof(behavior_flags) / sizeof(behavior_flags[0]));
+	if (options->ticket_lifetime != 0) {
+		debug("ticket lifetime: %ds (%dd,%dh,%dm,%ds)",
+		      (int) options->ticket_lifetime,
+		      (int) options->ticket_lifetime / (24 * 60 * 60),
+		      (int) (options->ticket_lifetime / (60 * 60)) % 24,
+		      (int) (options->ticket_lifetime / (60)) % 60,
+		      (int) options->ticket_lifetime  % 60);
+	} else {
+		debug("ticket lifetime: default");
+	}
+	if (options->renew_lifetime != 0) {
+		debug("renewable lifetime: %ds (%dd,%dh,%dm,%ds)",
+		      (int) options->renew_lifetime,
+		      (int) options->renew_lifetime / (24 * 60 * 60),
+		      (int) (options->renew_lifetime / (60 * 60)) % 24,
+		      (int) (options->renew_lifetime / (60)) % 60,
+		      (int) options->renew_lifetime  % 60);
+	} else {
+		debug("renewable lifetime: default");
+	}
+	if (options->minimum_uid != (uid_t) -1) {
+		debug("minimum uid: %d", options->minimum_uid);
+	}
+	if (options->banner) {
+		debug("banner: %s", options->banner);
+	}
+	if (options->ccache_dir) {
+		debug("ccache dir: %s", options->ccache_dir);
+	}
+	if (options->ccname_template) {
+		debug("ccname template: %s", options->ccname_template);
+	}
+	if (options->keytab) {
+		debug("keytab: %s", options->keytab);
+	}
+	if (options->pwhelp) {
+		debug("pwhelp: %s", options->pwhelp);
+	}
+	if (options->token_strategy) {
+		debug("token strategy: %s", options->token_strategy);
+	}
+	debug("token fetch workers: %d", options->token_fetch_workers);
+	debug("shmem transport: %s",
+	      _pam_krb5_shm_transport_name(options->shmem_transport));
+	for (i = 0;
+	     (options->hosts != NULL) && (options->hosts[i] != NULL);
+	     i++) {
+		debug("host: %s", options->hosts[i]);
+	}
+	if (options->negative_cache && options->ignore_unknown_principals) {
+		debug("negative cache: %s (%d seconds, %d entries)",
+		      options->negative_cache, options->negative_cache_ttl,
+		      options->negative_cache_size);
+	}
+	if (options->k5login_cache) {
+		debug("k5login cache: %s (%d entries)",
+		      options->k5login_cache, options->k5login_cache_size);
+	}
+	if (options->offline_cache) {
+		debug("offline cache: %s (%d second window)",
+		      options->offline_cache, options->offline_window);
+	}
+	if (options->cell_realm_cache) {
+		debug("cell realm cache: %s (%d seconds, %d seconds for "
+		      "failures, %d seconds for token methods)",
+		      options->cell_realm_cache,
+		      options->cell_realm_cache_ttl,
+		      options->cell_realm_cache_negative_ttl,
+		      options->token_method_ttl);
+	}
+	for (i = 0; i < options->n_afs_cells; i++) {
+		if (options->afs_cells[i].principal_name != NULL) {
+			debug("afs cell: %s (%s)",
+			      options->afs_cells[i].cell,
+			      options->afs_cells[i].principal_name);
+		} else {
+			debug("afs cell: %s", options->afs_cells[i].cell);
+		}
+	}
+	for (i = 0; i < options->n_mappings; i++) {
+		debug("mapping: \"%s\" to \"%s\"",
+		      options->mappings[i].pattern,
+		      options->mappings[i].replacement);
+	}
+}
+
 struct _pam_krb5_options *
 _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 		       PAM_KRB5_MAYBE_CONST char **argv,
 		       krb5_context ctx)
 {
-	struct _pam_krb5_options *options;
+	struct _pam_krb5_options *options, *cached;
+	struct option_source src;
 	int try_first_pass, use_first_pass, initial_prompt, subsequent_prompt;
-	int i;
+	int i, debug_parser;
 	char *default_realm, **list;
-	char *service;
-	struct stat stroot, stafs;
+	char *service, *key, *transport;
+	const char *cache_dir;
+	size_t key_length;
 
 	options = malloc(sizeof(struct _pam_krb5_options));
 	if (options == NULL) {
@@ -341,9 +974,10 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	if (pamh != NULL) {
 		_pam_krb5_get_item_text(pamh, PAM_SERVICE, &service);
 	}
+	option_source_init(&src, argc, argv, ctx);
 
 	/* command-line option */
-	options->debug = option_b(argc, argv, ctx, NULL,
+	options->debug = option_b(&src, NULL,
 				  service, NULL, NULL,
 				  "debug", 0);
 
@@ -374,39 +1008,83 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 		}
 	}
 
+	/* compiled options cache -- only settable here, since the point is to
+	 * avoid reading the configuration file */
+	cache_dir = NULL;
+	debug_parser = 0;
+	for (i = 0; i < argc; i++) {
+		if (strncmp(argv[i], "options_cache=", 14) == 0) {
+			cache_dir = argv[i] + 14;
+		}
+		if (strcmp(argv[i], "debug_parser") == 0) {
+			debug_parser = 1;
+		}
+	}
+	key = NULL;
+	key_length = 0;
+	if ((cache_dir != NULL) && (strlen(cache_dir) > 0) && !debug_parser) {
+		key = _pam_krb5_optcache_key(argc, argv, service,
+					     options->realm, &key_length);
+	}
+	if (key != NULL) {
+		cached = _pam_krb5_optcache_load(cache_dir, key, key_length,
+						 options->debug);
+		if (cached != NULL) {
+			free(key);
+			option_source_free(&src);
+			_pam_krb5_options_free(pamh, ctx, options);
+			options = cached;
+#ifdef HAVE_KRB5_SET_TRACE_CALLBACK
+			if (options->debug) {
+				krb5_set_trace_callback(ctx, &trace, NULL);
+			}
+#endif
+			/* This isn't configuration, so recheck it. */
+			if (!options->ignore_afs) {
+				option_afs_mounted(options);
+				if (options->n_afs_cells > 0) {
+					options->v4_for_afs = 1;
+				}
+			}
+			map_compile_mappings(options->mappings,
+					     options->n_mappings);
+			options->options_cache = xstrdup(cache_dir);
+			if (options->debug || options->debug_flag) {
+				option_debug(options);
+			}
+			return options;
+		}
+	}
+
 	/* parsing debugging */
 	for (i = 0; i < argc; i++) {
 		if (strcmp(argv[i], "debug_parser") == 0) {
 			char *s, **l;
-			i = option_b(argc, argv, ctx, options->realm,
+			i = option_b(&src, options->realm,
 				     service, NULL, NULL,
 				     "boolean_parameter_1", -1);
 			debug("boolean_parameter_1 = %d", i);
-			i = option_b(argc, argv, ctx, options->realm,
+			i = option_b(&src, options->realm,
 				     service, NULL, NULL,
 				     "boolean_parameter_2", 0);
 			debug("boolean_parameter_2 = %d", i);
-			i = option_b(argc, argv, ctx, options->realm,
+			i = option_b(&src, options->realm,
 				     service, NULL, NULL,
 				     "boolean_parameter_3", 1);
 			debug("boolean_parameter_3 = %d", i);
-			s = option_s(argc, argv,
-				     ctx, options->realm, "string_parameter_1",
+			s = option_s(&src, options->realm, "string_parameter_1",
 				     "default_string_value");
 			debug("string_parameter_1 = '%s'", s ? s : "(null)");
 			free_s(s);
-			s = option_s(argc, argv,
-				     ctx, options->realm, "string_parameter_2",
+			s = option_s(&src, options->realm, "string_parameter_2",
 				     "default_string_value");
 			debug("string_parameter_2 = '%s'", s ? s : "(null)");
 			free_s(s);
-			s = option_s(argc, argv,
-				     ctx, options->realm, "string_parameter_3",
+			s = option_s(&src, options->realm, "string_parameter_3",
 				     "default_string_value");
 			debug("string_parameter_3 = '%s'", s ? s : "(null)");
 			free_s(s);
-			l = option_l(argc, argv,
-				     ctx, options->realm, "list_parameter_1",
+			l = option_l(&src, options->realm, "list_parameter_1",
 				     "");
 			for (i = 0; (l != NULL) && (l[i] != NULL); i++) {
 				debug("list_parameter_1[%d] = '%s'", i, l[i]);
@@ -417,257 +1095,115 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	}
 
 	/* private option */
-	options->debug = option_b(argc, argv, ctx, options->realm,
+	options->debug = option_b(&src, options->realm,
 				  service, NULL, NULL,
 				  "debug", 0);
-	if (options->debug) {
-		debug("flag: debug");
-	}
+	options->debug_flag = options->debug;
 
 #ifdef HAVE_KRB5_SET_TRACE_CALLBACK
-	options->debug = option_b(argc, argv, ctx, options->realm,
+	options->debug = option_b(&src, options->realm,
 				  service, NULL, NULL,
 				  "trace", 0);
+	options->trace_flag = options->debug;
 	if (options->debug) {
-		debug("flag: trace");
 		krb5_set_trace_callback(ctx, &trace, NULL);
 	}
 #endif
 
 	/* private option */
-	options->debug_sensitive = option_b(argc, argv, ctx, options->realm,
+	options->debug_sensitive = option_b(&src, options->realm,
 					    service, NULL, NULL,
 					    "debug_sensitive", 0);
-	if (options->debug && options->debug_sensitive) {
-		debug("flag: debug_sensitive");
-	}
 
 	/* library options */
-	options->addressless = option_b(argc, argv,
-					ctx, options->realm,
+	options->addressless = option_b(&src, options->realm,
 					service, NULL, NULL, "addressless", -1);
-	options->forwardable = option_b(argc, argv,
-					ctx, options->realm,
+	options->forwardable = option_b(&src, options->realm,
 					service, NULL, NULL, "forwardable", -1);
-	options->proxiable = option_b(argc, argv,
-				      ctx, options->realm,
+	options->proxiable = option_b(&src, options->realm,
 				      service, NULL, NULL, "proxiable", -1);
-	options->renewable = option_b(argc, argv,
-				      ctx, options->realm,
+	options->renewable = option_b(&src, options->realm,
 				      service, NULL, NULL, "renewable", -1);
-	if (options->debug) {
-		debug("flags:%s%s%s%s%s%s%s%s",
-		      options->addressless == 1 ? " addressless" : "",
-		      options->addressless == 0 ? " not addressless" : "",
-		      options->forwardable == 1 ? " forwardable" : "",
-		      options->forwardable == 0 ? " not forwardable" : "",
-		      options->proxiable == 1 ? " proxiable" : "",
-		      options->proxiable == 0 ? " not proxiable" : "",
-		      options->renewable == 1 ? " renewable" : "",
-		      options->renewable == 0 ? " not renewable" : "");
-	}
 
 #ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_CANONICALIZE
-	options->canonicalize = option_b(argc, argv,
-					 ctx, options->realm,
+	options->canonicalize = option_b(&src, options->realm,
 					 service, NULL, NULL,
 					 "canonicalize", -1);
-	if (options->debug && (options->canonicalize == 1)) {
-		debug("flag: canonicalize");
-	}
-	if (options->debug && (options->canonicalize == 0)) {
-		debug("flag: don't canonicalize");
-	}
 #endif
 
 #ifdef HAVE_KRB5_ANAME_TO_LOCALNAME
 	/* private option */
-	options->always_allow_localname = option_b(argc, argv,
-						   ctx, options->realm,
+	options->always_allow_localname = option_b(&src, options->realm,
 						   service, NULL, NULL,
 						   "always_allow_localname",
 						   0);
-	if (options->debug && (options->always_allow_localname == 1)) {
-		debug("flag: always_allow_localname");
-	}
-	if (options->debug && (options->always_allow_localname == 0)) {
-		debug("flag: don't always_allow_localname");
-	}
 #endif
 #ifdef HAVE_AFS
 	/* private option */
-	options->ignore_afs = option_b(argc, argv,
-				       ctx, options->realm,
+	options->ignore_afs = option_b(&src, options->realm,
 				       service, NULL, NULL, "ignore_afs", 0);
-	if (options->debug && (options->ignore_afs == 1)) {
-		debug("flag: ignore_afs");
-	}
-	if (options->debug && (options->ignore_afs == 0)) {
-		debug("flag: no ignore_afs");
-	}
 
 	/* private option */
-	options->null_afs_first = option_b(argc, argv,
-					   ctx, options->realm,
+	options->null_afs_first = option_b(&src, options->realm,
 					   service, NULL, NULL, "null_afs", -1);
 	if (options->null_afs_first == -1) {
-		options->null_afs_first = option_b(argc, argv,
-						   ctx, options->realm,
+		options->null_afs_first = option_b(&src, options->realm,
 						   service, NULL, NULL,
 						   "nullafs", 0);
 	}
-	if (options->debug && (options->null_afs_first == 1)) {
-		debug("flag: null_afs");
-	}
-	if (options->debug && (options->null_afs_first == 0)) {
-		debug("flag: no null_afs");
-	}
 
 	/* private option */
-	options->tokens = option_b(argc, argv, ctx, options->realm,
+	options->tokens = option_b(&src, options->realm,
 				   service, NULL, NULL, "tokens", 0);
-	if (options->debug && options->tokens) {
-		debug("flag: tokens");
-	}
 #else
 	options->ignore_afs = 1;
 	options->tokens = 0;
 #endif
 
-	/* private option */
-	options->cred_session = option_b(argc, argv,
-					 ctx, options->realm,
-					 service, NULL, DEFAULT_NO_CRED_SESSION,
-					 "cred_session", 1);
-	if (options->debug && (options->cred_session == 1)) {
-		debug("flag: cred_session");
-	}
-	if (options->debug && (options->cred_session == 0)) {
-		debug("flag: no cred_session");
-	}
-
-	/* private option */
-	options->ignore_k5login = option_b(argc, argv,
-					   ctx, options->realm,
-					   service, NULL, NULL,
-					   "ignore_k5login", 0);
-	if (options->debug && (options->ignore_k5login == 1)) {
-		debug("flag: ignore_k5login");
-	}
-	if (options->debug && (options->ignore_k5login == 0)) {
-		debug("flag: no ignore_k5login");
-	}
+	/* private options */
+	option_flags(&src, options, service, session_flags,
+		     sizeof(session_flags) / sizeof(session_flags[0]));
 
 #ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_PKINIT
 	/* option specific to the Heimdal implementation */
-	options->pkinit_identity = option_s(argc, argv, ctx, options->realm,
+	options->pkinit_identity = option_s(&src, options->realm,
 					    "pkinit_identity",
 					    DEFAULT_PKINIT_IDENTITY);
-	if (options->debug && options->pkinit_identity) {
-		debug("pkinit_identity(template): %s",
-		      options->pkinit_identity);
-	}
-	options->pkinit_flags = option_i(argc, argv,
-					 ctx, options->realm, "pkinit_flags");
+	options->pkinit_flags = option_i(&src, options->realm, "pkinit_flags");
 	if (options->pkinit_flags == -1) {
 		options->pkinit_flags = 0;
 	}
-	if (options->debug) {
-		debug("pkinit_flags: %d", options->pkinit_flags);
-	}
 #endif
 #ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_PA
 	/* option specific to the MIT implementation */
-	options->preauth_options = option_l(argc, argv, ctx, options->realm,
+	options->preauth_options = option_l(&src, options->realm,
 					    "preauth_options",
 					    DEFAULT_PREAUTH_OPTIONS);
-	if (options->debug && options->preauth_options) {
-		int i;
-		for (i = 0; options->preauth_options[i] != NULL; i++) {
-			debug("preauth_options(template): %s",
-			      options->preauth_options[i]);
-		}
-	}
 #endif
 #ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_CHANGE_PASSWORD_PROMPT
 	/* library option */
-	options->chpw_prompt = option_b(argc, argv,
-				        ctx, options->realm,
-				        service,
+	options->chpw_prompt = option_b(&src, options->realm,
+					service,
 					DEFAULT_CHPW_PROMPT, "",
 					"chpw_prompt", 0);
-	if (options->debug && options->user_check) {
-		debug("flag: chpw_prompt");
-	}
 #endif
 
-	/* private option */
-	options->user_check = option_b(argc, argv,
-				       ctx, options->realm,
-				       service, NULL, NULL, "user_check", 1);
-	if (options->debug && options->user_check) {
-		debug("flag: user_check");
-	}
-
-	/* private option */
-	options->use_authtok = option_b(argc, argv,
-					ctx, options->realm,
-					service, NULL, NULL, "use_authtok", 0);
-	if (options->debug && options->use_authtok) {
-		debug("flag: use_authtok");
-	}
-
-	/* private option */
-	options->v4 = option_b(argc, argv,
-			       ctx, options->realm,
-			       service, NULL, NULL, "krb4_convert", 0);
-	if (options->debug && (options->v4 == 1)) {
-		debug("flag: krb4_convert");
-	}
-	if (options->debug && (options->v4 == 0)) {
-		debug("flag: no krb4_convert");
-	}
-
-	/* private option */
-	options->v4_use_524 = option_b(argc, argv,
-				       ctx, options->realm,
-				       service, NULL, NULL,
-				       "krb4_convert_524", 1);
-	if (options->debug && (options->v4_use_524 == 1)) {
-		debug("flag: krb4_convert_524");
-	}
-	if (options->debug && (options->v4_use_524 == 0)) {
-		debug("flag: no krb4_convert_524");
-	}
-
-	/* private option */
-	options->v4_use_as_req = option_b(argc, argv,
-				          ctx, options->realm,
-					  service, NULL, NULL,
-					  "krb4_use_as_req", 1);
-	if (options->debug && (options->v4_use_as_req == 1)) {
-		debug("flag: krb4_use_as_req");
-	}
-	if (options->debug && (options->v4_use_as_req == 0)) {
-		debug("flag: no krb4_use_as_req");
-	}
+	/* private options */
+	option_flags(&src, options, service, account_flags,
+		     sizeof(account_flags) / sizeof(account_flags[0]));
 
 	/* private option */
 	options->use_first_pass = 1;
 	options->use_second_pass = 1;
 	options->use_third_pass = 1;
 	options->permit_password_callback = 0;
-	use_first_pass = option_b(argc, argv,
-				  ctx, options->realm,
+	use_first_pass = option_b(&src, options->realm,
 				  service, NULL, NULL, "use_first_pass", -1);
-	try_first_pass = option_b(argc, argv,
-				  ctx, options->realm,
+	try_first_pass = option_b(&src, options->realm,
 				  service, NULL, NULL, "try_first_pass", -1);
-	initial_prompt = option_b(argc, argv,
-				  ctx, options->realm,
+	initial_prompt = option_b(&src, options->realm,
 				  service, NULL, NULL, "initial_prompt", -1);
-	subsequent_prompt = option_b(argc, argv,
-				     ctx, options->realm,
+	subsequent_prompt = option_b(&src, options->realm,
 				     service, NULL, NULL,
 				     "subsequent_prompt", -1);
 	if (initial_prompt != -1) {
@@ -683,114 +1219,20 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	if (try_first_pass == 1) {
 		options->use_second_pass = 1;
 	}
-	if (options->debug) {
-		if (options->use_first_pass == 1) {
-			debug("will try previously set password first");
-		}
-		if (options->use_second_pass == 1) {
-			if (options->use_first_pass == 1) {
-				debug("will ask for a password if that fails");
-			} else {
-				debug("will ask for a password");
-			}
-		}
-		if (options->use_third_pass == 1) {
-			debug("will let libkrb5 ask questions");
-		} else {
-			debug("will not let libkrb5 ask questions");
-		}
-	}
-
-	/* private option */
-	options->use_shmem = option_b(argc, argv,
-				      ctx, options->realm,
-				      service, DEFAULT_USE_SHMEM, NULL,
-				      "use_shmem", 0);
-	if (options->debug && (options->use_shmem == 1)) {
-		debug("flag: use_shmem");
-	}
-	if (options->debug && (options->use_shmem == 0)) {
-		debug("flag: no use_shmem");
-	}
-
-	/* private option */
-	options->external = option_b(argc, argv,
-				     ctx, options->realm,
-				     service, DEFAULT_EXTERNAL, "",
-				     "external", 0);
-	if (options->debug && (options->external == 1)) {
-		debug("flag: external");
-	}
-	if (options->debug && (options->external == 0)) {
-		debug("flag: no external");
-	}
-
-	/* private option */
-	options->existing_ticket = option_b(argc, argv,
-					    ctx, options->realm,
-					    service, NULL, NULL,
-					    "existing_ticket", 0);
-	if (options->debug && options->existing_ticket) {
-		debug("flag: existing_ticket");
-	}
 
-	/* private option */
-	options->multiple_ccaches = option_b(argc, argv,
-					     ctx, options->realm,
-					     service,
-					     DEFAULT_MULTIPLE_CCACHES, "",
-					     "multiple_ccaches", 0);
-	if (options->debug && (options->multiple_ccaches == 1)) {
-		debug("flag: multiple_ccaches");
-	}
-	if (options->debug && (options->multiple_ccaches == 0)) {
-		debug("flag: no multiple_ccaches");
-	}
-
-	/* private option */
-	options->validate = option_b(argc, argv,
-				     ctx, options->realm,
-				     service, NULL, NULL,
-				     "validate", 1);
-	if (options->debug && (options->validate == 1)) {
-		debug("flag: validate");
-	}
-	options->validate_user_user = option_b(argc, argv,
-					       ctx, options->realm,
-					       service, NULL, NULL,
-					       "validate_user_user", 0);
-	if (options->debug && (options->validate_user_user == 1)) {
-		debug("flag: validate_user_user");
-	}
-
-	options->warn = option_b(argc, argv,
-				 ctx, options->realm,
-				 service, NULL, NULL, "warn", 1);
-	if (options->debug && (options->warn == 1)) {
-		debug("flag: warn");
-	}
+	/* private options */
+	option_flags(&src, options, service, behavior_flags,
+		     sizeof(behavior_flags) / sizeof(behavior_flags[0]));
 
 	/* private option */
-	options->ticket_lifetime = option_t(argc, argv, ctx, options->realm,
+	options->ticket_lifetime = option_t(&src, options->realm,
 					    "ticket_lifetime");
 	if (options->ticket_lifetime < 0) {
 		options->ticket_lifetime = 0;
 	}
-	if (options->debug) {
-		if (options->ticket_lifetime != 0) {
-			debug("ticket lifetime: %ds (%dd,%dh,%dm,%ds)",
-			      (int) options->ticket_lifetime,
-			      (int) options->ticket_lifetime / (24 * 60 * 60),
-			      (int) (options->ticket_lifetime / (60 * 60)) % 24,
-			      (int) (options->ticket_lifetime / (60)) % 60,
-			      (int) options->ticket_lifetime  % 60);
-		} else {
-			debug("ticket lifetime: default");
-		}
-	}
 
 	/* library option */
-	options->renew_lifetime = option_t(argc, argv, ctx, options->realm,
+	options->renew_lifetime = option_t(&src, options->realm,
 					   "renew_lifetime");
 	if (options->renew_lifetime < 0) {
 		options->renew_lifetime = 0;
@@ -798,57 +1240,29 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	if (options->renew_lifetime > 0) {
 		options->renewable = 1;
 	}
-	if (options->debug) {
-		if (options->renew_lifetime != 0) {
-			debug("renewable lifetime: %ds (%dd,%dh,%dm,%ds)",
-			      (int) options->renew_lifetime,
-			      (int) options->renew_lifetime / (24 * 60 * 60),
-			      (int) (options->renew_lifetime / (60 * 60)) % 24,
-			      (int) (options->renew_lifetime / (60)) % 60,
-			      (int) options->renew_lifetime  % 60);
-		} else {
-			debug("renewable lifetime: default");
-		}
-	}
 
 	/* private option */
-	options->minimum_uid = option_i(argc, argv,
-					ctx, options->realm, "minimum_uid");
-	if (options->debug && (options->minimum_uid != (uid_t) -1)) {
-		debug("minimum uid: %d", options->minimum_uid);
-	}
+	options->minimum_uid = option_i(&src, options->realm, "minimum_uid");
 
 	/* private options */
-	options->banner = option_s(argc, argv,
-				   ctx, options->realm, "banner",
+	options->banner = option_s(&src, options->realm, "banner",
 				   "Kerberos 5");
-	if (options->debug && options->banner) {
-		debug("banner: %s", options->banner);
-	}
-	options->ccache_dir = option_s(argc, argv,
-				       ctx, options->realm, "ccache_dir",
+	options->ccache_dir = option_s(&src, options->realm, "ccache_dir",
 				       DEFAULT_CCACHE_DIR);
 	if (strlen(options->ccache_dir) == 0) {
 		xstrfree(options->ccache_dir);
 		options->ccache_dir = xstrdup(DEFAULT_CCACHE_DIR);
 	}
-	if (options->debug && options->ccache_dir) {
-		debug("ccache dir: %s", options->ccache_dir);
-	}
-	options->ccname_template = option_s(argc, argv,
-					    ctx, options->realm,
+	options->ccname_template = option_s(&src, options->realm,
 					    "ccname_template",
 					    DEFAULT_CCNAME_TEMPLATE);
 	if (strlen(options->ccname_template) == 0) {
 		xstrfree(options->ccname_template);
 		options->ccname_template = xstrdup(DEFAULT_CCNAME_TEMPLATE);
 	}
-	if (options->debug && options->ccname_template) {
-		debug("ccname template: %s", options->ccname_template);
-	}
 
 	if (service != NULL) {
-		list = option_l(argc, argv, ctx, options->realm,
+		list = option_l(&src, options->realm,
 				"keytab", DEFAULT_KEYTAB_LOCATION);
 		for (i = 0; (list != NULL) && (list[i] != NULL); i++) {
 			if ((strncmp(list[i], service, strlen(service)) == 0) &&
@@ -872,59 +1286,51 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 		xstrfree(options->keytab);
 		options->keytab = xstrdup(DEFAULT_KEYTAB_LOCATION);
 	}
-	if (options->debug && options->keytab) {
-		debug("keytab: %s", options->keytab);
-	}
 
-	options->pwhelp = option_s(argc, argv,
-				   ctx, options->realm, "pwhelp",
+	options->pwhelp = option_s(&src, options->realm, "pwhelp",
 				   "");
 	if (strlen(options->pwhelp) == 0) {
 		xstrfree(options->pwhelp);
 		options->pwhelp = NULL;
 	}
-	if (options->debug && options->pwhelp) {
-		debug("pwhelp: %s", options->pwhelp);
-	}
 
-	options->token_strategy = option_s(argc, argv,
-					   ctx, options->realm,
+	options->token_strategy = option_s(&src, options->realm,
 					   "token_strategy", "");
 	if (strlen(options->token_strategy) == 0) {
 		xstrfree(options->token_strategy);
 		options->token_strategy = xstrdup(DEFAULT_TOKEN_STRATEGY);
 	}
-	if (options->debug && options->token_strategy) {
-		debug("token strategy: %s", options->token_strategy);
+	options->token_fetch_workers = option_i(&src, options->realm,
+						"token_fetch_workers");
+	if (options->token_fetch_workers <= 0) {
+		options->token_fetch_workers = DEFAULT_TOKEN_FETCH_WORKERS;
 	}
 
-	options->hosts = option_l(argc, argv,
-				  ctx, options->realm, "hosts", "");
-	if (options->hosts) {
-		int i;
-		for (i = 0; options->hosts[i] != NULL; i++) {
-			if (options->debug) {
-				debug("host: %s", options->hosts[i]);
-			}
-			options->addressless = 0;
-		}
+	transport = option_s(&src, options->realm, "shmem_transport", "");
+	if (strlen(transport) == 0) {
+		xstrfree(transport);
+		transport = xstrdup(DEFAULT_SHMEM_TRANSPORT);
+	}
+	options->shmem_transport = _pam_krb5_shm_transport(transport);
+	xstrfree(transport);
+
+	options->hosts = option_l(&src, options->realm, "hosts", "");
+	if ((options->hosts != NULL) && (options->hosts[0] != NULL)) {
+		options->addressless = 0;
 	}
 
-	options->ignore_unknown_principals = option_b(argc, argv, ctx,
-						      options->realm,
+	options->ignore_unknown_principals = option_b(&src, options->realm,
 						      service, NULL, NULL,
 						      "ignore_unknown_principals", -1);
 	if (options->ignore_unknown_principals == -1) {
-		options->ignore_unknown_principals = option_b(argc, argv, ctx,
-							      options->realm,
+		options->ignore_unknown_principals = option_b(&src, options->realm,
 							      service,
 							      NULL, NULL,
 							      "ignore_unknown_spn",
 							      -1);
 	}
 	if (options->ignore_unknown_principals == -1) {
-		options->ignore_unknown_principals = option_b(argc, argv, ctx,
-							      options->realm,
+		options->ignore_unknown_principals = option_b(&src, options->realm,
 							      service,
 							      NULL, NULL,
 							      "ignore_unknown_upn",
@@ -934,18 +1340,81 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 		options->ignore_unknown_principals = 0;
 	}
 
+	/* remembering unknown principals only matters if we ignore them */
+	options->negative_cache = option_s(&src, options->realm,
+					   "negative_cache", "");
+	if (strlen(options->negative_cache) == 0) {
+		xstrfree(options->negative_cache);
+		options->negative_cache = NULL;
+	}
+	options->negative_cache_ttl = option_t(&src, options->realm,
+					       "negative_cache_ttl");
+	if (options->negative_cache_ttl < 0) {
+		options->negative_cache_ttl = DEFAULT_NEGATIVE_CACHE_TTL;
+	}
+	options->negative_cache_size = option_i(&src, options->realm,
+						"negative_cache_size");
+	if (options->negative_cache_size <= 0) {
+		options->negative_cache_size = DEFAULT_NEGATIVE_CACHE_SIZE;
+	}
+
+	/* remembering which principals .k5login files list */
+	options->k5login_cache = option_s(&src, options->realm,
+					  "k5login_cache", "");
+	if (strlen(options->k5login_cache) == 0) {
+		xstrfree(options->k5login_cache);
+		options->k5login_cache = NULL;
+	}
+	options->k5login_cache_size = option_i(&src, options->realm,
+					       "k5login_cache_size");
+	if (options->k5login_cache_size <= 0) {
+		options->k5login_cache_size = DEFAULT_K5LOGIN_CACHE_SIZE;
+	}
+
+	/* remembering password verifiers for when the KDCs are unreachable */
+	options->offline_cache = option_s(&src, options->realm,
+					  "offline_cache", "");
+	if (strlen(options->offline_cache) == 0) {
+		xstrfree(options->offline_cache);
+		options->offline_cache = NULL;
+	}
+	options->offline_window = option_t(&src, options->realm,
+					   "offline_window");
+	if (options->offline_window < 0) {
+		options->offline_window = 0;
+	}
+
+	/* remembering which realms AFS cells are in */
+	options->cell_realm_cache = option_s(&src, options->realm,
+					     "cell_realm_cache", "");
+	if (strlen(options->cell_realm_cache) == 0) {
+		xstrfree(options->cell_realm_cache);
+		options->cell_realm_cache = NULL;
+	}
+	options->cell_realm_cache_ttl = option_t(&src, options->realm,
+						 "cell_realm_cache_ttl");
+	if (options->cell_realm_cache_ttl < 0) {
+		options->cell_realm_cache_ttl = DEFAULT_CELL_REALM_CACHE_TTL;
+	}
+	options->cell_realm_cache_negative_ttl = option_t(&src,
+							  options->realm,
+							  "cell_realm_cache_negative_ttl");
+	if (options->cell_realm_cache_negative_ttl < 0) {
+		options->cell_realm_cache_negative_ttl =
+			DEFAULT_CELL_REALM_CACHE_NEGATIVE_TTL;
+	}
+	options->token_method_ttl = option_t(&src, options->realm,
+					     "token_method_ttl");
+	if (options->token_method_ttl < 0) {
+		options->token_method_ttl = DEFAULT_TOKEN_METHOD_TTL;
+	}
+
 	/* If /afs is on a different device from /, this suggests that AFS is
 	 * running.  Set up to get tokens for the local cell and attempt to
 	 * get that cell's name if we're not ignoring AFS altogether. */
 	if (!options->ignore_afs) {
-		if (stat("/", &stroot) == 0) {
-			if (stat("/afs", &stafs) == 0) {
-				if (stroot.st_dev != stafs.st_dev) {
-					options->v4_for_afs = 1;
-				}
-			}
-		}
-		list = option_l(argc, argv, ctx, options->realm, "afs_cells",
+		option_afs_mounted(options);
+		list = option_l(&src, options->realm, "afs_cells",
 				"");
 		if ((list != NULL) && (list[0] != NULL)) {
 			int i;
@@ -978,24 +1447,10 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 			}
 			free_l(list);
 		}
-		if (options->debug && options->afs_cells) {
-			int i;
-			for (i = 0; i < options->n_afs_cells; i++) {
-				if (options->afs_cells[i].principal_name != NULL) {
-					debug("afs cell: %s (%s)",
-					      options->afs_cells[i].cell,
-					      options->afs_cells[i].principal_name);
-				} else {
-					debug("afs cell: %s",
-					      options->afs_cells[i].cell);
-				}
-			}
-		}
 	}
 
-	options->mappings_s = option_s(argc, argv,
-				       ctx, options->realm, "mappings", "");
-	list = option_l(argc, argv, ctx, options->realm, "mappings", "");
+	options->mappings_s = option_s(&src, options->realm, "mappings", "");
+	list = option_l(&src, options->realm, "mappings", "");
 	for (i = 0; (list != NULL) && (list[i] != NULL); i++) {
 		/* nothing */
 	}
@@ -1013,14 +1468,29 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 			options->mappings[i].pattern = xstrdup(list[i * 2]);
 			options->mappings[i].replacement =
 				xstrdup(list[i * 2 + 1]);
-			if (options->debug) {
-				debug("mapping: \"%s\" to \"%s\"",
-				      options->mappings[i].pattern,
-				      options->mappings[i].replacement);
-			}
+			options->mappings[i].rule = NULL;
 		}
+		map_compile_mappings(options->mappings, options->n_mappings);
 	}
 	free_l(list);
+	option_source_free(&src);
+
+	if (options->debug || options->debug_flag) {
+		option_debug(options);
+	}
+
+	if (key != NULL) {
+		if ((_pam_krb5_optcache_store(cache_dir, key, key_length,
+					      options) != 0) &&
+		    options->debug) {
+			debug("error saving options to cache in \"%s\"",
+			      cache_dir);
+		}
+		free(key);
+		/* Also used for remembering other things, but it's not worth
+		 * saving. */
+		options->options_cache = xstrdup(cache_dir);
+	}
 
 	return options;
 }
@@ -1045,6 +1515,16 @@ _pam_krb5_options_free(pam_handle_t *pamh, krb5_context ctx,
 	options->ccname_template = NULL;
 	free_s(options->keytab);
 	options->keytab = NULL;
+	free_s(options->negative_cache);
+	options->negative_cache = NULL;
+	free_s(options->offline_cache);
+	options->offline_cache = NULL;
+	free_s(options->k5login_cache);
+	options->k5login_cache = NULL;
+	free_s(options->cell_realm_cache);
+	options->cell_realm_cache = NULL;
+	free_s(options->options_cache);
+	options->options_cache = NULL;
 	free_s(options->pwhelp);
 	options->pwhelp = NULL;
 	free_s(options->realm);
@@ -1057,6 +1537,7 @@ _pam_krb5_options_free(pam_handle_t *pamh, krb5_context ctx,
 	}
 	free(options->afs_cells);
 	options->afs_cells = NULL;
+	map_free_mappings(options->mappings, options->n_mappings);
 	for (i = 0; i < options->n_mappings; i++) {
 		xstrfree(options->mappings[i].pattern);
 		xstrfree(options->mappings[i].replacement);
@@ -33,8 +33,11 @@
 #ifndef pam_krb5_options_h
 #define pam_krb5_options_h
 
+/* Settings which are read from the configuration need to be added to the
+ * tables in optcache.c, too. */
 struct _pam_krb5_options {
 	int debug;
+	int debug_flag, trace_flag;	/* which of these turned it on */
 
 	int addressless;
 #ifdef HAVE_KRB5_ANAME_TO_LOCALNAME
@@ -43,6 +46,8 @@ struct _pam_krb5_options {
 #ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_CANONICALIZE
 	int canonicalize;
 #endif
+	int cell_realm_cache_negative_ttl;
+	int cell_realm_cache_ttl;
 	int chpw_prompt;
 	int cred_session;
 	int debug_sensitive;
@@ -52,11 +57,18 @@ struct _pam_krb5_options {
 	int ignore_afs;
 	int ignore_k5login;
 	int ignore_unknown_principals;
+	int k5login_cache_size;
 	int multiple_ccaches;
+	int negative_cache_size;
+	int negative_cache_ttl;
 	int null_afs_first;
+	int offline_window;
 	int permit_password_callback;
+	int persistent_storetmp;
 	int proxiable;
 	int renewable;
+	int token_fetch_workers;
+	int token_method_ttl;
 	int tokens;
 	int user_check;
 	int use_authtok;
@@ -64,6 +76,7 @@ struct _pam_krb5_options {
 	int use_second_pass;
 	int use_third_pass;
 	int use_shmem;
+	int shmem_transport;
 	int validate;
 	int validate_user_user;
 	int v4;
@@ -80,7 +93,12 @@ struct _pam_krb5_options {
 	char *banner;
 	char *ccache_dir;
 	char *ccname_template;
+	char *cell_realm_cache;
+	char *k5login_cache;
 	char *keytab;
+	char *negative_cache;
+	char *offline_cache;
+	char *options_cache;
 	char *pwhelp;
 	char *realm;
 	char *token_strategy;
@@ -102,6 +120,7 @@ struct _pam_krb5_options {
 	char *mappings_s;
 	struct name_mapping {
 		char *pattern, *replacement;
+		struct _pam_krb5_map_rule *rule;
 	} *mappings;
 	int n_mappings;
 };
@@ -0,0 +1,203 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#include KRB5_H
+
+#include "cellcache.h"
+#include "logstdio.h"
+#include "negcache.h"
+#include "options.h"
+
+extern char *log_progname;
+
+static int
+show(const struct _pam_krb5_negcache_entry *entry, void *data)
+{
+	time_t *now = data;
+
+	printf("%-48s %8ld\n", entry->principal,
+	       (long) (entry->expires - *now));
+	return 0;
+}
+
+static int
+show_cell(const struct _pam_krb5_cellcache_entry *entry, void *data)
+{
+	time_t *now = data;
+	char method[PAM_KRB5_CELLCACHE_METHOD_MAX +
+		    PAM_KRB5_CELLCACHE_PRINCIPAL_MAX + 4];
+
+	if (entry->expires != 0) {
+		printf("%-32s %-32s %8ld\n", entry->cell,
+		       entry->realm ? entry->realm : "(unknown)",
+		       (long) (entry->expires - *now));
+	}
+	if (entry->method != NULL) {
+		snprintf(method, sizeof(method), "[%s]%s%s", entry->method,
+			 entry->principal ? " " : "",
+			 entry->principal ? entry->principal : "");
+		printf("%-32s %-32s %8ld\n", entry->cell, method,
+		       (long) (entry->method_expires - *now));
+	}
+	return 0;
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s -d directory [-f] [principal ...]\n"
+		"       %s -d directory -c [-f] [cell ...]\n",
+		argv0, argv0);
+}
+
+/* The same, for the cell realm cache. */
+static int
+cells(const char *dir, int flush, int argc, char **argv)
+{
+	time_t now;
+	int i, ret;
+
+	if (!flush) {
+		now = time(NULL);
+		if (_pam_krb5_cellcache_list(dir, show_cell, &now) != 0) {
+			if (log_options.debug) {
+				debug("no cell realm cache in \"%s\"", dir);
+			}
+		}
+		return 0;
+	}
+	ret = 0;
+	if (argc == 0) {
+		if (_pam_krb5_cellcache_flush(dir, NULL) != 0) {
+			fprintf(stderr, "%s: error flushing cell realm cache "
+				"in \"%s\"\n", log_progname, dir);
+			ret = 1;
+		}
+	}
+	for (i = 0; i < argc; i++) {
+		if (_pam_krb5_cellcache_flush(dir, argv[i]) != 0) {
+			fprintf(stderr, "%s: error removing \"%s\" from "
+				"cell realm cache in \"%s\"\n", log_progname,
+				argv[i], dir);
+			ret = 1;
+		} else if (log_options.debug) {
+			debug("removed \"%s\"", argv[i]);
+		}
+	}
+	return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *dir;
+	time_t now;
+	int c, cell, flush, ret;
+
+	log_progname = "pam_krb5_cachectl";
+	memset(&log_options, 0, sizeof(log_options));
+	dir = NULL;
+	cell = 0;
+	flush = 0;
+	while ((c = getopt(argc, argv, "cd:fv")) != -1) {
+		switch (c) {
+		case 'c':
+			cell = 1;
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		case 'f':
+			flush = 1;
+			break;
+		case 'v':
+			log_options.debug++;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((dir == NULL) || (!flush && (optind < argc))) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (cell) {
+		return cells(dir, flush, argc - optind, argv + optind);
+	}
+
+	/* Without -f, just show what's there. */
+	if (!flush) {
+		now = time(NULL);
+		if (_pam_krb5_negcache_list(dir, show, &now) != 0) {
+			if (log_options.debug) {
+				debug("no unknown principal cache in \"%s\"",
+				      dir);
+			}
+		}
+		return 0;
+	}
+
+	/* With -f, forget about the named principals, or everything. */
+	ret = 0;
+	if (optind >= argc) {
+		if (_pam_krb5_negcache_flush(dir, NULL) != 0) {
+			fprintf(stderr, "%s: error flushing cache in \"%s\"\n",
+				log_progname, dir);
+			ret = 1;
+		}
+	}
+	for (c = optind; c < argc; c++) {
+		if (_pam_krb5_negcache_flush(dir, argv[c]) != 0) {
+			fprintf(stderr, "%s: error removing \"%s\" from "
+				"cache in \"%s\"\n", log_progname, argv[c],
+				dir);
+			ret = 1;
+		} else if (log_options.debug) {
+			debug("removed \"%s\"", argv[c]);
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <errno.h>
+#include <limits.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#include KRB5_H
+#ifdef USE_KRB4
+#include KRB4_DES_H
+#include KRB4_KRB_H
+#ifdef KRB4_KRB_ERR_H
+#include KRB4_KRB_ERR_H
+#endif
+#endif
+
+#include "logstdio.h"
+#include "options.h"
+#include "shmem.h"
+
+extern char *log_progname;
+
+/* By default, leave segments alone for this long after they're created, so
+ * that we don't race with a process which is about to attach to one. */
+#define DEFAULT_MINIMUM_AGE 300
+
+struct reap_state {
+	int remove, header;
+	time_t now, minimum_age;
+	unsigned int found, orphaned, removed;
+};
+
+/* Guess at which kind of stash, if any, a segment holds, based on how
+ * stash.c lays them out: four ints, the first being the length of the
+ * ccache file which follows, for v5 credentials, and two ints, the second
+ * being the size of the CREDENTIALS structure which follows, for v4. */
+static const char *
+classify(const unsigned char *blob, size_t size)
+{
+	const int *ints;
+	ints = (const int *) blob;
+	if ((size >= sizeof(int) * 4 + 2) &&
+	    (ints[0] > 0) &&
+	    (sizeof(int) * 4 + ints[0] <= size) &&
+	    (blob[sizeof(int) * 4] == 5) &&
+	    (blob[sizeof(int) * 4 + 1] >= 1) &&
+	    (blob[sizeof(int) * 4 + 1] <= 4)) {
+		return "v5";
+	}
+#ifdef USE_KRB4
+	if ((size >= sizeof(int) * 2 + sizeof(CREDENTIALS)) &&
+	    (ints[1] == sizeof(CREDENTIALS))) {
+		return "v4";
+	}
+#endif
+	return NULL;
+}
+
+/* Check if a process exists, erring on the side of thinking that it does. */
+static int
+alive(pid_t pid)
+{
+	return (pid <= 0) || (kill(pid, 0) == 0) || (errno != ESRCH);
+}
+
+static int
+examine(const struct _pam_krb5_shm_info *info, void *data)
+{
+	struct reap_state *state = data;
+	struct passwd *pwd;
+	char ref[64], owner[32];
+	const char *kind, *status;
+	void *blob;
+	size_t size;
+	long age;
+
+	/* Look inside to see if it's one of ours. */
+	blob = _pam_krb5_shm_attach(info->transport, info->key,
+				    info->creator, &size);
+	if (blob == NULL) {
+		if (log_options.debug) {
+			debug("unable to examine segment %d", info->key);
+		}
+		return 0;
+	}
+	kind = classify(blob, size);
+	_pam_krb5_shm_detach(info->transport, blob, size);
+	if (kind == NULL) {
+		return 0;
+	}
+	state->found++;
+
+	/* It's an orphan if its creator is gone and nobody's using it. */
+	age = state->now - info->changed;
+	if (alive(info->creator) || (info->attached > 0)) {
+		status = "active";
+	} else {
+		state->orphaned++;
+		status = "orphaned";
+		if (state->remove && (age >= state->minimum_age)) {
+			_pam_krb5_shm_remove(info->transport, info->creator,
+					     info->key, log_options.debug);
+			state->removed++;
+			status = "removed";
+		}
+	}
+
+	_pam_krb5_shm_format(info->transport, info->key, info->creator,
+			     ref, sizeof(ref));
+	pwd = getpwuid(info->owner);
+	if (pwd != NULL) {
+		snprintf(owner, sizeof(owner), "%s", pwd->pw_name);
+	} else {
+		snprintf(owner, sizeof(owner), "%lu",
+			 (unsigned long) info->owner);
+	}
+	if (state->header) {
+		printf("%-24s %-12s %8s %8s %6s %-4s %s\n",
+		       "SEGMENT", "OWNER", "CREATOR", "AGE", "SIZE", "TYPE",
+		       "STATUS");
+		state->header = 0;
+	}
+	printf("%-24s %-12s %8ld %8ld %6lu %-4s %s\n",
+	       ref, owner, (long) info->creator, age,
+	       (unsigned long) info->size, kind, status);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct reap_state state;
+	int c;
+
+	log_progname = "pam_krb5_shmreap";
+	memset(&log_options, 0, sizeof(log_options));
+	memset(&state, 0, sizeof(state));
+	state.header = 1;
+	state.minimum_age = DEFAULT_MINIMUM_AGE;
+	while ((c = getopt(argc, argv, "a:qrv")) != -1) {
+		switch (c) {
+		case 'a':
+			state.minimum_age = atol(optarg);
+			break;
+		case 'q':
+			state.header = 0;
+			break;
+		case 'r':
+			state.remove = 1;
+			break;
+		case 'v':
+			log_options.debug++;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-q] [-r] [-v] "
+				"[-a minimum-age]\n", argv[0]);
+			return 1;
+		}
+	}
+	if ((optind < argc) || (state.minimum_age < 0)) {
+		fprintf(stderr, "Usage: %s [-q] [-r] [-v] "
+			"[-a minimum-age]\n", argv[0]);
+		return 1;
+	}
+
+	state.now = time(NULL);
+	_pam_krb5_shm_list(examine, &state);
+	if (log_options.debug) {
+		debug("%u segments, %u orphaned, %u removed",
+		      state.found, state.orphaned, state.removed);
+	}
+	return 0;
+}
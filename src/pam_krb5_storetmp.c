@@ -33,13 +33,17 @@
 #include "../config.h"
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
 #include <grp.h>
+#include <limits.h>
 #include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "storetmp.h"
 #include "xstr.h"
 
 /* A simple (hopefully) helper which creates a file using mkstemp() and a
@@ -49,8 +53,263 @@
  *
  * While all of this can be done directly by pam_krb5, we need to do it after
  * an exec() to have the file created with the proper context if we're running
- * in an SELinux environment, so the helper is used.  To simplify debugging and
- * maintenance, use of this helper is not conditionalized. */
+ * in an SELinux environment and pam_krb5 wasn't built with libselinux, or if
+ * it can't find out which context the file should have, so the helper is used
+ * in those cases. */
+
+static ssize_t
+read_all(int fd, void *buf, size_t len)
+{
+	size_t length;
+	ssize_t ret;
+
+	for (length = 0; length < len; length += ret) {
+		ret = read(fd, (char *) buf + length, len - length);
+		if ((ret == -1) && (errno == EINTR)) {
+			ret = 0;
+			continue;
+		}
+		if (ret <= 0) {
+			break;
+		}
+	}
+	return length;
+}
+
+static ssize_t
+write_all(int fd, const void *buf, size_t len)
+{
+	size_t length;
+	ssize_t ret;
+
+	for (length = 0; length < len; length += ret) {
+		ret = write(fd, (const char *) buf + length, len - length);
+		if ((ret == -1) && (errno == EINTR)) {
+			ret = 0;
+			continue;
+		}
+		if (ret <= 0) {
+			break;
+		}
+	}
+	return length;
+}
+
+/* The IDs we were running with before we switched to a client's. */
+struct persistent_ids {
+	gid_t groups[NGROUPS_MAX], gid;
+	uid_t uid;
+	int n_groups;
+};
+
+/* Switch our effective IDs to the given ones.  We can't give up privileges
+ * for good, since the next request may be for someone else.  Returns -1 if
+ * we didn't end up with exactly the IDs we were asked for, in which case
+ * the caller should still switch back before refusing the request. */
+static int
+persistent_become(struct persistent_ids *saved, long long uid, long long gid)
+{
+	int ret;
+
+	ret = 0;
+	saved->uid = geteuid();
+	saved->gid = getegid();
+	saved->n_groups = -1;
+	if (saved->uid == 0) {
+		saved->n_groups = getgroups(NGROUPS_MAX, saved->groups);
+		if ((saved->n_groups < 0) ||
+		    (setgroups(0, &saved->gid) != 0)) {
+			ret = -1;
+		}
+	}
+	if ((gid != -1) && (saved->gid != gid) && (setegid(gid) != 0)) {
+		ret = -1;
+	}
+	if ((uid != -1) && (saved->uid != uid) && (seteuid(uid) != 0)) {
+		ret = -1;
+	}
+	if (((gid != -1) && (getegid() != gid)) ||
+	    ((uid != -1) && (geteuid() != uid))) {
+		ret = -1;
+	}
+	return ret;
+}
+
+/* Switch back to the IDs we had before. */
+static void
+persistent_restore(struct persistent_ids *saved)
+{
+	if (geteuid() != saved->uid) {
+		seteuid(saved->uid);
+	}
+	if (getegid() != saved->gid) {
+		setegid(saved->gid);
+	}
+	if (saved->n_groups >= 0) {
+		setgroups(saved->n_groups, saved->groups);
+	}
+}
+
+/* The names of the files which we've created and not yet removed. */
+struct persistent_file {
+	char *name;
+	struct persistent_file *next;
+};
+static struct persistent_file *persistent_files;
+
+static struct persistent_file **
+persistent_find(const char *filename)
+{
+	struct persistent_file **file;
+
+	for (file = &persistent_files; *file != NULL; file = &(*file)->next) {
+		if (strcmp((*file)->name, filename) == 0) {
+			break;
+		}
+	}
+	return file;
+}
+
+/* Create one file for a persistent helper's client. */
+static int
+persistent_create(char *filename, long long uid, long long gid,
+		  const unsigned char *data, size_t data_len)
+{
+	struct persistent_ids saved;
+	struct persistent_file *file;
+	int fd, ret;
+
+	ret = -1;
+	fd = -1;
+	if (persistent_become(&saved, uid, gid) == 0) {
+		fd = mkstemp(filename);
+	}
+	if (fd != -1) {
+		if (write_all(fd, data, data_len) == (ssize_t) data_len) {
+			ret = 0;
+		}
+		if (close(fd) != 0) {
+			ret = -1;
+		}
+		if (ret != 0) {
+			unlink(filename);
+		}
+	}
+	persistent_restore(&saved);
+	if (ret == 0) {
+		file = malloc(sizeof(*file));
+		if (file != NULL) {
+			file->name = xstrdup(filename);
+			if (file->name != NULL) {
+				file->next = persistent_files;
+				persistent_files = file;
+			} else {
+				free(file);
+			}
+		}
+	}
+	return ret;
+}
+
+/* Remove one file for a persistent helper's client.  We'll only remove
+ * regular files which we created from a pattern, and we do it as the file's
+ * owner, so that we can't be used to remove anything which that user
+ * couldn't have removed. */
+static int
+persistent_delete(const char *filename)
+{
+	struct persistent_ids saved;
+	struct persistent_file **file, *node;
+	struct stat st, st2;
+	int ret;
+
+	file = persistent_find(filename);
+	if ((*file == NULL) ||
+	    (lstat(filename, &st) != 0) ||
+	    !S_ISREG(st.st_mode) ||
+	    (st.st_nlink != 1)) {
+		return -1;
+	}
+	ret = -1;
+	if ((persistent_become(&saved, st.st_uid, st.st_gid) == 0) &&
+	    (lstat(filename, &st2) == 0) &&
+	    (st2.st_dev == st.st_dev) &&
+	    (st2.st_ino == st.st_ino)) {
+		ret = unlink(filename);
+	}
+	persistent_restore(&saved);
+	if (ret == 0) {
+		node = *file;
+		*file = node->next;
+		xstrfree(node->name);
+		free(node);
+	}
+	return ret;
+}
+
+/* Serve requests until our client goes away. */
+static int
+persistent(void)
+{
+	struct _pam_krb5_storetmp_request request;
+	struct _pam_krb5_storetmp_reply reply;
+	char *filename;
+	unsigned char *data;
+
+	while (read_all(STDIN_FILENO, &request,
+			sizeof(request)) == sizeof(request)) {
+		if ((request.pattern_len == 0) ||
+		    (request.pattern_len > STORETMP_MAX_PATTERN) ||
+		    (request.data_len > STORETMP_MAX_DATA)) {
+			return 2;
+		}
+		filename = malloc(request.pattern_len + 1);
+		data = malloc(request.data_len + 1);
+		if ((filename == NULL) || (data == NULL)) {
+			return 3;
+		}
+		if ((read_all(STDIN_FILENO, filename,
+			      request.pattern_len) != request.pattern_len) ||
+		    (read_all(STDIN_FILENO, data,
+			      request.data_len) != request.data_len)) {
+			return 2;
+		}
+		filename[request.pattern_len] = '\0';
+		reply.status = -1;
+		switch (request.op) {
+		case STORETMP_OP_CREATE:
+			if ((strlen(filename) == request.pattern_len) &&
+			    (request.pattern_len > 6) &&
+			    (strcmp(filename + request.pattern_len - 6,
+				    "XXXXXX") == 0)) {
+				reply.status = persistent_create(filename,
+								 request.uid,
+								 request.gid,
+								 data,
+								 request.data_len);
+			}
+			break;
+		case STORETMP_OP_DELETE:
+			if (strlen(filename) == request.pattern_len) {
+				reply.status = persistent_delete(filename);
+			}
+			break;
+		default:
+			break;
+		}
+		reply.name_len = (reply.status == 0) ? strlen(filename) : 0;
+		if ((write_all(STDOUT_FILENO, &reply,
+			       sizeof(reply)) != sizeof(reply)) ||
+		    (write_all(STDOUT_FILENO, filename,
+			       reply.name_len) != (ssize_t) reply.name_len)) {
+			return 8;
+		}
+		memset(data, 0, request.data_len);
+		free(data);
+		free(filename);
+	}
+	return 0;
+}
 
 int
 main(int argc, const char **argv)
@@ -66,6 +325,10 @@ main(int argc, const char **argv)
 		return 1;
 	}
 
+	if ((argc == 2) && (strcmp(argv[1], STORETMP_PERSISTENT_ARG) == 0)) {
+		return persistent();
+	}
+
 	/* One, two, or three arguments.  No more, no less, else we bail. */
 	if ((argc < 2) || (argc > 4)) {
 		return 2;
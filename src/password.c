@@ -65,6 +65,7 @@
 #include "options.h"
 #include "prompter.h"
 #include "stash.h"
+#include "txn.h"
 #include "userinfo.h"
 #include "v5.h"
 #include "v4.h"
@@ -89,7 +90,7 @@ pam_sm_chauthtok(pam_handle_t *pamh, int flags,
 	struct pam_message message;
 
 	/* Initialize Kerberos. */
-	if (_pam_krb5_init_ctx(&ctx, argc, argv) != 0) {
+	if (_pam_krb5_txn_init_ctx(pamh, &ctx, argc, argv) != 0) {
 		warn("error initializing Kerberos");
 		return PAM_SERVICE_ERR;
 	}
@@ -98,7 +99,7 @@ pam_sm_chauthtok(pam_handle_t *pamh, int flags,
 	i = pam_get_user(pamh, &user, NULL);
 	if ((i != PAM_SUCCESS) || (user == NULL)) {
 		warn("could not identify user name");
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return i;
 	}
 
@@ -106,20 +107,20 @@ pam_sm_chauthtok(pam_handle_t *pamh, int flags,
 	i = v5_alloc_get_init_creds_opt(ctx, &gic_options);
 	if (i != 0) {
 		warn("error initializing options (shouldn't happen)");
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
-	options = _pam_krb5_options_init(pamh, argc, argv, ctx);
+	options = _pam_krb5_txn_options_init(pamh, argc, argv, ctx);
 	if (options == NULL) {
 		warn("error parsing options (shouldn't happen)");
 		v5_free_get_init_creds_opt(ctx, gic_options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 	_pam_krb5_set_init_opts(ctx, gic_options, options);
 
 	/* Get information about the user and the user's principal name. */
-	userinfo = _pam_krb5_user_info_init(ctx, user, options);
+	userinfo = _pam_krb5_txn_user_info_init(pamh, ctx, user, options);
 	if (userinfo == NULL) {
 		if (options->ignore_unknown_principals) {
 			retval = PAM_IGNORE;
@@ -127,9 +128,9 @@ pam_sm_chauthtok(pam_handle_t *pamh, int flags,
 			warn("error getting information about '%s'", user);
 			retval = PAM_USER_UNKNOWN;
 		}
-		_pam_krb5_options_free(pamh, ctx, options);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
 		v5_free_get_init_creds_opt(ctx, gic_options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return retval;
 	}
 
@@ -141,10 +142,10 @@ pam_sm_chauthtok(pam_handle_t *pamh, int flags,
 			debug("ignoring '%s' -- uid below minimum = %lu", user,
 			      (unsigned long) options->minimum_uid);
 		}
-		_pam_krb5_user_info_free(ctx, userinfo);
-		_pam_krb5_options_free(pamh, ctx, options);
+		_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
 		v5_free_get_init_creds_opt(ctx, gic_options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_IGNORE;
 	}
 
@@ -555,9 +556,9 @@ pam_sm_chauthtok(pam_handle_t *pamh, int flags,
 		       "unknown phase"),
 		      retval, pam_strerror(pamh, retval));
 	}
-	_pam_krb5_user_info_free(ctx, userinfo);
-	_pam_krb5_options_free(pamh, ctx, options);
+	_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
+	_pam_krb5_txn_options_free(pamh, ctx, options);
 	v5_free_get_init_creds_opt(ctx, gic_options);
-	krb5_free_context(ctx);
+	_pam_krb5_txn_free_ctx(pamh, ctx);
 	return retval;
 }
@@ -33,6 +33,7 @@
 #include "../config.h"
 
 #include <sys/types.h>
+#include <grp.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include "perms.h"
@@ -40,6 +41,9 @@
 struct _pam_krb5_perms {
 	uid_t ruid, euid;
 	gid_t rgid, egid;
+	/* Only used when we've become someone else. */
+	int become, n_groups;
+	gid_t *groups;
 };
 
 struct _pam_krb5_perms *
@@ -48,6 +52,9 @@ _pam_krb5_switch_perms(void)
 	struct _pam_krb5_perms *ret;
 	ret = malloc(sizeof(*ret));
 	if (ret != NULL) {
+		ret->become = 0;
+		ret->n_groups = -1;
+		ret->groups = NULL;
 		ret->ruid = getuid();
 		ret->euid = geteuid();
 		ret->rgid = getgid();
@@ -74,16 +81,83 @@ _pam_krb5_switch_perms(void)
 	return ret;
 }
 
+/* Switch our effective IDs to the user's, dropping supplementary groups, so
+ * that we can only read files which the user could read.  Returns NULL if
+ * we can't, which is always the case if we're not root or the user. */
+struct _pam_krb5_perms *
+_pam_krb5_become_user(uid_t uid, gid_t gid)
+{
+	struct _pam_krb5_perms *ret;
+
+	ret = malloc(sizeof(*ret));
+	if (ret == NULL) {
+		return NULL;
+	}
+	ret->become = 1;
+	ret->ruid = -1;
+	ret->rgid = -1;
+	ret->euid = geteuid();
+	ret->egid = getegid();
+	ret->n_groups = -1;
+	ret->groups = NULL;
+	if ((ret->euid == uid) && (ret->egid == gid)) {
+		/* Nothing to do. */
+		return ret;
+	}
+	if (ret->euid != 0) {
+		free(ret);
+		return NULL;
+	}
+	ret->n_groups = getgroups(0, NULL);
+	if (ret->n_groups > 0) {
+		ret->groups = malloc(sizeof(gid_t) * ret->n_groups);
+		if ((ret->groups == NULL) ||
+		    (getgroups(ret->n_groups, ret->groups) != ret->n_groups)) {
+			free(ret->groups);
+			free(ret);
+			return NULL;
+		}
+	}
+	if ((ret->n_groups < 0) ||
+	    (setgroups(0, NULL) != 0) ||
+	    (setegid(gid) != 0) ||
+	    (seteuid(uid) != 0) ||
+	    (geteuid() != uid) ||
+	    (getegid() != gid)) {
+		_pam_krb5_restore_perms(ret);
+		return NULL;
+	}
+	return ret;
+}
+
 int
 _pam_krb5_restore_perms(struct _pam_krb5_perms *saved)
 {
 	int ret = -1;
-	if (saved != NULL) {
+	if (saved == NULL) {
+		return ret;
+	}
+	if (saved->become) {
+		ret = 0;
+		if ((geteuid() != saved->euid) &&
+		    (seteuid(saved->euid) != 0)) {
+			ret = -1;
+		}
+		if ((getegid() != saved->egid) &&
+		    (setegid(saved->egid) != 0)) {
+			ret = -1;
+		}
+		if ((saved->n_groups >= 0) &&
+		    (setgroups(saved->n_groups, saved->groups) != 0)) {
+			ret = -1;
+		}
+		free(saved->groups);
+	} else {
 		if ((setreuid(saved->ruid, saved->euid) == 0) &&
 		    (setregid(saved->rgid, saved->egid) == 0)) {
 			ret = 0;
 		}
-		free(saved);
 	}
+	free(saved);
 	return ret;
 }
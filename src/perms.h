@@ -35,6 +35,7 @@
 
 struct _pam_krb5_perms;
 struct _pam_krb5_perms *_pam_krb5_switch_perms(void);
+struct _pam_krb5_perms *_pam_krb5_become_user(uid_t uid, gid_t gid);
 int _pam_krb5_restore_perms(struct _pam_krb5_perms *saved);
 
 #endif
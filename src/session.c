@@ -63,6 +63,7 @@
 #include "shmem.h"
 #include "stash.h"
 #include "tokens.h"
+#include "txn.h"
 #include "userinfo.h"
 #include "v5.h"
 #include "v4.h"
@@ -84,7 +85,7 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 	int i, retval;
 
 	/* Initialize Kerberos. */
-	if (_pam_krb5_init_ctx(&ctx, argc, argv) != 0) {
+	if (_pam_krb5_txn_init_ctx(pamh, &ctx, argc, argv) != 0) {
 		warn("error initializing Kerberos");
 		return PAM_SERVICE_ERR;
 	}
@@ -93,28 +94,28 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 	i = pam_get_user(pamh, &user, NULL);
 	if ((i != PAM_SUCCESS) || (user == NULL)) {
 		warn("could not identify user name");
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return i;
 	}
 
 	/* Read our options. */
-	options = _pam_krb5_options_init(pamh, argc, argv, ctx);
+	options = _pam_krb5_txn_options_init(pamh, argc, argv, ctx);
 	if (options == NULL) {
 		warn("error parsing options (shouldn't happen)");
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 
 	/* If we're in a no-cred-session situation, return. */
 	if ((!options->cred_session) &&
 	    (caller_type == _pam_krb5_session_caller_setcred)) {
-		_pam_krb5_options_free(pamh, ctx, options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SUCCESS;
 	}
 
 	/* Get information about the user and the user's principal name. */
-	userinfo = _pam_krb5_user_info_init(ctx, user, options);
+	userinfo = _pam_krb5_txn_user_info_init(pamh, ctx, user, options);
 	if (userinfo == NULL) {
 		if (options->debug) {
 			debug("no user info for '%s'", user);
@@ -129,8 +130,8 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 			      retval,
 			      pam_strerror(pamh, retval));
 		}
-		_pam_krb5_options_free(pamh, ctx, options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return retval;
 	}
 	if ((options->user_check) &&
@@ -140,13 +141,13 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 			debug("ignoring '%s' -- uid below minimum = %lu", user,
 			      (unsigned long) options->minimum_uid);
 		}
-		_pam_krb5_user_info_free(ctx, userinfo);
+		_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
 		if (options->debug) {
 			debug("%s returning %d (%s)", caller, PAM_IGNORE,
 			      pam_strerror(pamh, PAM_IGNORE));
 		}
-		_pam_krb5_options_free(pamh, ctx, options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_IGNORE;
 	}
 
@@ -154,14 +155,14 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 	stash = _pam_krb5_stash_get(pamh, user, userinfo, options);
 	if (stash == NULL) {
 		warn("no stash for '%s' (shouldn't happen)", user);
-		_pam_krb5_user_info_free(ctx, userinfo);
+		_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
 		if (options->debug) {
 			debug("%s returning %d (%s)", caller,
 			      PAM_SERVICE_ERR,
 			      pam_strerror(pamh, PAM_SERVICE_ERR));
 		}
-		_pam_krb5_options_free(pamh, ctx, options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 
@@ -175,7 +176,8 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 				      " creator pid %ld",
 				      stash->v5shm, (long) stash->v5shm_owner);
 			}
-			_pam_krb5_shm_remove(stash->v5shm_owner, stash->v5shm,
+			_pam_krb5_shm_remove(stash->v5shm_transport,
+					     stash->v5shm_owner, stash->v5shm,
 					     options->debug);
 			stash->v5shm = -1;
 			_pam_krb5_stash_shm5_name(options, user, &segname);
@@ -191,7 +193,8 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 				      " creator pid %ld",
 				      stash->v4shm, (long) stash->v4shm_owner);
 			}
-			_pam_krb5_shm_remove(stash->v4shm_owner, stash->v4shm,
+			_pam_krb5_shm_remove(stash->v4shm_transport,
+					     stash->v4shm_owner, stash->v4shm,
 					     options->debug);
 			stash->v4shm = -1;
 			_pam_krb5_stash_shm4_name(options, user, &segname);
@@ -209,13 +212,13 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 			debug("no v5 creds for user '%s', "
 			      "skipping session setup", user);
 		}
-		_pam_krb5_user_info_free(ctx, userinfo);
+		_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
 		if (options->debug) {
 			debug("%s returning %d (%s)", caller, PAM_SUCCESS,
 			      pam_strerror(pamh, PAM_SUCCESS));
 		}
-		_pam_krb5_options_free(pamh, ctx, options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SUCCESS;
 	}
 
@@ -309,11 +312,11 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 		debug("%s returning %d (%s)", caller, i,
 		      pam_strerror(pamh, i));
 	}
-	_pam_krb5_options_free(pamh, ctx, options);
-	_pam_krb5_user_info_free(ctx, userinfo);
+	_pam_krb5_txn_options_free(pamh, ctx, options);
+	_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
 
 
-	krb5_free_context(ctx);
+	_pam_krb5_txn_free_ctx(pamh, ctx);
 	return i;
 }
 
@@ -331,7 +334,7 @@ _pam_krb5_close_session(pam_handle_t *pamh, int flags,
 	int i, retval;
 
 	/* Initialize Kerberos. */
-	if (_pam_krb5_init_ctx(&ctx, argc, argv) != 0) {
+	if (_pam_krb5_txn_init_ctx(pamh, &ctx, argc, argv) != 0) {
 		warn("error initializing Kerberos");
 		return PAM_SERVICE_ERR;
 	}
@@ -340,27 +343,27 @@ _pam_krb5_close_session(pam_handle_t *pamh, int flags,
 	i = pam_get_user(pamh, &user, NULL);
 	if (i != PAM_SUCCESS) {
 		warn("could not determine user name");
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return i;
 	}
 
 	/* Read our options. */
-	options = _pam_krb5_options_init(pamh, argc, argv, ctx);
+	options = _pam_krb5_txn_options_init(pamh, argc, argv, ctx);
 	if (options == NULL) {
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 
 	/* If we're in a no-cred-session situation, return. */
 	if ((!options->cred_session) &&
 	    (caller_type == _pam_krb5_session_caller_setcred)) {
-		_pam_krb5_options_free(pamh, ctx, options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SUCCESS;
 	}
 
 	/* Get information about the user and the user's principal name. */
-	userinfo = _pam_krb5_user_info_init(ctx, user, options);
+	userinfo = _pam_krb5_txn_user_info_init(pamh, ctx, user, options);
 	if (userinfo == NULL) {
 		if (options->ignore_unknown_principals) {
 			retval = PAM_IGNORE;
@@ -373,8 +376,8 @@ _pam_krb5_close_session(pam_handle_t *pamh, int flags,
 			      retval,
 			      pam_strerror(pamh, retval));
 		}
-		_pam_krb5_options_free(pamh, ctx, options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return retval;
 	}
 
@@ -385,13 +388,13 @@ _pam_krb5_close_session(pam_handle_t *pamh, int flags,
 		if (options->debug) {
 			debug("ignoring '%s' -- uid below minimum", user);
 		}
-		_pam_krb5_user_info_free(ctx, userinfo);
+		_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
 		if (options->debug) {
 			debug("%s returning %d (%s)", caller, PAM_IGNORE,
 			      pam_strerror(pamh, PAM_IGNORE));
 		}
-		_pam_krb5_options_free(pamh, ctx, options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_IGNORE;
 	}
 
@@ -399,14 +402,14 @@ _pam_krb5_close_session(pam_handle_t *pamh, int flags,
 	stash = _pam_krb5_stash_get(pamh, user, userinfo, options);
 	if (stash == NULL) {
 		warn("no stash for user %s (shouldn't happen)", user);
-		_pam_krb5_user_info_free(ctx, userinfo);
+		_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
 		if (options->debug) {
 			debug("%s returning %d (%s)", caller,
 			      PAM_SERVICE_ERR,
 			      pam_strerror(pamh, PAM_SERVICE_ERR));
 		}
-		_pam_krb5_options_free(pamh, ctx, options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 
@@ -417,14 +420,14 @@ _pam_krb5_close_session(pam_handle_t *pamh, int flags,
 			      "skipping session cleanup",
 			      user);
 		}
-		_pam_krb5_user_info_free(ctx, userinfo);
+		_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
 		if (options->debug) {
 			debug("%s returning %d (%s)", caller,
 			      PAM_SUCCESS,
 			      pam_strerror(pamh, PAM_SUCCESS));
 		}
-		_pam_krb5_options_free(pamh, ctx, options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SUCCESS;
 	}
 
@@ -457,14 +460,14 @@ _pam_krb5_close_session(pam_handle_t *pamh, int flags,
 		}
 	}
 #endif
-	_pam_krb5_user_info_free(ctx, userinfo);
+	_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
 	if (options->debug) {
 		debug("%s returning %d (%s)", caller,
 		      PAM_SUCCESS,
 		      pam_strerror(pamh, PAM_SUCCESS));
 	}
-	_pam_krb5_options_free(pamh, ctx, options);
-	krb5_free_context(ctx);
+	_pam_krb5_txn_options_free(pamh, ctx, options);
+	_pam_krb5_txn_free_ctx(pamh, ctx);
 	return PAM_SUCCESS;
 }
 
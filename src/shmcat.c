@@ -67,17 +67,25 @@
 int
 main(int argc, char **argv)
 {
-	int i, key;
+	int i, key, transport;
+	pid_t owner;
 	void *addr;
 	size_t size, written;
 	ssize_t ret;
 	if (argc < 2) {
-		fprintf(stderr, "Usage: shmcat [id ...]\n");
+		fprintf(stderr, "Usage: shmcat [id|id/pid|pkey/pid ...]\n");
 		return 1;
 	}
 	for (i = 1; i < argc; i++) {
-		key = atoi(argv[i]);
-		addr = _pam_krb5_shm_attach(key, &size);
+		/* Accept either a bare System V segment ID or a value as
+		 * it would appear in the PAM environment. */
+		if (_pam_krb5_shm_parse(argv[i], &transport,
+					&key, &owner) != 0) {
+			transport = PAM_KRB5_SHM_SYSV;
+			key = atoi(argv[i]);
+			owner = -1;
+		}
+		addr = _pam_krb5_shm_attach(transport, key, owner, &size);
 		if (addr != NULL) {
 			written = 0;
 			while (written < size) {
@@ -91,10 +99,10 @@ main(int argc, char **argv)
 					written += ret;
 				}
 			}
-			_pam_krb5_shm_detach(addr);
+			_pam_krb5_shm_detach(transport, addr, size);
 		} else {
-			fprintf(stderr, "Error attaching to segment %d!\n",
-				key);
+			fprintf(stderr, "Error attaching to segment %s!\n",
+				argv[i]);
 		}
 	}
 	return 0;
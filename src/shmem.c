@@ -34,13 +34,19 @@
 
 #include <sys/types.h>
 #include <sys/ipc.h>
+#ifdef HAVE_SHM_OPEN
+#include <sys/mman.h>
+#endif
 #include <sys/shm.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef HAVE_SECURITY_PAM_APPL_H
@@ -67,18 +73,98 @@
 #include "userinfo.h"
 #include "xstr.h"
 
+/* Segments which we'll read must be at least this large, and no larger than
+ * this. */
+#define PAM_KRB5_SHM_MIN_SIZE	16
+#define PAM_KRB5_SHM_MAX_SIZE	0xffff
+
 /* A record of a shared memory segment's key, and the name under which the
  * structure was saved by libpam. */
 struct _pam_krb5_shm_rec {
 	char *name;
+	int transport;
 	pid_t pid;
 	int key;
 	int debug;
 };
 
-/* Release a shared memory segment. */
-void
-_pam_krb5_shm_remove(pid_t pid, int key, int log_debug)
+/* The operations which each transport provides.  "create" makes a new
+ * segment owned by the calling process and maps it for writing, "map" maps a
+ * segment for reading, optionally only if the current user owns it, and
+ * "unmap" and "remove" undo those.  "list" calls the callback for every
+ * segment which might be one of ours, until the callback returns non-zero. */
+struct _pam_krb5_shm_ops {
+	const char *name;
+	int (*create)(size_t size, void **address);
+	void *(*map)(int key, pid_t owner, size_t *size, int check);
+	void (*unmap)(void *address, size_t size);
+	void (*remove)(pid_t pid, int key, int log_debug);
+	int (*list)(int (*callback)(const struct _pam_krb5_shm_info *info,
+				    void *data),
+		    void *data);
+};
+
+/* System V segments, which are identified by the kernel-assigned ID. */
+static int
+_pam_krb5_shm_sysv_create(size_t size, void **address)
+{
+	int key;
+
+	/* Handle minimum size requirements on shared memory segments. */
+#ifdef SHMMIN
+	if (size < SHMMIN) {
+		size = SHMMIN;
+	}
+#endif
+
+	/* Create the segment. */
+	key = shmget(IPC_PRIVATE, size, IPC_CREAT | S_IRUSR | S_IWUSR);
+	if ((key != -1) && (address != NULL)) {
+		/* Get a local handle to the segment. */
+		*address = shmat(key, NULL, 0);
+		if (*address == (void *) -1) {
+			warn("failed to attach to shmem segment %d", key);
+			*address = NULL;
+			shmctl(key, IPC_RMID, NULL);
+			key = -1;
+		}
+	}
+	return key;
+}
+
+static void *
+_pam_krb5_shm_sysv_map(int key, pid_t owner, size_t *size, int check)
+{
+	void *address;
+	struct shmid_ds ds;
+
+	if (shmctl(key, IPC_STAT, &ds) == -1) {
+		return NULL;
+	}
+	/* Make sure that "we" own it. */
+	if (check &&
+	    ((ds.shm_segsz < PAM_KRB5_SHM_MIN_SIZE) ||
+	     (ds.shm_segsz > PAM_KRB5_SHM_MAX_SIZE) ||
+	     (ds.shm_perm.cuid != getuid()) ||
+	     (ds.shm_perm.cuid != geteuid()))) {
+		return NULL;
+	}
+	address = shmat(key, NULL, check ? SHM_RDONLY : 0);
+	if (address == (void *) -1) {
+		return NULL;
+	}
+	*size = ds.shm_segsz;
+	return address;
+}
+
+static void
+_pam_krb5_shm_sysv_unmap(void *address, size_t size)
+{
+	shmdt(address);
+}
+
+static void
+_pam_krb5_shm_sysv_remove(pid_t pid, int key, int log_debug)
 {
 	struct shmid_ds ds;
 	if (pid != -1) {
@@ -107,13 +193,386 @@ _pam_krb5_shm_remove(pid_t pid, int key, int log_debug)
 	}
 }
 
+/* Walk the kernel's table of segments.  Without SHM_STAT, we can't, so we
+ * don't find any. */
+static int
+_pam_krb5_shm_sysv_list(int (*callback)(const struct _pam_krb5_shm_info *info,
+					void *data),
+			void *data)
+{
+#if defined(SHM_INFO) && defined(SHM_STAT)
+	struct shm_info shm_info;
+	struct shmid_ds ds;
+	struct _pam_krb5_shm_info info;
+	int i, max, key, ret;
+
+	max = shmctl(0, SHM_INFO, (struct shmid_ds *) &shm_info);
+	for (i = 0, ret = 0; (i <= max) && (ret == 0); i++) {
+		key = shmctl(i, SHM_STAT, &ds);
+		if (key == -1) {
+			continue;
+		}
+		/* We only create private, owner-only segments. */
+		if ((ds.shm_perm.mode & ALLPERMS) != (S_IRUSR | S_IWUSR)) {
+			continue;
+		}
+		memset(&info, 0, sizeof(info));
+		info.transport = PAM_KRB5_SHM_SYSV;
+		info.key = key;
+		info.creator = ds.shm_cpid;
+		info.owner = ds.shm_perm.cuid;
+		info.size = ds.shm_segsz;
+		info.changed = ds.shm_ctime;
+		info.attached = ds.shm_nattch;
+		ret = callback(&info, data);
+	}
+	return ret;
+#else
+	return 0;
+#endif
+}
+
+#ifdef HAVE_SHM_OPEN
+/* POSIX segments, which are named using the creator's PID and a key which we
+ * read from /dev/urandom.  A segment's mode is set to read-only as soon as it's
+ * mapped for writing, so that nobody can open it for writing afterward, and
+ * readers check for that mode, and that the segment is exactly the size of
+ * what was stored in it, before they look at its contents. */
+#define PAM_KRB5_SHM_POSIX_DIR "/dev/shm"
+#define PAM_KRB5_SHM_POSIX_PREFIX "pam_krb5-"
+
+static void
+_pam_krb5_shm_posix_name(pid_t pid, int key, char *name, size_t length)
+{
+	snprintf(name, length, "/" PAM_KRB5_SHM_POSIX_PREFIX "%ld-%d",
+		 (long) pid, key);
+}
+
+static int
+_pam_krb5_shm_posix_create(size_t size, void **address)
+{
+	char name[64];
+	int fd, rfd, key, i;
+	void *p;
+
+	/* Anyone can create objects, so make the names hard to guess. */
+	rfd = open("/dev/urandom", O_RDONLY);
+	if (rfd == -1) {
+		warn("error opening /dev/urandom");
+		return -1;
+	}
+	fd = -1;
+	key = -1;
+	for (i = 0; (i < 16) && (fd == -1); i++) {
+		if (_pam_krb5_read_with_retry(rfd, (unsigned char *) &key,
+					      sizeof(key)) != sizeof(key)) {
+			break;
+		}
+		key &= INT_MAX;
+		_pam_krb5_shm_posix_name(getpid(), key, name, sizeof(name));
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL,
+			      S_IRUSR | S_IWUSR);
+		if ((fd == -1) && (errno != EEXIST)) {
+			break;
+		}
+	}
+	close(rfd);
+	if (fd == -1) {
+		return -1;
+	}
+	if (ftruncate(fd, size) == -1) {
+		warn("failed to size shared memory object \"%s\"", name);
+		shm_unlink(name);
+		close(fd);
+		return -1;
+	}
+	if (address != NULL) {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 fd, 0);
+		if (p == MAP_FAILED) {
+			warn("failed to map shared memory object \"%s\"",
+			     name);
+			shm_unlink(name);
+			close(fd);
+			return -1;
+		}
+		*address = p;
+	}
+	fchmod(fd, S_IRUSR);
+	close(fd);
+	return key;
+}
+
+static void *
+_pam_krb5_shm_posix_map(int key, pid_t owner, size_t *size, int check)
+{
+	char name[64];
+	struct stat st;
+	void *address;
+	int fd;
+
+	if (owner == -1) {
+		return NULL;
+	}
+	_pam_krb5_shm_posix_name(owner, key, name, sizeof(name));
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1) {
+		return NULL;
+	}
+	if ((fstat(fd, &st) == -1) ||
+	    !S_ISREG(st.st_mode) ||
+	    (st.st_size == 0) ||
+	    (check &&
+	     ((st.st_size < PAM_KRB5_SHM_MIN_SIZE) ||
+	      (st.st_size > PAM_KRB5_SHM_MAX_SIZE) ||
+	      ((st.st_mode & ALLPERMS) != S_IRUSR) ||
+	      (st.st_uid != getuid()) ||
+	      (st.st_uid != geteuid())))) {
+		close(fd);
+		return NULL;
+	}
+	address = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (address == MAP_FAILED) {
+		return NULL;
+	}
+	*size = st.st_size;
+	return address;
+}
+
+static void
+_pam_krb5_shm_posix_unmap(void *address, size_t size)
+{
+	munmap(address, size);
+}
+
+static void
+_pam_krb5_shm_posix_remove(pid_t pid, int key, int log_debug)
+{
+	char name[64];
+	struct stat st;
+	int fd;
+
+	/* Without the creator's PID, we can't find it. */
+	if (pid == -1) {
+		return;
+	}
+	_pam_krb5_shm_posix_name(pid, key, name, sizeof(name));
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1) {
+		return;
+	}
+	if ((fstat(fd, &st) == 0) &&
+	    ((st.st_uid == geteuid()) || (geteuid() == 0))) {
+		if (log_debug) {
+			debug("cleanup function removing shared memory "
+			      "object \"%s\"", name);
+		}
+		shm_unlink(name);
+	} else {
+		warn("shared memory object \"%s\" belongs to another user, "
+		     "not removing", name);
+	}
+	close(fd);
+}
+
+/* Look for objects with names like ours where the system makes them
+ * visible, which on Linux is /dev/shm. */
+static int
+_pam_krb5_shm_posix_list(int (*callback)(const struct _pam_krb5_shm_info *info,
+					 void *data),
+			 void *data)
+{
+	DIR *dir;
+	struct dirent *ent;
+	struct stat st;
+	struct _pam_krb5_shm_info info;
+	char path[PATH_MAX], *p, *q;
+	long pid, key;
+	int ret;
+
+	dir = opendir(PAM_KRB5_SHM_POSIX_DIR);
+	if (dir == NULL) {
+		return 0;
+	}
+	ret = 0;
+	while ((ret == 0) && ((ent = readdir(dir)) != NULL)) {
+		if (strncmp(ent->d_name, PAM_KRB5_SHM_POSIX_PREFIX,
+			    strlen(PAM_KRB5_SHM_POSIX_PREFIX)) != 0) {
+			continue;
+		}
+		p = ent->d_name + strlen(PAM_KRB5_SHM_POSIX_PREFIX);
+		pid = strtol(p, &q, 10);
+		if ((q == p) || (*q != '-') || (pid <= 0)) {
+			continue;
+		}
+		p = q + 1;
+		key = strtol(p, &q, 10);
+		if ((q == p) || (*q != '\0') || (key < 0) || (key > INT_MAX)) {
+			continue;
+		}
+		snprintf(path, sizeof(path), PAM_KRB5_SHM_POSIX_DIR "/%s",
+			 ent->d_name);
+		if ((lstat(path, &st) == -1) || !S_ISREG(st.st_mode)) {
+			continue;
+		}
+		memset(&info, 0, sizeof(info));
+		info.transport = PAM_KRB5_SHM_POSIX;
+		info.key = key;
+		info.creator = pid;
+		info.owner = st.st_uid;
+		info.size = st.st_size;
+		info.changed = st.st_ctime;
+		info.attached = -1;
+		ret = callback(&info, data);
+	}
+	closedir(dir);
+	return ret;
+}
+#endif
+
+/* Indexed by transport number. */
+static const struct _pam_krb5_shm_ops _pam_krb5_shm_transports[] = {
+	{
+		"sysv",
+		_pam_krb5_shm_sysv_create,
+		_pam_krb5_shm_sysv_map,
+		_pam_krb5_shm_sysv_unmap,
+		_pam_krb5_shm_sysv_remove,
+		_pam_krb5_shm_sysv_list,
+	},
+#ifdef HAVE_SHM_OPEN
+	{
+		"posix",
+		_pam_krb5_shm_posix_create,
+		_pam_krb5_shm_posix_map,
+		_pam_krb5_shm_posix_unmap,
+		_pam_krb5_shm_posix_remove,
+		_pam_krb5_shm_posix_list,
+	},
+#else
+	{
+		NULL, NULL, NULL, NULL, NULL, NULL,
+	},
+#endif
+};
+
+static const struct _pam_krb5_shm_ops *
+_pam_krb5_shm_ops(int transport)
+{
+	if ((transport < 0) ||
+	    (transport >= (int) (sizeof(_pam_krb5_shm_transports) /
+				 sizeof(_pam_krb5_shm_transports[0]))) ||
+	    (_pam_krb5_shm_transports[transport].name == NULL)) {
+		return NULL;
+	}
+	return &_pam_krb5_shm_transports[transport];
+}
+
+/* Look up a transport by name, falling back to System V segments if we don't
+ * recognize the name or can't use it here. */
+int
+_pam_krb5_shm_transport(const char *name)
+{
+	int i;
+	for (i = 0;
+	     i < (int) (sizeof(_pam_krb5_shm_transports) /
+			sizeof(_pam_krb5_shm_transports[0]));
+	     i++) {
+		if ((_pam_krb5_shm_transports[i].name != NULL) &&
+		    (name != NULL) &&
+		    (strcmp(_pam_krb5_shm_transports[i].name, name) == 0)) {
+			return i;
+		}
+	}
+	if ((name != NULL) && (strlen(name) > 0)) {
+		warn("shared memory transport \"%s\" not supported, using "
+		     "\"%s\"", name,
+		     _pam_krb5_shm_transports[PAM_KRB5_SHM_SYSV].name);
+	}
+	return PAM_KRB5_SHM_SYSV;
+}
+
+/* The name of a transport, for logging. */
+const char *
+_pam_krb5_shm_transport_name(int transport)
+{
+	const struct _pam_krb5_shm_ops *ops;
+
+	ops = _pam_krb5_shm_ops(transport);
+	return (ops != NULL) ? ops->name : "unknown";
+}
+
+/* Format a reference to a segment for storage in the environment.  System V
+ * segments are written as "KEY/PID", as they always have been, and others
+ * get a prefix which keeps older versions of the module from mistaking them
+ * for System V segments. */
+void
+_pam_krb5_shm_format(int transport, int key, pid_t owner,
+		     char *value, size_t length)
+{
+	switch (transport) {
+	case PAM_KRB5_SHM_POSIX:
+		snprintf(value, length, "p%d/%ld", key, (long) owner);
+		break;
+	default:
+		snprintf(value, length, "%d/%ld", key, (long) owner);
+		break;
+	}
+}
+
+/* Parse a reference to a segment.  Returns 0 on success. */
+int
+_pam_krb5_shm_parse(const char *value, int *transport, int *key,
+		    pid_t *owner)
+{
+	char *p, *q;
+	long l;
+
+	*transport = PAM_KRB5_SHM_SYSV;
+	*key = -1;
+	*owner = -1;
+	if (value == NULL) {
+		return -1;
+	}
+	if (*value == 'p') {
+		*transport = PAM_KRB5_SHM_POSIX;
+		value++;
+	}
+	p = NULL;
+	l = strtol(value, &p, 0);
+	if ((p == NULL) || (p == value) || (*p != '/')) {
+		return -1;
+	}
+	if ((l < INT_MAX) && (l > INT_MIN)) {
+		*key = l;
+	}
+	q = NULL;
+	l = strtol(p + 1, &q, 0);
+	if ((q != NULL) && (*q == '\0') && (q > p + 1)) {
+		*owner = l;
+	}
+	return 0;
+}
+
+/* Release a shared memory segment. */
+void
+_pam_krb5_shm_remove(int transport, pid_t pid, int key, int log_debug)
+{
+	const struct _pam_krb5_shm_ops *ops;
+	ops = _pam_krb5_shm_ops(transport);
+	if (ops != NULL) {
+		ops->remove(pid, key, log_debug);
+	}
+}
+
 /* Clean up a shared memory segment and its record. */
 static void
 _pam_krb5_shm_cleanup(pam_handle_t *pamh, void *data, int status)
 {
 	struct _pam_krb5_shm_rec *rec;
 	rec = data;
-	_pam_krb5_shm_remove(rec->pid, rec->key, rec->debug);
+	_pam_krb5_shm_remove(rec->transport, rec->pid, rec->key, rec->debug);
 	free(rec->name);
 	free(rec);
 }
@@ -122,8 +581,10 @@ _pam_krb5_shm_cleanup(pam_handle_t *pamh, void *data, int status)
  * be cleaned up automatically by libpam.  If address is not NULL, attach to
  * the segment and return its address (which must be subsequently detached). */
 int
-_pam_krb5_shm_new(pam_handle_t *pamh, size_t size, void **address, int debug)
+_pam_krb5_shm_new(pam_handle_t *pamh, int transport, size_t size,
+		  void **address, int debug)
 {
+	const struct _pam_krb5_shm_ops *ops;
 	int key;
 	struct _pam_krb5_shm_rec *rec;
 
@@ -131,50 +592,35 @@ _pam_krb5_shm_new(pam_handle_t *pamh, size_t size, void **address, int debug)
 	if (address != NULL) {
 		*address = NULL;
 	}
+	ops = _pam_krb5_shm_ops(transport);
+	if (ops == NULL) {
+		return -1;
+	}
 
 	/* Allocate space for the record-keeping structure. */
 	rec = malloc(sizeof(struct _pam_krb5_shm_rec));
 	if (rec == NULL) {
 		return -1;
 	}
-	rec->name = malloc(strlen("_pam_krb5_shm_") + sizeof(key) * 8);
+	rec->name = malloc(strlen("_pam_krb5_shm_") + 1 + sizeof(key) * 8);
 	if (rec->name == NULL) {
 		free(rec);
 		return -1;
 	}
+	rec->transport = transport;
 	rec->pid = getpid();
 	rec->debug = debug;
 
-	/* Handle minimum size requirements on shared memory segments. */
-#ifdef SHMMIN
-	if (size < SHMMIN) {
-		size = SHMMIN;
-	}
-#endif
-
 	/* Create the segment. */
-	key = shmget(IPC_PRIVATE, size, IPC_CREAT | S_IRUSR | S_IWUSR);
-	if (key != -1) {
-		/* Get a local handle to the segment. */
-		if (address != NULL) {
-			*address = shmat(key, NULL, 0);
-			if (*address == (void *) -1) {
-				warn("failed to attach to shmem segment %d",
-				     key);
-				shmctl(key, IPC_RMID, NULL);
-				key = -1;
-			}
-		}
-		/* Save the segment. */
-		if (key != -1) {
-			sprintf(rec->name, "_pam_krb5_shm_%d", key);
-			rec->key = key;
-			pam_set_data(pamh, rec->name, rec,
-				     _pam_krb5_shm_cleanup);
-		}
-	}
+	key = ops->create(size, address);
 
-	if (key == -1) {
+	/* Save the segment. */
+	if (key != -1) {
+		sprintf(rec->name, "_pam_krb5_shm_%s%d",
+			(transport == PAM_KRB5_SHM_SYSV) ? "" : "p", key);
+		rec->key = key;
+		pam_set_data(pamh, rec->name, rec, _pam_krb5_shm_cleanup);
+	} else {
 		free(rec->name);
 		free(rec);
 	}
@@ -186,7 +632,7 @@ _pam_krb5_shm_new(pam_handle_t *pamh, size_t size, void **address, int debug)
  * specified offset.  If address is given, attach to the segment and return the
  * address, which must be detached by the caller. */
 int
-_pam_krb5_shm_new_from_blob(pam_handle_t *pamh, size_t lead,
+_pam_krb5_shm_new_from_blob(pam_handle_t *pamh, int transport, size_t lead,
 			    void *source, size_t size, void **address,
 			    int debug)
 {
@@ -194,9 +640,9 @@ _pam_krb5_shm_new_from_blob(pam_handle_t *pamh, size_t lead,
 	void *block;
 	block = NULL;
 	/* Create the segment and attach to it here. */
-	key = _pam_krb5_shm_new(pamh, size + lead, &block, debug);
+	key = _pam_krb5_shm_new(pamh, transport, size + lead, &block, debug);
 	/* Copy in the caller's data. */
-	if ((key != -1) && (block != (void *) -1)) {
+	if ((key != -1) && (block != NULL)) {
 		if (lead > 0) {
 			memset((unsigned char*)block, 0, lead);
 		}
@@ -207,7 +653,8 @@ _pam_krb5_shm_new_from_blob(pam_handle_t *pamh, size_t lead,
 		*address = block;
 	} else {
 		if (block != NULL) {
-			block = _pam_krb5_shm_detach(block);
+			block = _pam_krb5_shm_detach(transport, block,
+						     size + lead);
 		}
 	}
 	return key;
@@ -217,7 +664,7 @@ _pam_krb5_shm_new_from_blob(pam_handle_t *pamh, size_t lead,
  * segment at a specified offset.  If address is given, attach to the segment
  * and return the address, which must be detached by the caller. */
 int
-_pam_krb5_shm_new_from_file(pam_handle_t *pamh, size_t lead,
+_pam_krb5_shm_new_from_file(pam_handle_t *pamh, int transport, size_t lead,
 			    const char *file, size_t *file_size, void **address,
 			    int debug)
 {
@@ -240,15 +687,17 @@ _pam_krb5_shm_new_from_file(pam_handle_t *pamh, size_t lead,
 	    (S_ISREG(st.st_mode)) &&
 	    (st.st_size < 0x10000)) {
 		/* Create a shared memory segment in which to store the file. */
-		key = _pam_krb5_shm_new(pamh, st.st_size + lead, &block, debug);
-		if ((key != -1) && (block != (void *) -1)) {
+		key = _pam_krb5_shm_new(pamh, transport, st.st_size + lead,
+					&block, debug);
+		if ((key != -1) && (block != NULL)) {
 			p = block;
 			if (lead > 0) {
 				memset(p, 0, lead);
 			}
 			if (_pam_krb5_read_with_retry(fd, p + lead,
 						      st.st_size) != st.st_size) {
-				block = _pam_krb5_shm_detach(block);
+				block = _pam_krb5_shm_detach(transport, block,
+							     st.st_size + lead);
 				key = -1;
 			}
 			if (key != -1) {
@@ -258,7 +707,10 @@ _pam_krb5_shm_new_from_file(pam_handle_t *pamh, size_t lead,
 				if (address != NULL) {
 					*address = block;
 				} else {
-					block = _pam_krb5_shm_detach(block);
+					block = _pam_krb5_shm_detach(transport,
+								     block,
+								     st.st_size +
+								     lead);
 				}
 			}
 		}
@@ -271,72 +723,68 @@ _pam_krb5_shm_new_from_file(pam_handle_t *pamh, size_t lead,
 }
 
 /* Attach to a segment, returning the address where it was mapped, and the size
- * of the segment.  The caller will need to detach it. */
+ * of the segment, without checking who owns it.  The caller will need to
+ * detach it. */
 void *
-_pam_krb5_shm_attach(int key, size_t *size)
+_pam_krb5_shm_attach(int transport, int key, pid_t owner, size_t *size)
 {
-	void *address;
-	struct shmid_ds ds;
+	const struct _pam_krb5_shm_ops *ops;
+	size_t dummy;
 
-	if (size != NULL) {
-		*size = 0;
+	if (size == NULL) {
+		size = &dummy;
 	}
-	address = shmat(key, NULL, 0);
-	if (address == (void*) -1) {
+	*size = 0;
+	ops = _pam_krb5_shm_ops(transport);
+	if (ops == NULL) {
 		return NULL;
 	}
-	if (shmctl(key, IPC_STAT, &ds) == -1) {
-		address = _pam_krb5_shm_detach(address);
-		return NULL;
-	}
-	if (size != NULL) {
-		*size = ds.shm_segsz;
-	}
-	return address;
+	return ops->map(key, owner, size, 0);
 }
 
 /* Detach from a segment, returning NULL. */
 void *
-_pam_krb5_shm_detach(void *address)
+_pam_krb5_shm_detach(int transport, void *address, size_t size)
 {
-	if ((address != NULL) && (address != (void*) -1)) {
-		shmdt(address);
+	const struct _pam_krb5_shm_ops *ops;
+	ops = _pam_krb5_shm_ops(transport);
+	if ((ops != NULL) && (address != NULL) && (address != (void*) -1)) {
+		ops->unmap(address, size);
 	}
 	return NULL;
 }
 
-/* Copy the contents of a shared memory segment into a chunk of memory on the
- * heap, returning the allocated size. */
-void
-_pam_krb5_blob_from_shm(int key, void **block, size_t *block_size)
+/* Map a segment which the current user owns for reading, so that its contents
+ * can be examined in place, returning its address and size.  The caller will
+ * need to detach it. */
+void *
+_pam_krb5_shm_map(int transport, int key, pid_t owner, size_t *size)
 {
-	void *address;
-	struct shmid_ds ds;
-
-	*block = NULL;
-	*block_size = 0;
+	const struct _pam_krb5_shm_ops *ops;
+	*size = 0;
+	ops = _pam_krb5_shm_ops(transport);
+	if (ops == NULL) {
+		return NULL;
+	}
+	return ops->map(key, owner, size, 1);
+}
 
-	/* Attach to the segment and make sure that "we" own it. */
-	address = _pam_krb5_shm_attach(key, NULL);
-	if (address != NULL) {
-		if ((shmctl(key, IPC_STAT, &ds) == -1) ||
-		    (ds.shm_segsz < 16)|| (ds.shm_segsz > 0xffff) ||
-		    (ds.shm_perm.cuid != getuid()) ||
-		    (ds.shm_perm.cuid != geteuid())) {
-			address = _pam_krb5_shm_detach(address);
-			if (block_size != NULL) {
-				*block_size = 0;
-			}
-		}
-		/* Make a copy of the memory. */
-		if (address != NULL) {
-			*block = malloc(ds.shm_segsz);
-			if (*block != NULL) {
-				memcpy(*block, address, ds.shm_segsz);
-				*block_size = ds.shm_segsz;
-			}
+/* Call the callback for every segment of every transport which might be one
+ * of ours, stopping if it returns non-zero. */
+int
+_pam_krb5_shm_list(int (*callback)(const struct _pam_krb5_shm_info *info,
+				   void *data),
+		   void *data)
+{
+	int i, ret;
+	for (i = 0, ret = 0;
+	     (ret == 0) &&
+	     (i < (int) (sizeof(_pam_krb5_shm_transports) /
+			 sizeof(_pam_krb5_shm_transports[0])));
+	     i++) {
+		if (_pam_krb5_shm_transports[i].list != NULL) {
+			ret = _pam_krb5_shm_transports[i].list(callback, data);
 		}
-		/* Detach from the segment if we haven't already. */
-		address = _pam_krb5_shm_detach(address);
 	}
+	return ret;
 }
@@ -33,17 +33,43 @@
 #ifndef pam_krb5_shmem_h
 #define pam_krb5_shmem_h
 
-int _pam_krb5_shm_new(pam_handle_t *pamh, size_t size, void **address,
-		      int debug);
-void *_pam_krb5_shm_attach(int key, size_t *size);
-void *_pam_krb5_shm_detach(void *address);
-void _pam_krb5_shm_remove(pid_t pid, int key, int debug);
-int _pam_krb5_shm_new_from_file(pam_handle_t *pamh, size_t lead,
+/* Ways of passing data to other processes using shared memory. */
+#define PAM_KRB5_SHM_SYSV	0
+#define PAM_KRB5_SHM_POSIX	1
+
+/* What we can find out about a segment without looking inside it.  The
+ * attachment count is -1 if it isn't known. */
+struct _pam_krb5_shm_info {
+	int transport;
+	int key;
+	pid_t creator;
+	uid_t owner;
+	size_t size;
+	time_t changed;
+	int attached;
+};
+
+int _pam_krb5_shm_transport(const char *name);
+const char *_pam_krb5_shm_transport_name(int transport);
+void _pam_krb5_shm_format(int transport, int key, pid_t owner,
+			  char *value, size_t length);
+int _pam_krb5_shm_parse(const char *value, int *transport, int *key,
+			pid_t *owner);
+
+int _pam_krb5_shm_new(pam_handle_t *pamh, int transport, size_t size,
+		      void **address, int debug);
+void *_pam_krb5_shm_attach(int transport, int key, pid_t owner, size_t *size);
+void *_pam_krb5_shm_map(int transport, int key, pid_t owner, size_t *size);
+void *_pam_krb5_shm_detach(int transport, void *address, size_t size);
+void _pam_krb5_shm_remove(int transport, pid_t pid, int key, int debug);
+int _pam_krb5_shm_list(int (*callback)(const struct _pam_krb5_shm_info *info,
+				       void *data),
+		       void *data);
+int _pam_krb5_shm_new_from_file(pam_handle_t *pamh, int transport, size_t lead,
 				const char *file, size_t *file_size,
 				void **address, int debug);
-int _pam_krb5_shm_new_from_blob(pam_handle_t *pamh, size_t lead,
+int _pam_krb5_shm_new_from_blob(pam_handle_t *pamh, int transport, size_t lead,
 				void *source, size_t size, void **address,
 				int debug);
-void _pam_krb5_blob_from_shm(int key, void **block, size_t *block_size);
 
 #endif
@@ -58,11 +58,15 @@
 #endif
 
 #include "init.h"
+#include "initopts.h"
+#include "items.h"
 #include "log.h"
 #include "options.h"
+#include "prompter.h"
 #include "sly.h"
 #include "stash.h"
 #include "tokens.h"
+#include "txn.h"
 #include "userinfo.h"
 #include "v5.h"
 #include "v4.h"
@@ -132,6 +136,45 @@ sly_v5(krb5_context ctx, const char *v5ccname,
 	return PAM_SUCCESS;
 }
 
+/* If we let the user in using a saved verifier while the KDCs were away,
+ * see if they're back now, so that there'll be something to store. */
+static void
+sly_offline_retry(krb5_context ctx, pam_handle_t *pamh, const char *user,
+		  struct _pam_krb5_user_info *userinfo,
+		  struct _pam_krb5_options *options,
+		  struct _pam_krb5_stash *stash)
+{
+	krb5_get_init_creds_opt *gic_options;
+	char *password;
+	int result;
+
+	password = NULL;
+	if ((_pam_krb5_get_item_text(pamh, PAM_AUTHTOK, &password) !=
+	     PAM_SUCCESS) ||
+	    (password == NULL) ||
+	    (strlen(password) == 0)) {
+		return;
+	}
+	if (v5_alloc_get_init_creds_opt(ctx, &gic_options) != 0) {
+		return;
+	}
+	_pam_krb5_set_init_opts(ctx, gic_options, options);
+	result = KRB5_KDC_UNREACH;
+	if ((v5_get_creds(ctx, pamh, &stash->v5creds, user, userinfo,
+			  options, KRB5_TGS_NAME, password, gic_options,
+			  _pam_krb5_always_fail_prompter,
+			  &stash->v5expired, &result) == PAM_SUCCESS) &&
+	    (result == 0)) {
+		if (options->debug) {
+			debug("KDCs are reachable again, obtained credentials "
+			      "for '%s'", user);
+		}
+		stash->v5result = 0;
+		stash->v5offline = 0;
+	}
+	v5_free_get_init_creds_opt(ctx, gic_options);
+}
+
 /* Inexpensive checks. */
 int
 _pam_krb5_sly_looks_unsafe(void)
@@ -190,7 +233,7 @@ _pam_krb5_sly_maybe_refresh(pam_handle_t *pamh, int flags,
 	}
 
 	/* Initialize Kerberos. */
-	if (_pam_krb5_init_ctx(&ctx, argc, argv) != 0) {
+	if (_pam_krb5_txn_init_ctx(pamh, &ctx, argc, argv) != 0) {
 		warn("error initializing Kerberos");
 		return PAM_SERVICE_ERR;
 	}
@@ -199,15 +242,15 @@ _pam_krb5_sly_maybe_refresh(pam_handle_t *pamh, int flags,
 	i = pam_get_user(pamh, &user, NULL);
 	if ((i != PAM_SUCCESS) || (user == NULL)) {
 		warn("could not identify user name");
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return i;
 	}
 
 	/* Read our options. */
-	options = _pam_krb5_options_init(pamh, argc, argv, ctx);
+	options = _pam_krb5_txn_options_init(pamh, argc, argv, ctx);
 	if (options == NULL) {
 		warn("error parsing options (shouldn't happen)");
-		krb5_free_context(ctx);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 	if (options->debug) {
@@ -215,7 +258,7 @@ _pam_krb5_sly_maybe_refresh(pam_handle_t *pamh, int flags,
 	}
 
 	/* Get information about the user and the user's principal name. */
-	userinfo = _pam_krb5_user_info_init(ctx, user, options);
+	userinfo = _pam_krb5_txn_user_info_init(pamh, ctx, user, options);
 	if (userinfo == NULL) {
 		if (options->ignore_unknown_principals) {
 			retval = PAM_IGNORE;
@@ -224,8 +267,8 @@ _pam_krb5_sly_maybe_refresh(pam_handle_t *pamh, int flags,
 			     "(shouldn't happen)", user);
 			retval = PAM_USER_UNKNOWN;
 		}
-		_pam_krb5_options_free(pamh, ctx, options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return retval;
 	}
 
@@ -235,9 +278,9 @@ _pam_krb5_sly_maybe_refresh(pam_handle_t *pamh, int flags,
 		if (options->debug) {
 			debug("ignoring '%s' -- uid below minimum", user);
 		}
-		_pam_krb5_user_info_free(ctx, userinfo);
-		_pam_krb5_options_free(pamh, ctx, options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_IGNORE;
 	}
 
@@ -246,12 +289,16 @@ _pam_krb5_sly_maybe_refresh(pam_handle_t *pamh, int flags,
 	if (stash == NULL) {
 		warn("error retrieving stash for '%s' (shouldn't happen)",
 		     user);
-		_pam_krb5_user_info_free(ctx, userinfo);
-		_pam_krb5_options_free(pamh, ctx, options);
-		krb5_free_context(ctx);
+		_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
+		_pam_krb5_txn_options_free(pamh, ctx, options);
+		_pam_krb5_txn_free_ctx(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 
+	if (stash->v5offline && (options->offline_cache != NULL)) {
+		sly_offline_retry(ctx, pamh, user, userinfo, options, stash);
+	}
+
 	retval = PAM_SERVICE_ERR;
 
 	/* Save credentials in the right places. */
@@ -394,9 +441,9 @@ _pam_krb5_sly_maybe_refresh(pam_handle_t *pamh, int flags,
 		      pam_strerror(pamh, retval));
 	}
 
-	_pam_krb5_user_info_free(ctx, userinfo);
-	_pam_krb5_options_free(pamh, ctx, options);
-	krb5_free_context(ctx);
+	_pam_krb5_txn_user_info_free(pamh, ctx, userinfo);
+	_pam_krb5_txn_options_free(pamh, ctx, options);
+	_pam_krb5_txn_free_ctx(pamh, ctx);
 
 	return retval;
 }
@@ -0,0 +1,345 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "spawn.h"
+
+/* Starting a child used to mean fork()ing the whole calling process and
+ * then calling close() on every descriptor number up to the limit, which
+ * costs a system call per possible descriptor.  Here we close only the
+ * descriptors which are actually open, and when all the child is going to
+ * do is run a helper, we use vfork() so that we don't have to copy the
+ * caller's address space, either.
+ *
+ * A vfork()ed child shares its parent's memory, so until it calls exec it
+ * sticks to system calls.  In particular, glibc's setreuid() and friends
+ * try to change the credentials of every thread in the process by walking
+ * the parent's thread list, so we make the raw system calls instead, which
+ * only affect the child.  If we can't do that, we fork(). */
+#if defined(HAVE_VFORK) && defined(__linux__) && defined(HAVE_SYS_SYSCALL_H)
+#if defined(SYS_setreuid32) && defined(SYS_setregid32) && \
+    defined(SYS_setgroups32)
+#define SPAWN_SETGROUPS(n, list) syscall(SYS_setgroups32, (n), (list))
+#define SPAWN_SETREGID(r, e) syscall(SYS_setregid32, (r), (e))
+#define SPAWN_SETREUID(r, e) syscall(SYS_setreuid32, (r), (e))
+#define SPAWN_USE_VFORK
+#elif defined(SYS_setreuid) && defined(SYS_setregid) && defined(SYS_setgroups)
+#define SPAWN_SETGROUPS(n, list) syscall(SYS_setgroups, (n), (list))
+#define SPAWN_SETREGID(r, e) syscall(SYS_setregid, (r), (e))
+#define SPAWN_SETREUID(r, e) syscall(SYS_setreuid, (r), (e))
+#define SPAWN_USE_VFORK
+#endif
+#endif
+#ifndef SPAWN_USE_VFORK
+#define SPAWN_SETGROUPS(n, list) setgroups((n), (list))
+#define SPAWN_SETREGID(r, e) setregid((r), (e))
+#define SPAWN_SETREUID(r, e) setreuid((r), (e))
+#endif
+
+#if defined(__linux__) && defined(HAVE_SYS_SYSCALL_H) && \
+    defined(SYS_getdents64)
+#define SPAWN_PROC_FD
+struct spawn_dirent64 {
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+#endif
+
+/* Close every descriptor numbered "lowfd" or higher.  This has to be safe
+ * to call in a vfork()ed child, so no memory allocation. */
+void
+_pam_krb5_spawn_close_from(int lowfd)
+{
+#ifdef SPAWN_PROC_FD
+	union {
+		char buf[4096];
+		struct spawn_dirent64 align;
+	} u;
+	struct spawn_dirent64 *d;
+	long n, offset;
+	int dirfd, fd;
+	const char *p;
+#endif
+	long i, max;
+
+#if defined(HAVE_SYS_SYSCALL_H) && defined(SYS_close_range)
+	if (syscall(SYS_close_range, (unsigned int) lowfd, ~0U, 0) == 0) {
+		return;
+	}
+#elif defined(HAVE_CLOSE_RANGE)
+	if (close_range(lowfd, ~0U, 0) == 0) {
+		return;
+	}
+#endif
+#ifdef SPAWN_PROC_FD
+	/* Only look at the descriptors which are actually open. */
+	dirfd = open("/proc/self/fd", O_RDONLY | O_DIRECTORY);
+	if (dirfd != -1) {
+		while ((n = syscall(SYS_getdents64, dirfd,
+				    u.buf, sizeof(u.buf))) > 0) {
+			for (offset = 0; offset < n; offset += d->d_reclen) {
+				d = (struct spawn_dirent64 *) (u.buf + offset);
+				fd = 0;
+				for (p = d->d_name; (*p >= '0') && (*p <= '9');
+				     p++) {
+					fd = fd * 10 + (*p - '0');
+				}
+				if ((p == d->d_name) || (*p != '\0') ||
+				    (fd < lowfd) || (fd == dirfd)) {
+					continue;
+				}
+				close(fd);
+			}
+		}
+		close(dirfd);
+		if (n == 0) {
+			return;
+		}
+	}
+#endif
+	/* Fall back to trying every possible descriptor. */
+	max = sysconf(_SC_OPEN_MAX);
+	for (i = lowfd; i < max; i++) {
+		close(i);
+	}
+}
+
+/* Renumber the "n" descriptors in "fds" to "base", "base + 1", and so on,
+ * and close everything at or above "first_free".  Also safe to call in a
+ * vfork()ed child. */
+static void
+spawn_move(int *fds, int n, int base, int first_free)
+{
+	int i, fd;
+
+	/* Get them all out of the way first, in case they overlap. */
+	for (i = 0; i < n; i++) {
+		fd = fcntl(fds[i], F_DUPFD, first_free + n);
+		if (fd != -1) {
+			fds[i] = fd;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		if (dup2(fds[i], base + i) != -1) {
+			fds[i] = base + i;
+		}
+	}
+	_pam_krb5_spawn_close_from(first_free);
+}
+
+/* Reset SIGCHLD so that we can wait for our child, and ignore SIGPIPE in
+ * case it exits before reading everything we send it.  We do this before
+ * starting the child, because it may exit right away. */
+static int
+spawn_signals_save(struct _pam_krb5_spawn *spawn)
+{
+	struct sigaction default_handler, ignore_handler;
+
+	memset(&default_handler, 0, sizeof(default_handler));
+	default_handler.sa_handler = SIG_DFL;
+	if (sigaction(SIGCHLD, &default_handler,
+		      &spawn->saved_sigchld) != 0) {
+		return -1;
+	}
+	memset(&ignore_handler, 0, sizeof(ignore_handler));
+	ignore_handler.sa_handler = SIG_IGN;
+	if (sigaction(SIGPIPE, &ignore_handler,
+		      &spawn->saved_sigpipe) != 0) {
+		sigaction(SIGCHLD, &spawn->saved_sigchld, NULL);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+spawn_signals_restore(struct _pam_krb5_spawn *spawn)
+{
+	sigaction(SIGCHLD, &spawn->saved_sigchld, NULL);
+	sigaction(SIGPIPE, &spawn->saved_sigpipe, NULL);
+}
+
+/* Start a child which will go on to run our own code.  Returns 0 in the
+ * child, in which only stdin, stdout, stderr, and the descriptors listed in
+ * "keep" remain open, the last of them renumbered starting at 3.  Returns
+ * the child's process ID in the parent, which should pass "spawn" to
+ * _pam_krb5_spawn_wait() afterward, or -1 on error. */
+pid_t
+_pam_krb5_spawn_fork(struct _pam_krb5_spawn *spawn, int *keep, int n_keep)
+{
+	if (spawn_signals_save(spawn) != 0) {
+		return -1;
+	}
+	spawn->pid = fork();
+	switch (spawn->pid) {
+	case -1:
+		spawn_signals_restore(spawn);
+		return -1;
+		break;
+	case 0:
+		spawn_move(keep, n_keep, STDERR_FILENO + 1,
+			   STDERR_FILENO + 1 + n_keep);
+		return 0;
+		break;
+	default:
+		return spawn->pid;
+		break;
+	}
+}
+
+/* The child's half of _pam_krb5_spawn_exec().  Never returns. */
+static void
+spawn_exec_child(const char *path, char *const argv[],
+		 int stdin_fd, int stdout_fd,
+		 uid_t uid, gid_t gid, int drop_groups,
+		 const sigset_t *mask)
+{
+	struct sigaction sa;
+	int fds[2], i;
+
+	fds[0] = stdin_fd;
+	fds[1] = stdout_fd;
+	spawn_move(fds, 2, STDIN_FILENO, STDERR_FILENO + 1);
+	if (drop_groups) {
+		SPAWN_SETGROUPS(0, NULL);
+	}
+	/* Now, attempt to assume the desired uid/gid pair.  Note that if
+	 * we're not root, this is allowed to fail. */
+	if ((gid != getgid()) || (gid != getegid())) {
+		SPAWN_SETREGID(gid, gid);
+	}
+	if ((uid != getuid()) || (uid != geteuid())) {
+		SPAWN_SETREUID(uid, uid);
+	}
+	if (mask != NULL) {
+		/* Our signal handlers are still the parent's, and they'd run
+		 * in the parent's memory, so reset them before we unblock
+		 * anything. */
+		for (i = 1; i < NSIG; i++) {
+			if ((sigaction(i, NULL, &sa) == 0) &&
+			    (sa.sa_handler != SIG_DFL) &&
+			    (sa.sa_handler != SIG_IGN)) {
+				memset(&sa, 0, sizeof(sa));
+				sa.sa_handler = SIG_DFL;
+				sigaction(i, &sa, NULL);
+			}
+		}
+		sigprocmask(SIG_SETMASK, mask, NULL);
+	}
+	execv(path, argv);
+	_exit(-1);
+}
+
+/* Run the helper at "path" with its stdin and stdout connected to the given
+ * descriptors, and nothing else of ours open, as "uid" and "gid" if we can
+ * switch to them.  Returns the child's process ID or -1. */
+pid_t
+_pam_krb5_spawn_exec(struct _pam_krb5_spawn *spawn,
+		     const char *path, char *const argv[],
+		     int stdin_fd, int stdout_fd,
+		     uid_t uid, gid_t gid, int drop_groups)
+{
+#ifdef SPAWN_USE_VFORK
+	sigset_t all, saved_mask;
+#endif
+
+	if (spawn_signals_save(spawn) != 0) {
+		return -1;
+	}
+#ifdef SPAWN_USE_VFORK
+	/* Keep our handlers from running in the child until it has reset
+	 * them. */
+	sigfillset(&all);
+	if (sigprocmask(SIG_SETMASK, &all, &saved_mask) != 0) {
+		spawn_signals_restore(spawn);
+		return -1;
+	}
+	spawn->pid = vfork();
+	if (spawn->pid == 0) {
+		spawn_exec_child(path, argv, stdin_fd, stdout_fd,
+				 uid, gid, drop_groups, &saved_mask);
+	}
+	sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+#else
+	spawn->pid = fork();
+	if (spawn->pid == 0) {
+		spawn_exec_child(path, argv, stdin_fd, stdout_fd,
+				 uid, gid, drop_groups, NULL);
+	}
+#endif
+	if (spawn->pid == -1) {
+		spawn_signals_restore(spawn);
+		return -1;
+	}
+	return spawn->pid;
+}
+
+/* Put the signal handlers back the way they were without waiting for the
+ * child, which is expected to outlive this call. */
+void
+_pam_krb5_spawn_detach(struct _pam_krb5_spawn *spawn)
+{
+	spawn_signals_restore(spawn);
+}
+
+/* Reap the child and put the signal handlers back the way they were.
+ * Returns the child's exit status as reported by waitpid(), or -1. */
+int
+_pam_krb5_spawn_wait(struct _pam_krb5_spawn *spawn)
+{
+	int status;
+
+	while (waitpid(spawn->pid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			status = -1;
+			break;
+		}
+	}
+	spawn_signals_restore(spawn);
+	return status;
+}
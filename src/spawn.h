@@ -0,0 +1,54 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef pam_krb5_spawn_h
+#define pam_krb5_spawn_h
+
+#include <signal.h>
+
+/* What we need to remember about a child process while it runs. */
+struct _pam_krb5_spawn {
+	pid_t pid;
+	struct sigaction saved_sigchld, saved_sigpipe;
+};
+
+void _pam_krb5_spawn_close_from(int lowfd);
+pid_t _pam_krb5_spawn_fork(struct _pam_krb5_spawn *spawn,
+			   int *keep, int n_keep);
+pid_t _pam_krb5_spawn_exec(struct _pam_krb5_spawn *spawn,
+			   const char *path, char *const argv[],
+			   int stdin_fd, int stdout_fd,
+			   uid_t uid, gid_t gid, int drop_groups);
+void _pam_krb5_spawn_detach(struct _pam_krb5_spawn *spawn);
+int _pam_krb5_spawn_wait(struct _pam_krb5_spawn *spawn);
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "spawn.h"
+
+/* Measure how long it takes to start a helper and wait for it, the way we
+ * used to (fork() and close every descriptor up to the limit) and the way
+ * we do now, with the descriptor limit set to various values.  Since
+ * fork() gets slower as the parent's address space grows, we can also be
+ * told to dirty some memory first, to look more like a real PAM host. */
+
+#define BENCH_HELPER "/bin/true"
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int
+old_spawn(void)
+{
+	pid_t child;
+	long i;
+
+	child = fork();
+	switch (child) {
+	case -1:
+		return -1;
+		break;
+	case 0:
+		for (i = 0; i < sysconf(_SC_OPEN_MAX); i++) {
+			if (i != STDERR_FILENO) {
+				close(i);
+			}
+		}
+		execl(BENCH_HELPER, BENCH_HELPER, NULL);
+		_exit(-1);
+		break;
+	default:
+		waitpid(child, NULL, 0);
+		break;
+	}
+	return 0;
+}
+
+static int
+new_fork(void)
+{
+	struct _pam_krb5_spawn spawn;
+
+	switch (_pam_krb5_spawn_fork(&spawn, NULL, 0)) {
+	case -1:
+		return -1;
+		break;
+	case 0:
+		execl(BENCH_HELPER, BENCH_HELPER, NULL);
+		_exit(-1);
+		break;
+	default:
+		_pam_krb5_spawn_wait(&spawn);
+		break;
+	}
+	return 0;
+}
+
+static int
+new_exec(void)
+{
+	struct _pam_krb5_spawn spawn;
+	char *argv[2];
+	int fd;
+
+	argv[0] = BENCH_HELPER;
+	argv[1] = NULL;
+	fd = open("/dev/null", O_RDWR);
+	if (fd == -1) {
+		return -1;
+	}
+	if (_pam_krb5_spawn_exec(&spawn, BENCH_HELPER, argv, fd, fd,
+				 getuid(), getgid(), 0) == -1) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	_pam_krb5_spawn_wait(&spawn);
+	return 0;
+}
+
+static double
+time_it(int (*fn)(void), int iterations)
+{
+	double start;
+	int i;
+
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		if (fn() != 0) {
+			return -1;
+		}
+	}
+	return (now() - start) / iterations;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const rlim_t limits[] = {1024, 65536, 1048576};
+	struct rlimit rl, hard;
+	rlim_t tested;
+	double old_time, fork_time, exec_time;
+	char *memory;
+	size_t megabytes;
+	int c, i, iterations;
+
+	iterations = 50;
+	tested = 0;
+	megabytes = 0;
+	while ((c = getopt(argc, argv, "m:n:")) != -1) {
+		switch (c) {
+		case 'm':
+			megabytes = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		default:
+			printf("%s: [-n iterations] [-m megabytes]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (iterations < 1) {
+		fprintf(stderr, "%s: counts must be positive\n", argv[0]);
+		return 1;
+	}
+	if (megabytes > 0) {
+		memory = malloc(megabytes * 1024 * 1024);
+		if (memory == NULL) {
+			perror("malloc");
+			return 1;
+		}
+		memset(memory, 0xa5, megabytes * 1024 * 1024);
+	}
+	if (getrlimit(RLIMIT_NOFILE, &hard) != 0) {
+		perror("getrlimit");
+		return 1;
+	}
+
+	printf("%10s %14s %14s %14s\n",
+	       "nofile", "fork+close", "spawn_fork", "spawn_exec");
+	for (i = 0; i < (int) (sizeof(limits) / sizeof(limits[0])); i++) {
+		rl.rlim_cur = limits[i];
+		rl.rlim_max = hard.rlim_max;
+		if ((hard.rlim_max != RLIM_INFINITY) &&
+		    (rl.rlim_cur > hard.rlim_max)) {
+			/* Try to raise it; we may be privileged. */
+			rl.rlim_max = rl.rlim_cur;
+		}
+		if (setrlimit(RLIMIT_NOFILE, &rl) != 0) {
+			/* Settle for the hard limit, once. */
+			rl.rlim_cur = rl.rlim_max = hard.rlim_max;
+			if ((tested >= hard.rlim_max) ||
+			    (setrlimit(RLIMIT_NOFILE, &rl) != 0)) {
+				printf("%10lu %14s\n",
+				       (unsigned long) limits[i],
+				       "(can't set)");
+				continue;
+			}
+		}
+		tested = rl.rlim_cur;
+		old_time = time_it(old_spawn, iterations);
+		fork_time = time_it(new_fork, iterations);
+		exec_time = time_it(new_exec, iterations);
+		if ((old_time < 0) || (fork_time < 0) || (exec_time < 0)) {
+			fprintf(stderr, "error starting %s\n", BENCH_HELPER);
+			return 1;
+		}
+		printf("%10lu %11.1f us %11.1f us %11.1f us\n",
+		       (unsigned long) rl.rlim_cur, old_time * 1000000,
+		       fork_time * 1000000, exec_time * 1000000);
+	}
+	return 0;
+}
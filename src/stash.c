@@ -60,6 +60,7 @@
 #include <keyutils.h>
 #endif
 
+#include "credblob.h"
 #include "init.h"
 #include "log.h"
 #include "shmem.h"
@@ -139,6 +140,16 @@ _pam_krb5_stash_cleanup(pam_handle_t *pamh, void *data, int error)
 {
 	struct _pam_krb5_stash *stash = data;
 	struct _pam_krb5_ccname_list *node;
+	krb5_context ctx;
+	krb5_ccache ccache;
+	if ((stash->v5memcc != NULL) &&
+	    (_pam_krb5_init_ctx(&ctx, 0, NULL) == 0)) {
+		if (krb5_cc_resolve(ctx, stash->v5memcc, &ccache) == 0) {
+			krb5_cc_destroy(ctx, ccache);
+		}
+		krb5_free_context(ctx);
+	}
+	xstrfree(stash->v5memcc);
 	krb5_free_cred_contents(stash->v5ctx, &stash->v5creds);
 	free(stash->key);
 	while (stash->v5ccnames != NULL) {
@@ -159,40 +170,34 @@ _pam_krb5_stash_cleanup(pam_handle_t *pamh, void *data, int error)
 		free(node);
 	}
 #endif
+	while (stash->afscells != NULL) {
+		if (stash->afscells->name != NULL) {
+			xstrfree(stash->afscells->name);
+		}
+		node = stash->afscells;
+		stash->afscells = node->next;
+		free(node);
+	}
 	memset(stash, 0, sizeof(struct _pam_krb5_stash));
 	free(stash);
 }
 
-/* Read v5 state from the shared memory segment. */
-static void
-_pam_krb5_stash_shm_read_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
-			    struct _pam_krb5_options *options, int key,
-			    void *blob, size_t blob_size)
+/* Read the first credential from a blob which holds the contents of a ccache
+ * file which we couldn't decode ourselves, by writing it to a temporary file
+ * and reading that as a ccache. */
+static int
+_pam_krb5_stash_shm_read_v5_file(struct _pam_krb5_stash *stash,
+				 struct _pam_krb5_options *options,
+				 unsigned char *blob_creds,
+				 ssize_t blob_creds_size,
+				 krb5_creds *creds)
 {
 	char tktfile[PATH_MAX + 6];
-	unsigned char *blob_creds;
-	ssize_t blob_creds_size;
-	int fd;
+	int fd, i;
 	krb5_context ctx;
 	krb5_ccache ccache;
 	krb5_cc_cursor cursor;
 
-	/* Sanity checks. */
-	if (blob_size < sizeof(int) * 3) {
-		warn("saved creds too small: %d bytes, need at least %d bytes",
-		     (int) blob_size, (int) (sizeof(int) * 3));
-		return;
-	}
-	blob_creds = blob;
-	blob_creds += sizeof(int) * 4;
-	blob_creds_size = ((int*)blob)[0];
-	if (blob_creds_size + sizeof(int) * 4 > blob_size) {
-		warn("saved creds too small: %d bytes, need %d bytes",
-		     (int) blob_size,
-		     (int) (blob_creds_size + sizeof(int) * 3));
-		return;
-	}
-
 	/* Create a temporary ccache file. */
 	snprintf(tktfile, sizeof(tktfile),
 		 "FILE:%s/pam_krb5_tmp_XXXXXX", options->ccache_dir);
@@ -200,7 +205,7 @@ _pam_krb5_stash_shm_read_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
 	if (fd == -1) {
 		warn("error creating temporary file \"%s\": %s",
 		     tktfile + 5, strerror(errno));
-		return;
+		return -1;
 	}
 
 	/* Store the blob's contents in the file. */
@@ -211,7 +216,7 @@ _pam_krb5_stash_shm_read_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
 		     tktfile + 5, strerror(errno));
 		unlink(tktfile + 5);
 		close(fd);
-		return;
+		return -1;
 	}
 
 	/* Read the first credential from the file. */
@@ -222,7 +227,7 @@ _pam_krb5_stash_shm_read_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
 			warn("error initializing kerberos");
 			unlink(tktfile + 5);
 			close(fd);
-			return;
+			return -1;
 		}
 	}
 	if (krb5_cc_resolve(ctx, tktfile, &ccache) != 0) {
@@ -232,7 +237,7 @@ _pam_krb5_stash_shm_read_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
 		}
 		unlink(tktfile + 5);
 		close(fd);
-		return;
+		return -1;
 	}
 	if (krb5_cc_start_seq_get(ctx, ccache, &cursor) != 0) {
 		warn("error iterating through ccache in \"%s\"", tktfile + 5);
@@ -242,21 +247,12 @@ _pam_krb5_stash_shm_read_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
 		}
 		unlink(tktfile + 5);
 		close(fd);
-		return;
+		return -1;
 	}
 
 	/* If we have an error reading the credential, there's nothing we can
 	 * do at this point to recover from it. */
-	if (krb5_cc_next_cred(ctx, ccache, &cursor, &stash->v5creds) == 0) {
-		/* Read other variables. */
-		stash->v5attempted = ((int*)blob)[1];
-		stash->v5result = ((int*)blob)[2];
-		stash->v5external = ((int*)blob)[3];
-		if (options->debug) {
-			debug("recovered v5 credentials from shared memory "
-			      "segment %d", key);
-		}
-	}
+	i = krb5_cc_next_cred(ctx, ccache, &cursor, creds);
 
 	/* Clean up. */
 	krb5_cc_end_seq_get(ctx, ccache, &cursor);
@@ -265,36 +261,74 @@ _pam_krb5_stash_shm_read_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
 		krb5_free_context(ctx);
 	}
 	close(fd);
+
+	return (i == 0) ? 0 : -1;
 }
 
-/* Save v5 state to the shared memory segment. */
+/* Read v5 state from the shared memory segment. */
 static void
-_pam_krb5_stash_shm_write_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
-			     struct _pam_krb5_options *options,
-			     const char *user,
-			     struct _pam_krb5_user_info *userinfo)
+_pam_krb5_stash_shm_read_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
+			    struct _pam_krb5_options *options, int key,
+			    void *blob, size_t blob_size)
 {
-	char variable[PATH_MAX + 6], *segname;
-	void *blob;
-	int *intblob;
-	size_t blob_size;
-	int fd, key;
-	krb5_context ctx;
-	krb5_ccache ccache;
+	unsigned char *blob_creds;
+	ssize_t blob_creds_size;
 
-	/* Sanity check. */
-	if ((stash->v5attempted == 0) || (stash->v5result != 0)) {
+	/* Sanity checks. */
+	if (blob_size < sizeof(int) * 3) {
+		warn("saved creds too small: %d bytes, need at least %d bytes",
+		     (int) blob_size, (int) (sizeof(int) * 3));
+		return;
+	}
+	blob_creds = blob;
+	blob_creds += sizeof(int) * 4;
+	blob_creds_size = ((int*)blob)[0];
+	if (blob_creds_size + sizeof(int) * 4 > blob_size) {
+		warn("saved creds too small: %d bytes, need %d bytes",
+		     (int) blob_size,
+		     (int) (blob_creds_size + sizeof(int) * 3));
 		return;
 	}
 
+	/* The credential is stored in the form of a ccache file.  Decode it
+	 * directly if we can, and go through a temporary file if we can't. */
+	if ((_pam_krb5_credblob_decode(blob_creds, blob_creds_size,
+				       &stash->v5creds) == 0) ||
+	    (_pam_krb5_stash_shm_read_v5_file(stash, options,
+					      blob_creds, blob_creds_size,
+					      &stash->v5creds) == 0)) {
+		/* Read other variables. */
+		stash->v5attempted = ((int*)blob)[1];
+		stash->v5result = ((int*)blob)[2];
+		stash->v5external = ((int*)blob)[3];
+		if (options->debug) {
+			debug("recovered v5 credentials from shared memory "
+			      "segment %d", key);
+		}
+	}
+}
+
+/* Write the credentials to a temporary ccache file and copy its contents into
+ * a new shared memory segment, for when we can't encode them ourselves. */
+static int
+_pam_krb5_stash_shm_write_v5_file(pam_handle_t *pamh,
+				  struct _pam_krb5_stash *stash,
+				  struct _pam_krb5_options *options,
+				  size_t lead, size_t *blob_size, void **blob)
+{
+	char tktfile[PATH_MAX + 6];
+	int fd, key;
+	krb5_context ctx;
+	krb5_ccache ccache;
+
 	/* Create a temporary ccache file. */
-	snprintf(variable, sizeof(variable),
+	snprintf(tktfile, sizeof(tktfile),
 		 "FILE:%s/pam_krb5_tmp_XXXXXX", options->ccache_dir);
-	fd = mkstemp(variable + 5);
+	fd = mkstemp(tktfile + 5);
 	if (fd == -1) {
 		warn("error creating temporary ccache file \"%s\"",
-		     variable + 5);
-		return;
+		     tktfile + 5);
+		return -1;
 	}
 
 	/* Write the credentials to that file. */
@@ -303,48 +337,104 @@ _pam_krb5_stash_shm_write_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
 	} else {
 		if (_pam_krb5_init_ctx(&ctx, 0, NULL) != PAM_SUCCESS) {
 			warn("error initializing kerberos");
-			unlink(variable + 5);
+			unlink(tktfile + 5);
 			close(fd);
-			return;
+			return -1;
 		}
 	}
-	if (krb5_cc_resolve(ctx, variable, &ccache) != 0) {
+	if (krb5_cc_resolve(ctx, tktfile, &ccache) != 0) {
 		warn("error opening credential cache file \"%s\" for writing",
-		     variable + 5);
+		     tktfile + 5);
 		if (ctx != stash->v5ctx) {
 			krb5_free_context(ctx);
 		}
-		unlink(variable + 5);
+		unlink(tktfile + 5);
 		close(fd);
-		return;
+		return -1;
 	}
 	if (krb5_cc_initialize(ctx, ccache, stash->v5creds.client) != 0) {
 		warn("error initializing credential cache file \"%s\"",
-		     variable + 5);
+		     tktfile + 5);
 		krb5_cc_close(ctx, ccache);
 		if (ctx != stash->v5ctx) {
 			krb5_free_context(ctx);
 		}
-		unlink(variable + 5);
+		unlink(tktfile + 5);
 		close(fd);
-		return;
+		return -1;
 	}
 	if (krb5_cc_store_cred(ctx, ccache, &stash->v5creds) != 0) {
 		warn("error writing to credential cache file \"%s\"",
-		     variable + 5);
+		     tktfile + 5);
 		krb5_cc_close(ctx, ccache);
 		if (ctx != stash->v5ctx) {
 			krb5_free_context(ctx);
 		}
-		unlink(variable + 5);
+		unlink(tktfile + 5);
 		close(fd);
-		return;
+		return -1;
 	}
 
 	/* Read the entire file. */
-	key = _pam_krb5_shm_new_from_file(pamh, sizeof(int) * 4,
-					  variable + 5, &blob_size, &blob,
-					  options->debug);
+	key = _pam_krb5_shm_new_from_file(pamh, options->shmem_transport,
+					  lead, tktfile + 5,
+					  blob_size, blob, options->debug);
+
+	/* Clean up. */
+	krb5_cc_destroy(ctx, ccache);
+	if (ctx != stash->v5ctx) {
+		krb5_free_context(ctx);
+	}
+	close(fd);
+
+	return key;
+}
+
+/* Save v5 state to the shared memory segment. */
+static void
+_pam_krb5_stash_shm_write_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
+			     struct _pam_krb5_options *options,
+			     const char *user,
+			     struct _pam_krb5_user_info *userinfo)
+{
+	char variable[PATH_MAX + 6], value[64], *segname;
+	void *blob;
+	int *intblob;
+	size_t blob_size;
+	int key;
+
+	/* Sanity check. */
+	if ((stash->v5attempted == 0) || (stash->v5result != 0)) {
+		return;
+	}
+
+	/* Store the credential in a new segment, in the form of a ccache
+	 * file.  Encode it directly if we can, and go through a temporary
+	 * file if we can't. */
+	blob = NULL;
+	blob_size = _pam_krb5_credblob_length(&stash->v5creds);
+	if (blob_size > 0) {
+		key = _pam_krb5_shm_new(pamh, options->shmem_transport,
+					sizeof(int) * 4 + blob_size,
+					&blob, options->debug);
+		if ((key != -1) && (blob != NULL)) {
+			memset(blob, 0, sizeof(int) * 4);
+			if (_pam_krb5_credblob_encode(&stash->v5creds,
+						      (unsigned char *) blob +
+						      sizeof(int) * 4,
+						      blob_size) != 0) {
+				blob = _pam_krb5_shm_detach(options->shmem_transport,
+							    blob,
+							    sizeof(int) * 4 +
+							    blob_size);
+				key = -1;
+			}
+		}
+	} else {
+		key = _pam_krb5_stash_shm_write_v5_file(pamh, stash, options,
+							sizeof(int) * 4,
+							&blob_size, &blob);
+	}
 	if ((key != -1) && (blob != NULL)) {
 		intblob = blob;
 		intblob[0] = blob_size;
@@ -353,33 +443,30 @@ _pam_krb5_stash_shm_write_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
 		intblob[3] = stash->v5external;
 	}
 	if (blob != NULL) {
-		blob = _pam_krb5_shm_detach(blob);
+		blob = _pam_krb5_shm_detach(options->shmem_transport, blob,
+					    sizeof(int) * 4 + blob_size);
 	}
 
-	/* Clean up. */
-	krb5_cc_destroy(ctx, ccache);
-	if (ctx != stash->v5ctx) {
-		krb5_free_context(ctx);
-	}
-	close(fd);
-
 	if (key != -1) {
 		segname = NULL;
 		_pam_krb5_stash_shm5_name(options, user, &segname);
 		if (segname != NULL) {
+			_pam_krb5_shm_format(options->shmem_transport,
+					     key, getpid(),
+					     value, sizeof(value));
 			snprintf(variable, sizeof(variable),
-				 "%s=%d/%ld",
-				 segname, key, (long) getpid());
+				 "%s=%s", segname, value);
 			free(segname);
 			pam_putenv(pamh, variable);
 			if (options->debug) {
 				debug("saved v5 credentials to shared memory "
-				      "segment %d (creator pid %ld)", key,
+				      "segment %s (creator pid %ld)", value,
 				      (long) getpid());
 				debug("set '%s' in environment", variable);
 			}
 			stash->v5shm = key;
 			stash->v5shm_owner = getpid();
+			stash->v5shm_transport = options->shmem_transport;
 		}
 	} else {
 		warn("error saving v5 credential state to shared "
@@ -432,8 +519,9 @@ _pam_krb5_stash_shm_write_v4(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
 {
 	void *blob;
 	int *intblob, key;
-	char variable[PATH_MAX], *segname;
-	key = _pam_krb5_shm_new_from_blob(pamh, sizeof(int) * 2,
+	char variable[PATH_MAX], value[64], *segname;
+	key = _pam_krb5_shm_new_from_blob(pamh, options->shmem_transport,
+					  sizeof(int) * 2,
 					  &stash->v4creds,
 					  sizeof(stash->v4creds),
 					  &blob, options->debug);
@@ -443,26 +531,31 @@ _pam_krb5_stash_shm_write_v4(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
 		intblob[1] = sizeof(stash->v4creds);
 		_pam_krb5_stash_shm4_name(options, user, &segname);
 		if (segname != NULL) {
+			_pam_krb5_shm_format(options->shmem_transport,
+					     key, getpid(),
+					     value, sizeof(value));
 			snprintf(variable, sizeof(variable),
-				 "%s=%d/%ld",
-				 segname, key, (long) getpid());
+				 "%s=%s", segname, value);
 			free(segname);
 			pam_putenv(pamh, variable);
 			if (options->debug) {
 				debug("saved v4 credential state to shared "
-				      "memory segment %d (creator pid %ld)",
-				      key, (long) getpid());
+				      "memory segment %s (creator pid %ld)",
+				      value, (long) getpid());
 				debug("set '%s' in environment", variable);
 			}
 			stash->v4shm = key;
 			stash->v4shm_owner = getpid();
+			stash->v4shm_transport = options->shmem_transport;
 		}
 	} else {
 		warn("error saving v4 credential state to shared "
 		     "memory segment");
 	}
 	if (blob != NULL) {
-		blob = _pam_krb5_shm_detach(blob);
+		blob = _pam_krb5_shm_detach(options->shmem_transport, blob,
+					    sizeof(int) * 2 +
+					    sizeof(stash->v4creds));
 	}
 }
 #endif
@@ -474,10 +567,9 @@ _pam_krb5_stash_shm_read(pam_handle_t *pamh, const char *partial_key,
 			 struct _pam_krb5_stash *stash,
 			 struct _pam_krb5_options *options)
 {
-	int key;
+	int key, transport;
 	pid_t owner;
-	long l;
-	char *variable, *p, *q;
+	char *variable;
 	const char *value;
 	void *blob;
 	size_t blob_size;
@@ -492,31 +584,18 @@ _pam_krb5_stash_shm_read(pam_handle_t *pamh, const char *partial_key,
 
 	/* Read the variable and extract a shared memory identifier. */
 	value = pam_getenv(pamh, variable);
-	key = -1;
-	owner = -1;
-	if (value != NULL) {
-		l = strtol(value, &p, 0);
-		if ((p != NULL) && (*p == '/')) {
-			if ((l < INT_MAX) && (l > INT_MIN)) {
-				key = l;
-			}
-			q = NULL;
-			l = strtol(p + 1, &q, 0);
-			if ((q != NULL) && (*q == '\0') && (q > p + 1)) {
-				owner = l;
-			}
-		}
-	}
+	_pam_krb5_shm_parse(value, &transport, &key, &owner);
 
-	/* Get a copy of the contents of the shared memory segment. */
+	/* Examine the contents of the shared memory segment in place. */
 	if ((stash->v5shm == -1) && (owner != -1)) {
 		stash->v5shm = key;
 		stash->v5shm_owner = owner;
+		stash->v5shm_transport = transport;
 	}
 	if (key != -1) {
-		_pam_krb5_blob_from_shm(key, &blob, &blob_size);
+		blob = _pam_krb5_shm_map(transport, key, owner, &blob_size);
 		if ((blob == NULL) || (blob_size == 0)) {
-			warn("no segment with specified identifier %d", key);
+			warn("no segment with specified identifier %s", value);
 		} else {
 			/* Pull credentials from the blob, which contains a
 			 * ccache file.  Cross our fingers and hope it's
@@ -524,7 +603,8 @@ _pam_krb5_stash_shm_read(pam_handle_t *pamh, const char *partial_key,
 			_pam_krb5_stash_shm_read_v5(pamh, stash,
 						    options, key,
 						    blob, blob_size);
-			free(blob);
+			blob = _pam_krb5_shm_detach(transport, blob,
+						    blob_size);
 		}
 	}
 
@@ -534,38 +614,26 @@ _pam_krb5_stash_shm_read(pam_handle_t *pamh, const char *partial_key,
 
 	/* Read the variable and extract a shared memory identifier. */
 	value = pam_getenv(pamh, variable);
-	key = -1;
-	owner = -1;
-	if (value != NULL) {
-		l = strtol(value, &p, 0);
-		if ((p != NULL) && (*p == '/')) {
-			if ((l < INT_MAX) && (l > INT_MIN)) {
-				key = l;
-			}
-			q = NULL;
-			l = strtol(p + 1, &q, 0);
-			if ((q != NULL) && (*q == '\0') && (q > p + 1)) {
-				owner = l;
-			}
-		}
-	}
+	_pam_krb5_shm_parse(value, &transport, &key, &owner);
 
-	/* Get a copy of the contents of the shared memory segment. */
+	/* Examine the contents of the shared memory segment in place. */
 	if ((stash->v4shm == -1) && (owner != -1)) {
 		stash->v4shm = key;
 		stash->v4shm_owner = owner;
+		stash->v4shm_transport = transport;
 	}
 	if (key != -1) {
-		_pam_krb5_blob_from_shm(key, &blob, &blob_size);
+		blob = _pam_krb5_shm_map(transport, key, owner, &blob_size);
 		if ((blob == NULL) || (blob_size == 0)) {
-			warn("no segment with specified identifier %d", key);
+			warn("no segment with specified identifier %s", value);
 		} else {
 			/* Pull credentials from the blob, which contains a
 			 * credentials structure.  Cross our fingers and hope
 			 * it's useful. */
 			_pam_krb5_stash_shm_read_v4(pamh, stash, options,
 						    key, blob, blob_size);
-			free(blob);
+			blob = _pam_krb5_shm_detach(transport, blob,
+						    blob_size);
 		}
 	}
 #endif
@@ -806,11 +874,14 @@ _pam_krb5_stash_get(pam_handle_t *pamh, const char *user,
 	stash->v5result = KRB5KRB_ERR_GENERIC;
 	stash->v5expired = 0;
 	stash->v5external = 0;
+	stash->v5offline = 0;
 	stash->v5ccnames = NULL;
 	stash->v5setenv = 0;
 	stash->v5shm = -1;
 	stash->v5shm_owner = -1;
+	stash->v5shm_transport = PAM_KRB5_SHM_SYSV;
 	memset(&stash->v5creds, 0, sizeof(stash->v5creds));
+	stash->v5memcc = NULL;
 	stash->v4present = 0;
 #ifdef USE_KRB4
 	memset(&stash->v4creds, 0, sizeof(stash->v4creds));
@@ -818,8 +889,10 @@ _pam_krb5_stash_get(pam_handle_t *pamh, const char *user,
 	stash->v4setenv = 0;
 	stash->v4shm = -1;
 	stash->v4shm_owner = -1;
+	stash->v4shm_transport = PAM_KRB5_SHM_SYSV;
 #endif
 	stash->afspag = 0;
+	stash->afscells = NULL;
 	if (options->use_shmem) {
 		_pam_krb5_stash_shm_read(pamh, key, stash, options);
 	}
@@ -845,7 +918,8 @@ _pam_krb5_stash_get(pam_handle_t *pamh, const char *user,
  * saving its contents in the process.  The original file is removed and its
  * name is freed and overwritten with the name of the new ccache. */
 static void
-_pam_krb5_stash_clone_file(char **stored_file, uid_t uid, gid_t gid)
+_pam_krb5_stash_clone_file(char **stored_file, uid_t uid, gid_t gid,
+			   struct _pam_krb5_options *options)
 {
 	char *pattern, *filename;
 	size_t length;
@@ -873,6 +947,7 @@ _pam_krb5_stash_clone_file(char **stored_file, uid_t uid, gid_t gid)
 					    pattern,
 					    NULL, NULL,
 					    uid, gid,
+					    options->persistent_storetmp,
 					    filename,
 					    length + 8) == 0) {
 			unlink(*stored_file);
@@ -1086,7 +1161,8 @@ _pam_krb5_stash_clone_v5(krb5_context ctx,
 		 * dance to get the context right. */
 		filename = xstrdup(stash->v5ccnames->name + 5);
 		if (filename != NULL) {
-			_pam_krb5_stash_clone_file(&filename, uid, gid);
+			_pam_krb5_stash_clone_file(&filename, uid, gid,
+						   options);
 			newname = malloc(strlen(filename) + 6);
 			if (newname != NULL) {
 				sprintf(newname, "FILE:%s", filename);
@@ -1143,10 +1219,18 @@ _pam_krb5_stash_clone_v5(krb5_context ctx,
 				      stash->v5ccnames->name, newname,
 				      stash->v5ccnames->name);
 			}
+			/* Keep our MEMORY ccache around for our own use,
+			 * but otherwise, it's been replaced. */
+			if ((stash->v5memcc != NULL) &&
+			    (strcmp(stash->v5ccnames->name,
+				    stash->v5memcc) == 0)) {
+				krb5_cc_close(ctx, occache);
+			} else {
+				krb5_cc_destroy(ctx, occache);
+			}
 			xstrfree(stash->v5ccnames->name);
 			stash->v5ccnames->name = newname;
 			krb5_cc_close(ctx, nccache);
-			krb5_cc_destroy(ctx, occache);
 			/* If the new source and the destination are files,
 			 * re-clone it to get the permissions right. */
 			if (strncmp(options->ccname_template,
@@ -1182,22 +1266,26 @@ _pam_krb5_stash_clone_v5(krb5_context ctx,
 
 #ifdef USE_KRB4
 void
-_pam_krb5_stash_clone_v4(struct _pam_krb5_stash *stash, uid_t uid, gid_t gid)
+_pam_krb5_stash_clone_v4(struct _pam_krb5_stash *stash,
+			 struct _pam_krb5_options *options, uid_t uid, gid_t gid)
 {
 	if (stash->v4tktfiles == NULL) {
 		return;
 	}
-	_pam_krb5_stash_clone_file(&stash->v4tktfiles->name, uid, gid);
+	_pam_krb5_stash_clone_file(&stash->v4tktfiles->name, uid, gid,
+				   options);
 }
 #else
 void
-_pam_krb5_stash_clone_v4(struct _pam_krb5_stash *stash, uid_t uid, gid_t gid)
+_pam_krb5_stash_clone_v4(struct _pam_krb5_stash *stash,
+			 struct _pam_krb5_options *options, uid_t uid, gid_t gid)
 {
 }
 #endif
 
 static int
-_pam_krb5_stash_pop(krb5_context ctx, struct _pam_krb5_ccname_list **list)
+_pam_krb5_stash_pop(krb5_context ctx, struct _pam_krb5_options *options,
+		    struct _pam_krb5_ccname_list **list)
 {
 	struct _pam_krb5_ccname_list *node;
 	krb5_ccache ccache;
@@ -1216,7 +1304,9 @@ _pam_krb5_stash_pop(krb5_context ctx, struct _pam_krb5_ccname_list **list)
 				}
 			}
 			if (filename != NULL) {
-				if (_pam_krb5_storetmp_delete(filename) == 0) {
+				i = _pam_krb5_storetmp_delete(filename,
+							      options->persistent_storetmp);
+				if (i == 0) {
 					xstrfree(node->name);
 					node->name = NULL;
 					*list = node->next;
@@ -1298,14 +1388,14 @@ int
 _pam_krb5_stash_pop_v4(krb5_context ctx, struct _pam_krb5_stash *stash,
 		       struct _pam_krb5_options *options)
 {
-	return _pam_krb5_stash_pop(ctx, &stash->v4tktfiles);
+	return _pam_krb5_stash_pop(ctx, options, &stash->v4tktfiles);
 }
 int
 _pam_krb5_stash_push_v4(krb5_context ctx, struct _pam_krb5_stash *stash,
 		        struct _pam_krb5_options *options, const char *filename)
 {
 	if (options->multiple_ccaches == 0) {
-		_pam_krb5_stash_pop(ctx, &stash->v4tktfiles);
+		_pam_krb5_stash_pop(ctx, options, &stash->v4tktfiles);
 	}
 	return _pam_krb5_stash_push(ctx, &stash->v4tktfiles, filename);
 }
@@ -1324,11 +1414,85 @@ _pam_krb5_stash_push_v4(krb5_context ctx, struct _pam_krb5_stash *stash,
 }
 #endif
 
+/* Get the name of our MEMORY ccache, creating it if we haven't yet, and
+ * starting it over if the credentials we're holding have changed since we
+ * put them in it. */
+int
+_pam_krb5_stash_memcc(krb5_context ctx, struct _pam_krb5_stash *stash,
+		      struct _pam_krb5_user_info *userinfo,
+		      struct _pam_krb5_options *options,
+		      const char **ccname)
+{
+	char name[PATH_MAX];
+	krb5_ccache ccache;
+	static int counter = 0;
+
+	*ccname = NULL;
+	if (v5_creds_check_initialized(ctx, &stash->v5creds) != 0) {
+		return -1;
+	}
+	if ((stash->v5memcc != NULL) &&
+	    (stash->v5memcc_authtime == stash->v5creds.times.authtime) &&
+	    (stash->v5memcc_endtime == stash->v5creds.times.endtime)) {
+		*ccname = stash->v5memcc;
+		return 0;
+	}
+	if (stash->v5memcc == NULL) {
+		snprintf(name, sizeof(name), "MEMORY:_pam_krb5_stash_%s-%ld-%d",
+			 userinfo->unparsed_name, (long) getpid(), counter++);
+		stash->v5memcc = xstrdup(name);
+		if (stash->v5memcc == NULL) {
+			return -1;
+		}
+	}
+	if (krb5_cc_resolve(ctx, stash->v5memcc, &ccache) != 0) {
+		warn("error resolving ccache '%s'", stash->v5memcc);
+		return -1;
+	}
+	if ((krb5_cc_initialize(ctx, ccache, userinfo->principal_name) != 0) ||
+	    (krb5_cc_store_cred(ctx, ccache, &stash->v5creds) != 0)) {
+		warn("error storing credentials in ccache '%s'",
+		     stash->v5memcc);
+		krb5_cc_destroy(ctx, ccache);
+		xstrfree(stash->v5memcc);
+		stash->v5memcc = NULL;
+		return -1;
+	}
+	krb5_cc_close(ctx, ccache);
+	if (options->debug) {
+		debug("saved v5 credentials to '%s' for internal use",
+		      stash->v5memcc);
+	}
+	stash->v5memcc_authtime = stash->v5creds.times.authtime;
+	stash->v5memcc_endtime = stash->v5creds.times.endtime;
+	*ccname = stash->v5memcc;
+	return 0;
+}
+
+/* Remove the most recently-added ccache from the list, destroying it unless
+ * it's our MEMORY ccache, which we hang on to. */
+static int
+_pam_krb5_stash_pop_v5_list(krb5_context ctx, struct _pam_krb5_stash *stash,
+			    struct _pam_krb5_options *options)
+{
+	struct _pam_krb5_ccname_list *node;
+
+	node = stash->v5ccnames;
+	if ((node != NULL) && (stash->v5memcc != NULL) &&
+	    (node->name != NULL) && (strcmp(node->name, stash->v5memcc) == 0)) {
+		stash->v5ccnames = node->next;
+		xstrfree(node->name);
+		free(node);
+		return 0;
+	}
+	return _pam_krb5_stash_pop(ctx, options, &stash->v5ccnames);
+}
+
 int
 _pam_krb5_stash_pop_v5(krb5_context ctx, struct _pam_krb5_stash *stash,
 		       struct _pam_krb5_options *options)
 {
-	return _pam_krb5_stash_pop(ctx, &stash->v5ccnames);
+	return _pam_krb5_stash_pop_v5_list(ctx, stash, options);
 }
 
 int
@@ -1336,7 +1500,7 @@ _pam_krb5_stash_push_v5(krb5_context ctx, struct _pam_krb5_stash *stash,
 		        struct _pam_krb5_options *options, const char *ccname)
 {
 	if (options->multiple_ccaches == 0) {
-		_pam_krb5_stash_pop(ctx, &stash->v5ccnames);
+		_pam_krb5_stash_pop_v5_list(ctx, stash, options);
 	}
 	return _pam_krb5_stash_push(ctx, &stash->v5ccnames, ccname);
 }
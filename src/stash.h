@@ -43,12 +43,17 @@ struct _pam_krb5_ccname_list {
 struct _pam_krb5_stash {
 	char *key;
 	krb5_context v5ctx;
-	int v5attempted, v5result, v5expired, v5external;
+	int v5attempted, v5result, v5expired, v5external, v5offline;
 	struct _pam_krb5_ccname_list *v5ccnames;
 	krb5_creds v5creds;
+	/* A MEMORY ccache holding v5creds, and any other credentials we've
+	 * gotten using them, for our own use. */
+	char *v5memcc;
+	krb5_timestamp v5memcc_authtime, v5memcc_endtime;
 	int v5setenv;
 	int v5shm;
 	pid_t v5shm_owner;
+	int v5shm_transport;
 	int v4present;
 #ifdef USE_KRB4
 	CREDENTIALS v4creds;
@@ -56,8 +61,14 @@ struct _pam_krb5_stash {
 	int v4setenv;
 	int v4shm;
 	pid_t v4shm_owner;
+	int v4shm_transport;
 #endif
 	int afspag;
+	/* The AFS cells we've set tokens for, in which PAG, and using which
+	 * TGT, so that we don't do it again. */
+	struct _pam_krb5_ccname_list *afscells;
+	unsigned long afscells_pag;
+	krb5_timestamp afscells_authtime, afscells_endtime;
 };
 
 struct _pam_krb5_stash *_pam_krb5_stash_get(pam_handle_t *pamh,
@@ -70,7 +81,12 @@ void _pam_krb5_stash_clone_v5(krb5_context ctx, struct _pam_krb5_stash *stash,
 			      struct _pam_krb5_user_info *userinfo,
 			      uid_t uid, gid_t gid);
 void _pam_krb5_stash_clone_v4(struct _pam_krb5_stash *stash,
+			      struct _pam_krb5_options *options,
 			      uid_t uid, gid_t gid);
+int _pam_krb5_stash_memcc(krb5_context ctx, struct _pam_krb5_stash *stash,
+			  struct _pam_krb5_user_info *userinfo,
+			  struct _pam_krb5_options *options,
+			  const char **ccname);
 int _pam_krb5_stash_push_v5(krb5_context ctx, struct _pam_krb5_stash *stash,
 			    struct _pam_krb5_options *options,
 			    const char *ccname);
@@ -38,12 +38,22 @@
 #include <sys/wait.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <grp.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#ifdef HAVE_PTHREAD_ATFORK
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_SELINUX
+#include <selinux/selinux.h>
+#include <selinux/label.h>
+#endif
+
+#include "spawn.h"
 #include "storetmp.h"
 
 ssize_t
@@ -114,19 +124,196 @@ _pam_krb5_read_with_retry(int fd, unsigned char *buffer, ssize_t len)
 	return length;
 }
 
+/* A helper which we leave running for the rest of this process's life, so
+ * that storing and removing a session's files doesn't mean starting a new
+ * helper for each of them.  It exits when it sees us close its stdin, so
+ * children which we fork mustn't keep copies of our ends of its pipes. */
+static struct {
+	pid_t pid, owner;
+	int to, from;
+#ifdef HAVE_PTHREAD_ATFORK
+	int atfork;
+#endif
+} storetmp_coprocess = {-1, -1, -1, -1};
+
+/* Drop a copy of the helper's descriptors which we inherited from our
+ * parent, without waiting for a process that isn't ours. */
+static void
+storetmp_coprocess_disown(void)
+{
+	if (storetmp_coprocess.to != -1) {
+		close(storetmp_coprocess.to);
+	}
+	if (storetmp_coprocess.from != -1) {
+		close(storetmp_coprocess.from);
+	}
+	storetmp_coprocess.pid = -1;
+	storetmp_coprocess.owner = -1;
+	storetmp_coprocess.to = -1;
+	storetmp_coprocess.from = -1;
+}
+
+static void
+storetmp_coprocess_stop(void)
+{
+	pid_t pid, owner;
+
+	pid = storetmp_coprocess.pid;
+	owner = storetmp_coprocess.owner;
+	storetmp_coprocess_disown();
+	/* If we started it, reap it.  The application may have done that
+	 * for us already, which is fine. */
+	if ((pid != -1) && (owner == getpid())) {
+		waitpid(pid, NULL, 0);
+	}
+}
+
+static int
+storetmp_coprocess_start(void)
+{
+	int inpipe[2], outpipe[2];
+	char *argv[3];
+	struct _pam_krb5_spawn spawn;
+
+	/* A copy which we inherited belongs to our parent.  We'll have
+	 * dropped it already if we could register a fork handler. */
+	if ((storetmp_coprocess.pid != -1) &&
+	    (storetmp_coprocess.owner != getpid())) {
+		storetmp_coprocess_disown();
+	}
+	if (storetmp_coprocess.pid != -1) {
+		return 0;
+	}
+#ifdef HAVE_PTHREAD_ATFORK
+	if (!storetmp_coprocess.atfork) {
+		if (pthread_atfork(NULL, NULL,
+				   storetmp_coprocess_disown) != 0) {
+			return -1;
+		}
+		storetmp_coprocess.atfork = 1;
+	}
+#endif
+	if (pipe(inpipe) == -1) {
+		return -1;
+	}
+	if (pipe(outpipe) == -1) {
+		close(inpipe[0]);
+		close(inpipe[1]);
+		return -1;
+	}
+	argv[0] = "pam_krb5_storetmp";
+	argv[1] = STORETMP_PERSISTENT_ARG;
+	argv[2] = NULL;
+	if (_pam_krb5_spawn_exec(&spawn, PKGSECURITYDIR "/pam_krb5_storetmp",
+				 argv, inpipe[0], outpipe[1],
+				 geteuid(), getegid(), 0) == -1) {
+		close(inpipe[0]);
+		close(inpipe[1]);
+		close(outpipe[0]);
+		close(outpipe[1]);
+		return -1;
+	}
+	/* Don't leave the application's SIGCHLD handler disabled. */
+	_pam_krb5_spawn_detach(&spawn);
+	close(inpipe[0]);
+	close(outpipe[1]);
+	fcntl(inpipe[1], F_SETFD, FD_CLOEXEC);
+	fcntl(outpipe[0], F_SETFD, FD_CLOEXEC);
+	storetmp_coprocess.pid = spawn.pid;
+	storetmp_coprocess.owner = getpid();
+	storetmp_coprocess.to = inpipe[1];
+	storetmp_coprocess.from = outpipe[0];
+	return 0;
+}
+
+/* Ask the persistent helper to do something.  Returns -1 if we couldn't
+ * talk to it, in which case the caller should start a one-shot helper. */
+static int
+storetmp_coprocess_call(unsigned int op,
+			const unsigned char *data, ssize_t data_len,
+			const char *pattern, uid_t uid, gid_t gid,
+			char *outfile, size_t outfile_len)
+{
+	struct _pam_krb5_storetmp_request request;
+	struct _pam_krb5_storetmp_reply reply;
+	struct sigaction ignore_handler, saved_sigpipe_handler;
+	int ret;
+
+	if ((strlen(pattern) > STORETMP_MAX_PATTERN) ||
+	    (data_len > STORETMP_MAX_DATA) ||
+	    (storetmp_coprocess_start() != 0)) {
+		return -1;
+	}
+	memset(&request, 0, sizeof(request));
+	request.op = op;
+	request.uid = (uid == (uid_t) -1) ? -1 : (long long) uid;
+	request.gid = (gid == (gid_t) -1) ? -1 : (long long) gid;
+	request.pattern_len = strlen(pattern);
+	request.data_len = data_len;
+
+	/* The helper may have gone away. */
+	memset(&ignore_handler, 0, sizeof(ignore_handler));
+	ignore_handler.sa_handler = SIG_IGN;
+	if (sigaction(SIGPIPE, &ignore_handler, &saved_sigpipe_handler) != 0) {
+		return -1;
+	}
+	ret = -1;
+	memset(outfile, '\0', outfile_len);
+	if ((_pam_krb5_write_with_retry(storetmp_coprocess.to,
+					(unsigned char *) &request,
+					sizeof(request)) == sizeof(request)) &&
+	    (_pam_krb5_write_with_retry(storetmp_coprocess.to,
+					(const unsigned char *) pattern,
+					request.pattern_len) ==
+	     (ssize_t) request.pattern_len) &&
+	    (_pam_krb5_write_with_retry(storetmp_coprocess.to,
+					data, data_len) == data_len) &&
+	    (_pam_krb5_read_with_retry(storetmp_coprocess.from,
+				       (unsigned char *) &reply,
+				       sizeof(reply)) == sizeof(reply)) &&
+	    (reply.name_len < outfile_len) &&
+	    (_pam_krb5_read_with_retry(storetmp_coprocess.from,
+				       (unsigned char *) outfile,
+				       reply.name_len) ==
+	     (ssize_t) reply.name_len)) {
+		ret = (reply.status == 0) ? 0 : 1;
+	}
+	sigaction(SIGPIPE, &saved_sigpipe_handler, NULL);
+	if (ret == -1) {
+		/* We don't know what state it's in, so start over. */
+		memset(outfile, '\0', outfile_len);
+		storetmp_coprocess_stop();
+	}
+	return ret;
+}
+
 /* Use a helper to store the given data in a new file with a name which is
  * based on the given pattern. */
 static int
 _pam_krb5_storetmp_data(const unsigned char *data, ssize_t data_len,
 			const char *pattern, uid_t uid, gid_t gid,
-			char *outfile, size_t outfile_len)
+			int persistent, char *outfile, size_t outfile_len)
 {
 	int i;
 	int inpipe[2], outpipe[2], dummy[3];
 	char uidstr[100], gidstr[100];
-	pid_t child;
-	struct sigaction saved_sigchld_handler, saved_sigpipe_handler;
-	struct sigaction ignore_handler, default_handler;
+	char *argv[5];
+	struct _pam_krb5_spawn spawn;
+	if (persistent) {
+		switch (storetmp_coprocess_call(STORETMP_OP_CREATE,
+						data, data_len, pattern,
+						uid, gid,
+						outfile, outfile_len)) {
+		case 0:
+			return (strlen(outfile) >= strlen(pattern)) ? 0 : -1;
+			break;
+		case 1:
+			return -1;
+			break;
+		default:
+			break;
+		}
+	}
 	for (i = 0; i < 3; i++) {
 		dummy[i] = open("/dev/null", O_RDONLY);
 	}
@@ -144,31 +331,23 @@ _pam_krb5_storetmp_data(const unsigned char *data, ssize_t data_len,
 		close(inpipe[1]);
 		return -1;
 	}
-	/* Set signal handlers here.  We used to do it later, but that turns
-	 * out to be a race if the child decides to exit immediately. */
-	memset(&default_handler, 0, sizeof(default_handler));
-	default_handler.sa_handler = SIG_DFL;
-	if (sigaction(SIGCHLD, &default_handler, &saved_sigchld_handler) != 0) {
-		close(inpipe[0]);
-		close(inpipe[1]);
-		close(outpipe[0]);
-		close(outpipe[1]);
-		return -1;
-	}
-	memset(&ignore_handler, 0, sizeof(ignore_handler));
-	ignore_handler.sa_handler = SIG_IGN;
-	if (sigaction(SIGPIPE, &ignore_handler, &saved_sigpipe_handler) != 0) {
-		sigaction(SIGCHLD, &saved_sigchld_handler, NULL);
-		close(inpipe[0]);
-		close(inpipe[1]);
-		close(outpipe[0]);
-		close(outpipe[1]);
-		return -1;
-	}
-	switch (child = fork()) {
-	case -1:
-		sigaction(SIGCHLD, &saved_sigchld_handler, NULL);
-		sigaction(SIGPIPE, &saved_sigpipe_handler, NULL);
+#ifdef HAVE_LONG_LONG
+	snprintf(uidstr, sizeof(uidstr), "%llu", (unsigned long long) uid);
+	snprintf(gidstr, sizeof(gidstr), "%llu", (unsigned long long) gid);
+#else
+	snprintf(uidstr, sizeof(uidstr), "%lu", (unsigned long) uid);
+	snprintf(gidstr, sizeof(gidstr), "%lu", (unsigned long) gid);
+#endif
+	argv[0] = "pam_krb5_storetmp";
+	argv[1] = (char *) pattern;
+	argv[2] = uidstr;
+	argv[3] = gidstr;
+	argv[4] = NULL;
+	if ((strlen(uidstr) > sizeof(uidstr) - 2) ||
+	    (strlen(gidstr) > sizeof(gidstr) - 2) ||
+	    (_pam_krb5_spawn_exec(&spawn, PKGSECURITYDIR "/pam_krb5_storetmp",
+				  argv, inpipe[0], outpipe[1],
+				  uid, gid, (uid == 0)) == -1)) {
 		for (i = 0; i < 3; i++) {
 			close(dummy[i]);
 		}
@@ -177,84 +356,139 @@ _pam_krb5_storetmp_data(const unsigned char *data, ssize_t data_len,
 		close(outpipe[0]);
 		close(outpipe[1]);
 		return -1;
-		break;
-	case 0:
-		/* We're the child. */
+	}
+	for (i = 0; i < 3; i++) {
+		close(dummy[i]);
+	}
+	close(inpipe[0]);
+	close(outpipe[1]);
+	if (_pam_krb5_write_with_retry(inpipe[1], data, data_len) == data_len) {
 		close(inpipe[1]);
-		close(outpipe[0]);
-		for (i = 0; i < sysconf(_SC_OPEN_MAX); i++) {
-			if ((i != inpipe[0]) && (i != outpipe[1]) &&
-			    (i != STDERR_FILENO)) {
-				close(i);
-			}
-		}
-		dup2(outpipe[1], STDOUT_FILENO);
-		dup2(inpipe[0], STDIN_FILENO);
-#ifdef HAVE_LONG_LONG
-		snprintf(uidstr, sizeof(uidstr), "%llu",
-			 (unsigned long long) uid);
-		snprintf(gidstr, sizeof(gidstr), "%llu",
-			 (unsigned long long) gid);
+		memset(outfile, '\0', outfile_len);
+		_pam_krb5_read_with_retry(outpipe[0], (unsigned char*) outfile,
+					  outfile_len - 1);
+		outfile[outfile_len - 1] = '\0';
+	} else {
+		close(inpipe[1]);
+		memset(outfile, '\0', outfile_len);
+	}
+	close(outpipe[0]);
+	_pam_krb5_spawn_wait(&spawn);
+	if (strlen(outfile) >= strlen(pattern)) {
+		return 0;
+	} else {
+		return -1;
+	}
+}
+
+/* Check if SELinux is in use, in which case the files we create need to be
+ * given the right context. */
+static int
+storetmp_selinux_enabled(void)
+{
+#ifdef HAVE_SELINUX
+	return (is_selinux_enabled() > 0);
 #else
-		snprintf(uidstr, sizeof(uidstr), "%lu", (unsigned long) uid);
-		snprintf(gidstr, sizeof(gidstr), "%lu", (unsigned long) gid);
+	return (access("/sys/fs/selinux/enforce", F_OK) == 0) ||
+	       (access("/selinux/enforce", F_OK) == 0);
 #endif
-		if ((strlen(uidstr) > sizeof(uidstr) - 2) ||
-		    (strlen(gidstr) > sizeof(gidstr) - 2)) {
-			_exit(-1);
-		}
-		if (uid == 0) {
-			setgroups(0, NULL);
-		}
-		/* Now, attempt to assume the desired uid/gid pair.  Note that
-		 * if we're not root, this is allowed to fail. */
-		if ((gid != getgid()) || (gid != getegid())) {
-			setregid(gid, gid);
-		}
-		if ((uid != getuid()) || (uid != geteuid())) {
-			setreuid(uid, uid);
-		}
-		execl(PKGSECURITYDIR "/pam_krb5_storetmp", "pam_krb5_storetmp",
-		      pattern, uidstr, gidstr, NULL);
-		_exit(-1);
-		break;
-	default:
-		/* parent */
-		for (i = 0; i < 3; i++) {
-			close(dummy[i]);
+}
+
+/* Store the data ourselves, without running the helper.  We can only do
+ * that if SELinux isn't in use, or if we can find out which context the
+ * file should have and ask for it. */
+static int
+_pam_krb5_storetmp_direct(const unsigned char *data, ssize_t data_len,
+			  const char *pattern, uid_t uid, gid_t gid,
+			  char *outfile, size_t outfile_len)
+{
+	char *filename;
+	int fd, ret;
+#ifdef HAVE_SELINUX
+	struct selabel_handle *handle;
+	char *context, *saved;
+	int labeled;
+#endif
+
+	if ((strlen(pattern) > outfile_len - 1) ||
+	    (strlen(pattern) < 6) ||
+	    (strcmp(pattern + strlen(pattern) - 6, "XXXXXX") != 0)) {
+		return -1;
+	}
+#ifdef HAVE_SELINUX
+	labeled = 0;
+	saved = NULL;
+	if (storetmp_selinux_enabled()) {
+		handle = selabel_open(SELABEL_CTX_FILE, NULL, 0);
+		if (handle == NULL) {
+			return -1;
 		}
-		close(inpipe[0]);
-		close(outpipe[1]);
-		if (_pam_krb5_write_with_retry(inpipe[1],
-					       data, data_len) == data_len) {
-			close(inpipe[1]);
-			memset(outfile, '\0', outfile_len);
-			_pam_krb5_read_with_retry(outpipe[0],
-						  (unsigned char*) outfile,
-						  outfile_len - 1);
-			outfile[outfile_len - 1] = '\0';
-		} else {
-			close(inpipe[1]);
-			memset(outfile, '\0', outfile_len);
+		context = NULL;
+		if (selabel_lookup(handle, &context, pattern, S_IFREG) != 0) {
+			selabel_close(handle);
+			return -1;
 		}
-		close(outpipe[0]);
-		waitpid(child, NULL, 0);
-		sigaction(SIGCHLD, &saved_sigchld_handler, NULL);
-		sigaction(SIGPIPE, &saved_sigpipe_handler, NULL);
-		if (strlen(outfile) >= strlen(pattern)) {
-			return 0;
-		} else {
+		selabel_close(handle);
+		if ((getfscreatecon(&saved) != 0) ||
+		    (setfscreatecon(context) != 0)) {
+			if (saved != NULL) {
+				freecon(saved);
+			}
+			freecon(context);
 			return -1;
 		}
-		break;
+		freecon(context);
+		labeled = 1;
+	}
+#else
+	if (storetmp_selinux_enabled()) {
+		/* Leave it to the helper to get the context right. */
+		return -1;
+	}
+#endif
+	filename = strdup(pattern);
+	if (filename == NULL) {
+		fd = -1;
+	} else {
+		fd = mkstemp(filename);
+	}
+#ifdef HAVE_SELINUX
+	if (labeled) {
+		setfscreatecon(saved);
+		if (saved != NULL) {
+			freecon(saved);
+		}
+	}
+#endif
+	if (fd == -1) {
+		free(filename);
+		return -1;
+	}
+	/* As with the helper, failing to give the file away is only an error
+	 * if we're privileged. */
+	ret = -1;
+	if (((fchown(fd, uid, gid) == 0) || (geteuid() != 0)) &&
+	    (_pam_krb5_write_with_retry(fd, data, data_len) == data_len)) {
+		ret = 0;
 	}
-	abort(); /* not reached */
+	if (close(fd) != 0) {
+		ret = -1;
+	}
+	if (ret == 0) {
+		memset(outfile, '\0', outfile_len);
+		strcpy(outfile, filename);
+	} else {
+		unlink(filename);
+	}
+	free(filename);
+	return ret;
 }
 
 int
 _pam_krb5_storetmp_file(const char *infile, const char *pattern,
 			void **copy, size_t *copy_len,
-			uid_t uid, gid_t gid, char *outfile, size_t outfile_len)
+			uid_t uid, gid_t gid, int persistent,
+			char *outfile, size_t outfile_len)
 {
 	struct stat st;
 	int fd, ret;
@@ -270,7 +504,7 @@ _pam_krb5_storetmp_file(const char *infile, const char *pattern,
 		close(fd);
 		return -1;
 	}
-	if (st.st_size > 0x100000) {
+	if (st.st_size > STORETMP_MAX_DATA) {
 		close(fd);
 		return -1;
 	}
@@ -292,25 +526,44 @@ _pam_krb5_storetmp_file(const char *infile, const char *pattern,
 			*copy_len = st.st_size;
 		}
 	}
-	ret = _pam_krb5_storetmp_data(buf, st.st_size, pattern, uid, gid,
-				      outfile, outfile_len);
+	ret = _pam_krb5_storetmp_direct(buf, st.st_size, pattern, uid, gid,
+					outfile, outfile_len);
+	if (ret != 0) {
+		ret = _pam_krb5_storetmp_data(buf, st.st_size, pattern,
+					      uid, gid, persistent,
+					      outfile, outfile_len);
+	}
 	free(buf);
 	return ret;
 }
 
 int
-_pam_krb5_storetmp_delete(const char *file)
+_pam_krb5_storetmp_delete(const char *file, int persistent)
 {
 	char *buf;
 	unsigned char empty[] = "";
 	int ret;
 
+	/* Without SELinux, there's nothing the helper can do that we can't. */
+	if (!storetmp_selinux_enabled() && (unlink(file) == 0)) {
+		return 0;
+	}
+
 	buf = malloc(strlen(file) + 1);
 	if (buf == NULL) {
 		return -1;
 	}
 	memset(buf, 0, strlen(file) + 1);
-	ret = _pam_krb5_storetmp_data(empty, 0, file, -1, -1,
+	if (persistent) {
+		ret = storetmp_coprocess_call(STORETMP_OP_DELETE, empty, 0,
+					      file, -1, -1,
+					      buf, strlen(file) + 1);
+		if (ret != -1) {
+			free(buf);
+			return (ret == 0) ? 0 : -1;
+		}
+	}
+	ret = _pam_krb5_storetmp_data(empty, 0, file, -1, -1, 0,
 				      buf, strlen(file) + 1);
 	free(buf);
 
@@ -33,11 +33,33 @@
 #ifndef pam_krb5_storetmp_h
 #define pam_krb5_storetmp_h
 
+/* A helper started with this argument keeps running, reading requests from
+ * stdin and writing replies to stdout until it reads end-of-file.  Each
+ * request is a header, the pattern, and then the data to store; each reply
+ * is a header followed by the name of the new file, if there is one.  Both
+ * ends are always on the same host, so there's no byte-swapping. */
+#define STORETMP_PERSISTENT_ARG "-p"
+#define STORETMP_OP_CREATE 1
+#define STORETMP_OP_DELETE 2
+#define STORETMP_MAX_PATTERN 4096
+#define STORETMP_MAX_DATA 0x100000
+
+struct _pam_krb5_storetmp_request {
+	unsigned int op;
+	long long uid, gid;
+	unsigned int pattern_len, data_len;
+};
+
+struct _pam_krb5_storetmp_reply {
+	int status;
+	unsigned int name_len;
+};
+
 int _pam_krb5_storetmp_file(const char *infile, const char *pattern,
 			    void **copy, size_t *copy_len,
-			    uid_t uid, gid_t gid,
+			    uid_t uid, gid_t gid, int persistent,
 			    char *outfile, size_t outfile_len);
-int _pam_krb5_storetmp_delete(const char *file);
+int _pam_krb5_storetmp_delete(const char *file, int persistent);
 ssize_t _pam_krb5_read_with_retry(int fd,
 				  unsigned char *buffer, ssize_t len);
 ssize_t _pam_krb5_write_with_retry(int fd,
@@ -33,11 +33,24 @@
 #include "../config.h"
 
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <errno.h>
+#ifdef HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
 #include <limits.h>
+#ifdef HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#endif
+#include <signal.h>
 #include <stdio.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef HAVE_SECURITY_PAM_APPL_H
@@ -57,6 +70,9 @@
 #endif
 #endif
 
+#include "cellcache.h"
+#include "credblob.h"
+#include "init.h"
 #include "log.h"
 #include "minikafs.h"
 #include "options.h"
@@ -87,18 +103,531 @@ cell_is_in_option_list(struct _pam_krb5_options *options, const char *cell)
 	return 0;
 }
 
+/* Forget which cells we've already set tokens for. */
+static void
+tokens_forget(struct _pam_krb5_stash *stash)
+{
+	struct _pam_krb5_ccname_list *node;
+
+	while (stash->afscells != NULL) {
+		node = stash->afscells;
+		stash->afscells = node->next;
+		xstrfree(node->name);
+		free(node);
+	}
+	stash->afscells_pag = 0;
+	stash->afscells_authtime = 0;
+	stash->afscells_endtime = 0;
+}
+
+/* Check if the tokens we remember setting are still there to be used: we're
+ * in the same PAG, and they came from the TGT we have now, which hasn't
+ * expired yet. */
+static int
+tokens_reusable(struct _pam_krb5_stash *stash, unsigned long pag)
+{
+	return (stash->afscells != NULL) &&
+	       (stash->afscells_pag == pag) &&
+	       (stash->afscells_authtime == stash->v5creds.times.authtime) &&
+	       (stash->afscells_endtime == stash->v5creds.times.endtime) &&
+	       (stash->afscells_endtime > time(NULL));
+}
+
+/* Check if we've already set tokens for the cell. */
+static int
+tokens_have(struct _pam_krb5_stash *stash, const char *cell)
+{
+	struct _pam_krb5_ccname_list *node;
+
+	for (node = stash->afscells; node != NULL; node = node->next) {
+		if (strcmp(node->name, cell) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Remember that we've set tokens for the cell. */
+static void
+tokens_remember(struct _pam_krb5_stash *stash, const char *cell,
+		unsigned long pag)
+{
+	struct _pam_krb5_ccname_list *node;
+
+	node = malloc(sizeof(*node));
+	if (node == NULL) {
+		return;
+	}
+	node->name = xstrdup(cell);
+	if (node->name == NULL) {
+		free(node);
+		return;
+	}
+	if (stash->afscells == NULL) {
+		stash->afscells_pag = pag;
+		stash->afscells_authtime = stash->v5creds.times.authtime;
+		stash->afscells_endtime = stash->v5creds.times.endtime;
+	}
+	node->next = stash->afscells;
+	stash->afscells = node;
+}
+
+/* Fetching credentials for several cells at once.  Each worker thread
+ * takes the next cell from the list, fetches what it needs using a context
+ * and ccache of its own, which start out with copies of the credentials we
+ * already have in "seed", and leaves the results, encoded, in that cell's
+ * slot in "results", each one preceded by its length.  We add them all to
+ * the caller's ccache once the workers are done. */
+struct tokens_fetch_result {
+	unsigned char *buf;
+	size_t length;
+};
+
+struct tokens_fetch_job {
+	krb5_creds *tgt;
+	struct _pam_krb5_options *options;
+	struct tokens_cell *cells;
+	struct tokens_fetch_result *results, seed;
+	int *todo, n_todo, next;
+	uid_t uid;
+	const int *methods;
+	int n_methods;
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_t lock;
+#endif
+};
+
+/* More than any reasonable number of service tickets would need. */
+#define TOKENS_MAX_FETCH_SIZE 0x100000
+
+/* Microseconds since "start". */
+static long
+tokens_elapsed(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000000L +
+	       (now.tv_usec - start->tv_usec);
+}
+
+/* Add one encoded credential to a cell's results. */
+static void
+tokens_fetch_save(struct tokens_fetch_result *result, krb5_creds *creds)
+{
+	unsigned char *buf;
+	uint32_t length;
+	size_t size;
+
+	size = _pam_krb5_credblob_length(creds);
+	if ((size == 0) ||
+	    (result->length + sizeof(length) + size > TOKENS_MAX_FETCH_SIZE)) {
+		return;
+	}
+	buf = realloc(result->buf, result->length + sizeof(length) + size);
+	if (buf == NULL) {
+		return;
+	}
+	result->buf = buf;
+	if (_pam_krb5_credblob_encode(creds, buf + result->length +
+				      sizeof(length), size) == 0) {
+		length = size;
+		memcpy(buf + result->length, &length, sizeof(length));
+		result->length += sizeof(length) + size;
+	}
+}
+
+/* Decode the next credential in a cell's results, skipping any which won't
+ * decode.  Returns -1 when there aren't any more. */
+static int
+tokens_fetch_next(const struct tokens_fetch_result *result, size_t *offset,
+		  krb5_creds *creds)
+{
+	uint32_t length;
+
+	while (*offset + sizeof(length) <= result->length) {
+		memcpy(&length, result->buf + *offset, sizeof(length));
+		*offset += sizeof(length);
+		if (length > result->length - *offset) {
+			break;
+		}
+		*offset += length;
+		if (_pam_krb5_credblob_decode(result->buf + *offset - length,
+					      length, creds) == 0) {
+			return 0;
+		}
+	}
+	*offset = result->length;
+	return -1;
+}
+
+static void
+tokens_fetch_free(struct tokens_fetch_result *result)
+{
+	if (result->buf != NULL) {
+		memset(result->buf, 0, result->length);
+		free(result->buf);
+	}
+	result->buf = NULL;
+	result->length = 0;
+}
+
+/* Check if a credential is one of the ones we started the workers with. */
+static int
+tokens_fetch_seeded(krb5_context ctx, struct tokens_fetch_job *job,
+		    krb5_creds *creds)
+{
+	krb5_creds seeded;
+	size_t offset;
+	int found;
+
+	found = 0;
+	offset = 0;
+	memset(&seeded, 0, sizeof(seeded));
+	while (!found && (tokens_fetch_next(&job->seed, &offset,
+					    &seeded) == 0)) {
+		found = krb5_principal_compare(ctx, creds->server,
+					       seeded.server) &&
+			(creds->times.endtime == seeded.times.endtime);
+		krb5_free_cred_contents(ctx, &seeded);
+		memset(&seeded, 0, sizeof(seeded));
+	}
+	return found;
+}
+
+/* Check if a name component is a particular string. */
+static int
+tokens_component_is(krb5_principal princ, int i, const char *s, int anycase)
+{
+	int length;
+
+	length = v5_princ_component_length(princ, i);
+	return (length == (int) strlen(s)) &&
+	       ((anycase ?
+		 strncasecmp(v5_princ_component_contents(princ, i), s, length) :
+		 strncmp(v5_princ_component_contents(princ, i), s, length)) ==
+		0);
+}
+
+/* Check if a credential is for one of the services which minikafs_log()
+ * would try to use to get tokens for the cell. */
+static int
+tokens_fetch_matches(krb5_context ctx, struct _pam_krb5_options *options,
+		     krb5_creds *creds, const struct tokens_cell *cell)
+{
+	krb5_principal hint;
+	const char *bases[] = {"afs", "afsx", "afs-k5"};
+	unsigned int i;
+	int match, length;
+
+	if ((cell->hint_principal != NULL) &&
+	    (strlen(cell->hint_principal) > 0) &&
+	    (v5_parse_name(ctx, options, cell->hint_principal, &hint) == 0)) {
+		match = krb5_principal_compare(ctx, creds->server, hint);
+		krb5_free_principal(ctx, hint);
+		if (match) {
+			return 1;
+		}
+	}
+	for (i = 0; i < sizeof(bases) / sizeof(bases[0]); i++) {
+		switch (v5_princ_component_count(creds->server)) {
+		case 1:
+			/* "afs@REALM", where the realm is named for the
+			 * cell. */
+			length = v5_princ_realm_length(creds->server);
+			if ((i < 2) &&
+			    tokens_component_is(creds->server, 0,
+						bases[i], 0) &&
+			    (length == (int) strlen(cell->cell)) &&
+			    (strncasecmp(v5_princ_realm_contents(creds->server),
+					 cell->cell, length) == 0)) {
+				return 1;
+			}
+			break;
+		case 2:
+			/* "afs/cell@REALM". */
+			if (tokens_component_is(creds->server, 0,
+						bases[i], 0) &&
+			    tokens_component_is(creds->server, 1,
+						cell->cell, 1)) {
+				return 1;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	return 0;
+}
+
+/* Check if the ccache already has an unexpired ticket which we could use to
+ * get tokens for the cell. */
+static int
+tokens_fetch_cached(krb5_context ctx, krb5_ccache ccache,
+		    struct _pam_krb5_options *options,
+		    const struct tokens_cell *cell)
+{
+	krb5_cc_cursor cursor;
+	krb5_creds creds;
+	time_t now;
+	int found;
+
+	if (krb5_cc_start_seq_get(ctx, ccache, &cursor) != 0) {
+		return 0;
+	}
+	now = time(NULL);
+	found = 0;
+	memset(&creds, 0, sizeof(creds));
+	while (krb5_cc_next_cred(ctx, ccache, &cursor, &creds) == 0) {
+		if (!found &&
+		    (creds.times.endtime > now) &&
+		    tokens_fetch_matches(ctx, options, &creds, cell)) {
+			found = 1;
+		}
+		krb5_free_cred_contents(ctx, &creds);
+		memset(&creds, 0, sizeof(creds));
+	}
+	krb5_cc_end_seq_get(ctx, ccache, &cursor);
+	return found;
+}
+
+/* Get the credentials we'd need to get tokens for one cell. */
+static void
+tokens_fetch_cell(struct tokens_fetch_job *job, int i)
+{
+	struct tokens_cell *cell;
+	krb5_context ctx;
+	krb5_ccache ccache;
+	krb5_cc_cursor cursor;
+	krb5_creds creds;
+	struct timeval start;
+	size_t offset;
+	char ccname[PATH_MAX];
+
+	cell = &job->cells[i];
+	gettimeofday(&start, NULL);
+	if (_pam_krb5_init_ctx(&ctx, 0, NULL) != 0) {
+		return;
+	}
+	snprintf(ccname, sizeof(ccname), "MEMORY:_pam_krb5_token_f_%p_%d",
+		 (void *) job, i);
+	if (krb5_cc_resolve(ctx, ccname, &ccache) != 0) {
+		krb5_free_context(ctx);
+		return;
+	}
+	if ((krb5_cc_initialize(ctx, ccache, job->tgt->client) != 0) ||
+	    (krb5_cc_store_cred(ctx, ccache, job->tgt) != 0)) {
+		krb5_cc_destroy(ctx, ccache);
+		krb5_free_context(ctx);
+		return;
+	}
+	/* Start with the cross-realm TGTs and service tickets we have. */
+	offset = 0;
+	memset(&creds, 0, sizeof(creds));
+	while (tokens_fetch_next(&job->seed, &offset, &creds) == 0) {
+		krb5_cc_store_cred(ctx, ccache, &creds);
+		krb5_free_cred_contents(ctx, &creds);
+		memset(&creds, 0, sizeof(creds));
+	}
+	if (job->options->debug) {
+		debug("fetching credentials for cell '%s'", cell->cell);
+	}
+	if (minikafs_fetch(ctx, ccache, job->options,
+			   cell->cell, cell->hint_principal, job->uid,
+			   job->methods, job->n_methods) != 0) {
+		if (job->options->debug) {
+			debug("error fetching credentials for cell '%s'",
+			      cell->cell);
+		}
+	} else if (krb5_cc_start_seq_get(ctx, ccache, &cursor) == 0) {
+		memset(&creds, 0, sizeof(creds));
+		while (krb5_cc_next_cred(ctx, ccache, &cursor, &creds) == 0) {
+			/* The caller already has the TGT we started with,
+			 * and everything else we gave the worker. */
+			if (!krb5_principal_compare(ctx, creds.server,
+						    job->tgt->server) &&
+			    !tokens_fetch_seeded(ctx, job, &creds)) {
+				tokens_fetch_save(&job->results[i], &creds);
+			}
+			krb5_free_cred_contents(ctx, &creds);
+			memset(&creds, 0, sizeof(creds));
+		}
+		krb5_cc_end_seq_get(ctx, ccache, &cursor);
+	}
+	krb5_cc_destroy(ctx, ccache);
+	krb5_free_context(ctx);
+	cell->fetch_usec = tokens_elapsed(&start);
+}
+
+/* Fetch credentials for cells until there aren't any left. */
+static void *
+tokens_fetch_worker(void *arg)
+{
+	struct tokens_fetch_job *job = arg;
+	int i;
+
+	for (;;) {
+#ifdef HAVE_PTHREAD_CREATE
+		pthread_mutex_lock(&job->lock);
+#endif
+		i = (job->next < job->n_todo) ? job->todo[job->next++] : -1;
+#ifdef HAVE_PTHREAD_CREATE
+		pthread_mutex_unlock(&job->lock);
+#endif
+		if (i == -1) {
+			break;
+		}
+		tokens_fetch_cell(job, i);
+	}
+	return NULL;
+}
+
+void
+tokens_fetch(krb5_context context, krb5_ccache ccache, krb5_creds *tgt,
+	     struct _pam_krb5_options *options,
+	     struct tokens_cell *cells, int n_cells, uid_t uid,
+	     const int *methods, int n_methods, int max_workers)
+{
+	struct tokens_fetch_job job;
+	krb5_cc_cursor cursor;
+	krb5_creds creds;
+	size_t offset;
+	unsigned int count;
+	int i;
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_t *threads;
+	sigset_t all, saved;
+	int n_threads;
+#endif
+
+	for (i = 0; i < n_cells; i++) {
+		cells[i].fetched = 0;
+		cells[i].fetch_usec = 0;
+	}
+	if ((n_cells < 1) || (_pam_krb5_credblob_length(tgt) == 0)) {
+		return;
+	}
+	memset(&job, 0, sizeof(job));
+	job.tgt = tgt;
+	job.options = options;
+	job.cells = cells;
+	job.uid = uid;
+	job.methods = methods;
+	job.n_methods = n_methods;
+	job.results = calloc(n_cells, sizeof(*job.results));
+	job.todo = calloc(n_cells, sizeof(*job.todo));
+	if ((job.results == NULL) || (job.todo == NULL)) {
+		free(job.results);
+		free(job.todo);
+		return;
+	}
+
+	/* Hand the workers copies of what we already have, so that they
+	 * don't ask for any of it again, and don't bother with cells which we
+	 * already have tickets for. */
+	if (krb5_cc_start_seq_get(context, ccache, &cursor) == 0) {
+		memset(&creds, 0, sizeof(creds));
+		while (krb5_cc_next_cred(context, ccache, &cursor,
+					 &creds) == 0) {
+			if (!krb5_principal_compare(context, creds.server,
+						    tgt->server)) {
+				tokens_fetch_save(&job.seed, &creds);
+			}
+			krb5_free_cred_contents(context, &creds);
+			memset(&creds, 0, sizeof(creds));
+		}
+		krb5_cc_end_seq_get(context, ccache, &cursor);
+	}
+	for (i = 0; i < n_cells; i++) {
+		if (tokens_fetch_cached(context, ccache, options, &cells[i])) {
+			if (options->debug) {
+				debug("already have credentials for cell '%s'",
+				      cells[i].cell);
+			}
+			continue;
+		}
+		job.todo[job.n_todo++] = i;
+	}
+
+#ifdef HAVE_PTHREAD_CREATE
+	if (max_workers > job.n_todo) {
+		max_workers = job.n_todo;
+	}
+	if ((max_workers < 1) && (job.n_todo > 0)) {
+		max_workers = 1;
+	}
+	threads = NULL;
+	if (max_workers > 0) {
+		threads = calloc(max_workers, sizeof(*threads));
+	}
+	n_threads = 0;
+	if ((threads != NULL) &&
+	    (pthread_mutex_init(&job.lock, NULL) == 0)) {
+		/* Leave the application's signals to its own threads. */
+		sigfillset(&all);
+		pthread_sigmask(SIG_BLOCK, &all, &saved);
+		while ((n_threads < max_workers) &&
+		       (pthread_create(&threads[n_threads], NULL,
+				       tokens_fetch_worker, &job) == 0)) {
+			n_threads++;
+		}
+		pthread_sigmask(SIG_SETMASK, &saved, NULL);
+		/* If we couldn't start any, do it ourselves. */
+		if (n_threads == 0) {
+			tokens_fetch_worker(&job);
+		}
+		for (i = 0; i < n_threads; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		pthread_mutex_destroy(&job.lock);
+	}
+	free(threads);
+#else
+	tokens_fetch_worker(&job);
+#endif
+
+	/* Add whatever they fetched to our ccache. */
+	for (i = 0; i < job.n_todo; i++) {
+		count = 0;
+		offset = 0;
+		memset(&creds, 0, sizeof(creds));
+		while (tokens_fetch_next(&job.results[job.todo[i]], &offset,
+					 &creds) == 0) {
+			if (krb5_cc_store_cred(context, ccache, &creds) == 0) {
+				count++;
+			}
+			krb5_free_cred_contents(context, &creds);
+			memset(&creds, 0, sizeof(creds));
+		}
+		cells[job.todo[i]].fetched = count;
+		if (options->debug) {
+			debug("fetched %u credential%s for cell '%s' in %ld ms",
+			      count, (count == 1) ? "" : "s",
+			      cells[job.todo[i]].cell,
+			      cells[job.todo[i]].fetch_usec / 1000);
+		}
+	}
+	for (i = 0; i < n_cells; i++) {
+		tokens_fetch_free(&job.results[i]);
+	}
+	tokens_fetch_free(&job.seed);
+	free(job.results);
+	free(job.todo);
+}
+
 int
 tokens_obtain(krb5_context context,
 	      struct _pam_krb5_stash *stash,
 	      struct _pam_krb5_options *options,
 	      struct _pam_krb5_user_info *info, int newpag)
 {
-	int i, ret, use_2b;
+	int i, ret, use_2b, use_localcell, use_homecell, n_cells, have_pag;
 	unsigned int n;
+	unsigned long pag;
 	char localcell[LINE_MAX], homecell[LINE_MAX], homedir[LINE_MAX],
 	     lnk[LINE_MAX];
 	struct stat st;
-	char ccname[PATH_MAX];
+	const char *ccname;
 	krb5_ccache ccache;
 	uid_t uid;
 	const struct {
@@ -113,7 +642,7 @@ tokens_obtain(krb5_context context,
 	};
 	int *methods, n_methods;
 	const char *p, *q;
-	static int counter = 0;
+	struct tokens_cell *cells;
 
 	if (options->debug) {
 		debug("obtaining afs tokens");
@@ -133,13 +662,31 @@ tokens_obtain(krb5_context context,
 		return PAM_SUCCESS;
 	}
 
-	/* Create a PAG. */
+	/* Create a PAG if we were asked to, which leaves behind any tokens
+	 * we set earlier.  Otherwise, if we've already set tokens using this
+	 * TGT, and we're still in the PAG we set them in, keep them, and only
+	 * get tokens for any cells which we didn't get them for then.  If the
+	 * client can't tell us which PAG we're in, don't assume anything. */
 	if (newpag) {
+		tokens_forget(stash);
 		if (options->debug) {
 			debug("creating new PAG");
 		}
 		minikafs_setpag();
 		stash->afspag = 1;
+		have_pag = (minikafs_pag(&pag) == 0);
+	} else {
+		have_pag = (minikafs_pag(&pag) == 0);
+		if (have_pag && tokens_reusable(stash, pag)) {
+			if (options->debug) {
+				debug("keeping tokens obtained earlier");
+			}
+		} else {
+			tokens_forget(stash);
+		}
+	}
+	if (!have_pag) {
+		pag = 0;
 	}
 
 	/* If options say we should neither use the 524 service nor contact the
@@ -170,15 +717,13 @@ tokens_obtain(krb5_context context,
 		p = q + strspn(q, ",");
 	}
 
-	/* Open the ccache. */
+	/* Open the stash's ccache.  Any service tickets we get here stay in
+	 * it, so we won't need to ask for them again later. */
 	memset(&ccache, 0, sizeof(ccache));
-	snprintf(ccname, sizeof(ccname), "MEMORY:_pam_krb5_token_s_%s-%d",
-		 info->unparsed_name, counter++);
 	if (stash &&
-	    (v5_creds_check_initialized(context, &stash->v5creds) == 0) &&
-	    (krb5_cc_resolve(context, ccname, &ccache) == 0) &&
-	    (krb5_cc_initialize(context, ccache, stash->v5creds.client) == 0) &&
-	    (krb5_cc_store_cred(context, ccache, &stash->v5creds) == 0)) {
+	    (_pam_krb5_stash_memcc(context, stash, info, options,
+				   &ccname) == 0) &&
+	    (krb5_cc_resolve(context, ccname, &ccache) == 0)) {
 	} else {
 		memset(&ccache, 0, sizeof(ccache));
 	}
@@ -188,9 +733,114 @@ tokens_obtain(krb5_context context,
 	 * to determine which cell is considered the local cell.  Avoid getting
 	 * tripped up by dynamic root support in clients. */
 	memset(localcell, '\0', sizeof(localcell));
-	if ((minikafs_ws_cell(localcell, sizeof(localcell) - 1) == 0) &&
-	    (strcmp(localcell, "dynroot") != 0) &&
-	    (!cell_is_in_option_list(options, localcell))) {
+	use_localcell = (minikafs_ws_cell(localcell,
+					  sizeof(localcell) - 1) == 0) &&
+			(strcmp(localcell, "dynroot") != 0) &&
+			(!cell_is_in_option_list(options, localcell));
+	/* Get the name of the cell which houses the user's home directory.  In
+	 * case intervening directories aren't readable by system:anyuser
+	 * (which gives us an error), keep walking the directory chain until we
+	 * either succeed or run out of path components to remove.  And try to
+	 * avoid doing the same thing twice. */
+	strncpy(homedir, info->homedir ? info->homedir : "/afs",
+		sizeof(homedir) - 1);
+	homedir[sizeof(homedir) - 1] = '\0';
+	/* A common configuration is to have the home directory be a symlink
+	 * into /afs.  If the homedir is a symlink, chase it, *once*. */
+	memset(lnk, '\0', sizeof(lnk));
+	if ((lstat(homedir, &st) == 0) && S_ISLNK(st.st_mode)) {
+		/* Read the link. */
+		if (readlink(homedir, lnk, sizeof(lnk) - 1) <= 0) {
+			memset(lnk, '\0', sizeof(lnk));
+		}
+	}
+	/* If we remember where this home directory, pointing where it
+	 * does, was the last time we looked, don't bother looking again. */
+	i = -1;
+	if ((options->cell_realm_cache != NULL) &&
+	    (_pam_krb5_cellcache_home_lookup(options->cell_realm_cache,
+					     info->uid, homedir, lnk,
+					     homecell,
+					     sizeof(homecell)) == 1)) {
+		if (options->debug) {
+			debug("remembered that \"%s\" is in \"%s\"",
+			      homedir, homecell);
+		}
+		i = 0;
+	}
+	if (i != 0) {
+		/* If it's an absolute link, then we should ask about the link
+		 * destination instead. */
+		memset(homecell, '\0', sizeof(homecell));
+		i = minikafs_cell_of_file_walk_up(lnk[0] == '/' ?
+						  lnk : homedir,
+						  homecell,
+						  sizeof(homecell) - 1);
+		if ((i == 0) && (options->cell_realm_cache != NULL)) {
+			_pam_krb5_cellcache_home_add(options->cell_realm_cache,
+						     info->uid, homedir, lnk,
+						     homecell,
+						     options->cell_realm_cache_ttl,
+						     options->debug);
+		}
+	}
+	use_homecell = (i == 0) &&
+		       (strcmp(homecell, "dynroot") != 0) &&
+		       (strcmp(homecell, localcell) != 0) &&
+		       (!cell_is_in_option_list(options, homecell));
+	if (use_localcell && tokens_have(stash, localcell)) {
+		if (options->debug) {
+			debug("already have tokens for local cell '%s'",
+			      localcell);
+		}
+		use_localcell = 0;
+	}
+	if (use_homecell && tokens_have(stash, homecell)) {
+		if (options->debug) {
+			debug("already have tokens for home cell '%s'",
+			      homecell);
+		}
+		use_homecell = 0;
+	}
+
+	/* If we'll be getting tokens for more than one cell, fetch the
+	 * credentials for all of them at once, and then just set the tokens
+	 * one cell at a time, in order, below. */
+	cells = malloc((options->n_afs_cells + 2) * sizeof(*cells));
+	n_cells = 0;
+	if (cells != NULL) {
+		if (use_localcell) {
+			cells[n_cells].cell = localcell;
+			cells[n_cells++].hint_principal = NULL;
+		}
+		if (use_homecell) {
+			cells[n_cells].cell = homecell;
+			cells[n_cells++].hint_principal = NULL;
+		}
+		for (i = 0; i < options->n_afs_cells; i++) {
+			if (tokens_have(stash, options->afs_cells[i].cell)) {
+				continue;
+			}
+			cells[n_cells].cell = options->afs_cells[i].cell;
+			cells[n_cells++].hint_principal =
+				options->afs_cells[i].principal_name;
+		}
+	}
+	if ((n_cells > 1) &&
+	    (ccache != NULL) &&
+	    (options->token_fetch_workers > 1)) {
+		if (options->debug) {
+			debug("fetching credentials for %d cells using up to "
+			      "%d workers", n_cells,
+			      options->token_fetch_workers);
+		}
+		tokens_fetch(context, ccache, &stash->v5creds, options,
+			     cells, n_cells, uid, methods, n_methods,
+			     options->token_fetch_workers);
+	}
+	free(cells);
+
+	if (use_localcell) {
 		if (options->debug) {
 			debug("obtaining tokens for local cell '%s'",
 			      localcell);
@@ -211,37 +861,11 @@ tokens_obtain(krb5_context context,
 					      localcell);
 				}
 			}
+		} else {
+			tokens_remember(stash, localcell, pag);
 		}
 	}
-	/* Get the name of the cell which houses the user's home directory.  In
-	 * case intervening directories aren't readable by system:anyuser
-	 * (which gives us an error), keep walking the directory chain until we
-	 * either succeed or run out of path components to remove.  And try to
-	 * avoid doing the same thing twice. */
-	strncpy(homedir, info->homedir ? info->homedir : "/afs",
-		sizeof(homedir) - 1);
-	homedir[sizeof(homedir) - 1] = '\0';
-	/* A common configuration is to have the home directory be a symlink
-	 * into /afs.  If the homedir is a symlink, chase it, *once*. */
-	if (lstat(homedir, &st) == 0) {
-		if (st.st_mode & S_IFLNK) {
-			/* Read the link. */
-			memset(lnk, '\0', sizeof(lnk));
-			if (readlink(homedir, lnk, sizeof(lnk) - 1) == 0) {
-				/* If it's an absolute link, then we should
-				 * ask about the link destination instead. */
-				if ((strlen(lnk) > 0) && (lnk[0] == '/')) {
-					strcpy(homedir, lnk);
-				}
-			}
-		}
-	}
-	i = minikafs_cell_of_file_walk_up(homedir, homecell,
-					  sizeof(homecell) - 1);
-	if ((i == 0) &&
-	    (strcmp(homecell, "dynroot") != 0) &&
-	    (strcmp(homecell, localcell) != 0) &&
-	    (!cell_is_in_option_list(options, homecell))) {
+	if (use_homecell) {
 		if (options->debug) {
 			debug("obtaining tokens for home cell '%s'", homecell);
 		}
@@ -261,19 +885,26 @@ tokens_obtain(krb5_context context,
 					      homecell);
 				}
 			}
+		} else {
+			tokens_remember(stash, homecell, pag);
 		}
 	}
 
-	/* If there are no additional cells configured, stop here. */
 	if (options->afs_cells == NULL) {
 		if (options->debug) {
 			debug("no additional afs cells configured");
 		}
-		return PAM_SUCCESS;
 	}
 
 	/* Iterate through the list of other cells. */
 	for (i = 0; i < options->n_afs_cells; i++) {
+		if (tokens_have(stash, options->afs_cells[i].cell)) {
+			if (options->debug) {
+				debug("already have tokens for '%s'",
+				      options->afs_cells[i].cell);
+			}
+			continue;
+		}
 		if (options->debug) {
 			if (options->afs_cells[i].principal_name != NULL) {
 				debug("obtaining tokens for '%s' ('%s')",
@@ -302,12 +933,15 @@ tokens_obtain(krb5_context context,
 					      options->afs_cells[i].cell);
 				}
 			}
+		} else {
+			tokens_remember(stash, options->afs_cells[i].cell, pag);
 		}
 	}
 
 	if (ccache != NULL) {
-		krb5_cc_destroy(context, ccache);
+		krb5_cc_close(context, ccache);
 	}
+	free(methods);
 
 	/* Suppress all errors. */
 	return PAM_SUCCESS;
@@ -338,6 +972,7 @@ tokens_release(struct _pam_krb5_stash *stash, struct _pam_krb5_options *options)
 		}
 		minikafs_unlog();
 		stash->afspag = 0;
+		tokens_forget(stash);
 	}
 
 	/* Suppress all errors. */
@@ -33,7 +33,26 @@
 #ifndef pam_krb5_tokens_h
 #define pam_krb5_tokens_h
 
+#define DEFAULT_TOKEN_FETCH_WORKERS 4
+
+/* A cell for which we're going to try to get tokens.  tokens_fetch() notes
+ * how many credentials it got for the cell, and how long that took. */
+struct tokens_cell {
+	const char *cell, *hint_principal;
+	unsigned int fetched;
+	long fetch_usec;
+};
+
 int tokens_useful(void);
+/* Fetch the service tickets we'd need to get tokens for each of the cells
+ * which "ccache" doesn't already have one for, using "tgt", anything else in
+ * "ccache", and up to "max_workers" threads at a time, and add them to
+ * "ccache", so that minikafs_log() will find them there and only have to set
+ * the tokens. */
+void tokens_fetch(krb5_context context, krb5_ccache ccache, krb5_creds *tgt,
+		  struct _pam_krb5_options *options,
+		  struct tokens_cell *cells, int n_cells, uid_t uid,
+		  const int *methods, int n_methods, int max_workers);
 int tokens_obtain(krb5_context context,
 		  struct _pam_krb5_stash *stash,
 		  struct _pam_krb5_options *options,
@@ -0,0 +1,401 @@
+/*
+ * Copyright 2011 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#ifdef HAVE_SECURITY_PAM_MODULES_H
+#include <security/pam_modules.h>
+#endif
+
+#include KRB5_H
+
+#include "init.h"
+#include "items.h"
+#include "log.h"
+#include "options.h"
+#include "txn.h"
+#include "userinfo.h"
+#include "xstr.h"
+
+#define PAM_KRB5_TXN_KEY "_pam_krb5_txn"
+#define PAM_KRB5_TXN_PW_KEY "_pam_krb5_txn_pw"
+
+/* What we keep between calls.  The options are only valid for the context
+ * they were read using, and the user information is only valid for the
+ * options it was computed using, so each is discarded when whatever it
+ * depends on is replaced. */
+struct _pam_krb5_txn {
+	pid_t pid;
+	int argc;
+	char **argv;
+	krb5_context ctx;
+	char *service;
+	struct _pam_krb5_options *options;
+	char *user;
+	struct _pam_krb5_user_info *userinfo;
+};
+
+static struct _pam_krb5_txn *
+_pam_krb5_txn_get(pam_handle_t *pamh)
+{
+	struct _pam_krb5_txn *txn;
+	if (pam_get_data(pamh, PAM_KRB5_TXN_KEY,
+			 (PAM_KRB5_MAYBE_CONST void**) &txn) != PAM_SUCCESS) {
+		return NULL;
+	}
+	return txn;
+}
+
+static int
+_pam_krb5_txn_same_string(const char *a, const char *b)
+{
+	if ((a == NULL) || (b == NULL)) {
+		return (a == b);
+	}
+	return (strcmp(a, b) == 0);
+}
+
+static int
+_pam_krb5_txn_same_args(struct _pam_krb5_txn *txn,
+			int argc, PAM_KRB5_MAYBE_CONST char **argv)
+{
+	int i;
+	if (txn->argc != argc) {
+		return 0;
+	}
+	for (i = 0; i < argc; i++) {
+		if (!_pam_krb5_txn_same_string(txn->argv[i], argv[i])) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void
+_pam_krb5_txn_clear_userinfo(struct _pam_krb5_txn *txn)
+{
+	if (txn->userinfo != NULL) {
+		_pam_krb5_user_info_free(txn->ctx, txn->userinfo);
+		txn->userinfo = NULL;
+	}
+	xstrfree(txn->user);
+	txn->user = NULL;
+}
+
+static void
+_pam_krb5_txn_clear_options(pam_handle_t *pamh, struct _pam_krb5_txn *txn)
+{
+	_pam_krb5_txn_clear_userinfo(txn);
+	if (txn->options != NULL) {
+		_pam_krb5_options_free(pamh, txn->ctx, txn->options);
+		txn->options = NULL;
+	}
+	xstrfree(txn->service);
+	txn->service = NULL;
+}
+
+static void
+_pam_krb5_txn_cleanup(pam_handle_t *pamh, void *data, int error)
+{
+	struct _pam_krb5_txn *txn = data;
+	int i;
+	_pam_krb5_txn_clear_options(pamh, txn);
+	if (txn->ctx != NULL) {
+		krb5_free_context(txn->ctx);
+	}
+	if (txn->argv != NULL) {
+		for (i = 0; i < txn->argc; i++) {
+			xstrfree(txn->argv[i]);
+		}
+		free(txn->argv);
+	}
+	free(txn);
+}
+
+/* Hand out the saved context if our arguments haven't changed since it was
+ * created, and otherwise create a new one and save it in place of whatever
+ * we had before.  A context which we inherited across a fork() is never
+ * reused. */
+int
+_pam_krb5_txn_init_ctx(pam_handle_t *pamh, krb5_context *ctx,
+		       int argc, PAM_KRB5_MAYBE_CONST char **argv)
+{
+	struct _pam_krb5_txn *txn;
+	int i;
+
+	txn = _pam_krb5_txn_get(pamh);
+	if ((txn != NULL) &&
+	    (txn->ctx != NULL) &&
+	    (txn->pid == getpid()) &&
+	    _pam_krb5_txn_same_args(txn, argc, argv)) {
+		*ctx = txn->ctx;
+		return 0;
+	}
+
+	i = _pam_krb5_init_ctx(ctx, argc, argv);
+	if (i != 0) {
+		return i;
+	}
+
+	/* If we can't save it, the caller still gets a usable context, and
+	 * _pam_krb5_txn_free_ctx() will free it. */
+	txn = calloc(1, sizeof(*txn));
+	if (txn == NULL) {
+		return 0;
+	}
+	txn->pid = getpid();
+	txn->argc = argc;
+	if (argc > 0) {
+		txn->argv = calloc(argc, sizeof(char *));
+		if (txn->argv == NULL) {
+			_pam_krb5_txn_cleanup(pamh, txn, 0);
+			return 0;
+		}
+		for (i = 0; i < argc; i++) {
+			txn->argv[i] = xstrdup(argv[i]);
+			if (txn->argv[i] == NULL) {
+				_pam_krb5_txn_cleanup(pamh, txn, 0);
+				return 0;
+			}
+		}
+	}
+	txn->ctx = *ctx;
+	if (pam_set_data(pamh, PAM_KRB5_TXN_KEY, txn,
+			 _pam_krb5_txn_cleanup) != PAM_SUCCESS) {
+		txn->ctx = NULL;
+		_pam_krb5_txn_cleanup(pamh, txn, 0);
+	}
+	return 0;
+}
+
+void
+_pam_krb5_txn_free_ctx(pam_handle_t *pamh, krb5_context ctx)
+{
+	struct _pam_krb5_txn *txn;
+	txn = _pam_krb5_txn_get(pamh);
+	if ((txn != NULL) && (txn->ctx == ctx)) {
+		return;
+	}
+	krb5_free_context(ctx);
+}
+
+/* Hand out the saved options if they were read using this context (and so
+ * with these arguments) for the same service, and otherwise read them and
+ * save them in place of what we had before. */
+struct _pam_krb5_options *
+_pam_krb5_txn_options_init(pam_handle_t *pamh, int argc,
+			   PAM_KRB5_MAYBE_CONST char **argv,
+			   krb5_context ctx)
+{
+	struct _pam_krb5_txn *txn;
+	struct _pam_krb5_options *options;
+	char *service, *saved;
+
+	service = NULL;
+	_pam_krb5_get_item_text(pamh, PAM_SERVICE, &service);
+
+	txn = _pam_krb5_txn_get(pamh);
+	if ((txn != NULL) && (txn->ctx != ctx)) {
+		txn = NULL;
+	}
+	if ((txn != NULL) &&
+	    (txn->options != NULL) &&
+	    _pam_krb5_txn_same_string(txn->service, service)) {
+		if (txn->options->debug) {
+			debug("reusing options read for service \"%s\"",
+			      service ? service : "(unknown)");
+		}
+		return txn->options;
+	}
+
+	options = _pam_krb5_options_init(pamh, argc, argv, ctx);
+	if ((options == NULL) || (txn == NULL)) {
+		return options;
+	}
+
+	saved = NULL;
+	if ((service != NULL) && ((saved = xstrdup(service)) == NULL)) {
+		return options;
+	}
+	_pam_krb5_txn_clear_options(pamh, txn);
+	txn->options = options;
+	txn->service = saved;
+	return options;
+}
+
+void
+_pam_krb5_txn_options_free(pam_handle_t *pamh, krb5_context ctx,
+			   struct _pam_krb5_options *options)
+{
+	struct _pam_krb5_txn *txn;
+	txn = _pam_krb5_txn_get(pamh);
+	if ((txn != NULL) && (txn->options == options)) {
+		return;
+	}
+	_pam_krb5_options_free(pamh, ctx, options);
+}
+
+/* The user's passwd entry doesn't depend on our arguments or options, so
+ * it's kept apart from everything else, and outlives their being replaced
+ * when the application's PAM configuration passes different arguments to
+ * different entry points. */
+struct _pam_krb5_txn_pw {
+	char *user;
+	struct _pam_krb5_user_pw pw;
+};
+
+static void
+_pam_krb5_txn_pw_cleanup(pam_handle_t *pamh, void *data, int error)
+{
+	struct _pam_krb5_txn_pw *txn_pw = data;
+	xstrfree(txn_pw->user);
+	xstrfree(txn_pw->pw.homedir);
+	free(txn_pw);
+}
+
+/* Hand out the user's saved passwd information, or look it up and save it.
+ * If it can't be saved, it's returned in "scratch", and the caller needs to
+ * free the home directory. */
+static const struct _pam_krb5_user_pw *
+_pam_krb5_txn_pw_init(pam_handle_t *pamh, const char *user,
+		      struct _pam_krb5_user_pw *scratch, int verbose)
+{
+	struct _pam_krb5_txn_pw *txn_pw;
+
+	if ((pam_get_data(pamh, PAM_KRB5_TXN_PW_KEY,
+			  (PAM_KRB5_MAYBE_CONST void**) &txn_pw) ==
+	     PAM_SUCCESS) &&
+	    (txn_pw != NULL) &&
+	    _pam_krb5_txn_same_string(txn_pw->user, user)) {
+		if (verbose) {
+			debug("reusing passwd information for '%s'", user);
+		}
+		return &txn_pw->pw;
+	}
+
+	if (_pam_krb5_user_pw_lookup(user, scratch) != 0) {
+		return NULL;
+	}
+	txn_pw = calloc(1, sizeof(*txn_pw));
+	if (txn_pw == NULL) {
+		return scratch;
+	}
+	txn_pw->user = xstrdup(user);
+	if (txn_pw->user == NULL) {
+		free(txn_pw);
+		return scratch;
+	}
+	txn_pw->pw = *scratch;
+	if (pam_set_data(pamh, PAM_KRB5_TXN_PW_KEY, txn_pw,
+			 _pam_krb5_txn_pw_cleanup) != PAM_SUCCESS) {
+		xstrfree(txn_pw->user);
+		free(txn_pw);
+		return scratch;
+	}
+	return &txn_pw->pw;
+}
+
+/* Hand out the saved user information if it was looked up using these
+ * options for the same user, and otherwise look it up and save it in place
+ * of what we had before.  We don't save failed lookups. */
+struct _pam_krb5_user_info *
+_pam_krb5_txn_user_info_init(pam_handle_t *pamh, krb5_context ctx,
+			     const char *user,
+			     struct _pam_krb5_options *options)
+{
+	struct _pam_krb5_txn *txn;
+	struct _pam_krb5_user_info *userinfo;
+	struct _pam_krb5_user_pw scratch;
+	const struct _pam_krb5_user_pw *pw;
+	char *saved;
+
+	txn = _pam_krb5_txn_get(pamh);
+	if ((txn != NULL) &&
+	    ((txn->ctx != ctx) || (txn->options != options))) {
+		txn = NULL;
+	}
+	if ((txn != NULL) &&
+	    (txn->userinfo != NULL) &&
+	    _pam_krb5_txn_same_string(txn->user, user)) {
+		if (options->debug) {
+			debug("reusing information about '%s'", user);
+		}
+		return txn->userinfo;
+	}
+
+	pw = NULL;
+	if (options->user_check) {
+		memset(&scratch, 0, sizeof(scratch));
+		pw = _pam_krb5_txn_pw_init(pamh, user, &scratch,
+					   options->debug);
+		if (pw == NULL) {
+			return NULL;
+		}
+	}
+	userinfo = _pam_krb5_user_info_init(ctx, user, options, pw);
+	if (pw == &scratch) {
+		xstrfree(scratch.homedir);
+	}
+	if ((userinfo == NULL) || (txn == NULL)) {
+		return userinfo;
+	}
+
+	saved = xstrdup(user);
+	if (saved == NULL) {
+		return userinfo;
+	}
+	_pam_krb5_txn_clear_userinfo(txn);
+	txn->userinfo = userinfo;
+	txn->user = saved;
+	return userinfo;
+}
+
+void
+_pam_krb5_txn_user_info_free(pam_handle_t *pamh, krb5_context ctx,
+			     struct _pam_krb5_user_info *userinfo)
+{
+	struct _pam_krb5_txn *txn;
+	txn = _pam_krb5_txn_get(pamh);
+	if ((txn != NULL) && (txn->userinfo == userinfo)) {
+		return;
+	}
+	_pam_krb5_user_info_free(ctx, userinfo);
+}
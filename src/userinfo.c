@@ -65,23 +65,32 @@
 #include "xstr.h"
 
 #if defined(HAVE_GETPWNAM_R) || defined(HAVE___POSIX_GETPWNAM_R)
-#define CHUNK_SIZE 128
+/* Start with the size the system suggests, or with this if it doesn't,
+ * and double it each time it turns out to be too small, up to a point. */
+#define DEFAULT_PW_BUFSIZE 1024
+#define MAX_PW_BUFSIZE 0x100000
 /* Convert a name to a UID/GID pair. */
 static int
 _get_pw_nam(const char *name, uid_t *uid, gid_t *gid, char **homedir)
 {
 	struct passwd passwd, *pwd;
 	char *buffer;
-	int size, i;
+	long size;
+	int i;
 
-	size = CHUNK_SIZE;
+	size = -1;
+#ifdef _SC_GETPW_R_SIZE_MAX
+	size = sysconf(_SC_GETPW_R_SIZE_MAX);
+#endif
+	if ((size <= 0) || (size > MAX_PW_BUFSIZE)) {
+		size = DEFAULT_PW_BUFSIZE;
+	}
 	do {
 		/* Allocate a temporary buffer to hold the string data. */
 		buffer = malloc(size);
 		if (buffer == NULL) {
 			return 1;
 		}
-		memset(buffer, '\0', size);
 
 		/* Give it a shot. */
 		pwd = NULL;
@@ -98,7 +107,7 @@ _get_pw_nam(const char *name, uid_t *uid, gid_t *gid, char **homedir)
 		}
 
 		/* Free the buffer -- we'll reallocate it later. */
-		xstrfree(buffer);
+		free(buffer);
 		buffer = NULL;
 
 		/* We need to use more space if we got ERANGE back, and errno
@@ -108,8 +117,8 @@ _get_pw_nam(const char *name, uid_t *uid, gid_t *gid, char **homedir)
 		}
 
 		/* Increase the size of the buffer. */
-		size += CHUNK_SIZE;
-	} while (size > 0);
+		size *= 2;
+	} while (size <= MAX_PW_BUFSIZE);
 
 	/* If we exited successfully, then pull out the UID/GID. */
 	if ((i == 0) && (pwd != NULL) && (buffer != NULL)) {
@@ -142,10 +151,23 @@ _get_pw_nam(const char *name, uid_t *uid, gid_t *gid, char **homedir)
 }
 #endif
 
+/* Look up the parts of the user's passwd entry which we use. */
+int
+_pam_krb5_user_pw_lookup(const char *name, struct _pam_krb5_user_pw *pw)
+{
+	if (_get_pw_nam(name, &pw->uid, &pw->gid, &pw->homedir) != 0) {
+		warn("error resolving user name '%s' to uid/gid pair", name);
+		return -1;
+	}
+	return 0;
+}
+
 struct _pam_krb5_user_info *
 _pam_krb5_user_info_init(krb5_context ctx, const char *name,
-			 struct _pam_krb5_options *options)
+			 struct _pam_krb5_options *options,
+			 const struct _pam_krb5_user_pw *pw)
 {
+	struct _pam_krb5_user_pw looked_up;
 	struct _pam_krb5_user_info *ret = NULL;
 	char local_name[LINE_MAX];
 	char qualified_name[LINE_MAX];
@@ -225,16 +247,22 @@ _pam_krb5_user_info_init(krb5_context ctx, const char *name,
 	local_name[sizeof(local_name) - 1] = '\0';
 
 	if (options->user_check) {
-		/* Look up the user's UID/GID. */
-		if (_get_pw_nam(local_name,
-				&ret->uid, &ret->gid,
-				&ret->homedir) != 0) {
-			warn("error resolving user name '%s' to uid/gid pair",
-			     local_name);
-			v5_free_unparsed_name(ctx, ret->unparsed_name);
-			krb5_free_principal(ctx, ret->principal_name);
-			free(ret);
-			return NULL;
+		/* Look up the user's UID/GID, unless the caller already did. */
+		if (pw == NULL) {
+			if (_pam_krb5_user_pw_lookup(local_name,
+						     &looked_up) != 0) {
+				v5_free_unparsed_name(ctx, ret->unparsed_name);
+				krb5_free_principal(ctx, ret->principal_name);
+				free(ret);
+				return NULL;
+			}
+			ret->uid = looked_up.uid;
+			ret->gid = looked_up.gid;
+			ret->homedir = looked_up.homedir;
+		} else {
+			ret->uid = pw->uid;
+			ret->gid = pw->gid;
+			ret->homedir = xstrdup(pw->homedir);
 		}
 	} else {
 		/* Set things to the current UID/GID. */
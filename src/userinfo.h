@@ -43,9 +43,19 @@ struct _pam_krb5_user_info {
 	char *unparsed_name;
 };
 
+/* The parts of the user's passwd entry which we use. */
+struct _pam_krb5_user_pw {
+	uid_t uid;
+	gid_t gid;
+	char *homedir;
+};
+
+int _pam_krb5_user_pw_lookup(const char *name, struct _pam_krb5_user_pw *pw);
+
 struct _pam_krb5_user_info *_pam_krb5_user_info_init(krb5_context ctx,
 						     const char *name,
-						     struct _pam_krb5_options *options);
+						     struct _pam_krb5_options *options,
+						     const struct _pam_krb5_user_pw *pw);
 
 void _pam_krb5_user_info_free(krb5_context ctx,
 			      struct _pam_krb5_user_info *info);
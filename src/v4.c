@@ -480,7 +480,7 @@ v4_save(krb5_context ctx,
 		/* Generate a *new* ticket file with the same contents as this
 		 * one. */
 		if (clone_cc) {
-			_pam_krb5_stash_clone_v4(stash, uid, gid);
+			_pam_krb5_stash_clone_v4(stash, options, uid, gid);
 		}
 		krb_set_tkt_string(stash->v4tktfiles->name);
 		if (ccname != NULL) {
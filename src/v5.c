@@ -33,8 +33,14 @@
 #include "../config.h"
 
 #include <errno.h>
+#ifdef HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
 #include <limits.h>
 #include <stdio.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -66,7 +72,11 @@
 
 #include "conv.h"
 #include "initopts.h"
+#include "ktindex.h"
 #include "log.h"
+#include "negcache.h"
+#include "offline.h"
+#include "optcache.h"
 #include "perms.h"
 #include "prompter.h"
 #include "sly.h"
@@ -1009,17 +1019,121 @@ v5_validate_using_ccache(krb5_context ctx, krb5_creds *creds,
 	return PAM_SUCCESS;
 }
 
+/* Check parts of an indexed keytab entry's principal name. */
+static int
+v5_ktindex_realm_is(struct _pam_krb5_ktindex *index,
+		    struct _pam_krb5_ktindex_entry *entry,
+		    krb5_principal princ)
+{
+	const unsigned char *data;
+	size_t length;
+
+	data = _pam_krb5_ktindex_realm(index, entry, &length);
+	return (length == (size_t) v5_princ_realm_length(princ)) &&
+	       (memcmp(data, v5_princ_realm_contents(princ), length) == 0);
+}
+
+static int
+v5_ktindex_component_is(struct _pam_krb5_ktindex *index,
+			struct _pam_krb5_ktindex_entry *entry,
+			unsigned int i, const char *value, size_t value_length)
+{
+	const unsigned char *data;
+	size_t length;
+
+	data = _pam_krb5_ktindex_component(index, entry, i, &length);
+	return (data != NULL) &&
+	       (length == value_length) &&
+	       (memcmp(data, value, length) == 0);
+}
+
+static int
+v5_ktindex_principal_is(struct _pam_krb5_ktindex *index,
+			struct _pam_krb5_ktindex_entry *entry,
+			krb5_principal princ)
+{
+	unsigned int i;
+
+	if ((entry->n_components != v5_princ_component_count(princ)) ||
+	    !v5_ktindex_realm_is(index, entry, princ)) {
+		return 0;
+	}
+	for (i = 0; i < entry->n_components; i++) {
+		if (!v5_ktindex_component_is(index, entry, i,
+					     v5_princ_component_contents(princ, i),
+					     v5_princ_component_length(princ, i))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+#if defined(HAVE_KRB5_KEYTAB_ENTRY_KEY) && \
+    defined(HAVE_KRB5_KEYBLOCK_ENCTYPE) && \
+    defined(HAVE_KRB5_KEYBLOCK_LENGTH) && \
+    defined(HAVE_KRB5_KEYBLOCK_CONTENTS)
+/* Copy a service's keys from an indexed keytab into an in-memory keytab, so
+ * that the library doesn't have to search through the file for them. */
+static krb5_keytab
+v5_ktindex_memory_keytab(krb5_context ctx, struct _pam_krb5_ktindex *index,
+			 krb5_principal princ)
+{
+	static unsigned int serial;
+	struct _pam_krb5_ktindex_entry *kte;
+	krb5_keytab_entry entry;
+	krb5_keytab keytab;
+	char name[LINE_MAX];
+	const unsigned char *key;
+	size_t i, n, length;
+
+	snprintf(name, sizeof(name), "MEMORY:pam_krb5_%ld_%u",
+		 (long) getpid(), serial++);
+	keytab = NULL;
+	if (krb5_kt_resolve(ctx, name, &keytab) != 0) {
+		return NULL;
+	}
+	n = 0;
+	for (i = 0; i < index->n_entries; i++) {
+		kte = &index->entries[i];
+		if (!v5_ktindex_principal_is(index, kte, princ)) {
+			continue;
+		}
+		key = _pam_krb5_ktindex_key(index, kte, &length);
+		memset(&entry, 0, sizeof(entry));
+		entry.principal = princ;
+		entry.timestamp = kte->timestamp;
+		entry.vno = kte->kvno;
+		entry.key.enctype = kte->enctype;
+		entry.key.length = length;
+		entry.key.contents = (krb5_octet *) key;
+		if (krb5_kt_add_entry(ctx, keytab, &entry) != 0) {
+			krb5_kt_close(ctx, keytab);
+			return NULL;
+		}
+		n++;
+	}
+	if (n == 0) {
+		krb5_kt_close(ctx, keytab);
+		return NULL;
+	}
+	return keytab;
+}
+#endif
+
 /* Select the principal name of the service to use when validating the creds in
  * question. */
 static int
 v5_select_keytab_service(krb5_context ctx, krb5_creds *creds,
+			 krb5_keytab keytab, struct _pam_krb5_ktindex *index,
 			 const char *ktname,
 			 krb5_principal *service)
 {
 	krb5_principal host, princ;
-	krb5_keytab keytab;
 	krb5_kt_cursor cursor;
 	krb5_keytab_entry entry;
+	struct _pam_krb5_ktindex_entry *kte, *best;
+	char *name;
+	size_t n;
 	int i, score;
 
 	*service = NULL;
@@ -1033,21 +1147,49 @@ v5_select_keytab_service(krb5_context ctx, krb5_creds *creds,
 		return PAM_SERVICE_ERR;
 	}
 
-	/* Open the keytab. */
-	memset(&keytab, 0, sizeof(keytab));
-	if (ktname != NULL) {
-		i = krb5_kt_resolve(ctx, ktname, &keytab);
-	} else {
-		i = krb5_kt_default(ctx, &keytab);
-	}
-	if (i != 0) {
-		if (ktname != NULL) {
-			warn("error resolving keytab '%s'", ktname);
-		} else {
-			warn("error resolving default keytab");
+	/* If we've got an index of the keytab, score its entries using the
+	 * rules described below, without having the library decode them all,
+	 * and keep the first of the best. */
+	if (index != NULL) {
+		best = NULL;
+		score = -1;
+		for (n = 0; n < index->n_entries; n++) {
+			kte = &index->entries[n];
+			i = 0;
+			if (v5_ktindex_realm_is(index, kte, creds->client)) {
+				i = 1;
+			}
+			if ((i == 1) && (kte->n_components == 2)) {
+				i = 2;
+				if (v5_ktindex_component_is(index, kte, 0,
+							    "host", 4)) {
+					i = 3;
+				}
+				if (v5_ktindex_component_is(index, kte, 1,
+							    v5_princ_component_contents(host, 1),
+							    v5_princ_component_length(host, 1))) {
+					i += 2;
+				}
+			}
+			if (i > score) {
+				best = kte;
+				score = i;
+			}
 		}
 		krb5_free_principal(ctx, host);
-		return PAM_SERVICE_ERR;
+		if (best == NULL) {
+			return PAM_SUCCESS;
+		}
+		name = _pam_krb5_ktindex_unparse(index, best);
+		if ((name == NULL) ||
+		    (krb5_parse_name(ctx, name, service) != 0)) {
+			warn("internal error copying principal name");
+			free(name);
+			*service = NULL;
+			return PAM_SERVICE_ERR;
+		}
+		free(name);
+		return PAM_SUCCESS;
 	}
 
 	/* Set up to walk the keytab. */
@@ -1059,7 +1201,6 @@ v5_select_keytab_service(krb5_context ctx, krb5_creds *creds,
 		} else {
 			warn("error reading default keytab");
 		}
-		krb5_kt_close(ctx, keytab);
 		krb5_free_principal(ctx, host);
 		return PAM_SERVICE_ERR;
 	}
@@ -1080,7 +1221,6 @@ v5_select_keytab_service(krb5_context ctx, krb5_creds *creds,
 			if (i != 0) {
 				warn("internal error copying principal name");
 				krb5_kt_end_seq_get(ctx, keytab, &cursor);
-				krb5_kt_close(ctx, keytab);
 				krb5_free_principal(ctx, host);
 				return PAM_SERVICE_ERR;
 			}
@@ -1095,7 +1235,6 @@ v5_select_keytab_service(krb5_context ctx, krb5_creds *creds,
 			if (i != 0) {
 				warn("internal error copying principal name");
 				krb5_kt_end_seq_get(ctx, keytab, &cursor);
-				krb5_kt_close(ctx, keytab);
 				krb5_free_principal(ctx, host);
 				return PAM_SERVICE_ERR;
 			}
@@ -1113,7 +1252,6 @@ v5_select_keytab_service(krb5_context ctx, krb5_creds *creds,
 			if (i != 0) {
 				warn("internal error copying principal name");
 				krb5_kt_end_seq_get(ctx, keytab, &cursor);
-				krb5_kt_close(ctx, keytab);
 				krb5_free_principal(ctx, host);
 				return PAM_SERVICE_ERR;
 			}
@@ -1134,7 +1272,6 @@ v5_select_keytab_service(krb5_context ctx, krb5_creds *creds,
 			if (i != 0) {
 				warn("internal error copying principal name");
 				krb5_kt_end_seq_get(ctx, keytab, &cursor);
-				krb5_kt_close(ctx, keytab);
 				krb5_free_principal(ctx, host);
 				return PAM_SERVICE_ERR;
 			}
@@ -1158,7 +1295,6 @@ v5_select_keytab_service(krb5_context ctx, krb5_creds *creds,
 			if (i != 0) {
 				warn("internal error copying principal name");
 				krb5_kt_end_seq_get(ctx, keytab, &cursor);
-				krb5_kt_close(ctx, keytab);
 				krb5_free_principal(ctx, host);
 				return PAM_SERVICE_ERR;
 			}
@@ -1185,7 +1321,6 @@ v5_select_keytab_service(krb5_context ctx, krb5_creds *creds,
 			if (i != 0) {
 				warn("internal error copying principal name");
 				krb5_kt_end_seq_get(ctx, keytab, &cursor);
-				krb5_kt_close(ctx, keytab);
 				krb5_free_principal(ctx, host);
 				return PAM_SERVICE_ERR;
 			}
@@ -1194,7 +1329,6 @@ v5_select_keytab_service(krb5_context ctx, krb5_creds *creds,
 	}
 
 	krb5_kt_end_seq_get(ctx, keytab, &cursor);
-	krb5_kt_close(ctx, keytab);
 	krb5_free_principal(ctx, host);
 
 	*service = princ;
@@ -1204,25 +1338,17 @@ v5_select_keytab_service(krb5_context ctx, krb5_creds *creds,
 
 static int
 v5_validate_using_keytab(krb5_context ctx, krb5_creds *creds,
-			 const struct _pam_krb5_options *options, int *krberr)
+			 const struct _pam_krb5_options *options, int *krberr,
+			 int *with_key)
 {
 	int i;
-	char *principal;
+	char *principal, *realm, *cached;
 	krb5_principal princ;
 	krb5_keytab keytab;
+	krb5_keytab_entry entry;
+	struct _pam_krb5_ktindex *index;
 	krb5_verify_init_creds_opt opt;
 
-	/* Try to figure out the name of a suitable service. */
-	princ = NULL;
-	v5_select_keytab_service(ctx, creds, options->keytab, &princ);
-
-	/* Try to get a text representation of the principal to which the key
-	 * belongs, for logging purposes. */
-	principal = NULL;
-	if (princ != NULL) {
-		i = krb5_unparse_name(ctx, princ, &principal);
-	}
-
 	/* Try to open the keytab. */
 	keytab = NULL;
 	if (options->keytab != NULL) {
@@ -1237,12 +1363,94 @@ v5_validate_using_keytab(krb5_context ctx, krb5_creds *creds,
 		}
 	}
 
+	/* Try to figure out the name of a suitable service, reusing the
+	 * one we picked the last time we looked at this keytab. */
+	princ = NULL;
+	principal = NULL;
+	realm = NULL;
+	if ((options->options_cache != NULL) && (options->keytab != NULL)) {
+		realm = malloc(v5_princ_realm_length(creds->client) + 1);
+		if (realm != NULL) {
+			memcpy(realm, v5_princ_realm_contents(creds->client),
+			       v5_princ_realm_length(creds->client));
+			realm[v5_princ_realm_length(creds->client)] = '\0';
+			cached = _pam_krb5_optcache_keytab_load(options->options_cache,
+								options->keytab,
+								realm,
+								options->debug);
+			if ((cached != NULL) &&
+			    (krb5_parse_name(ctx, cached, &princ) != 0)) {
+				princ = NULL;
+			}
+			xstrfree(cached);
+		}
+	}
+	index = NULL;
+	if (keytab != NULL) {
+		index = _pam_krb5_ktindex_open(options->keytab);
+	}
+	if ((princ == NULL) && (keytab != NULL)) {
+		v5_select_keytab_service(ctx, creds, keytab, index,
+					 options->keytab, &princ);
+		if ((princ != NULL) && (realm != NULL) &&
+		    (krb5_unparse_name(ctx, princ, &principal) == 0)) {
+			if ((_pam_krb5_optcache_keytab_store(options->options_cache,
+							     options->keytab,
+							     realm,
+							     principal) != 0) &&
+			    options->debug) {
+				debug("error saving keytab service to cache "
+				      "in \"%s\"", options->options_cache);
+			}
+		}
+	}
+	free(realm);
+
+	/* Try to get a text representation of the principal to which the key
+	 * belongs, for logging purposes. */
+	if ((princ != NULL) && (principal == NULL)) {
+		i = krb5_unparse_name(ctx, princ, &principal);
+	}
+
+#if defined(HAVE_KRB5_KEYTAB_ENTRY_KEY) && \
+    defined(HAVE_KRB5_KEYBLOCK_ENCTYPE) && \
+    defined(HAVE_KRB5_KEYBLOCK_LENGTH) && \
+    defined(HAVE_KRB5_KEYBLOCK_CONTENTS)
+	/* Hand the library only the service's keys. */
+	if ((index != NULL) && (princ != NULL)) {
+		krb5_keytab memkeytab;
+		memkeytab = v5_ktindex_memory_keytab(ctx, index, princ);
+		if (memkeytab != NULL) {
+			krb5_kt_close(ctx, keytab);
+			keytab = memkeytab;
+		}
+	}
+#endif
+	_pam_krb5_ktindex_close(index);
+
+	/* Unless we're told otherwise, the library reports success if it
+	 * can't find a key to check with, so note whether or not there is
+	 * one. */
+	*with_key = 0;
+	if ((princ != NULL) && (keytab != NULL) &&
+	    (krb5_kt_get_entry(ctx, keytab, princ, 0, 0, &entry) == 0)) {
+#ifdef HAVE_KRB5_FREE_KEYTAB_ENTRY_CONTENTS
+		krb5_free_keytab_entry_contents(ctx, &entry);
+#else
+		krb5_kt_free_entry(ctx, &entry);
+#endif
+		*with_key = 1;
+	}
+
 	/* Perform the verification checks using the service's key, assuming we
 	 * have some idea of what the service's name is, and that we can read
 	 * the key. */
 	krb5_verify_init_creds_opt_init(&opt);
 	i = krb5_verify_init_creds(ctx, creds, princ, keytab, NULL, &opt);
 	*krberr = i;
+	if (i != 0) {
+		*with_key = 0;
+	}
 	if (keytab != NULL) {
 		krb5_kt_close(ctx, keytab);
 	}
@@ -1273,16 +1481,19 @@ v5_validate_using_keytab(krb5_context ctx, krb5_creds *creds,
 	}
 }
 
+/* Validate "creds", noting in "with_keytab" whether or not we actually
+ * checked them using a key from the keytab. */
 static int
 v5_validate(krb5_context ctx, krb5_creds *creds,
 	    struct _pam_krb5_user_info *userinfo,
-	    const struct _pam_krb5_options *options)
+	    const struct _pam_krb5_options *options, int *with_keytab)
 {
 	int ret, krberr;
 	/* Obtain creds for a service for which we have keys in the keytab and
 	 * then just authenticate to it. */
 	krberr = 0;
-	ret = v5_validate_using_keytab(ctx, creds, options, &krberr);
+	ret = v5_validate_using_keytab(ctx, creds, options, &krberr,
+				       with_keytab);
 	switch (ret) {
 	case PAM_AUTH_ERR:
 		switch (krberr) {
@@ -1339,7 +1550,7 @@ v5_get_creds(krb5_context ctx,
 	     int *expired,
 	     int *result)
 {
-	int i;
+	int i, negcached, validated;
 	char realm_service[LINE_MAX];
 	char *opt;
 	const char *realm;
@@ -1354,6 +1565,7 @@ v5_get_creds(krb5_context ctx,
 	/* In case we already have creds, get rid of them. */
 	krb5_free_cred_contents(ctx, creds);
 	memset(creds, 0, sizeof(*creds));
+	negcached = 0;
 
 	/* Check some string lengths. */
 	if (strchr(userinfo->unparsed_name, '@') != NULL) {
@@ -1444,6 +1656,19 @@ v5_get_creds(krb5_context ctx,
 			     "(shouldn't happen)", realm_service);
 			i = KRB5_REALM_CANT_RESOLVE;
 		}
+	} else if ((options->negative_cache != NULL) &&
+		   (options->negative_cache_ttl > 0) &&
+		   options->ignore_unknown_principals &&
+		   _pam_krb5_negcache_check(options->negative_cache,
+					    userinfo->unparsed_name,
+					    options->debug)) {
+		/* The KDC told us about this one recently. */
+		if (options->debug) {
+			debug("'%s' was recently reported unknown, not "
+			      "contacting the KDC", userinfo->unparsed_name);
+		}
+		negcached = 1;
+		i = KRB5KDC_ERR_C_PRINCIPAL_UNKNOWN;
 	} else {
 		/* Contact the KDC. */
 		prompter_data.ctx = ctx;
@@ -1547,12 +1772,14 @@ v5_get_creds(krb5_context ctx,
 	case 0:
 		/* Flat-out success.  Validate the TGT if it's actually a TGT,
 		 * and if we can. */
+		validated = 0;
 		if ((options->validate == 1) &&
 		    (strcmp(service, KRB5_TGS_NAME) == 0)) {
 			if (options->debug) {
 				debug("validating credentials");
 			}
-			switch (v5_validate(ctx, creds, userinfo, options)) {
+			switch (v5_validate(ctx, creds, userinfo, options,
+					    &validated)) {
 			case PAM_AUTH_ERR:
 				return PAM_AUTH_ERR;
 				break;
@@ -1560,6 +1787,24 @@ v5_get_creds(krb5_context ctx,
 				break;
 			}
 		}
+		/* Remember how to check this password if the KDCs go away,
+		 * but only if the keytab tells us that it was the real KDC
+		 * which accepted it, or anyone who can spoof the KDC could
+		 * plant a verifier. */
+		if (validated &&
+		    (options->offline_cache != NULL) &&
+		    (password != NULL)) {
+			if (_pam_krb5_offline_store(ctx, options->offline_cache,
+						    userinfo->unparsed_name,
+						    password,
+						    creds->times.endtime) != 0) {
+				if (options->debug) {
+					debug("error saving offline verifier "
+					      "for '%s'",
+					      userinfo->unparsed_name);
+				}
+			}
+		}
 		return PAM_SUCCESS;
 		break;
 	case KRB5KDC_ERR_CLIENT_REVOKED:
@@ -1574,7 +1819,21 @@ v5_get_creds(krb5_context ctx,
 	case KRB5KDC_ERR_C_PRINCIPAL_UNKNOWN:
 	case KRB5KDC_ERR_NAME_EXP:
 		/* The user is unknown or a principal has expired. */
+		if (options->offline_cache != NULL) {
+			_pam_krb5_offline_forget(options->offline_cache,
+						 userinfo->unparsed_name);
+		}
 		if (options->ignore_unknown_principals) {
+			if ((i == KRB5KDC_ERR_C_PRINCIPAL_UNKNOWN) &&
+			    !negcached &&
+			    (options->negative_cache != NULL) &&
+			    (options->negative_cache_ttl > 0)) {
+				_pam_krb5_negcache_add(options->negative_cache,
+						       userinfo->unparsed_name,
+						       options->negative_cache_ttl,
+						       options->negative_cache_size,
+						       options->debug);
+			}
 			return PAM_IGNORE;
 		} else {
 			return PAM_USER_UNKNOWN;
@@ -1653,9 +1912,27 @@ v5_get_creds(krb5_context ctx,
 		}
 		return PAM_AUTH_ERR;
 		break;
+	case KRB5_KDC_UNREACH:
+		/* Fall back to a verifier from an earlier login, if we have
+		 * one.  The caller sees that we have no credentials from the
+		 * result code. */
+		if ((options->offline_cache != NULL) &&
+		    (password != NULL) &&
+		    (strcmp(service, KRB5_TGS_NAME) == 0) &&
+		    (_pam_krb5_offline_check(ctx, options->offline_cache,
+					     userinfo->unparsed_name,
+					     password,
+					     options->offline_window,
+					     options->debug) == 0)) {
+			notice("KDCs for %s unreachable, authenticated '%s' "
+			       "using a saved verifier", realm,
+			       userinfo->unparsed_name);
+			return PAM_SUCCESS;
+		}
+		return PAM_AUTHINFO_UNAVAIL;
+		break;
 	case EAGAIN:
 	case KRB5_REALM_CANT_RESOLVE:
-	case KRB5_KDC_UNREACH:
 		return PAM_AUTHINFO_UNAVAIL;
 	default:
 		return PAM_AUTH_ERR;
@@ -1671,9 +1948,7 @@ v5_save(krb5_context ctx,
 	const char **ret_ccname,
 	int for_user)
 {
-	char ccname[PATH_MAX];
-	krb5_ccache ccache;
-	static int counter = 0;
+	const char *ccname;
 
 	if (ret_ccname != NULL) {
 		*ret_ccname = NULL;
@@ -1687,39 +1962,17 @@ v5_save(krb5_context ctx,
 		return KRB5KRB_ERR_GENERIC;
 	}
 
-	/* Derive the ccache name from the supplied template. */
-	snprintf(ccname, sizeof(ccname), "MEMORY:_pam_krb5_tmp_s_%s-%d",
-		 userinfo->unparsed_name, counter++);
-	if (options->debug) {
-		debug("saving v5 credentials to '%s' for internal use", ccname);
-	}
-	/* Create an in-memory structure and then open the file.  One of two
-	 * things will happen here.  Either libkrb5 will just use the file, and
-	 * we're safer because it wouldn't have used O_EXCL to do so, or it
-	 * will nuke the file and reopen it with O_EXCL.  In the latter case,
-	 * the descriptor we have will become useless, so we don't actually use
-	 * it for anything. */
-	if (krb5_cc_resolve(ctx, ccname, &ccache) != 0) {
-		warn("error resolving ccache '%s'", ccname);
+	/* Use the stash's in-memory ccache, which holds the credentials and
+	 * any service tickets we've already gotten with them. */
+	if (_pam_krb5_stash_memcc(ctx, stash, userinfo, options,
+				  &ccname) != 0) {
 		return PAM_SERVICE_ERR;
 	}
-	if (krb5_cc_initialize(ctx, ccache, userinfo->principal_name) != 0) {
-		warn("error initializing ccache '%s'", ccname);
-		krb5_cc_destroy(ctx, ccache);
-		return PAM_SERVICE_ERR;
-	}
-	if (krb5_cc_store_cred(ctx, ccache, &stash->v5creds) != 0) {
-		warn("error storing credentials in ccache '%s'", ccname);
-		krb5_cc_destroy(ctx, ccache);
-		return PAM_SERVICE_ERR;
-	}
-	/* If we got to here, we succeeded. */
-	krb5_cc_close(ctx, ccache);
-	/* Save the new ccache name in the stash, and optionally return it to
+	/* Save the ccache name in the stash, and optionally return it to
 	 * the caller. */
 	if (_pam_krb5_stash_push_v5(ctx, stash, options, ccname) == 0) {
 		/* Generate a *new* ccache with the same contents as this
-		 * one, but for the user's use, and destroy this one. */
+		 * one, but for the user's use. */
 		if (for_user) {
 			_pam_krb5_stash_clone_v5(ctx, stash, options,
 						 user, userinfo,
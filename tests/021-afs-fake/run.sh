@@ -0,0 +1,13 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+echo ""; echo Setting password to \"foo\".
+$kadmin -q 'cpw -pw foo '$test_principal 2> /dev/null > /dev/null
+$kadmin -q 'modprinc -pwexpire never '$test_principal 2> /dev/null > /dev/null
+for service in afs-k5/example.com afs/cell1.example.com afs/cell2.example.com ; do
+	$kadmin -q 'ank -randkey '$service 2> /dev/null > /dev/null
+done
+
+echo ""; echo Succeed: tokens for three cells from a fake AFS client.
+$afsbench -q -n 1 -c 3 $test_principal foo token_strategy=rxk5 2> /dev/null
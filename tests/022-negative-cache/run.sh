@@ -0,0 +1,28 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+test_flags="$test_flags ignore_afs ignore_unknown_principals"
+negcache=$testdir/kdc/negcache
+rm -fr $negcache
+mkdir -m 700 $negcache
+test_flags="$test_flags negative_cache=$negcache negative_cache_ttl=3"
+
+echo ""; echo Removing the principal.
+$kadmin -q 'delprinc -force '$test_principal 2> /dev/null > /dev/null
+
+echo ""; echo Ignore: unknown principal, recorded in the negative cache.
+test_run -auth $test_principal $pam_krb5 $test_flags -- foo
+
+echo ""; echo Setting password to \"foo\".
+$kadmin -q 'ank -pw foo '$test_principal 2> /dev/null > /dev/null
+$kadmin -q 'modprinc -pwexpire never '$test_principal 2> /dev/null > /dev/null
+
+echo ""; echo Ignore: principal still in the negative cache.
+test_run -auth $test_principal $pam_krb5 $test_flags -- foo
+
+echo ""; echo Succeed: negative cache entry has expired.
+sleep 4
+test_run -auth $test_principal $pam_krb5 $test_flags -- foo
+
+rm -fr $negcache
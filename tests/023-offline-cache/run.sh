@@ -0,0 +1,46 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+test_flags="$test_flags ignore_afs"
+keytab=$testdir/kdc/offline.keytab
+validated=$testdir/kdc/offline-validated
+unvalidated=$testdir/kdc/offline-unvalidated
+offline_config=$testdir/kdc/krb5-offline.conf
+rm -fr $keytab $validated $unvalidated $offline_config
+mkdir -m 700 $validated $unvalidated
+# The same realm, but with KDCs which nobody is listening for.
+sed 's,:8800,:8899,g' $KRB5_CONFIG > $offline_config
+
+echo ""; echo Setting password to \"foo\".
+$kadmin -q 'cpw -pw foo '$test_principal 2> /dev/null > /dev/null
+$kadmin -q 'modprinc -pwexpire never '$test_principal 2> /dev/null > /dev/null
+$kadmin -q 'ank -randkey host/'$test_host 2> /dev/null > /dev/null
+$kadmin -q 'ktadd -k '$keytab' host/'$test_host 2> /dev/null > /dev/null
+
+echo ""; echo Succeed: validated using a keytab, verifier saved.
+test_run -auth $test_principal $pam_krb5 $test_flags keytab=$keytab offline_cache=$validated -- foo
+
+echo ""; echo Succeed: not validated, no verifier saved.
+test_run -auth $test_principal $pam_krb5 $test_flags keytab=$testdir/kdc/missing.keytab offline_cache=$unvalidated -- foo
+
+echo ""; echo Succeed: KDCs unreachable, saved verifier matches.
+(KRB5_CONFIG=$offline_config ; export KRB5_CONFIG
+ test_run -auth $test_principal $pam_krb5 $test_flags keytab=$keytab offline_cache=$validated -- foo)
+
+echo ""; echo Fail: KDCs unreachable, no saved verifier.
+(KRB5_CONFIG=$offline_config ; export KRB5_CONFIG
+ test_run -auth $test_principal $pam_krb5 $test_flags keytab=$keytab offline_cache=$unvalidated -- foo)
+
+echo ""; echo Fail: KDCs unreachable, incorrect password.
+(KRB5_CONFIG=$offline_config ; export KRB5_CONFIG
+ test_run -auth $test_principal $pam_krb5 $test_flags keytab=$keytab offline_cache=$validated -- bar)
+
+echo ""; echo Setting password to \"foolong\".
+$kadmin -q 'cpw -pw foolong '$test_principal 2> /dev/null > /dev/null
+$kadmin -q 'modprinc -pwexpire never '$test_principal 2> /dev/null > /dev/null
+
+echo ""; echo Fail: KDCs reachable, saved verifier not consulted.
+test_run -auth $test_principal $pam_krb5 $test_flags keytab=$keytab offline_cache=$validated -- foo
+
+rm -fr $keytab $validated $unvalidated $offline_config
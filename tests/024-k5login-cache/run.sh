@@ -0,0 +1,43 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+test_flags="$test_flags ignore_afs"
+k5login=$testdir/kdc/k5login
+k5lcache=$testdir/kdc/k5lcache
+k5login_config=$testdir/kdc/krb5-k5login.conf
+rm -fr $k5login $k5lcache $k5login_config
+mkdir -m 700 $k5login $k5lcache
+# Have libkrb5 look for .k5login files somewhere we can write to.
+sed -e '/^\[libdefaults\]/a\' -e " k5login_directory = $k5login" $KRB5_CONFIG > $k5login_config
+
+echo ""; echo Setting password to \"foo\".
+$kadmin -q 'cpw -pw foo '$test_principal 2> /dev/null > /dev/null
+$kadmin -q 'modprinc -pwexpire never '$test_principal 2> /dev/null > /dev/null
+
+KRB5_CONFIG=$k5login_config ; export KRB5_CONFIG
+
+# Files which were modified within the last couple of seconds aren't cached.
+echo $test_principal@EXAMPLE.COM > $k5login/$test_principal
+sleep 3
+
+echo ""; echo Succeed: listed in .k5login, which gets cached.
+test_run -auth -account $test_principal $pam_krb5 $test_flags k5login_cache=$k5lcache -- foo
+
+# Changing the permissions doesn't change anything the cache keys on, so we
+# can only succeed from here on if we use the cached copy.
+chmod 000 $k5login/$test_principal
+
+echo ""; echo Fail: listed in .k5login, but we can\'t read it.
+test_run -auth -account $test_principal $pam_krb5 $test_flags -- foo
+
+echo ""; echo Succeed: listed in the cached copy of .k5login.
+test_run -auth -account $test_principal $pam_krb5 $test_flags k5login_cache=$k5lcache -- foo
+
+chmod 600 $k5login/$test_principal
+echo $test_principal.other@EXAMPLE.COM > $k5login/$test_principal
+
+echo ""; echo Fail: no longer listed in the modified .k5login.
+test_run -auth -account $test_principal $pam_krb5 $test_flags k5login_cache=$k5lcache -- foo
+
+rm -fr $k5login $k5lcache $k5login_config
@@ -0,0 +1,43 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+optcache=$testdir/kdc/optcache
+rm -fr $optcache
+mkdir -m 755 $optcache
+
+echo "";echo Checking handling of cached options.
+$kadmin -q 'cpw -pw foo '$test_principal 2> /dev/null > /dev/null
+$kadmin -q 'modprinc -pwexpire never '$test_principal 2> /dev/null > /dev/null
+
+# A miss writes a new record and renames it into place, so a hit is the only
+# way to leave the list of records and their inode numbers alone.
+records=
+check_records() {
+	if test -z "$1" ; then
+		return
+	fi
+	current=`cd $optcache && ls -i options_* 2> /dev/null`
+	if test -z "$current" ; then
+		echo No options record.
+	elif test "$current" = "$records" ; then
+		echo Options record reused.
+	else
+		echo Options record written.
+	fi
+	records="$current"
+}
+
+for cache in "" options_cache=$optcache options_cache=$optcache ; do
+	echo "";echo FPRI ${cache:+(cached)}
+	test_run -auth -setcred $test_principal -run klist_f $pam_krb5 $test_flags $cache renew_lifetime=3600 proxiable forwardable -- foo
+	check_records "$cache"
+done
+
+for cache in "" options_cache=$optcache options_cache=$optcache ; do
+	echo "";echo I ${cache:+(cached)}
+	test_run -auth -setcred $test_principal -run klist_f $pam_krb5 $test_flags $cache renew_lifetime=0 not_proxiable not_forwardable -- foo
+	check_records "$cache"
+done
+
+rm -fr $optcache
@@ -0,0 +1,15 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+test_flags="$test_flags ignore_afs"
+
+echo "";echo Checking reuse of passwd information with different arguments.
+$kadmin -q 'cpw -pw foo '$test_principal 2> /dev/null > /dev/null
+$kadmin -q 'modprinc -pwexpire never '$test_principal 2> /dev/null > /dev/null
+
+echo "";echo Ccache directory = testdir/kdc after authentication.
+test_run -auth -account -setcred $test_principal -run klist_c $pam_krb5 $test_flags ++ $test_flags ccache_dir=${testdir}/kdc -- foo
+
+echo "";echo Ccache directory = testdir/kdc throughout.
+test_run -auth -account -setcred $test_principal -run klist_c $pam_krb5 $test_flags ccache_dir=${testdir}/kdc -- foo
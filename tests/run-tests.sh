@@ -33,6 +33,12 @@ for test in ${@:-"$testdir"/0*} ; do
 			continue
 		fi
 	fi
+	if ! test -x "$afsbench" ; then
+		if test -r $test/uses_afs ; then
+			echo Skipping AFS-specific test `basename "$test"`.
+			continue
+		fi
+	fi
 	echo -n `basename "$test"` ..." "
 	test_kdcinitdb
 	test_kdcprep
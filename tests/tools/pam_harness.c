@@ -120,7 +120,7 @@ main(int argc, char **argv)
 	void *dlhandle;
 	int doauth, doaccount, dosession, dosetcred, dochauthtok, doprompt;
 	int noreentrancy;
-	int i, ret, responses, args, argcount;
+	int i, ret, responses, args, argcount, later_args, later_argcount;
 	const char *user, *module;
 	pam_handle_t *pamh;
 	struct pam_partial_handle {
@@ -143,7 +143,7 @@ main(int argc, char **argv)
 		       "[-authtok tok] [-oldauthtok tok]\n"
 		       "       [-prompt string] [-showprompt] [-run command] "
 		       "[-noreentrancy]\n"
-		       "       user [module [arg ...]| stack] "
+		       "       user [module [arg ...] [++ arg ...]| stack] "
 		       "[-- response ...]\n",
 		       strchr(argv[0], '/') ?
 		       strrchr(argv[0], '/') + 1 :
@@ -155,6 +155,7 @@ main(int argc, char **argv)
 	doauth = doaccount = dosession = dosetcred = dochauthtok = doprompt = 0;
 	noreentrancy = 0;
 	args = argcount = responses = 0;
+	later_args = later_argcount = 0;
 	tty = ruser = rhost = authtok = oldauthtok = run = prompt = NULL;
 	for (i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "-auth") == 0) {
@@ -224,6 +225,12 @@ main(int argc, char **argv)
 		if (strcmp(argv[i], "--") == 0) {
 			if (responses == 0) responses = i + 1;
 		}
+		/* Arguments after "++" replace the others for everything
+		 * which follows authentication, the way a configuration
+		 * can pass different arguments to different entry points. */
+		if ((strcmp(argv[i], "++") == 0) && (responses == 0)) {
+			if (later_args == 0) later_args = i + 1;
+		}
 		if (args == 0) {
 			args = i;
 		}
@@ -236,11 +243,19 @@ main(int argc, char **argv)
 	if (args != 0) {
 		argcount = 0;
 		for (i = args;
-		    (argv[i] != NULL) && (strcmp(argv[i], "--") != 0);
+		    (argv[i] != NULL) && (strcmp(argv[i], "--") != 0) &&
+		    (strcmp(argv[i], "++") != 0);
 		    i++) {
 			argcount++;
 		}
 	}
+	if (later_args != 0) {
+		for (i = later_args;
+		    (argv[i] != NULL) && (strcmp(argv[i], "--") != 0);
+		    i++) {
+			later_argcount++;
+		}
+	}
 
 	/* Bail on invocation errors. */
 	if ((user == NULL) || (module == NULL)) {
@@ -444,6 +459,10 @@ main(int argc, char **argv)
 				return 255;
 			}
 		}
+		if (later_args != 0) {
+			args = later_args;
+			argcount = later_argcount;
+		}
 		if (doaccount) {
 			call_fn("pam_sm_acct_mgmt", "ACCT", 0);
 		}